@@ -3,16 +3,46 @@
 #include "pico/stdlib.h"
 #include "hardware/pio.h"
 #include "hardware/clocks.h"
+#include "hardware/irq.h"
 
 #include "button_debounce.pio.h"
 #include "button_debounce.h"
+#include "pio_resources.h"
+#include "pio_timing.h"
 
-// indicate if errors and warnings should print a message
-// comment out for no messages
-#define PRINT_ERRORS
+// the errors and warnings are events in the trace ring (see ../trace_ring), they are
+// printed by trace_drain(). TRACE_LEVEL_ERROR for only the errors, TRACE_LEVEL_OFF for
+// no messages
+#define TRACE_LEVEL TRACE_LEVEL_WARNING
+#include "trace_ring.h"
 
-// indicator that something is not used or not set
-#define UNUSED -10
+// the number of instructions of the debounce program per debounce time (see set_debounce_time)
+#define DEBOUNCE_INSTRUCTIONS 62.f
+
+// the trace events, the value is the gpio (or base gpio, or group)
+#define DEBOUNCE_TRACE_NO_SM TRACE_ID(TRACE_DRIVER_DEBOUNCE, 0)
+#define DEBOUNCE_TRACE_INVALID_GPIO TRACE_ID(TRACE_DRIVER_DEBOUNCE, 1)
+#define DEBOUNCE_TRACE_ALREADY_DEBOUNCED TRACE_ID(TRACE_DRIVER_DEBOUNCE, 2)
+#define DEBOUNCE_TRACE_MAX_GPIOS TRACE_ID(TRACE_DRIVER_DEBOUNCE, 3)
+#define DEBOUNCE_TRACE_NOT_DEBOUNCED TRACE_ID(TRACE_DRIVER_DEBOUNCE, 4)
+#define DEBOUNCE_TRACE_TIME_TOO_SHORT TRACE_ID(TRACE_DRIVER_DEBOUNCE, 5)
+#define DEBOUNCE_TRACE_TIME_TOO_LONG TRACE_ID(TRACE_DRIVER_DEBOUNCE, 6)
+#define DEBOUNCE_TRACE_INVALID_GROUP TRACE_ID(TRACE_DRIVER_DEBOUNCE, 7)
+#define DEBOUNCE_TRACE_INVALID_GROUP_TIME TRACE_ID(TRACE_DRIVER_DEBOUNCE, 8)
+#define DEBOUNCE_TRACE_MAX_GROUPS TRACE_ID(TRACE_DRIVER_DEBOUNCE, 9)
+#define DEBOUNCE_TRACE_NOT_A_GROUP TRACE_ID(TRACE_DRIVER_DEBOUNCE, 10)
+const char *const debounce_trace_names[] = {
+    "no_state_machine",
+    "gpio_should_be_0_to_28_excluding_23_24_25",
+    "gpio_already_debounced",
+    "max_8_gpios",
+    "gpio_not_debounced",
+    "debounce_time_below_0.5_ms",
+    "debounce_time_too_long_for_the_clock",
+    "group_gpios_should_be_0_to_28",
+    "group_debounce_time_should_be_0.5_to_1000_ms",
+    "max_8_groups",
+    "not_a_debounced_group"};
 
 /* 
  * class that debounces gpio using the PIO state machines.
@@ -22,17 +52,60 @@
 Debounce::Debounce(void)
 {
     // indicate that currently there are no gpios debounced
-    for (int i = 0; i < 32; i++)
+    num_of_debounced = 0;
+    // no groups of gpios yet
+    for (int g = 0; g < 8; g++)
+        groups[g].mask = 0;
+    callback = NULL;
+    TRACE_SET_NAMES(TRACE_DRIVER_DEBOUNCE, "debounce", debounce_trace_names);
+}
+
+/* 
+ * find the slot of a debounced gpio
+ * @param gpio: the gpio to look for
+ * returns the index in slots, or -1 if the gpio isn't debounced
+ */
+int Debounce::find_slot(uint gpio)
+{
+    for (uint i = 0; i < num_of_debounced; i++)
+        if (slots[i].gpio == gpio)
+            return i;
+    return -1;
+}
+
+/* 
+ * find the group of a debounced gpio
+ * @param gpio: the gpio to look for
+ * returns the index in groups, or -1 if the gpio isn't in a group
+ */
+int Debounce::find_group(uint gpio)
+{
+    for (int g = 0; g < 8; g++)
+        if (groups[g].mask & (1u << gpio))
+            return g;
+    return -1;
+}
+
+/* 
+ * claim a sm and load its program (via the shared pio resources: pio0 first, then pio1,
+ * the program is loaded once in each pio)
+ * @param program: the program of the sm
+ * @param pio: the pio of the sm
+ * @param offset: the location of the program in the pio memory
+ * returns the sm, or -1 if none is available
+ */
+int Debounce::claim_sm(const pio_program_t *program, PIO *pio, uint *offset)
+{
+    uint sm;
+    if (!pio_resources_claim_sm(program, pio, &sm, offset))
     {
-        gpio_debounced[i] = UNUSED;
-        pio_debounced[i] = (PIO)NULL;
-        sm_debounced[i] = UNUSED;
-        offset[i] = UNUSED;
-        // conf[i] = (pio_sm_config) 0;
+        // no sm (or no room for the program) in pio0 or pio1, return an error
+        TRACE_ERROR(DEBOUNCE_TRACE_NO_SM, 0);
+        return -1;
     }
-    num_of_debounced = 0;
-    pio0_already_set = UNUSED;
-    pio1_already_set = UNUSED;
+    // the interrupt handler for the edge events or the samples of a group
+    pio_resources_set_irq_handler(*pio, sm, irq_handler, this);
+    return sm;
 }
 
 /* 
@@ -46,89 +119,53 @@ int Debounce::debounce_gpio(uint gpio)
     // check if the gpio is valid
     if ((gpio > 28) || gpio == 23 || gpio == 24 || gpio == 25)
     {
-#ifdef PRINT_ERRORS
-        printf("debounce error: gpio should be 0 to 28 excluding 23, 24 and 25\n");
-#endif
+        TRACE_ERROR(DEBOUNCE_TRACE_INVALID_GPIO, gpio);
         return -1;
     }
     // check that the gpio is unused
-    if (gpio_debounced[gpio] != UNUSED)
+    if (find_slot(gpio) != -1 || find_group(gpio) != -1)
     {
-#ifdef PRINT_ERRORS
-        printf("debounce warning: gpio is already debounced\n");
-#endif
+        TRACE_WARNING(DEBOUNCE_TRACE_ALREADY_DEBOUNCED, gpio);
         return -1;
     }
     // check if there are still sm available (there are 8, but other programs could also be using sm, which is checked later)
     if (num_of_debounced == 8)
     {
-#ifdef PRINT_ERRORS
-        printf("debounce error: max 8 gpios can be debounced (no state machine available)\n");
-#endif
+        TRACE_ERROR(DEBOUNCE_TRACE_MAX_GPIOS, gpio);
         return -1;
     }
 
-    // Find a pio and sm:
-    // start with trying to use pio0
-    PIO pio = pio0;
-    // claim a state machine, no panic if non is available
-    uint sm = pio_claim_unused_sm(pio, false);
-    // check if this is a valid sm
+    // Find a pio and sm
+    PIO pio;
+    uint offset;
+    int sm = claim_sm(&button_debounce_program, &pio, &offset);
     if (sm == -1)
-    {
-        // pio0 did not deliver a sm, try pio1
-        pio = pio1;
-        // claim a state machine, no panic if non is available
-        sm = pio_claim_unused_sm(pio, false);
-        // check if this is a valid sm
-        if (sm == -1)
-        {
-            // also no sm from pio1, return an error
-#ifdef PRINT_ERRORS
-            printf("debounce error: no state machine available\n");
-#endif
-            return -1;
-        }
-    }
+        return -1;
 
-    pio_debounced[gpio] = pio;
-    sm_debounced[gpio] = sm;
-    gpio_debounced[gpio] = gpio;
+    // the next free slot
+    debounce_slot &slot = slots[num_of_debounced];
+    slot.gpio = gpio;
+    slot.pio = pio;
+    slot.sm = sm;
+    slot.border = offset + button_debounce_border;
     num_of_debounced += 1;
 
-    // check if the pio program has already been loaded:
-    if ((pio_debounced[gpio] == pio0) && (pio0_already_set != UNUSED))
-    {
-        offset[gpio] = offset[pio0_already_set];
-        conf[gpio] = conf[pio0_already_set];
-    }
-    else if ((pio_debounced[gpio] == pio1) && (pio1_already_set != UNUSED))
-    {
-        offset[gpio] = offset[pio1_already_set];
-        conf[gpio] = conf[pio1_already_set];
-    }
-    else
-    {
-        // load the pio program into the pio memory
-        offset[gpio] = pio_add_program(pio_debounced[gpio], &button_debounce_program);
-        // make a sm config
-        conf[gpio] = button_debounce_program_get_default_config(offset[gpio]);
-        // set the initial clkdiv to 10ms
-        sm_config_set_clkdiv(&conf[gpio], 10.);
-        if (pio_debounced[gpio] == pio0)
-            pio0_already_set = gpio;
-        else
-            pio1_already_set = gpio;
-    }
+    // make a sm config
+    pio_sm_config c = button_debounce_program_get_default_config(offset);
     // set the 'wait' gpios
-    sm_config_set_in_pins(&conf[gpio], gpio); // for WAIT, IN
+    sm_config_set_in_pins(&c, gpio); // for WAIT, IN
     // set the 'jmp' gpios
-    sm_config_set_jmp_pin(&conf[gpio], gpio); // for JMP
+    sm_config_set_jmp_pin(&c, gpio); // for JMP
     // init the pio sm with the config
-    pio_sm_init(pio_debounced[gpio], sm_debounced[gpio], offset[gpio], &conf[gpio]);
+    pio_sm_init(pio, sm, offset, &c);
+    // the initial debounce time is 10 ms, also when the system clock changes
+    pio_timing_register_sm(pio, sm, DEBOUNCE_INSTRUCTIONS * 1000.f / 10.f);
+    // clear the irq flag of the sm and use it as the interrupt for edge events
+    pio_interrupt_clear(pio, sm);
+    pio_set_irq0_source_enabled(pio, (pio_interrupt_source)(pis_interrupt0 + sm), true);
 
     // enable the sm
-    pio_sm_set_enabled(pio_debounced[gpio], sm_debounced[gpio], true);
+    pio_sm_set_enabled(pio, sm, true);
     return 0;
 };
 
@@ -136,7 +173,7 @@ int Debounce::debounce_gpio(uint gpio)
  * Request to debounce the gpio
  * @param gpio: the gpio that needs to be debounced
  *              the value must be a uint in the range [0, 28] excluding 23, 24 and 25. 
- * @param debounce_time: the float debounce_time in milliseconds in the range [0.5, 30.]
+ * @param debounce_time: the float debounce_time in milliseconds in the range [0.5, 30.] (at 125 MHz)
  */
 
 int Debounce::set_debounce_time(uint gpio, float debounce_time)
@@ -144,56 +181,44 @@ int Debounce::set_debounce_time(uint gpio, float debounce_time)
     // check if the gpio is valid
     if ((gpio > 28) || gpio == 23 || gpio == 24 || gpio == 25)
     {
-#ifdef PRINT_ERRORS
-        printf("debounce error: gpio should be 0 to 28 excluding 23, 24 and 25\n");
-#endif
+        TRACE_ERROR(DEBOUNCE_TRACE_INVALID_GPIO, gpio);
         return -1;
     }
-    if (debounce_time < 0.5)
+    // check that this gpio is indeed being debounced
+    int i = find_slot(gpio);
+    if (i == -1)
     {
-#ifdef PRINT_ERRORS
-        printf("debounce error: debounce time must be > 0 ms\n");
-#endif
+        TRACE_ERROR(DEBOUNCE_TRACE_NOT_DEBOUNCED, gpio);
         return -1;
     }
-    if (debounce_time > 30)
+    if (debounce_time < 0.5)
     {
-#ifdef PRINT_ERRORS
-        printf("debounce error: the maximum is 30 ms, if you need longer debounce times: instructions are in the code\n");
-#endif
+        TRACE_ERROR(DEBOUNCE_TRACE_TIME_TOO_SHORT, gpio);
         return -1;
     }
 
     /* 
-        calculate clkdiv based on debounce time:
+        calculate the frequency of the sm based on debounce time:
         Note: the resulting debounce time will not be very precise, but probably within 5 to 10%
 
-        In the pio code it becomes clear that the debounce time is about 31*2 = 62 instructions.
-        The time in seconds when a clkdiv is applied then becomes: clkdiv * 62 / 125000000
-        In microseconds this is: clkdiv * 62/125, which is about half the clkdiv value.
-        Conversely: the clkdiv for a given debounce_time in miliseconds is: 2 * 1000 * debounce_time
-        The minimum clkdiv value is 1, the corresponding debounce time is about 500 microseconds
-        The maximum clkdiv value is 65535, the corresponding debounce time is about 33 milliseconds
+        In the pio code it becomes clear that the debounce time is about 31*2 = 62 instructions
+        (DEBOUNCE_INSTRUCTIONS). So the sm needs 62 instructions per debounce time, for a
+        debounce_time in miliseconds: 62 * 1000 / debounce_time instructions per second.
+        The clkdiv follows from the system clock (see ../pio_timing), it is set again when the
+        system clock changes. The maximum clkdiv value is 65536: at 125 MHz the corresponding
+        debounce time is about 32 milliseconds, at a higher clock it is shorter.
         
         If a longer debounce time is required, the pio code must be adapted to add some pauses. This is
         indicated in the pio code.
      */
-
-    // stop the sm
-    pio_sm_set_enabled(pio_debounced[gpio], sm_debounced[gpio], false);
-    // calculate the clkdiv (see explanation above)
-    float clkdiv = 2. * debounce_time * 1000.;
-    // check that the clkdiv has a valid value
-    if (clkdiv < 1.0)
-        clkdiv = 1.0;
-    else if (clkdiv > 65535.)
-        clkdiv = 65535.;
-    // set the clkdiv for both pio
-    sm_config_set_clkdiv(&conf[gpio], clkdiv);
-    // do the init of the pio/sm
-    pio_sm_init(pio_debounced[gpio], sm_debounced[gpio], offset[gpio], &conf[gpio]);
-    // enable the sm
-    pio_sm_set_enabled(pio_debounced[gpio], sm_debounced[gpio], true);
+    float sm_hz = DEBOUNCE_INSTRUCTIONS * 1000.f / debounce_time;
+    if (clock_get_hz(clk_sys) / sm_hz > 65536.f)
+    {
+        TRACE_ERROR(DEBOUNCE_TRACE_TIME_TOO_LONG, gpio);
+        return -1;
+    }
+    // set the clkdiv of the sm, it keeps running (and keeps its debounced value)
+    pio_timing_register_sm(slots[i].pio, slots[i].sm, sm_hz);
     return 0;
 };
 
@@ -207,29 +232,202 @@ int Debounce::read(uint gpio)
     // check if the gpio is valid
     if ((gpio > 28) || gpio == 23 || gpio == 24 || gpio == 25)
     {
-#ifdef PRINT_ERRORS
-        printf("debounce error: gpio should be 0 to 28 excluding 23, 24 and 25\n");
-#endif
+        TRACE_ERROR(DEBOUNCE_TRACE_INVALID_GPIO, gpio);
         return -1;
     }
+    // a gpio in a group: the value is kept by the vertical counter
+    int g = find_group(gpio);
+    if (g != -1)
+        return (groups[g].values >> gpio) & 1;
     // check that this gpio is indeed being debounced
-    if (gpio_debounced[gpio] == UNUSED)
+    int i = find_slot(gpio);
+    if (i == -1)
     {
-#ifdef PRINT_ERRORS
-        printf("debounce error: gpio is not debounced\n");
-#endif
+        TRACE_ERROR(DEBOUNCE_TRACE_NOT_DEBOUNCED, gpio);
         return -1;
     }
     // read the program counter
-    uint pc = pio_sm_get_pc(pio_debounced[gpio], sm_debounced[gpio]);
+    uint pc = pio_sm_get_pc(slots[i].pio, slots[i].sm);
     // if it is at or beyond the "wait 0 pin 0" it has value 1, else 0
     // in the pio code a public define called 'border' is set at that position
-    if (pc >= (offset[gpio] + button_debounce_border))
+    if (pc >= slots[i].border)
         return 1;
     else
         return 0;
 };
 
+/* 
+ * Read the current values of all debounced gpios at once
+ * returns a mask with bit 'gpio' set if the debounced gpio is 1
+ */
+uint32_t Debounce::read_all(void)
+{
+    uint32_t values = 0;
+    // no checks needed: only the used slots are read
+    for (uint i = 0; i < num_of_debounced; i++)
+        if (pio_sm_get_pc(slots[i].pio, slots[i].sm) >= slots[i].border)
+            values |= 1u << slots[i].gpio;
+    // the groups
+    for (int g = 0; g < 8; g++)
+        values |= groups[g].values & groups[g].mask;
+    return values;
+};
+
+/* 
+ * set the function that is called when a debounced gpio changes
+ * @param callback: the function, or NULL to stop the calls
+ */
+void Debounce::set_callback(debounce_callback _callback)
+{
+    callback = _callback;
+};
+
+/* 
+ * the interrupt handler (called by the pio resources for the sm): the sm has set its irq flag,
+ * i.e. its debounced gpio has changed, or the sm of a group has pushed a sample
+ */
+void Debounce::irq_handler(PIO pio, uint sm, void *user_data)
+{
+    Debounce *d = (Debounce *)user_data;
+    for (uint i = 0; i < d->num_of_debounced; i++)
+    {
+        debounce_slot &slot = d->slots[i];
+        // the irq flag of the sm
+        if (slot.pio == pio && slot.sm == sm && pio_interrupt_get(pio, sm))
+        {
+            pio_interrupt_clear(slot.pio, slot.sm);
+            if (d->callback != NULL)
+                d->callback(slot.gpio, pio_sm_get_pc(slot.pio, slot.sm) >= slot.border ? 1 : 0);
+        }
+    }
+    for (int g = 0; g < 8; g++)
+    {
+        debounce_group &group = d->groups[g];
+        if (group.mask == 0 || group.pio != pio || group.sm != sm)
+            continue;
+        while (!pio_sm_is_rx_fifo_empty(group.pio, group.sm))
+        {
+            uint32_t sample = pio_sm_get(group.pio, group.sm) & group.mask;
+            // the vertical counter: each gpio that differs from its debounced value counts the
+            // samples (count1 count0 = 00, 01, 10, 11), a gpio that is the same is reset to 00
+            uint32_t delta = sample ^ group.values;
+            group.count1 = (group.count1 ^ group.count0) & delta;
+            group.count0 = ~group.count0 & delta;
+            // the counter rolls over to 00 at the 4th consecutive sample: the gpio changes
+            uint32_t toggle = delta & ~(group.count0 | group.count1);
+            group.values ^= toggle;
+            // the edge events
+            while (toggle && d->callback != NULL)
+            {
+                uint gpio = __builtin_ctz(toggle);
+                toggle &= toggle - 1;
+                d->callback(gpio, (group.values >> gpio) & 1);
+            }
+        }
+    }
+};
+
+/* 
+ * Request to debounce a group of consecutive gpios with one sm
+ * @param base_gpio: the first gpio of the group
+ * @param count: the number of gpios in the group, gpios 23, 24 and 25 are skipped
+ * @param debounce_time: the float debounce_time in milliseconds in the range [0.5, 1000.]
+ */
+int Debounce::debounce_gpio_group(uint base_gpio, uint count, float debounce_time)
+{
+    // check if the gpios are valid
+    if (count == 0 || base_gpio + count > 29)
+    {
+        TRACE_ERROR(DEBOUNCE_TRACE_INVALID_GROUP, base_gpio);
+        return -1;
+    }
+    if (debounce_time < 0.5 || debounce_time > 1000.)
+    {
+        TRACE_ERROR(DEBOUNCE_TRACE_INVALID_GROUP_TIME, base_gpio);
+        return -1;
+    }
+    // the gpios of the group, without 23, 24 and 25
+    uint32_t mask = ((1u << count) - 1) << base_gpio;
+    mask &= ~((1u << 23) | (1u << 24) | (1u << 25));
+    // check that the gpios are unused
+    for (uint gpio = base_gpio; gpio < base_gpio + count; gpio++)
+        if ((mask & (1u << gpio)) && (find_slot(gpio) != -1 || find_group(gpio) != -1))
+        {
+            TRACE_WARNING(DEBOUNCE_TRACE_ALREADY_DEBOUNCED, gpio);
+            return -1;
+        }
+    // find a free group
+    int g;
+    for (g = 0; g < 8; g++)
+        if (groups[g].mask == 0)
+            break;
+    if (g == 8)
+    {
+        TRACE_ERROR(DEBOUNCE_TRACE_MAX_GROUPS, base_gpio);
+        return -1;
+    }
+    // Find a pio and sm
+    PIO pio;
+    uint offset;
+    int sm = claim_sm(&button_debounce_group_program, &pio, &offset);
+    if (sm == -1)
+        return -1;
+    // the gpios are inputs
+    for (uint gpio = base_gpio; gpio < base_gpio + count; gpio++)
+        if (mask & (1u << gpio))
+            gpio_init(gpio);
+    // the group starts with the current values of the gpios
+    debounce_group &group = groups[g];
+    group.pio = pio;
+    group.sm = sm;
+    group.values = gpio_get_all() & mask;
+    group.count0 = 0;
+    group.count1 = 0;
+    group.mask = mask;
+
+    // make a sm config
+    pio_sm_config c = button_debounce_group_program_get_default_config(offset);
+    // all 32 gpios are sampled: 'in' starting at gpio 0
+    sm_config_set_in_pins(&c, 0);
+    // shift direction doesn't matter for 'in pins 32', no autopush
+    sm_config_set_in_shift(&c, false, false, 32);
+    // init the pio sm with the config
+    pio_sm_init(pio, sm, offset, &c);
+    // the frequency: a gpio changes after 4 samples of 1027 clock cycles each (the clkdiv
+    // follows from the system clock, also when it changes)
+    pio_timing_register_sm(pio, sm, 4.f * 1027.f * 1000.f / debounce_time);
+    // the interrupt when a sample is available
+    pio_set_irq0_source_enabled(pio, (pio_interrupt_source)(pis_sm0_rx_fifo_not_empty + sm), true);
+
+    // enable the sm
+    pio_sm_set_enabled(pio, sm, true);
+    return g;
+};
+
+/* 
+ * undebounce a group of gpios
+ * @param group: the number of the group returned by debounce_gpio_group()
+ */
+int Debounce::undebounce_gpio_group(int g)
+{
+    if (g < 0 || g >= 8 || groups[g].mask == 0)
+    {
+        TRACE_ERROR(DEBOUNCE_TRACE_NOT_A_GROUP, (uint32_t)g);
+        return -1;
+    }
+    PIO pio_used = groups[g].pio;
+    uint sm_used = groups[g].sm;
+    // disable the interrupt of the sm
+    pio_set_irq0_source_enabled(pio_used, (pio_interrupt_source)(pis_sm0_rx_fifo_not_empty + sm_used), false);
+    // indicate that the group is not used
+    groups[g].mask = 0;
+    groups[g].values = 0;
+    pio_timing_unregister_sm(pio_used, sm_used);
+    // disable and unclaim the sm, the program is removed after the last sm that uses it
+    pio_resources_release_sm(pio_used, sm_used, &button_debounce_group_program);
+    return 0;
+};
+
 /* 
  * undebounce a previously debounced gpio
  * @param gpio: the gpio that is no longer going to be debounced
@@ -240,56 +438,31 @@ int Debounce::undebounce_gpio(uint gpio)
     // check if the gpio is valid
     if ((gpio > 28) || gpio == 23 || gpio == 24 || gpio == 25)
     {
-#ifdef PRINT_ERRORS
-        printf("debounce error: gpio should be 0 to 28 excluding 23, 24 and 25\n");
-#endif
+        TRACE_ERROR(DEBOUNCE_TRACE_INVALID_GPIO, gpio);
         return -1;
     }
     // check that this gpio is indeed being debounced
-    if (gpio_debounced[gpio] == UNUSED)
+    int i = find_slot(gpio);
+    if (i == -1)
     {
-#ifdef PRINT_ERRORS
-        printf("debounce error: gpio is not debounced\n");
-#endif
+        TRACE_ERROR(DEBOUNCE_TRACE_NOT_DEBOUNCED, gpio);
         return -1;
     }
 
-    // disable the pio
-    pio_sm_set_enabled(pio_debounced[gpio], sm_debounced[gpio], false);
-    // save pio, sm and offset to - if possible - unclaim the sm and remove the program from pio memory
-    PIO pio_used = pio_debounced[gpio];
-    uint sm_used = sm_debounced[gpio];
-    int offset_used = offset[gpio];
-    // indicate that the gpio is not debounced
-    gpio_debounced[gpio] = UNUSED;
-    pio_debounced[gpio] = (PIO)NULL;
-    sm_debounced[gpio] = UNUSED;
-    offset[gpio] = UNUSED;
-
-    // unclaim the sm
-    pio_sm_unclaim(pio_used, sm_used);
-
-    // if this is the last gpio of a pio: remove the program, set pioX_already_set to UNUSED
-    int i;
-    for (i = 0; i < 32; i++)
-    {
-        // check if the pio is still in use (i.e. one of the sm belongs to this pio)
-        if (pio_debounced[i] == pio_used)
-            break;
-    }
-    // if i==32 it means that no other debounced gpio uses this pio
-    if (i == 32)
-    {
-        // remove the program
-        pio_remove_program(pio_used, &button_debounce_program, offset_used);
-        // indicate that the pio (either pio0 or pio1) is not set
-        if (pio_used == pio0)
-            pio0_already_set = UNUSED;
-        else
-            pio1_already_set = UNUSED;
-    }
-    // there is one less gpio being debounced
+    // save pio and sm to unclaim the sm and release the program
+    PIO pio_used = slots[i].pio;
+    uint sm_used = slots[i].sm;
+    // disable the interrupt of the sm
+    pio_set_irq0_source_enabled(pio_used, (pio_interrupt_source)(pis_interrupt0 + sm_used), false);
+    pio_interrupt_clear(pio_used, sm_used);
+    // indicate that the gpio is not debounced: the last slot takes its place
     num_of_debounced--;
+    slots[i] = slots[num_of_debounced];
+    pio_timing_unregister_sm(pio_used, sm_used);
+
+    // disable and unclaim the sm, the program is removed from the pio memory after the last
+    // sm that uses it
+    pio_resources_release_sm(pio_used, sm_used, &button_debounce_program);
 
     return 0;
 }
@@ -7,10 +7,18 @@
 #include "button_debounce.pio.h"
 
 
+/* 
+ * the function that is called when the debounced value of a gpio changes
+ * @param gpio: the gpio that changed
+ * @param value: the new debounced value (0 or 1)
+ */
+typedef void (*debounce_callback)(uint gpio, int value);
+
 /* 
  * class that debounces gpio using the PIO state machines.
- * up to 8 gpios can be debounced at any one time.
+ * up to 8 gpios can be debounced at any one time with a sm for each gpio.
  * the debounce time for each gpio can be set individually, default it is set a 10ms.
+ * more gpios (up to all 26 usable gpios) can be debounced as a group by a single sm.
  */
 class Debounce
 {
@@ -27,21 +35,51 @@ public:
      */
     int debounce_gpio(uint gpio);
 
+    /* 
+     * Request to debounce a group of consecutive gpios with one sm
+     * @param base_gpio: the first gpio of the group
+     * @param count: the number of gpios in the group, gpios 23, 24 and 25 are skipped
+     *               e.g. debounce_gpio_group(0, 29) debounces all 26 usable gpios
+     * @param debounce_time: the float debounce_time in milliseconds in the range [0.5, 1000.]
+     * returns the number of the group, or -1 if it failed
+     */
+    int debounce_gpio_group(uint base_gpio, uint count, float debounce_time = 10.);
+
+    /* 
+     * undebounce a group of gpios
+     * @param group: the number of the group returned by debounce_gpio_group()
+     */
+    int undebounce_gpio_group(int group);
+
     /* 
      * set the debounce time for a gpio
      * @param gpio: the gpio for which the debounce time will be set
      *              the gpio must have previously been debounced using debounce_gpio()
-     * @param debounce_time: the float debounce_time in milliseconds in the range [0.5, 30.]
+     * @param debounce_time: the float debounce_time in milliseconds in the range [0.5, 30.] (at 125 MHz, the maximum is lower at a higher system clock)
      */
     int set_debounce_time(uint gpio, float debounce_time);
 
     /* 
      * Read the current value of the debounced the gpio
      * @param gpio: the gpio whose value (low, high) is read
-     *              the gpio must have previously been debounced using debounce_gpio()
+     *              the gpio must have previously been debounced using debounce_gpio() or debounce_gpio_group()
      */
     int read(uint gpio);
 
+    /* 
+     * Read the current values of all debounced gpios at once
+     * returns a mask with bit 'gpio' set if the debounced gpio is 1
+     * Note: gpios that are not debounced read as 0
+     */
+    uint32_t read_all(void);
+
+    /* 
+     * set the function that is called (from the PIO interrupt) when a debounced gpio changes
+     * @param callback: the function, or NULL to stop the calls
+     * Note: the callback uses the PIO0_IRQ_0 and PIO1_IRQ_0 interrupts (via the shared pio resources) and the sm irq flags
+     */
+    void set_callback(debounce_callback callback);
+
     /* 
      * undebounce (rebounce?) a previously debounced gpio
      * @param gpio: the gpio that is no longer going to be debounced
@@ -50,20 +88,41 @@ public:
     int undebounce_gpio(uint gpio);
 
 private:
-    // the number of instantiated buttons to debounce
-    uint num_of_debounced = 0;
+    // the interrupt handler (for each sm): calls the callback if the sm has set its irq flag
+    static void irq_handler(PIO pio, uint sm, void *user_data);
+    // find the slot of a debounced gpio, returns -1 if the gpio isn't debounced
+    int find_slot(uint gpio);
+    // find the group of a debounced gpio, returns -1 if the gpio isn't in a group
+    int find_group(uint gpio);
+    // claim a sm and load its program (pio0 first, then pio1), returns the sm or -1 if none is available
+    int claim_sm(const pio_program_t *program, PIO *pio, uint *offset);
 
-    // Note: yes, the below way of doing things is somewhat wastefull, but handy
-    // for each gpio indicate if it is debounced
-    int gpio_debounced[32];
-    // for each gpio the PIO used to debounce
-    PIO pio_debounced[32];
-    // for each gpio the sm used to debounce
-    int sm_debounced[32];
-    // for each gpio the location of the pio program in the memory
-    int offset[32];
-    // for each gpio the configurations of the pio sm
-    pio_sm_config conf[32];
-    // flags to indicate the pio has already been set (and by which gpio)
-    int pio0_already_set, pio1_already_set;
+    // a debounced gpio: the gpio, the pio and sm that debounce it, and the program counter
+    // at or above which the debounced value is 1
+    struct debounce_slot
+    {
+        uint gpio;
+        PIO pio;
+        uint sm;
+        uint border;
+    };
+    // the debounced gpios: the first num_of_debounced slots are used
+    debounce_slot slots[8];
+    // the number of debounced gpios
+    uint num_of_debounced = 0;
+    // a group of debounced gpios: the gpios (a bit for each gpio), the pio and sm that sample
+    // them, the debounced values and the vertical counter (bit i of count0 and count1 form
+    // the counter of gpio i)
+    struct debounce_group
+    {
+        uint32_t mask;
+        PIO pio;
+        uint sm;
+        volatile uint32_t values;
+        uint32_t count0, count1;
+    };
+    // the groups of debounced gpios, mask == 0 means the group isn't used
+    debounce_group groups[8];
+    // the function to call when a debounced gpio changes
+    debounce_callback callback = NULL;
 };
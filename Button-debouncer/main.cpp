@@ -2,6 +2,7 @@
 
 #include "pico/stdlib.h"
 #include "button_debounce.h"
+#include "trace_ring.h"
 
 /*
   This code shows how to use the button debouncer that uses the PIO state machines.
@@ -10,7 +11,10 @@
   Instantiate the debouncer, e.g.: Debounce debouncer;
   Request to debounce the gpio, e.g. gpio 3: debouncer.debounce_gpio(3)
   set the debounce time for a gpio, e.g. set to 1ms: debouncer.set_debounce_time(3, 1);
+  Request to debounce a group of gpios with one sm, e.g. gpio 11 to 22 with 5ms: debouncer.debounce_gpio_group(11, 12, 5);
   Read the current value of the debounced the gpio, e.g. gpio 3: int v = debouncer.read(3);
+  Read the current values of all debounced gpios at once (bit 'gpio' of the mask): uint32_t mask = debouncer.read_all();
+  Get a call when a debounced gpio changes, e.g.: debouncer.set_callback(print_change);
   undebounce (rebounce?) a previously debounced gpio, e.g. gpio 3: debouncer.undebounce_gpio(3);
 
   This example code first debounces gpio 3 to 10, then in an infinite loop reads the current 
@@ -18,6 +22,12 @@
   one by one debounced again.
  */
 
+// called (from the interrupt) when a debounced gpio changes
+void print_change(uint gpio, int value)
+{
+    printf("\ngpio %d changed to %d", gpio, value);
+}
+
 int main()
 {
     // necessary for printf
@@ -36,6 +46,13 @@ int main()
     debouncer.debounce_gpio(9);
     debouncer.debounce_gpio(10);
 
+    // debounce gpio 11 to 22 as a group, using only one sm
+    // (a group of all 26 usable gpios would be: debouncer.debounce_gpio_group(0, 29))
+    debouncer.debounce_gpio_group(11, 12);
+
+    // print the changes of the debounced gpios
+    debouncer.set_callback(print_change);
+
     // set different debounce times
     // Note: an external puls generator that can vary the puls widts and an logic analyser 
     // was used during testing to verify that this indeed works.
@@ -68,6 +85,10 @@ int main()
                 else 
                     printf("X\t");
             }
+            // all values at once
+            printf("mask = %08x", debouncer.read_all());
+            // the errors of the debouncer (e.g. reading a gpio that isn't debounced)
+            trace_drain(16);
             sleep_ms(250);
             // one by one UNdebounce the gpios
             debouncer.undebounce_gpio(stop_debounce);
@@ -86,6 +107,8 @@ int main()
                 else 
                     printf("X\t");
             }
+            // the errors of the debouncer (e.g. reading a gpio that isn't debounced)
+            trace_drain(16);
             sleep_ms(250);
             // one by one debounce the gpios
             debouncer.debounce_gpio(debounce_again);
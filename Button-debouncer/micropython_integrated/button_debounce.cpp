@@ -6,6 +6,7 @@
 
 #include "button_debounce.pio.h"
 #include "button_debounce.h"
+#include "pio_program_cache.h"
 
 // FIXME: micropython doesn't let the printf go through, so might as well not print
 // indicate if errors and warnings should print a message
@@ -42,8 +43,6 @@ void Debounce::start(void)
         // conf[i] = (pio_sm_config) 0;
     }
     num_of_debounced = 0;
-    pio0_already_set = UNUSED;
-    pio1_already_set = UNUSED;
     has_started = true;
 }
 
@@ -110,35 +109,28 @@ int Debounce::debounce_gpio(uint gpio)
         }
     }
 
+    // load the pio program into the pio memory via the shared program cache:
+    // if the same program is already loaded in this pio (by this or another driver) that copy is used
+    int program_offset = pio_program_cache_add(pio, &button_debounce_program);
+    if (program_offset < 0)
+    {
+        pio_sm_unclaim(pio, sm);
+#ifdef PRINT_ERRORS
+        printf("debounce error: no room for the program in the pio memory\n");
+#endif
+        return -1;
+    }
+
     pio_debounced[gpio] = pio;
     sm_debounced[gpio] = sm;
     gpio_debounced[gpio] = gpio;
+    offset[gpio] = program_offset;
     num_of_debounced += 1;
 
-    // check if the pio program has already been loaded:
-    if ((pio_debounced[gpio] == pio0) && (pio0_already_set != UNUSED))
-    {
-        offset[gpio] = offset[pio0_already_set];
-        conf[gpio] = conf[pio0_already_set];
-    }
-    else if ((pio_debounced[gpio] == pio1) && (pio1_already_set != UNUSED))
-    {
-        offset[gpio] = offset[pio1_already_set];
-        conf[gpio] = conf[pio1_already_set];
-    }
-    else
-    {
-        // load the pio program into the pio memory
-        offset[gpio] = pio_add_program(pio_debounced[gpio], &button_debounce_program);
-        // make a sm config
-        conf[gpio] = button_debounce_program_get_default_config(offset[gpio]);
-        // set the initial clkdiv to 10ms
-        sm_config_set_clkdiv(&conf[gpio], 10.);
-        if (pio_debounced[gpio] == pio0)
-            pio0_already_set = gpio;
-        else
-            pio1_already_set = gpio;
-    }
+    // make a sm config
+    conf[gpio] = button_debounce_program_get_default_config(offset[gpio]);
+    // set the initial clkdiv to 10ms
+    sm_config_set_clkdiv(&conf[gpio], 10.);
     // set the 'wait' gpios
     sm_config_set_in_pins(&conf[gpio], gpio); // for WAIT, IN
     // set the 'jmp' gpios
@@ -266,6 +258,22 @@ int Debounce::read(uint gpio)
         return 0;
 };
 
+/* 
+ * Read the current values of all debounced gpios at once
+ * returns a mask with bit 'gpio' set if the debounced gpio is 1
+ */
+uint32_t Debounce::read_mask(void)
+{
+    uint32_t values = 0;
+    if (has_started == false)
+        return 0;
+    for (uint gpio = 0; gpio < 29; gpio++)
+        if (gpio_debounced[gpio] != UNUSED &&
+            pio_sm_get_pc(pio_debounced[gpio], sm_debounced[gpio]) >= (uint)(offset[gpio] + button_debounce_border))
+            values |= 1u << gpio;
+    return values;
+};
+
 /* 
  * undebounce a previously debounced gpio
  * @param gpio: the gpio that is no longer going to be debounced
@@ -300,10 +308,9 @@ int Debounce::undebounce_gpio(uint gpio)
 
     // disable the pio
     pio_sm_set_enabled(pio_debounced[gpio], sm_debounced[gpio], false);
-    // save pio, sm and offset to - if possible - unclaim the sm and remove the program from pio memory
+    // save pio and sm to unclaim the sm and release the program
     PIO pio_used = pio_debounced[gpio];
     uint sm_used = sm_debounced[gpio];
-    int offset_used = offset[gpio];
     // indicate that the gpio is not debounced
     gpio_debounced[gpio] = UNUSED;
     pio_debounced[gpio] = (PIO)NULL;
@@ -313,25 +320,8 @@ int Debounce::undebounce_gpio(uint gpio)
     // unclaim the sm
     pio_sm_unclaim(pio_used, sm_used);
 
-    // if this is the last gpio of a pio: remove the program, set pioX_already_set to UNUSED
-    int i;
-    for (i = 0; i < 32; i++)
-    {
-        // check if the pio is still in use (i.e. one of the sm belongs to this pio)
-        if (pio_debounced[i] == pio_used)
-            break;
-    }
-    // if i==32 it means that no other debounced gpio uses this pio
-    if (i == 32)
-    {
-        // remove the program
-        pio_remove_program(pio_used, &button_debounce_program, offset_used);
-        // indicate that the pio (either pio0 or pio1) is not set
-        if (pio_used == pio0)
-            pio0_already_set = UNUSED;
-        else
-            pio1_already_set = UNUSED;
-    }
+    // release the program, the program cache removes it if this was its last user
+    pio_program_cache_remove(pio_used, &button_debounce_program);
     // there is one less gpio being debounced
     num_of_debounced--;
 
@@ -44,6 +44,12 @@ public:
      */
     int read(uint gpio);
 
+    /* 
+     * Read the current values of all debounced gpios at once
+     * returns a mask with bit 'gpio' set if the debounced gpio is 1
+     */
+    uint32_t read_mask(void);
+
     /* 
      * undebounce (rebounce?) a previously debounced gpio
      * @param gpio: the gpio that is no longer going to be debounced
@@ -69,7 +75,5 @@ private:
     int offset[32];
     // for each gpio the configurations of the pio sm
     pio_sm_config conf[32];
-    // flags to indicate the pio has already been set (and by which gpio)
-    int pio0_already_set, pio1_already_set;
 };
 
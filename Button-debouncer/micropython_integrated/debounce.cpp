@@ -32,6 +32,12 @@ mp_obj_t read(mp_obj_t mp_gpio) {
     return mp_obj_new_int(debounce.read(gpio));
 }
 
+// the values of all debounced gpios as a mask (bit 'gpio')
+// Note: the mask (gpio 0 to 28) always fits in a small int, so this doesn't allocate memory
+mp_obj_t read_mask() {
+    return MP_OBJ_NEW_SMALL_INT(debounce.read_mask());
+}
+
 mp_obj_t undebounce_gpio(mp_obj_t mp_gpio) {
     const auto gpio = mp_obj_get_int(mp_gpio);
     // mp_printf(&mp_plat_print, "undebounce_gpio\n");
@@ -7,6 +7,7 @@ STATIC MP_DEFINE_CONST_FUN_OBJ_0(start_obj, start);
 STATIC MP_DEFINE_CONST_FUN_OBJ_1(debounce_gpio_obj, debounce_gpio);
 STATIC MP_DEFINE_CONST_FUN_OBJ_2(set_debounce_time_obj, set_debounce_time);
 STATIC MP_DEFINE_CONST_FUN_OBJ_1(read_obj, read);
+STATIC MP_DEFINE_CONST_FUN_OBJ_0(read_mask_obj, read_mask);
 STATIC MP_DEFINE_CONST_FUN_OBJ_1(undebounce_gpio_obj, undebounce_gpio);
 
 // Define all properties of the module.
@@ -21,6 +22,7 @@ STATIC const mp_rom_map_elem_t debounce_module_globals_table[] = {
     { MP_ROM_QSTR(MP_QSTR_debounce_gpio), MP_ROM_PTR(&debounce_gpio_obj) },
     { MP_ROM_QSTR(MP_QSTR_set_debounce_time), MP_ROM_PTR(&set_debounce_time_obj) },
     { MP_ROM_QSTR(MP_QSTR_read), MP_ROM_PTR(&read_obj) },
+    { MP_ROM_QSTR(MP_QSTR_read_mask), MP_ROM_PTR(&read_mask_obj) },
     { MP_ROM_QSTR(MP_QSTR_undebounce_gpio), MP_ROM_PTR(&undebounce_gpio_obj) },
 };
 STATIC MP_DEFINE_CONST_DICT(debounce_module_globals, debounce_module_globals_table);
@@ -7,4 +7,5 @@ extern mp_obj_t start();
 extern mp_obj_t debounce_gpio(mp_obj_t mp_gpio);
 extern mp_obj_t set_debounce_time(mp_obj_t mp_gpio, mp_obj_t mp_debounce_time);
 extern mp_obj_t read(mp_obj_t mp_gpio);
+extern mp_obj_t read_mask();
 extern mp_obj_t undebounce_gpio(mp_obj_t mp_gpio);
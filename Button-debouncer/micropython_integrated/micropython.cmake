@@ -4,10 +4,12 @@ target_sources(usermod_debounce INTERFACE
     ${CMAKE_CURRENT_LIST_DIR}/button_debounce.cpp
     ${CMAKE_CURRENT_LIST_DIR}/debounce.cpp
     ${CMAKE_CURRENT_LIST_DIR}/debouncemodule.c
+    ${CMAKE_CURRENT_LIST_DIR}/../../pio_resources/pio_program_cache.c
 )
 
 target_include_directories(usermod_debounce INTERFACE
     ${CMAKE_CURRENT_LIST_DIR}
+    ${CMAKE_CURRENT_LIST_DIR}/../../pio_resources
 )
 
 target_link_libraries(usermod INTERFACE usermod_debounce) 
@@ -0,0 +1,64 @@
+#include <stdio.h>
+
+#include "pico/stdlib.h"
+#include "hardware/pio.h"
+
+#include "four_sm_lockstep.pio.h"
+#include "pio_resources.h"
+#include "pio_sync.h"
+
+// the first of the four output pins (one for each sm)
+#define BASE_PIN 10
+
+/*
+Four state machines are started in the same clock cycle (pio_sync_start) and meet at a barrier
+(pio_sync_barrier) after each pulse. The pulses have a different length for each sm, but
+the next pulses start in the same clock cycle again: see the pins on a logic analyzer.
+*/
+
+int main()
+{
+    // needed for printf
+    stdio_init_all();
+
+    // claim all four state machines of a pio and load the program
+    PIO pio;
+    uint offset;
+    if (!pio_resources_claim_sm_mask(&four_sm_lockstep_program, 0b1111, &pio, &offset))
+    {
+        printf("four_sm_lockstep: no pio with four free state machines\n");
+        while (true)
+            ;
+    }
+    for (uint sm = 0; sm < 4; sm++)
+    {
+        // the pin of this sm
+        pio_gpio_init(pio, BASE_PIN + sm);
+        pio_sm_set_consecutive_pindirs(pio, sm, BASE_PIN + sm, 1, true);
+        // make a sm config
+        pio_sm_config c = four_sm_lockstep_program_get_default_config(offset);
+        sm_config_set_set_pins(&c, BASE_PIN + sm, 1);
+        // the same clock divider for all: they stay in phase
+        sm_config_set_clkdiv(&c, 10);
+        // init the pio sm with the config (not enabled)
+        pio_sm_init(pio, sm, offset, &c);
+        // the length of the pulse in the OSR: 100, 200, 300 and 400 loops
+        pio_sm_put(pio, sm, 100 * (sm + 1));
+        pio_sm_exec(pio, sm, pio_encode_pull(false, true));
+    }
+    // the barrier for the four state machines
+    static pio_sync_barrier barrier;
+    pio_sync_barrier_init(&barrier, pio, 0b1111);
+    // start all four in the same clock cycle
+    pio_sync_start(pio, 0b1111);
+
+    // print the number of times the state machines have met, each second
+    uint32_t previous = 0;
+    while (true)
+    {
+        sleep_ms(1000);
+        uint32_t count = barrier.count;
+        printf("barriers: %d (%d per second)\n", count, count - previous);
+        previous = count;
+    }
+}
@@ -2,31 +2,102 @@
 
 #include "pico/stdlib.h"
 #include "hardware/pio.h"
+#include "hardware/irq.h"
+#include "hardware/clocks.h"
 
 #include "HCSR04.pio.h"
+#include "pio_resources.h"
+#include "pio_subroutines.h"
+#include "pio_timing.h"
 
-// class that sets up and reads the HCSR04
+// the maximum number of sensors: all state machines of all pio blocks
+#define MAX_SENSORS (NUM_PIOS * 4)
+// the number of measurements kept for each sensor
+#define RING_SIZE 8
+// the maximum distance (cm) that is measured, longer echos (or no echo) are invalid
+#define MAX_DISTANCE_CM 400
+// the frequency of the state machines: the trigger pulse in the pio program is counted for
+// 125 MHz, at another system clock the clkdiv keeps it (see ../pio_timing)
+#define HCSR04_SM_HZ 125000000.f
+
+// the calls of the shared pio subroutines in the program
+static const pio_subroutines_call HCSR04_calls[] = {
+    {HCSR04_offset_call_delay, pio_subroutines_offset_delay},
+    {HCSR04_offset_call_wait_high, pio_subroutines_offset_wait_high},
+    {HCSR04_offset_call_wait_low, pio_subroutines_offset_wait_low},
+};
+
+// a measurement: the distance in cm (0 cm means invalid measurement) and when it was received
+typedef struct
+{
+    float cm;
+    uint64_t timestamp_us;
+} measurement;
+
+// class that sets up and reads several HCSR04 sensors
 // The HCSR04 works by giving it a 10 us pulse on its Trigger pin
 // The distance to an object is represented by the length of the pulse on its Echo pin
+//
+// Each sensor has its own state machine (pio0 first, then pio1), claimed via the shared pio
+// resources, which load the pio program once in each pio. The state machines measure when the
+// c code sets their irq flag: a repeating timer goes through a schedule of slots, in each slot
+// a group of sensors is started at the same time. To avoid crosstalk (a sensor receiving the echo of another
+// sensor) each sensor can get its own slot (staggered), sensors that face apart can share
+// a slot (simultaneous). The results are collected by one interrupt handler (RxFIFO not
+// empty) that puts them, with a timestamp, in a ring buffer for each sensor.
 class HCSR04
 {
 public:
     // constructor
+    HCSR04()
+    {
+        // using
+        // - the time for 1 pio clock tick (1/clock speed)
+        // - speed of sound in air is about 340 m/s
+        // - the sound travels from the HCSR04 to the object and back (twice the distance)
+        // we can calculate the distance in cm per clock cycle (0.000136 at 125 MHz), also
+        // when the system clock changes
+        set_clock(clock_get_hz(clk_sys), this);
+        pio_timing_add_callback(set_clock, this);
+        max_loops = (uint32_t)(MAX_DISTANCE_CM / cm_per_cycle / 2);
+    }
+
+    // add a sensor, returns its number (or -1 if there is no free state machine)
     // input = pin connected to the 'Echo' pin of the HCSR04.
     // ! NOTE: USE A VOLTAGE DIVIDER FOR THE INPUT (i.e. the Echo pin of the HCSR04)
     //         to go from 5V (which is needed by the HCSR04 module) to 3.3V
     // output = pin connected to the 'Trig' pin of the HCSR04.
-    HCSR04(uint input, uint output)
+    int add_sensor(uint input, uint output)
     {
-        // pio 0 is used
-        pio = pio0;
-        // state machine 0
-        sm = 0;
+        if (num_of_sensors == MAX_SENSORS)
+            return -1;
+        // load the pio program linked to the shared pio subroutines (both once in each pio) and
+        // claim a state machine in the same pio: the first pio (pio0 first) that has a free
+        // state machine and room for the program, so a full pio0 falls through to pio1
+        PIO pio = NULL;
+        uint sm = 0;
+        int offset = -1;
+        for (uint p = 0; p < NUM_PIOS && offset < 0; p++)
+        {
+            pio = pio_get_instance(p);
+            if (!has_free_sm(pio))
+                continue;
+            offset = pio_subroutines_add_program(pio, &HCSR04_program, HCSR04_calls, 3, &linked[p]);
+            if (offset >= 0)
+                sm = pio_claim_unused_sm(pio, true);
+        }
+        if (offset < 0)
+            return -1;
+        uint s = num_of_sensors++;
+        sensors[s].pio = pio;
+        sensors[s].sm = sm;
+        sensors[s].count = 0;
+        sensors[s].owner = this;
+        // the interrupt handler of the sm
+        pio_resources_set_irq_handler(pio, sm, rx_fifo_handler, &sensors[s]);
         // configure the used pins
         pio_gpio_init(pio, input);
         pio_gpio_init(pio, output);
-        // load the pio program into the pio memory
-        uint offset = pio_add_program(pio, &HCSR04_program);
         // make a sm config
         pio_sm_config c = HCSR04_program_get_default_config(offset);
         // set the 'in' pins, also used for 'wait'
@@ -41,56 +112,202 @@ public:
         sm_config_set_in_shift(&c, false, false, 0);
         // init the pio sm with the config
         pio_sm_init(pio, sm, offset, &c);
-        // enable the sm
+        // the sm runs at HCSR04_SM_HZ, at any system clock
+        pio_timing_register_sm(pio, sm, HCSR04_SM_HZ);
+        // the timeout: the number of loops (2 clock cycles each) for an echo of MAX_DISTANCE_CM
+        // put it in the OSR, where it stays
+        pio_sm_put(pio, sm, max_loops);
+        pio_sm_exec(pio, sm, pio_encode_pull(false, true));
+        // the interrupt when a measurement has been pushed
+        pio_set_irq0_source_enabled(pio, (pio_interrupt_source)(pis_sm0_rx_fifo_not_empty + sm), true);
+        // enable the sm: it waits for its irq flag to start a measurement
         pio_sm_set_enabled(pio, sm, true);
+        // by default each sensor gets its own slot: staggered
+        slots[num_of_slots++] = 1u << s;
+        return s;
     }
 
-    // read the distance to an object in cm (0 cm means invalid measurement)
-    float read(void)
+    // set the schedule: the sensors (a bit for each sensor) to start in each slot
+    // e.g. {0b01, 0b10}: staggered, {0b11}: simultaneous
+    void set_schedule(const uint32_t *schedule, uint slots_in_schedule)
     {
-        // value is used to read from the sm RX FIFO
-        uint32_t clock_cycles = 0;
-        // clear the FIFO: do a new measurement
-        pio_sm_clear_fifos(pio, sm);
-        // give the sm some time to do a measurement and place it in the FIFO
-        sleep_ms(100);
-        // check that the FIFO isn't empty
-        if (pio_sm_is_rx_fifo_empty(pio, sm))
-        {
+        num_of_slots = 0;
+        for (uint i = 0; i < slots_in_schedule && i < MAX_SENSORS; i++)
+            slots[num_of_slots++] = schedule[i];
+    }
+
+    // start measuring: a slot every slot_us microseconds
+    // Note: the echo of a sensor takes up to 25 ms (about 40 Hz), a sensor in consecutive
+    //       slots needs slot_us to be at least that
+    void start(uint32_t slot_us)
+    {
+        // no slots (no sensors or an empty schedule): nothing to start
+        if (num_of_slots == 0)
+            return;
+        slot_time_us = slot_us;
+        current_slot = 0;
+        add_repeating_timer_us(-(int64_t)slot_us, next_slot, this, &timer);
+    }
+
+    // the number of complete scans (all slots) per second
+    float scan_rate()
+    {
+        if (num_of_slots == 0)
+            return 0;
+        return 1000000.f / (slot_time_us * num_of_slots);
+    }
+
+    // read the latest distance to an object of a sensor in cm (0 cm means invalid measurement)
+    // this does not wait
+    float read(uint sensor)
+    {
+        measurement m;
+        if (!read_latest(sensor, &m))
             return 0;
+        return m.cm;
+    }
+
+    // the latest measurement of a sensor, returns false if there is none yet
+    bool read_latest(uint sensor, measurement *m)
+    {
+        if (sensor >= num_of_sensors)
+            return false;
+        sensor_data &s = sensors[sensor];
+        uint32_t count;
+        // try again if a new measurement came in while copying
+        do
+        {
+            count = s.count;
+            if (count == 0)
+                return false;
+            *m = s.ring[(count - 1) % RING_SIZE];
+        } while (count != s.count);
+        return true;
+    }
+
+    // the number of measurements of a sensor since the start
+    uint32_t measurements(uint sensor)
+    {
+        return sensors[sensor].count;
+    }
+
+private:
+    // check if a pio has a free state machine (without claiming it)
+    static bool has_free_sm(PIO pio)
+    {
+        for (uint sm = 0; sm < 4; sm++)
+            if (!pio_sm_is_claimed(pio, sm))
+                return true;
+        return false;
+    }
+
+    // the timer: start the sensors of the next slot
+    static bool next_slot(repeating_timer_t *rt)
+    {
+        HCSR04 *h = (HCSR04 *)rt->user_data;
+        uint32_t group = h->slots[h->current_slot];
+        // set the irq flags of the state machines, per pio at once
+        uint32_t flags[NUM_PIOS] = {0};
+        PIO pios[NUM_PIOS];
+        for (uint s = 0; s < h->num_of_sensors; s++)
+            if (group & (1u << s))
+            {
+                uint p = pio_get_index(h->sensors[s].pio);
+                flags[p] |= 1u << h->sensors[s].sm;
+                pios[p] = h->sensors[s].pio;
+            }
+        for (uint p = 0; p < NUM_PIOS; p++)
+            if (flags[p])
+                pios[p]->irq_force = flags[p];
+        h->current_slot = (h->current_slot + 1) % h->num_of_slots;
+        // keep repeating
+        return true;
+    }
+
+    // the interrupt handler (called by the pio resources for the sm of a sensor): the sensor has
+    // pushed a measurement
+    static void rx_fifo_handler(PIO pio, uint sm, void *user_data)
+    {
+        uint64_t now = time_us_64();
+        sensor_data &s = *(sensor_data *)user_data;
+        HCSR04 *h = s.owner;
+        while (!pio_sm_is_rx_fifo_empty(pio, sm))
+        {
+            uint32_t x = pio_sm_get(pio, sm);
+            measurement &m = s.ring[s.count % RING_SIZE];
+            // a timeout gives x = 0xFFFFFFFF (an echo that is too long) or the maximum - 1 (no echo)
+            // otherwise: every test for the end of the echo puls takes 2 pio clock ticks,
+            // but changes the 'timer' by only one
+            if (x >= h->max_loops - 1)
+                m.cm = 0;
+            else
+                m.cm = (float)(2 * (h->max_loops - x)) * h->cm_per_cycle;
+            m.timestamp_us = now;
+            s.count++;
         }
-        // read one data item from the FIFO
-        // Note: every test for the end of the echo puls takes 2 pio clock ticks,
-        //       but changes the 'timer' by only one
-        clock_cycles = 2 * pio_sm_get(pio, sm);
-        // using
-        // - the time for 1 pio clock tick (1/125000000 s)
-        // - speed of sound in air is about 340 m/s
-        // - the sound travels from the HCSR04 to the object and back (twice the distance)
-        // we can calculate the distance in cm by multiplying with 0.000136
-        float cm = (float)clock_cycles * 0.000136;
-        return (cm);
     }
 
+    // the data of a sensor
+    struct sensor_data
+    {
+        PIO pio;
+        uint sm;
+        HCSR04 *owner;
+        // the measurements and the number of measurements since the start
+        measurement ring[RING_SIZE];
+        volatile uint32_t count;
+    };
+
 private:
-    // the pio instance
-    PIO pio;
-    // the state machine
-    uint sm;
+    // the distance in cm per clock cycle of the state machines for a system clock
+    // Note: below 125 MHz the clkdiv is 1, the state machines are slower than HCSR04_SM_HZ
+    static void set_clock(uint32_t clock_hz, void *user_data)
+    {
+        HCSR04 *h = (HCSR04 *)user_data;
+        h->cm_per_cycle = 17000.f * pio_timing_clkdiv(HCSR04_SM_HZ) / clock_hz;
+    }
+
+    sensor_data sensors[MAX_SENSORS];
+    uint num_of_sensors = 0;
+    // the schedule
+    uint32_t slots[MAX_SENSORS];
+    uint num_of_slots = 0;
+    volatile uint current_slot = 0;
+    uint32_t slot_time_us = 0;
+    repeating_timer_t timer;
+    // the conversion to cm and the timeout
+    float cm_per_cycle;
+    uint32_t max_loops;
+    // the program linked to the shared pio subroutines, for each pio
+    static pio_subroutines_linked linked[NUM_PIOS];
 };
 
+pio_subroutines_linked HCSR04::linked[NUM_PIOS];
+
 int main()
 {
     // needed for printf
     stdio_init_all();
-    // the instance of the HCSR04 (Echo pin = 14, Trig pin = 15)
-    HCSR04 my_HCSR04(14, 15);
+    // the sensors
+    HCSR04 my_HCSR04;
+    // the first sensor (Echo pin = 14, Trig pin = 15)
+    my_HCSR04.add_sensor(14, 15);
+    // the second sensor (Echo pin = 16, Trig pin = 17)
+    my_HCSR04.add_sensor(16, 17);
+    // the default schedule is staggered: each sensor has its own slot
+    // for sensors that face apart they can be started at the same time:
+    //     uint32_t simultaneous[] = {0b11};
+    //     my_HCSR04.set_schedule(simultaneous, 1);
+    // a slot every 30 ms
+    my_HCSR04.start(30000);
+    printf("scan rate = %f Hz\n", my_HCSR04.scan_rate());
     // infinite loop to print distance measurements
     while (true)
     {
-        // read the distance sensor and print the result
-        float cm = my_HCSR04.read();
-        printf("cm = %f\n", cm);
+        // read the distance sensors and print the results, this doesn't wait
+        measurement m0, m1;
+        if (my_HCSR04.read_latest(0, &m0) && my_HCSR04.read_latest(1, &m1))
+            printf("cm = %f (at %d ms) \tcm = %f (at %d ms)\n", m0.cm, (uint32_t)(m0.timestamp_us / 1000), m1.cm, (uint32_t)(m1.timestamp_us / 1000));
         sleep_ms(100);
     }
-}
\ No newline at end of file
+}
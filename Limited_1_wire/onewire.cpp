@@ -1,8 +1,14 @@
 /*
 
-This code uses pio code to read a single DS18B20 temperature sensor.
-It is not suited to read more than one sensor: it does not use the parts
-of the 1-wire protocol that allowes more than one sensor.
+This code uses pio code to read DS18B20 temperature sensors.
+With one sensor on the bus it can be read with Skip ROM (0xCC), see read_temperature().
+With more sensors on the bus their ROMs (unique IDs) are found with the Search ROM 
+algorithm (see search_rom()) and each sensor is addressed with Match ROM (0x55). 
+All sensors are asked to convert the temperature at the same time (see convert_all()),
+after which they are read one by one, so all sensors are read in one conversion time.
+The conversion time depends on the resolution (see set_resolution()): sensors with their
+own power supply signal the end of the conversion, for parasite powered sensors the
+conversion time for the resolution is waited.
 
 */
 
@@ -10,12 +16,32 @@ of the 1-wire protocol that allowes more than one sensor.
 
 #include "pico/stdlib.h"
 #include "hardware/pio.h"
+#include "hardware/irq.h"
+#include "hardware/dma.h"
+#include "pio_resources.h"
+#include "pio_timing.h"
+// the trace level (see ../trace_ring): TRACE_LEVEL_OFF removes the trace of the errors
+#define TRACE_LEVEL TRACE_LEVEL_WARNING
+#include "trace_ring.h"
+#include "core1_service.h"
 
 #include "onewire.pio.h"
 
 // the pin to which the sensor is connected.
 // Note that an external pullup resistor of 4.7k is needed on this pin
 #define OW_PIN 15
+// the maximum number of sensors on the bus
+#define MAX_DEVICES 20
+// the family code (first byte of the ROM) of the DS18B20
+#define DS18B20_FAMILY 0x28
+// read the sensors on core 1 (see ../core1_service), core 0 only prints the latest results
+// in a loop with a fixed period
+// #define ON_CORE1
+
+// the state of an asynchronous temperature reading (see start_conversion)
+#define ONEWIRE_BUSY 0
+#define ONEWIRE_READY 1
+#define ONEWIRE_ERROR -1
 
 // ---------------------------------------------------------------------------------
 // The 1-Wire CRC scheme is described in Maxim Application Note 27:
@@ -32,22 +58,56 @@ static const uint8_t dscrc2x16_table[] = {
     0x00, 0x9D, 0x23, 0xBE, 0x46, 0xDB, 0x65, 0xF8,
     0x8C, 0x11, 0xAF, 0x32, 0xCA, 0x57, 0xE9, 0x74};
 // ---------------------------------------------------------------------------------
+// The full 256 entry table (made from the tiny table in the constructor of OneWire):
+// one lookup per byte instead of two
+static uint8_t dscrc_table[256];
+
+// the trace events (errors), the value is the calculated crc << 8 | the received crc
+#define ONEWIRE_TRACE_ROM_CRC TRACE_ID(TRACE_DRIVER_ONEWIRE, 0)
+#define ONEWIRE_TRACE_DATA_CRC TRACE_ID(TRACE_DRIVER_ONEWIRE, 1)
+// the value is the number of ROMs found before the failure
+#define ONEWIRE_TRACE_SEARCH_FAILED TRACE_ID(TRACE_DRIVER_ONEWIRE, 2)
+// the crc of an asynchronous reading (in the interrupt)
+#define ONEWIRE_TRACE_ASYNC_CRC TRACE_ID(TRACE_DRIVER_ONEWIRE, 3)
+const char *const onewire_trace_names[] = {"rom_crc", "data_crc", "search_failed", "async_crc"};
+
+// the conversion time (ms) for a resolution of 9, 10, 11 and 12 bits
+static const uint conversion_time_ms[4] = {94, 188, 375, 750};
 
 class OneWire
 {
 public:
     OneWire(uint onewire_pin)
     {
-        pio = pio0;
-        // state machine 0
-        sm = 0;
+        TRACE_SET_NAMES(TRACE_DRIVER_ONEWIRE, "OneWire", onewire_trace_names);
+        // claim a state machine (in any pio) and load the pio programs into the pio memory
+        // Note: the programs are shared with other OneWire buses on the same pio
+        if (!pio_resources_claim_sm(&onewire_wait_program, &pio, &sm, &offset_wait))
+        {
+            printf("OneWire: no free state machine\n");
+            return;
+        }
+        int o_reset = pio_resources_add_program(pio, &onewire_reset_program);
+        int o_write_byte = pio_resources_add_program(pio, &onewire_write_byte_program);
+        int o_read_byte = pio_resources_add_program(pio, &onewire_read_byte_program);
+        if (o_reset < 0 || o_write_byte < 0 || o_read_byte < 0)
+        {
+            printf("OneWire: no room for the programs in the pio memory\n");
+            // release what was loaded: the bus can't be used
+            if (o_reset >= 0)
+                pio_resources_remove_program(pio, &onewire_reset_program);
+            if (o_write_byte >= 0)
+                pio_resources_remove_program(pio, &onewire_write_byte_program);
+            if (o_read_byte >= 0)
+                pio_resources_remove_program(pio, &onewire_read_byte_program);
+            pio_resources_release_sm(pio, sm, &onewire_wait_program);
+            return;
+        }
+        offset_reset = o_reset;
+        offset_write_byte = o_write_byte;
+        offset_read_byte = o_read_byte;
         // configure the used pins
-        pio_gpio_init(pio, OW_PIN);
-        // load the pio programs into the pio memory
-        offset_wait = pio_add_program(pio, &onewire_wait_program);
-        offset_reset = pio_add_program(pio, &onewire_reset_program);
-        offset_write_byte = pio_add_program(pio, &onewire_write_byte_program);
-        offset_read_byte = pio_add_program(pio, &onewire_read_byte_program);
+        pio_gpio_init(pio, onewire_pin);
 
         // make a sm config
         pio_sm_config c = pio_get_default_sm_config();
@@ -61,19 +121,36 @@ public:
         // set the in pin
         sm_config_set_in_pins(&c, OW_PIN);
         // set shift to right: bits shifted by 'in' are ordered as least
-        // significant bit (LSB) first, no autopush/pull
-        sm_config_set_in_shift(&c, true, false, 0);
+        // significant bit (LSB) first, autopush at 32 bits (4 bytes per word when reading
+        // bytes, the other programs push themselves), no autopull
+        sm_config_set_in_shift(&c, true, true, 32);
         sm_config_set_out_shift(&c, true, false, 0);
-        // one clock cycle is 10 us
-        sm_config_set_clkdiv(&c, 1250);
         // init the pio sm with the config, start with the wait program
         pio_sm_init(pio, sm, offset_wait, &c);
+        // one clock cycle is 10 us (100 kHz), at any system clock (see ../pio_timing)
+        pio_timing_register_sm(pio, sm, 100000);
         // enable the sm
         pio_sm_set_enabled(pio, sm, true);
+        // the dma channel that reads the words of read_bytes() from the RxFIFO
+        dma_chan = dma_claim_unused_channel(true);
+        dma_config = dma_channel_get_default_config(dma_chan);
+        channel_config_set_transfer_data_size(&dma_config, DMA_SIZE_32);
+        channel_config_set_read_increment(&dma_config, false);
+        channel_config_set_write_increment(&dma_config, true);
+        channel_config_set_dreq(&dma_config, pio_get_dreq(pio, sm, false));
+        // the crc table
+        for (uint i = 0; i < 256; i++)
+            dscrc_table[i] = dscrc2x16_table[i & 0x0f] ^ dscrc2x16_table[16 + (i >> 4)];
+        // the interrupt for the asynchronous reading (its source is only enabled during a reading)
+        pio_resources_set_irq_handler(pio, sm, rx_fifo_handler, this);
+        ok = true;
     }
 
     int reset()
     {
+        // no state machine or programs (see the constructor)
+        if (!ok)
+            return -1;
         // start the reset program and check if a sensor (worker) responds
         pio_sm_exec(pio, sm, offset_reset);
         // read the return value: 0 means there are at least one workers
@@ -89,6 +166,8 @@ public:
         // this method checks if there are workers (i.e. DS18B20 sensors)
         // and then - assuming only one is present - checks if it can read
         // this sensor properly by asking for its unique ID and doing a CRC.
+        if (!ok)
+            return -1;
 
         // start the reset program
         pio_sm_exec(pio, sm, offset_reset);
@@ -99,18 +178,14 @@ public:
             return -1;
         else
         {
-            // for stability reasons give it some time
-            sleep_ms(10);
             // send the command to get the address of the worker
             send_byte(0x33);
-            // for stability reasons give it some time
-            sleep_ms(10);
             // read the results
             read_bytes(8);
             // the eighth byte is the crc
             if (crc8(results, 7) != results[7])
             {
-                printf("crc of ROM is wrong!!!!!!!!!!!\n");
+                TRACE_ERROR(ONEWIRE_TRACE_ROM_CRC, crc8(results, 7) << 8 | results[7]);
                 return -1;
             }
             return 1;
@@ -119,25 +194,53 @@ public:
 
     void send_byte(uint32_t to_send)
     {
+        // start the sm program that writes a byte, it waits at its 'pull' for the byte.
+        // Jump first, then put: the sm may still be stalled at the 'pull' of an earlier write,
+        // which would take a word that is put before the jump
+        pio_sm_exec(pio, sm, offset_write_byte);
         // put the byte in the TxFIFO
         pio_sm_put(pio, sm, to_send);
-        // start the sm program that writes a byte 
-        pio_sm_exec(pio, sm, offset_write_byte);
+        // wait until the sm signals that the byte has been written, so that
+        // no sleep is needed before the next byte is sent or read
+        pio_sm_get_blocking(pio, sm);
     }
 
     uint32_t read_byte()
     {
-        // start the sm program that reads a byte
+        // start the sm program that reads the 8 bits of one byte (jump first, see send_byte)
         pio_sm_exec(pio, sm, offset_read_byte);
-        // wait for the result
+        pio_sm_put(pio, sm, 7);
+        // wait for the result: one word with the byte in its upper bits
         return pio_sm_get_blocking(pio, sm) >> 24;
     }
 
-    void read_bytes(int n)
+    void read_bytes(uint n)
     {
-        // read n bytes from the sensor
-        for (int i = 0; i < n; i++)
-            results[i] = (uint8_t)read_byte() & 0xFF;
+        if (n > sizeof(results))
+            n = sizeof(results);
+        // the sm packs 4 bytes per word (autopush): the dma takes all n / 4 + 1 words from
+        // the RxFIFO in one go
+        uint32_t words[sizeof(results) / 4 + 1];
+        dma_channel_configure(dma_chan, &dma_config, words, &pio->rxf[sm], n / 4 + 1, true);
+        // read n bytes from the sensor (the sm reads all bits one after the other)
+        pio_sm_exec(pio, sm, offset_read_byte);
+        pio_sm_put(pio, sm, 8 * n - 1);
+        dma_channel_wait_for_finish_blocking(dma_chan);
+        uint done = 0;
+        for (uint w = 0; w < n / 4 + 1; w++)
+            done += unpack_word(words[w], results + done, n - done);
+    }
+
+    // the bytes in a word pushed by the read program: 4 bytes (the first in the lowest bits), or
+    // in the last word the remaining bytes in the upper bits
+    // returns the number of bytes taken from the word
+    static uint unpack_word(uint32_t word, uint8_t *bytes, uint remaining)
+    {
+        uint n = (remaining < 4) ? remaining : 4;
+        uint shift = 32 - 8 * n;
+        for (uint i = 0; i < n; i++)
+            bytes[i] = (uint8_t)(word >> (shift + 8 * i));
+        return n;
     }
 
     float read_temperature()
@@ -146,77 +249,495 @@ public:
         int workers = reset();
         if (workers < 0)
             return -1;
-        // for stability reasons give it some time
-        sleep_ms(10);
         // address the family (not one specific sensor)
         send_byte(0xCC);
-        // for stability reasons give it some time
-        sleep_ms(5);
         // ask for a temperature conversion
         send_byte(0x44);
-        // a temperature conversion at 12 bit resolution takes 750ms
-        sleep_ms(800);
+        // wait for the temperature conversion
+        wait_for_conversion();
         // put the sensor in a known state
         workers = reset();
         if (workers < 0)
             return -1;
-        // for stability reasons give it some time
-        sleep_ms(10);
         // address the family (not one specific sensor)
         send_byte(0xCC);
-        // for stability reasons give it some time
-        sleep_ms(5);
         // ask for the results
         send_byte(0xBE);
-        // for stability reasons give it some time
-        sleep_ms(10);
         // read the results
         read_bytes(9);
         // the ninth byte is the crc
         if (crc8(results, 8) != results[8])
         {
-            printf("crc of data is wrong!!!!!!!!!!!\n");
+            TRACE_ERROR(ONEWIRE_TRACE_DATA_CRC, crc8(results, 8) << 8 | results[8]);
+            return -1;
+        }
+        return convert_results();
+    }
+
+    // find the ROMs (unique IDs) of all workers on the bus with the Search ROM algorithm
+    // (see Maxim application note 187), returns the number of ROMs found
+    // roms: place for max_devices ROMs of 8 bytes
+    int search_rom(uint8_t roms[][8], int max_devices)
+    {
+        if (!ok)
+            return 0;
+        // there is no room for the triplet program next to the other programs:
+        // let the sm wait and replace the read byte program by the triplet program
+        pio_sm_exec(pio, sm, offset_wait);
+        pio_resources_remove_program(pio, &onewire_read_byte_program);
+        int offset_triplet = pio_resources_add_program(pio, &onewire_triplet_program);
+        if (offset_triplet < 0)
+        {
+            // e.g. the cache is full: put the read byte program back (it had room)
+            printf("OneWire: no room for the search program in the pio memory\n");
+            restore_read_byte();
+            return 0;
+        }
+
+        uint8_t rom[8] = {0};
+        // the bit (1 to 64) at which the last search took the 0 direction while both were present
+        int last_discrepancy = 0;
+        int devices = 0;
+        do
+        {
+            if (reset() < 0)
+                break;
+            send_byte(0xF0);
+            int discrepancy = 0;
+            bool error = false;
+            for (int bit = 1; bit <= 64; bit++)
+            {
+                uint8_t mask = 1 << ((bit - 1) % 8);
+                uint8_t *rom_byte = &rom[(bit - 1) / 8];
+                // read the bit and its complement from all workers
+                pio_sm_exec(pio, sm, offset_triplet);
+                uint32_t bits = pio_sm_get_blocking(pio, sm) >> 30;
+                uint id_bit = bits & 1;
+                uint cmp_id_bit = bits >> 1;
+                uint direction;
+                if (id_bit && cmp_id_bit)
+                {
+                    // no workers responded
+                    error = true;
+                    direction = 1;
+                }
+                else if (id_bit != cmp_id_bit)
+                    // all workers have the same bit
+                    direction = id_bit;
+                else
+                {
+                    // workers with a 0 and with a 1: a discrepancy
+                    // below the last discrepancy take the same direction as the previous ROM,
+                    // at the last discrepancy take 1 (the 0 was taken last time),
+                    // above it take 0 first
+                    if (bit < last_discrepancy)
+                        direction = (*rom_byte & mask) ? 1 : 0;
+                    else
+                        direction = (bit == last_discrepancy) ? 1 : 0;
+                    if (direction == 0)
+                        discrepancy = bit;
+                }
+                if (direction)
+                    *rom_byte |= mask;
+                else
+                    *rom_byte &= ~mask;
+                // write the direction: only the workers with that bit stay in the search
+                pio_sm_put(pio, sm, direction);
+                wait_for_pc(offset_triplet + onewire_triplet_offset_triplet_stop);
+                if (error)
+                    break;
+            }
+            if (error || crc8(rom, 7) != rom[7])
+            {
+                TRACE_ERROR(ONEWIRE_TRACE_SEARCH_FAILED, devices);
+                break;
+            }
+            for (int i = 0; i < 8; i++)
+                roms[devices][i] = rom[i];
+            devices++;
+            last_discrepancy = discrepancy;
+        } while (last_discrepancy != 0 && devices < max_devices);
+
+        // restore the read byte program
+        pio_sm_exec(pio, sm, offset_wait);
+        pio_resources_remove_program(pio, &onewire_triplet_program);
+        restore_read_byte();
+        return devices;
+    }
+
+    // load the read byte program again after the search, without it the bus can't be used
+    void restore_read_byte()
+    {
+        int offset = pio_resources_add_program(pio, &onewire_read_byte_program);
+        if (offset < 0)
+        {
+            printf("OneWire: the read byte program can't be loaded again\n");
+            ok = false;
+        }
+        else
+            offset_read_byte = offset;
+    }
+
+    // address one worker with Match ROM
+    void match_rom(const uint8_t *rom)
+    {
+        send_byte(0x55);
+        for (int i = 0; i < 8; i++)
+            send_byte(rom[i]);
+    }
+
+    // ask all sensors at once for a temperature conversion
+    int convert_all()
+    {
+        // put the sensors in a known state
+        if (reset() < 0)
+            return -1;
+        // address all sensors
+        send_byte(0xCC);
+        // ask for a temperature conversion
+        send_byte(0x44);
+        // wait for the temperature conversion
+        wait_for_conversion();
+        return 1;
+    }
+
+    // read the temperature of one sensor (after convert_all)
+    float read_temperature(const uint8_t *rom)
+    {
+        // put the sensor in a known state
+        if (reset() < 0)
+            return -1;
+        // address the sensor
+        match_rom(rom);
+        // ask for the results
+        send_byte(0xBE);
+        // read the results
+        read_bytes(9);
+        // the ninth byte is the crc
+        if (crc8(results, 8) != results[8])
+        {
+            TRACE_ERROR(ONEWIRE_TRACE_DATA_CRC, crc8(results, 8) << 8 | results[8]);
             return -1;
         }
-        // convert the temperature results to a float
-        // the bits in results[0] indicate temperature as follows:
-        // bit 7 to 0: 2^3, 2^2, 2^1, 2^0, 2^-1, 2^-2, 2^-3, 2^-4
-        uint8_t Tlow = results[0];
-        float T = 0;
-        for (int bit = 0; bit < 8; bit++)
-            if ((Tlow & 1 << bit) > 0)
-                T += 1 << bit;
-        // above counting started as if 2^-4 is 1, so correct by dividing by 16
-        T /= 16.;
-        // the bits in results[1] indicate temperature as follows:
-        // bit 7 to 0: S, S, S, S, S, 2^6, 2^5, 2^4; where S = sign
-        // note that negative numbers start at -128
-        uint8_t Thigh = results[1];
-        for (int bit = 0; bit < 3; bit++)
-            if ((Thigh & 1 << bit) > 0)
-                T += 1 << (bit + 4);
-        // check the sign using bit 3
-        if ((Thigh & 1 << 3) > 0)
-            T = -128.+T;
-        return T;
+        return convert_results();
     }
 
     // ---------------------------------------------------------------------------------
-    // Copied (and adapted) from https://github.com/PaulStoffregen/OneWire/blob/master/OneWire.cpp
+    // Non-blocking (asynchronous) temperature reading
+    //
+    // A temperature reading is a list of steps (reset, write bytes, wait, read bytes).
+    // The steps are done by the sm, the interrupt of the RxFIFO (the sm pushes a word 
+    // at the end of each reset and written byte, and for every 4 read bytes) and an alarm
+    // (for the conversion time) start the next step. The bytes to write are put in the TxFIFO
+    // as a batch (topped up when a byte has been written), the bytes to read are all
+    // read by one start of the read program.
+    // Usage: start_conversion(), then poll() until it is not ONEWIRE_BUSY, then result()
+
+    // start a temperature conversion and read the result when it is done
+    // rom: the sensor to read, or NULL to use Skip ROM (only one sensor on the bus)
+    // returns false if a reading is already in progress (or the bus can't be used)
+    bool start_conversion(const uint8_t *rom = NULL)
+    {
+        if (!ok || async_state == ONEWIRE_BUSY)
+            return false;
+        // make the steps: the conversion
+        num_of_steps = 0;
+        num_of_to_write = 0;
+        add_step(STEP_RESET, 0);
+        add_address(rom);
+        to_write[num_of_to_write++] = 0x44;
+        add_step(STEP_WRITE, num_of_to_write);
+        // wait for the temperature conversion: poll if the sensors are not parasite powered
+        if (parasite_power)
+            add_step(STEP_WAIT, conversion_time_ms[resolution - 9]);
+        else
+            add_step(STEP_READY, 0);
+        // and reading the scratchpad
+        add_step(STEP_RESET, 0);
+        uint first = num_of_to_write;
+        add_address(rom);
+        to_write[num_of_to_write++] = 0xBE;
+        add_step(STEP_WRITE, num_of_to_write - first);
+        add_step(STEP_READ, 9);
+        // start with the first step
+        async_state = ONEWIRE_BUSY;
+        current_step = 0;
+        write_index = 0;
+        pio_set_irq0_source_enabled(pio, (pio_interrupt_source)(pis_sm0_rx_fifo_not_empty + sm), true);
+        start_step();
+        return true;
+    }
+
+    // the state of the reading: ONEWIRE_BUSY, ONEWIRE_READY or ONEWIRE_ERROR
+    int poll()
+    {
+        return async_state;
+    }
+
+    // the temperature of the last reading (if poll() returned ONEWIRE_READY)
+    float result()
+    {
+        return convert_results();
+    }
+
+    // the temperature of the results read from a sensor in 1/16 degrees (fixed point)
+    // results[0] and results[1] are the temperature as a 16 bit signed number with 4 fractional bits
+    int16_t convert_results_fixed()
+    {
+        int16_t T = (int16_t)(results[1] << 8 | results[0]);
+        // at a lower resolution the lowest bits are undefined
+        return T & ~((1 << (12 - resolution)) - 1);
+    }
+
+    // convert the results read from a sensor to a temperature
+    float convert_results()
+    {
+        return convert_results_fixed() / 16.f;
+    }
+
+    // the resolution (9 to 12 bits) of all sensors, or of one sensor (rom)
+    // it is written to the scratchpad (not to the EEPROM of the sensor)
+    // a lower resolution has a shorter conversion time: 94 ms at 9 bits, 750 ms at 12 bits
+    int set_resolution(uint bits, const uint8_t *rom = NULL)
+    {
+        if (bits < 9 || bits > 12)
+            return -1;
+        if (reset() < 0)
+            return -1;
+        if (rom == NULL)
+            send_byte(0xCC);
+        else
+            match_rom(rom);
+        // write scratchpad: TH, TL (the alarm values, not used) and the configuration
+        send_byte(0x4E);
+        send_byte(0x7F);
+        send_byte(0x80);
+        send_byte((bits - 9) << 5 | 0x1F);
+        resolution = bits;
+        return 1;
+    }
+
+    // check if one of the sensors is parasite powered (Read Power Supply)
+    // a parasite powered sensor pulls the first read slot low
+    bool check_parasite_power()
+    {
+        if (reset() < 0)
+            return false;
+        send_byte(0xCC);
+        send_byte(0xB4);
+        parasite_power = (read_byte() & 1) == 0;
+        return parasite_power;
+    }
+
+    // wait until a temperature conversion is done
+    // sensors with their own power supply answer read slots with 0 until the conversion
+    // is done, parasite powered sensors can't (the bus must stay high) -> wait the conversion time
+    void wait_for_conversion()
+    {
+        if (parasite_power)
+        {
+            sleep_ms(conversion_time_ms[resolution - 9]);
+            return;
+        }
+        absolute_time_t timeout = make_timeout_time_ms(conversion_time_ms[resolution - 9] + 50);
+        while (read_byte() == 0 && !time_reached(timeout))
+            ;
+    }
+
+    // ---------------------------------------------------------------------------------
+    // Copied (and adapted to the 256 entry table) from https://github.com/PaulStoffregen/OneWire/blob/master/OneWire.cpp
     uint8_t crc8(const uint8_t *addr, uint8_t len)
     {
         uint8_t crc = 0;
         while (len--)
-        {
-            crc = *addr++ ^ crc; // just re-using crc as intermediate
-            crc = dscrc2x16_table[(crc & 0x0f)] ^
-                  dscrc2x16_table[16 + ((crc >> 4) & 0x0f)];
-        }
+            crc = dscrc_table[*addr++ ^ crc];
         return crc;
     }
     // ---------------------------------------------------------------------------------
 
 private:
+    // the steps of an asynchronous temperature reading
+    enum step_type
+    {
+        STEP_RESET,
+        STEP_WRITE,
+        STEP_WAIT,
+        // read slots until the sensor signals that its conversion is done
+        STEP_READY,
+        STEP_READ
+    };
+    struct step
+    {
+        step_type type;
+        // WRITE, READ: the number of bytes, WAIT: the time in ms
+        uint value;
+    };
+    step steps[8];
+    uint num_of_steps = 0;
+    uint current_step = 0;
+    // the bytes to write in all WRITE steps
+    uint8_t to_write[20];
+    uint num_of_to_write = 0;
+    // the next byte to put in the TxFIFO (up to write_last for the current step),
+    // and the number of bytes written or read in the current step
+    uint write_index = 0;
+    uint write_last = 0;
+    uint done = 0;
+    volatile int async_state = ONEWIRE_READY;
+    // the resolution of the sensors (see set_resolution)
+    uint resolution = 12;
+    // true if one of the sensors is parasite powered (see check_parasite_power)
+    bool parasite_power = true;
+
+    void add_step(step_type type, uint value)
+    {
+        steps[num_of_steps].type = type;
+        steps[num_of_steps].value = value;
+        num_of_steps++;
+    }
+
+    // the bytes to address a sensor: Match ROM + the rom, or Skip ROM
+    void add_address(const uint8_t *rom)
+    {
+        if (rom == NULL)
+            to_write[num_of_to_write++] = 0xCC;
+        else
+        {
+            to_write[num_of_to_write++] = 0x55;
+            for (int i = 0; i < 8; i++)
+                to_write[num_of_to_write++] = rom[i];
+        }
+    }
+
+    // put bytes of the current WRITE step in the TxFIFO, as long as it is not full
+    void fill_tx_fifo()
+    {
+        while (write_index < write_last && !pio_sm_is_tx_fifo_full(pio, sm))
+            pio_sm_put(pio, sm, to_write[write_index++]);
+    }
+
+    // the end of all the steps
+    void finish(int state)
+    {
+        pio_set_irq0_source_enabled(pio, (pio_interrupt_source)(pis_sm0_rx_fifo_not_empty + sm), false);
+        // a correct crc means a correct reading
+        if (state == ONEWIRE_READY && crc8(results, 8) != results[8])
+        {
+            TRACE_ERROR(ONEWIRE_TRACE_ASYNC_CRC, crc8(results, 8) << 8 | results[8]);
+            state = ONEWIRE_ERROR;
+        }
+        async_state = state;
+    }
+
+    // start the current step
+    void start_step()
+    {
+        if (current_step == num_of_steps)
+        {
+            finish(ONEWIRE_READY);
+            return;
+        }
+        done = 0;
+        step &s = steps[current_step];
+        switch (s.type)
+        {
+        case STEP_RESET:
+            pio_sm_exec(pio, sm, offset_reset);
+            break;
+        case STEP_WRITE:
+            // the bytes as a batch: as many as fit in the TxFIFO, the rest follows in the interrupt
+            // (jump first, see send_byte)
+            write_last = write_index + s.value;
+            pio_sm_exec(pio, sm, offset_write_byte);
+            fill_tx_fifo();
+            break;
+        case STEP_WAIT:
+            add_alarm_in_ms(s.value, wait_done, this, true);
+            break;
+        case STEP_READY:
+            // one byte (jump first, see send_byte)
+            pio_sm_exec(pio, sm, offset_read_byte);
+            pio_sm_put(pio, sm, 7);
+            break;
+        case STEP_READ:
+            // all bits of all bytes: 4 bytes per word, and a last word with the rest
+            pio_sm_exec(pio, sm, offset_read_byte);
+            pio_sm_put(pio, sm, 8 * s.value - 1);
+            break;
+        }
+    }
+
+    // the alarm for a WAIT step
+    static int64_t wait_done(alarm_id_t id, void *user_data)
+    {
+        OneWire *ow = (OneWire *)user_data;
+        ow->current_step++;
+        ow->start_step();
+        // no repeat
+        return 0;
+    }
+
+    // the interrupt handler (called by the pio resources for the sm of the bus): the sm has pushed
+    // a word (end of a reset, a written byte or a read byte)
+    static void rx_fifo_handler(PIO pio, uint sm, void *user_data)
+    {
+        OneWire *ow = (OneWire *)user_data;
+        while (ow->async_state == ONEWIRE_BUSY && !pio_sm_is_rx_fifo_empty(ow->pio, ow->sm))
+        {
+            uint32_t word = pio_sm_get(ow->pio, ow->sm);
+            step &s = ow->steps[ow->current_step];
+            bool step_done = false;
+            switch (s.type)
+            {
+            case STEP_RESET:
+                // 0 means there is at least one worker
+                if (word != 0)
+                {
+                    ow->finish(ONEWIRE_ERROR);
+                    return;
+                }
+                step_done = true;
+                break;
+            case STEP_WRITE:
+                ow->done++;
+                // top up the TxFIFO
+                ow->fill_tx_fifo();
+                step_done = (ow->done == s.value);
+                break;
+            case STEP_READY:
+                // a byte of 0 (8 read slots): the conversion is still going on, read again
+                step_done = (word >> 24) != 0;
+                if (!step_done)
+                    ow->start_step();
+                break;
+            case STEP_READ:
+                {
+                    // 4 bytes, or the last word (with fewer or no bytes)
+                    uint n = unpack_word(word, ow->results + ow->done, s.value - ow->done);
+                    ow->done += n;
+                    step_done = (n < 4);
+                }
+                break;
+            default:
+                break;
+            }
+            if (step_done)
+            {
+                ow->current_step++;
+                ow->start_step();
+            }
+        }
+    }
+
+    // wait until the sm has reached the end (the program counter) of a program
+    void wait_for_pc(uint pc)
+    {
+        while (pio_sm_get_pc(pio, sm) != pc)
+            ;
+    }
+
+    // if the state machine is claimed and the programs are loaded
+    bool ok = false;
     // the pio instance
     PIO pio;
     // the state machine
@@ -228,21 +749,134 @@ private:
     uint offset_read_byte;
     // the result of reading the sensor
     uint8_t results[9];
+    // the dma channel of read_bytes()
+    int dma_chan;
+    dma_channel_config dma_config;
 };
 
+
+#ifdef ON_CORE1
+// the reading of the sensors on core 1: one sensor after the other, without blocking
+struct sensor_task
+{
+    OneWire *ow;
+    uint8_t roms[MAX_DEVICES][8];
+    int devices;
+    // the sensor that is being read (-1: none yet)
+    int current;
+    // the latest reading of each sensor: the state and the temperature in 1/16 degrees
+    core1_mailbox readings[MAX_DEVICES];
+};
+sensor_task sensors;
+
+// the task: check if the reading of the current sensor is done, then start the next sensor
+uint32_t read_sensors(void *user_data)
+{
+    sensor_task *t = (sensor_task *)user_data;
+    if (t->current >= 0)
+    {
+        int state = t->ow->poll();
+        // check again in 10 ms
+        if (state == ONEWIRE_BUSY)
+            return 10000;
+        uint32_t reading[2] = {(uint32_t)state, (uint32_t)(state == ONEWIRE_READY ? t->ow->convert_results_fixed() : 0)};
+        core1_mailbox_publish(&t->readings[t->current], reading, 2);
+    }
+    t->current = (t->current + 1) % t->devices;
+    t->ow->start_conversion(t->roms[t->current]);
+    return 10000;
+}
+
+// the setup on core 1: the interrupt of the OneWire is on core 1
+void setup_sensors(void *user_data)
+{
+    sensor_task *t = (sensor_task *)user_data;
+    static OneWire DS18B20(OW_PIN);
+    t->ow = &DS18B20;
+    t->devices = DS18B20.search_rom(t->roms, MAX_DEVICES);
+    DS18B20.check_parasite_power();
+    DS18B20.set_resolution(10);
+    t->current = -1;
+    if (t->devices > 0)
+        core1_service_add_task(read_sensors, t, 0);
+}
+
+int main()
+{
+    // needed for printf
+    stdio_init_all();
+    // make the OneWire and find the sensors on core 1
+    core1_service_start(setup_sensors, &sensors);
+    printf("%d sensors\n", sensors.devices);
+    // the loop of core 0 has a fixed period, it never waits for the sensors
+    absolute_time_t next = get_absolute_time();
+    uint32_t printed[MAX_DEVICES] = {0};
+    while (true)
+    {
+        for (int d = 0; d < sensors.devices; d++)
+        {
+            uint32_t reading[2];
+            uint32_t n = core1_mailbox_read(&sensors.readings[d], reading, 2);
+            // a new reading since the last loop
+            if (n != printed[d])
+            {
+                if ((int)reading[0] == ONEWIRE_READY)
+                    printf("Temperature %d = %f (reading %d)\n", d, (int16_t)reading[1] / 16.f, n);
+                else
+                    printf("Temperature %d: error (reading %d)\n", d, n);
+                printed[d] = n;
+            }
+        }
+        printf("core 1 was at most %d us late\n", core1_service_max_late_us(0));
+        // the errors (of both cores)
+        trace_drain(16);
+        next = delayed_by_ms(next, 500);
+        sleep_until(next);
+    }
+}
+#else
 int main()
 {
     // needed for printf
     stdio_init_all();
     // the instance of the OneWire
     OneWire DS18B20(OW_PIN);
-    // reset and determine if there are workers
-    int workers = DS18B20.reset_and_check();
+    // find the sensors on the bus
+    uint8_t roms[MAX_DEVICES][8];
+    int devices = DS18B20.search_rom(roms, MAX_DEVICES);
+    // with a power supply the end of the conversions can be polled
+    printf(DS18B20.check_parasite_power() ? "parasite powered\n" : "powered\n");
+    // 10 bits resolution (0.25 degrees): converts in 188 ms
+    DS18B20.set_resolution(10);
+    for (int d = 0; d < devices; d++)
+    {
+        printf("sensor %d: ", d);
+        for (int i = 7; i >= 0; i--)
+            printf("%02x", roms[d][i]);
+        printf(roms[d][0] == DS18B20_FAMILY ? "\n" : " (not a DS18B20)\n");
+    }
 
-    if (workers > 0)
+    if (devices > 0)
         while (true)
-            printf("Temperature = %f\n", DS18B20.read_temperature());
+        {
+            // the errors of the previous loop
+            trace_drain(16);
+            // one conversion for all sensors, then read them all
+            DS18B20.convert_all();
+            for (int d = 0; d < devices; d++)
+                printf("Temperature %d = %f\n", d, DS18B20.read_temperature(roms[d]));
+            // the same for the first sensor, but without blocking
+            DS18B20.start_conversion(roms[0]);
+            uint loops = 0;
+            while (DS18B20.poll() == ONEWIRE_BUSY)
+                // here the main loop can do other things
+                loops++;
+            if (DS18B20.poll() == ONEWIRE_READY)
+                printf("Temperature 0 = %f (async, %d loops while waiting)\n", DS18B20.result(), loops);
+        }
     else
+        // print the errors (e.g. of the search)
         while (true)
-            ;
-}
\ No newline at end of file
+            trace_drain(16);
+}
+#endif
@@ -2,14 +2,37 @@
 
 #include "pico/stdlib.h"
 #include "hardware/pio.h"
+#include "hardware/dma.h"
+#include "hardware/clocks.h"
 
 #include "PwmIn.pio.h"
+#include "pio_resources.h"
+#include "pio_timing.h"
+#ifdef BENCHMARK
+#include "hardware/pwm.h"
+#include "benchmark.h"
+#endif
 
 // class that sets up and reads PWM pulses: PwmIn. It has three functions:
 // read_period (in seconds)
 // read_pulsewidth (in seconds)
 // read_dutycycle (between 0 and 1)
 // read pulsewidth, period, and calculate the dutycycle
+//
+// The sm measures continuously and a dma channel writes every measurement (pulsewidth
+// and low period) into a ring buffer for this pin, so no measurements are lost and 
+// reading never waits for a new measurement. The functions above use the latest
+// measurement, there are also functions for the average of the latest measurements
+// and for all measurements since the last call.
+//
+// The conversion from clock cycles to time uses the system clock at the moment the
+// PwmIn is made (so it is also correct if the Pico is overclocked), and again when the clock
+// is changed with pio_timing_set_sys_clock_khz() (see ../pio_timing). Besides the float
+// functions there are integer functions (ns and ppm) that can be used in an interrupt.
+
+// the number of measurements in the ring buffer of a pin (a power of 2)
+#define RING_BITS 4
+#define RING_SIZE (1 << RING_BITS)
 
 class PwmIn
 {
@@ -18,14 +41,16 @@ public:
     // input = pin that receives the PWM pulses.
     PwmIn(uint input)
     {
-        // pio 0 is used
-        pio = pio0;
-        // state machine 0
-        sm = 0;
+        // a free state machine (in any pio): each pin has its own state machine
+        // the pio program is loaded into the pio memory once for each pio
+        uint offset;
+        if (!pio_resources_claim_sm(&PwmIn_program, &pio, &sm, &offset))
+        {
+            printf("PwmIn: no free state machine\n");
+            return;
+        }
         // configure the used pins
         pio_gpio_init(pio, input);
-        // load the pio program into the pio memory
-        uint offset = pio_add_program(pio, &PwmIn_program);
         // make a sm config
         pio_sm_config c = PwmIn_program_get_default_config(offset);
         // set the 'jmp' pin
@@ -36,6 +61,11 @@ public:
         sm_config_set_in_shift(&c, false, false, 0);
         // init the pio sm with the config
         pio_sm_init(pio, sm, offset, &c);
+        // the conversion from clock cycles to seconds and to ns, also when the clock changes
+        set_clock(clock_get_hz(clk_sys), this);
+        pio_timing_add_callback(set_clock, this);
+        // start the dma before the sm, so the measurements start at a pair in the ring buffer
+        configure_dma();
         // enable the sm
         pio_sm_set_enabled(pio, sm, true);
     }
@@ -44,16 +74,14 @@ public:
     float read_period(void)
     {
         read();
-        // one clock cycle is 1/125000000 seconds
-        return (period * 0.000000008);
+        return (period * seconds_per_cycle);
     }
 
     // read_pulsewidth (in seconds)
     float read_pulsewidth(void)
     {
         read();
-        // one clock cycle is 1/125000000 seconds
-        return (pulsewidth * 0.000000008);
+        return (pulsewidth * seconds_per_cycle);
     }
 
     // read_dutycycle (between 0 and 1)
@@ -67,45 +95,259 @@ public:
     void read_PWM(float *readings)
     {
         read();
-        *(readings + 0) = (float)pulsewidth * 0.000000008;
-        *(readings + 1) = (float)period * 0.000000008;
+        *(readings + 0) = (float)pulsewidth * seconds_per_cycle;
+        *(readings + 1) = (float)period * seconds_per_cycle;
         *(readings + 2) = ((float)pulsewidth / (float)period);
     }
 
+    // the integer versions (no float, so they can be used in an interrupt)
+    // read_period_ns (in ns)
+    uint32_t read_period_ns(void)
+    {
+        read();
+        return cycles_to_ns(period);
+    }
+
+    // read_pulsewidth_ns (in ns)
+    uint32_t read_pulsewidth_ns(void)
+    {
+        read();
+        return cycles_to_ns(pulsewidth);
+    }
+
+    // read_dutycycle_ppm (between 0 and 1000000)
+    uint32_t read_dutycycle_ppm(void)
+    {
+        read();
+        if (period == 0)
+            return 0;
+        return (uint32_t)((uint64_t)pulsewidth * 1000000 / period);
+    }
+
+    // convert clock cycles to ns
+    uint32_t cycles_to_ns(uint32_t cycles)
+    {
+        return (uint32_t)(((uint64_t)cycles * ns_per_cycle_q16) >> 16);
+    }
+
+    // the number of measurements done since the start
+    uint32_t measurements(void)
+    {
+        // the dma counts down from dma_count, two words per measurement
+        return (dma_count - dma_hw->ch[dma_chan].transfer_count) / 2;
+    }
+
+    // the latest measurement in clock cycles, returns false if there is none yet
+    bool read_latest(uint32_t *pw, uint32_t *p)
+    {
+        uint32_t n = measurements();
+        if (n == 0)
+            return false;
+        get(n - 1, pw, p);
+        return true;
+    }
+
+    // the average of the latest n measurements (at most RING_SIZE - 2) in clock cycles,
+    // returns the number of measurements that were averaged
+    uint read_average(uint n, uint32_t *pw, uint32_t *p)
+    {
+        uint32_t last = measurements();
+        if (n > last)
+            n = last;
+        if (n > RING_SIZE - 2)
+            n = RING_SIZE - 2;
+        uint64_t sum_pw = 0, sum_p = 0;
+        for (uint i = 0; i < n; i++)
+        {
+            uint32_t m_pw, m_p;
+            get(last - 1 - i, &m_pw, &m_p);
+            sum_pw += m_pw;
+            sum_p += m_p;
+        }
+        if (n > 0)
+        {
+            *pw = sum_pw / n;
+            *p = sum_p / n;
+        }
+        return n;
+    }
+
+    // all measurements since the last call (at most max) in clock cycles,
+    // returns the number of measurements
+    // Note: if more than RING_SIZE - 2 measurements were done since the last call, the
+    //       oldest are lost (they have been overwritten), 'lost' counts them
+    uint read_new(uint32_t *pw, uint32_t *p, uint max)
+    {
+        uint32_t last = measurements();
+        if (last - next_new > RING_SIZE - 2)
+        {
+            lost += last - next_new - (RING_SIZE - 2);
+            next_new = last - (RING_SIZE - 2);
+        }
+        uint n = 0;
+        while (next_new != last && n < max)
+        {
+            get(next_new++, &pw[n], &p[n]);
+            n++;
+        }
+        return n;
+    }
+
+    // the number of measurements that were lost by read_new
+    uint32_t lost = 0;
+
 private:
-    // read the period and pulsewidth
+    // the conversion from clock cycles to seconds and to ns (fixed point, 16 fractional bits)
+    // Note: the measurements in the ring buffer that were made before a change of the clock
+    //       are converted with the new clock
+    static void set_clock(uint32_t clock_hz, void *user_data)
+    {
+        PwmIn *p = (PwmIn *)user_data;
+        p->seconds_per_cycle = 1.f / clock_hz;
+        p->ns_per_cycle_q16 = (uint32_t)((1000000000ull << 16) / clock_hz);
+    }
+
+    // the latest measurement (no waiting, no clearing of the FIFO)
     void read(void)
     {
-        // clear the FIFO: do a new measurement
-        pio_sm_clear_fifos(pio, sm);
-        // wait for the FIFO to contain two data items: pulsewidth and period
-        while (pio_sm_get_rx_fifo_level(pio, sm) < 2)
-            ;
-        // read pulse width from the FIFO
-        pulsewidth = pio_sm_get(pio, sm);
-        // read period from the FIFO
-        period = pio_sm_get(pio, sm) + pulsewidth;
+        if (!read_latest(&pulsewidth, &period))
+            pulsewidth = period = 0;
+    }
+
+    // measurement number i from the ring buffer, in clock cycles
+    void get(uint32_t i, uint32_t *pw, uint32_t *p)
+    {
+        uint32_t *m = &ring[2 * (i % RING_SIZE)];
         // the measurements are taken with 2 clock cycles per timer tick
-        pulsewidth = 2 * pulsewidth;
-        // calculate the period in clock cycles:
-        period = 2 * period;
+        *pw = 2 * m[0];
+        // the period is the pulse width plus the low period
+        *p = 2 * (m[0] + m[1]);
+    }
+
+    // set up the dma: RxFIFO of the sm -> ring buffer
+    void configure_dma(void)
+    {
+        dma_chan = dma_claim_unused_channel(true);
+        dma_chan_ctrl = dma_claim_unused_channel(true);
+
+        dma_channel_config c = dma_channel_get_default_config(dma_chan);
+        channel_config_set_transfer_data_size(&c, DMA_SIZE_32);
+        channel_config_set_read_increment(&c, false);
+        channel_config_set_write_increment(&c, true);
+        // wrap the write address at the end of the ring buffer (2 words per measurement)
+        channel_config_set_ring(&c, true, RING_BITS + 3);
+        // the sm determines when there is data
+        channel_config_set_dreq(&c, pio_get_dreq(pio, sm, false));
+        // restart via the control channel when all words have been transferred
+        channel_config_set_chain_to(&c, dma_chan_ctrl);
+        dma_channel_configure(dma_chan, &c, ring, &pio->rxf[sm], dma_count, false);
+
+        // the control channel writes the transfer count (and triggers) the data channel
+        c = dma_channel_get_default_config(dma_chan_ctrl);
+        channel_config_set_transfer_data_size(&c, DMA_SIZE_32);
+        channel_config_set_read_increment(&c, false);
+        channel_config_set_write_increment(&c, false);
+        dma_channel_configure(dma_chan_ctrl, &c, &dma_hw->ch[dma_chan].al1_transfer_count_trig, &dma_count, 1, false);
+
+        dma_channel_start(dma_chan);
     }
+
     // the pio instance
     PIO pio;
     // the state machine
     uint sm;
+    // the dma channels
+    int dma_chan, dma_chan_ctrl;
+    // the number of words the dma channel transfers before it is restarted
+    // it is a multiple of the ring (2 * RING_SIZE words): the write address continues at the restart,
+    // so the count of measurements (modulo RING_SIZE) still matches the position in the ring
+    // Note: restarting resets the count of measurements: at 1 kHz after about 25 days
+    uint32_t dma_count = 0xFFFFFFFF - 2 * RING_SIZE + 1;
+    // the ring buffer with the measurements (pulse width, low period) in timer ticks
+    uint32_t ring[2 * RING_SIZE] __attribute__((aligned(8 * RING_SIZE)));
+    // the next measurement for read_new
+    uint32_t next_new = 0;
     // data about the PWM input measured in pio clock cycles
     uint32_t pulsewidth, period;
+    // the time of one clock cycle in seconds, and in ns with 16 fractional bits
+    float seconds_per_cycle;
+    uint32_t ns_per_cycle_q16;
 };
 
+#ifdef BENCHMARK
+/*
+The benchmark build (make benchmarks): the cost of reading the measurements
+
+There is no interrupt per pulse (the dma writes the measurements), so the cost is in the
+read functions. The pulses are made by the PWM hardware on the input pin itself (the sm
+still reads the pin), so nothing must be connected: 10 kHz with a duty cycle of 25%.
+*/
+#define BENCHMARK_PWM_HZ 10000
+#define BENCHMARK_PWM_DUTY_PERCENT 25
+
+// time a read function of the PwmIn
+#define BENCHMARK_READ(name, call)                           \
+    {                                                        \
+        benchmark_stats stats;                               \
+        benchmark_stats_init(&stats, name, "cycles");        \
+        for (uint i = 0; i < 100; i++)                       \
+        {                                                    \
+            uint32_t start = benchmark_start();              \
+            call;                                            \
+            benchmark_stats_add(&stats, benchmark_stop(start)); \
+        }                                                    \
+        benchmark_report(&stats);                            \
+    }
+
+void run_benchmarks(PwmIn &pwm_in, uint input)
+{
+    benchmark_init("PwmIn");
+    // the PWM hardware makes the pulses on the input pin
+    uint32_t wrap = clock_get_hz(clk_sys) / BENCHMARK_PWM_HZ;
+    uint slice = pwm_gpio_to_slice_num(input);
+    gpio_set_function(input, GPIO_FUNC_PWM);
+    pwm_set_wrap(slice, wrap - 1);
+    pwm_set_gpio_level(input, wrap * BENCHMARK_PWM_DUTY_PERCENT / 100);
+    pwm_set_enabled(slice, true);
+    // a full ring of measurements
+    sleep_ms(10);
+
+    float readings[3];
+    uint32_t pw[RING_SIZE], p[RING_SIZE];
+    volatile uint32_t result;
+    BENCHMARK_READ("read_PWM", pwm_in.read_PWM(readings));
+    BENCHMARK_READ("read_pulsewidth_ns", result = pwm_in.read_pulsewidth_ns());
+    BENCHMARK_READ("read_period_ns", result = pwm_in.read_period_ns());
+    BENCHMARK_READ("read_dutycycle_ppm", result = pwm_in.read_dutycycle_ppm());
+    BENCHMARK_READ("read_average_8", pwm_in.read_average(8, pw, p));
+    BENCHMARK_READ("read_new", pwm_in.read_new(pw, p, RING_SIZE));
+
+    // the measurement itself, compared with the PWM (in ns)
+    benchmark_report_value("pulsewidth_expected", "ns", 1e9f * BENCHMARK_PWM_DUTY_PERCENT / 100 / BENCHMARK_PWM_HZ);
+    benchmark_report_value("pulsewidth_measured", "ns", (float)pwm_in.read_pulsewidth_ns());
+    benchmark_report_value("period_expected", "ns", 1e9f / BENCHMARK_PWM_HZ);
+    benchmark_report_value("period_measured", "ns", (float)pwm_in.read_period_ns());
+    benchmark_report_value("lost", "count", (float)pwm_in.lost);
+    benchmark_done();
+}
+#endif
+
 int main()
 {
     // needed for printf
     stdio_init_all();
     // the instance of the PwmIn
     PwmIn my_PwmIn(14);
+#ifdef BENCHMARK
+    // the benchmark build (make benchmarks): measure the reads, then stop
+    run_benchmarks(my_PwmIn, 14);
+    while (true)
+        tight_loop_contents();
+#endif
     // the array with the results
     float pwm_reading[3];
+    // the measurements since the last loop
+    uint32_t pw[RING_SIZE], p[RING_SIZE];
     // infinite loop to print PWM measurements
     while (true)
     {
@@ -114,6 +356,18 @@ int main()
         {
             printf("pw=%.8f \tp=%.8f \tdc=%.8f\n", pwm_reading[0], pwm_reading[1], pwm_reading[2]);
         }
+        // the same without float
+        printf("pw=%d ns \tp=%d ns \tdc=%d ppm\n", my_PwmIn.read_pulsewidth_ns(), my_PwmIn.read_period_ns(), my_PwmIn.read_dutycycle_ppm());
+        // the average of the measurements since the last loop
+        uint n = my_PwmIn.read_new(pw, p, RING_SIZE);
+        uint64_t sum_pw = 0, sum_p = 0;
+        for (uint i = 0; i < n; i++)
+        {
+            sum_pw += pw[i];
+            sum_p += p[i];
+        }
+        if (n > 0)
+            printf("%d new measurements: average pw=%d \tp=%d clock cycles (%d lost)\n", n, (uint32_t)(sum_pw / n), (uint32_t)(sum_p / n), my_PwmIn.lost);
         sleep_ms(100);
     }
 }
@@ -5,16 +5,18 @@
 
 #include "PwmIn.h"
 
-#define NUM_OF_PINS 4
+// 8 RC servo channels and 2 fan tachometers: more than one pio block is used
+// (the RP2040 has 8 state machines: then only the 8 RC servo channels are read)
+#define NUM_OF_PINS (PWMIN_MAX_PINS < 10 ? PWMIN_MAX_PINS : 10)
 
 int main()
 {
     // needed for printf
     stdio_init_all();
-    printf("PwmIn on 4 pins\n");
+    printf("PwmIn on %d pins\n", NUM_OF_PINS);
 
     // set PwmIn
-    uint pin_list[NUM_OF_PINS] = {14, 15, 18, 19};
+    uint pin_list[10] = {6, 7, 8, 9, 10, 11, 12, 13, 14, 15};
     PwmIn my_PwmIn(pin_list, NUM_OF_PINS);
 
     while (true)
@@ -22,12 +24,10 @@ int main()
         // adviced empty (for now) function of sdk
         tight_loop_contents();
 
-        // translate pwm of input to output
-        float PW_0 = my_PwmIn.read_PW(0);
-        float PW_1 = my_PwmIn.read_PW(1);
-        float PW_2 = my_PwmIn.read_PW(2);
-        float PW_3 = my_PwmIn.read_PW(3);
-        printf("PW_0=%f PW_1=%f PW_2=%f PW_3=%f\n", PW_0, PW_1, PW_2, PW_3);
+        // print the pulse widths of all pins
+        for (uint pin = 0; pin < NUM_OF_PINS; pin++)
+            printf("PW_%d=%f ", pin, my_PwmIn.read_PW(pin));
+        printf("\n");
         sleep_ms(100);
     }
 }
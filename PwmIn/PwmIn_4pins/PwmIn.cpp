@@ -3,24 +3,44 @@
 #include "pico/stdlib.h"
 #include "hardware/pio.h"
 #include "hardware/irq.h"
+#include "hardware/clocks.h"
 
 #include "PwmIn.h"
 #include "PwmIn.pio.h"
+#include "pio_resources.h"
+#include "pio_timing.h"
 
-// class that reads PWM pulses from up to 4 pins
+void PwmIn::set_clock(uint32_t clock_hz, void *user_data)
+{
+    PwmIn *p = (PwmIn *)user_data;
+    // the measurements are taken with 2 clock cycles per timer tick
+    p->seconds_per_tick = 2.f / clock_hz;
+    p->ns_per_tick_q16 = (uint32_t)((2000000000ull << 16) / clock_hz);
+}
+
+// class that reads PWM pulses from up to PWMIN_MAX_PINS pins
 PwmIn::PwmIn(uint *pin_list, uint num_of_pins)
 {
-    _num_of_pins = num_of_pins;
-    // pio 0 is used
-    pio = pio0;
-    // load the pio program into the pio memory
-    uint offset = pio_add_program(pio, &PwmIn_program);
-    // start num_of_pins state machines
-    for (int i = 0; i < num_of_pins; i++)
+    _num_of_pins = 0;
+    // the conversion of the timer ticks, also when the clock changes
+    set_clock(clock_get_hz(clk_sys), this);
+    pio_timing_add_callback(set_clock, this);
+    // take a state machine for each pin
+    for (uint i = 0; i < num_of_pins && i < PWMIN_MAX_PINS; i++)
     {
-        // prepare state machine i
-        pulsewidth[i] = 0;
-        period[i] = 0;
+        // claim a state machine (pio0 first), the pio program is loaded once for each pio
+        PIO pio;
+        uint sm, offset;
+        if (!pio_resources_claim_sm(&PwmIn_program, &pio, &sm, &offset))
+        {
+            printf("PwmIn: no free state machine for pin %d\n", pin_list[i]);
+            break;
+        }
+        // prepare state machine sm
+        pwm_data[i].pulsewidth = 0;
+        pwm_data[i].period = 0;
+        // the IRQ handler of the sm, it gets the data of the pin (index in pin_list)
+        pio_resources_set_irq_handler(pio, sm, pio_irq_handler, &pwm_data[i]);
 
         // configure the used pins (pull down, controlled by PIO)
         gpio_pull_down(pin_list[i]);
@@ -34,16 +54,13 @@ PwmIn::PwmIn(uint *pin_list, uint num_of_pins)
         // set shift direction
         sm_config_set_in_shift(&c, false, false, 0);
         // init the pio sm with the config
-        pio_sm_init(pio, i, offset, &c);
+        pio_sm_init(pio, sm, offset, &c);
+        // allow irqs from this state machine
+        pio->inte0 |= PIO_IRQ0_INTE_SM0_BITS << sm;
         // enable the sm
-        pio_sm_set_enabled(pio, i, true);
+        pio_sm_set_enabled(pio, sm, true);
+        _num_of_pins++;
     }
-    // set the IRQ handler
-    irq_set_exclusive_handler(PIO0_IRQ_0, pio_irq_handler);
-    // enable the IRQ
-    irq_set_enabled(PIO0_IRQ_0, true);
-    // allow irqs from the low 4 state machines
-    pio0_hw->inte0 = PIO_IRQ0_INTE_SM0_BITS | PIO_IRQ0_INTE_SM1_BITS | PIO_IRQ0_INTE_SM2_BITS | PIO_IRQ0_INTE_SM3_BITS ;
 };
 
 // read the period and pulsewidth
@@ -51,40 +68,51 @@ void PwmIn::read_PWM(float *readings, uint pin)
 {
     if (pin < _num_of_pins)
     {
-
+        uint32_t pw = pwm_data[pin].pulsewidth;
         // determine whole period
-        period[pin] += pulsewidth[pin];
-        // the measurements are taken with 2 clock cycles per timer tick
-        // hence, it is 2*0.000000008
-        *(readings + 0) = (float)pulsewidth[pin] * 2 * 0.000000008;
-        *(readings + 1) = (float)period[pin] * 2 * 0.000000008;
-        *(readings + 2) = ((float)pulsewidth[pin] / (float)period[pin]);
-        pulsewidth[pin] = 0;
-        period[pin] = 0;
+        uint32_t p = pwm_data[pin].period + pw;
+        *(readings + 0) = (float)pw * seconds_per_tick;
+        *(readings + 1) = (float)p * seconds_per_tick;
+        *(readings + 2) = ((float)pw / (float)p);
+        pwm_data[pin].pulsewidth = 0;
+        pwm_data[pin].period = 0;
     }
 };
 
 // read only the duty cycle
 float PwmIn::read_DC(uint pin)
 {
-    return ((float)pulsewidth[pin] / (float)period[pin]);
+    return ((float)pwm_data[pin].pulsewidth / (float)(pwm_data[pin].period + pwm_data[pin].pulsewidth));
 }
 
 // read only the period
 float PwmIn::read_P(uint pin)
 {
-    // the measurements are taken with 2 clock cycles per timer tick
-    // hence, it is 2*0.000000008
-    return ((float)period[pin] * 0.000000016);
+    return ((float)(pwm_data[pin].period + pwm_data[pin].pulsewidth) * seconds_per_tick);
 }
 
 float PwmIn::read_PW(uint pin)
 {
-    // the measurements are taken with 2 clock cycles per timer tick
-    // hence, it is 2*0.000000008
-    return ((float)pulsewidth[pin] * 0.000000016);
+    return ((float)pwm_data[pin].pulsewidth * seconds_per_tick);
 };
 
-uint32_t PwmIn::pulsewidth[4];
-uint32_t PwmIn::period[4];
-PIO PwmIn::pio;
+// read only the pulsewidth in ns
+uint32_t PwmIn::read_PW_ns(uint pin)
+{
+    return (uint32_t)(((uint64_t)pwm_data[pin].pulsewidth * ns_per_tick_q16) >> 16);
+}
+
+// read only the period in ns
+uint32_t PwmIn::read_P_ns(uint pin)
+{
+    return (uint32_t)(((uint64_t)(pwm_data[pin].period + pwm_data[pin].pulsewidth) * ns_per_tick_q16) >> 16);
+}
+
+// read only the duty cycle in ppm
+uint32_t PwmIn::read_DC_ppm(uint pin)
+{
+    uint32_t p = pwm_data[pin].period + pwm_data[pin].pulsewidth;
+    if (p == 0)
+        return 0;
+    return (uint32_t)((uint64_t)pwm_data[pin].pulsewidth * 1000000 / p);
+}
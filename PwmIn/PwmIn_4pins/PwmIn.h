@@ -7,8 +7,14 @@
 #include "hardware/pio.h"
 #include "PwmIn.h"
 #include "PwmIn.pio.h"
+#include "pio_resources.h"
 
-// class that reads PWM pulses on max 4 pins
+// the maximum number of pins: all state machines of all pio blocks
+// (8 on the RP2040 with pio0 and pio1, 12 on the RP2350 with pio0, pio1 and pio2)
+#define PWMIN_MAX_PINS (NUM_PIOS * 4)
+
+// class that reads PWM pulses on max PWMIN_MAX_PINS pins
+// The state machines are taken from pio0 first, then from pio1 (and pio2), via the shared pio resources.
 class PwmIn
 {
 public:
@@ -22,34 +28,44 @@ public:
     float read_DC(uint pin);
     // read only the period
     float read_P(uint pin);
+    // the integer versions (no float, so they can be used in an interrupt)
+    // read only the pulsewidth in ns
+    uint32_t read_PW_ns(uint pin);
+    // read only the period in ns
+    uint32_t read_P_ns(uint pin);
+    // read only the duty cycle in ppm (between 0 and 1000000)
+    uint32_t read_DC_ppm(uint pin);
 
 private:
-    // set the irq handler
-    static void pio_irq_handler()
+    // the conversion from timer ticks to time for a system clock (also called when the clock
+    // is changed with pio_timing_set_sys_clock_khz(), see ../../pio_timing)
+    static void set_clock(uint32_t clock_hz, void *user_data);
+    // the irq handler (called by the pio resources for the sm of a pin)
+    static void pio_irq_handler(PIO pio, uint sm, void *user_data)
     {
-        int state_machine = -1;
-        // check which IRQ was raised:
-        for (int i = 0; i < 4; i++)
-        {
-            if (pio0_hw->irq & 1<<i)
-            {
-                // clear interrupt
-                pio0_hw->irq = 1 << i;
-                // read pulse width from the FIFO
-                pulsewidth[i] = pio_sm_get(pio, i);
-                // read low period from the FIFO
-                period[i] = pio_sm_get(pio, i);
-                // clear interrupt
-                pio0_hw->irq = 1 << i;
-            }
-        }
+        pwm_data_t *data = (pwm_data_t *)user_data;
+        // read pulse width from the FIFO
+        data->pulsewidth = pio_sm_get(pio, sm);
+        // read low period from the FIFO
+        data->period = pio_sm_get(pio, sm);
+        // clear interrupt
+        pio->irq = 1 << sm;
     }
-    // the pio instance
-    static PIO pio;
     // the pins and number of pins
     uint _num_of_pins;
-    // data about the PWM input measured in pio clock cycles
-    static uint32_t pulsewidth[4], period[4];
+    // data about the PWM input measured in timer ticks (2 clock cycles)
+    // Note: 'period' is the low period, the period is pulsewidth + period
+    // (one per pin of this PwmIn, so a second PwmIn has its own)
+    typedef struct
+    {
+        volatile uint32_t pulsewidth, period;
+    } pwm_data_t;
+    pwm_data_t pwm_data[PWMIN_MAX_PINS];
+    // the time of one timer tick in seconds, and in ns with 16 fractional bits
+    // (from the system clock when the PwmIn is made or the clock changes, so overclocking is
+    // taken into account)
+    float seconds_per_tick;
+    uint32_t ns_per_tick_q16;
 };
 
-#endif
\ No newline at end of file
+#endif
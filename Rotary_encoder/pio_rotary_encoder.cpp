@@ -1,12 +1,23 @@
 #include <stdio.h>
+#include <stdlib.h>
 
 #include "pico/stdlib.h"
 #include "hardware/pio.h"
-#include "hardware/irq.h"
 
 #include "pio_rotary_encoder.pio.h"
+#include "pio_resources.h"
+#ifdef BENCHMARK
+#include "benchmark.h"
+#endif
 
 // class to read the rotation of the rotary encoder
+// The sm keeps the count (rotation) itself and always pushes the latest count, so no
+// interrupt is needed for each step. Each encoder has its own sm: up to 8 encoders on
+// the RP2040 (pio0 first, then pio1).
+// Note: the program fills most of the pio memory (and has to start at 0), so each pio
+//       block has one copy of it, shared by its 4 state machines
+// The velocity (steps per second) is estimated from timestamped readings of the count,
+// see update_velocity().
 class RotaryEncoder
 {
 public:
@@ -16,32 +27,33 @@ public:
     RotaryEncoder(uint rotary_encoder_A)
     {
         uint8_t rotary_encoder_B = rotary_encoder_A + 1;
-        // pio 0 is used
-        PIO pio = pio0;
-        // state machine 0
-        uint8_t sm = 0;
+        // claim a state machine (pio0 first) and load the pio program into the pio memory
+        // (once for each pio, it has to start at 0)
+        uint offset;
+        if (!pio_resources_claim_sm(&pio_rotary_encoder_program, &pio, &sm, &offset))
+        {
+            printf("RotaryEncoder: no free state machine\n");
+            return;
+        }
         // configure the used pins as input with pull up
         pio_gpio_init(pio, rotary_encoder_A);
         gpio_set_pulls(rotary_encoder_A, true, false);
         pio_gpio_init(pio, rotary_encoder_B);
         gpio_set_pulls(rotary_encoder_B, true, false);
-        // load the pio program into the pio memory
-        uint offset = pio_add_program(pio, &pio_rotary_encoder_program);
         // make a sm config
-        pio_sm_config c = pio_rotary_encoder_program_get_default_config(offset);
+        pio_sm_config c = pio_rotary_encoder_program_get_default_config(0);
         // set the 'in' pins
         sm_config_set_in_pins(&c, rotary_encoder_A);
         // set shift to left: bits shifted by 'in' enter at the least
         // significant bit (LSB), no autopush
         sm_config_set_in_shift(&c, false, false, 0);
-        // set the IRQ handler
-        irq_set_exclusive_handler(PIO0_IRQ_0, pio_irq_handler);
-        // enable the IRQ
-        irq_set_enabled(PIO0_IRQ_0, true);
-        pio0_hw->inte0 = PIO_IRQ0_INTE_SM0_BITS | PIO_IRQ0_INTE_SM1_BITS;
         // init the sm.
-        // Note: the program starts after the jump table -> initial_pc = 16
-        pio_sm_init(pio, sm, 16, &c);
+        // Note: the program starts after the jump table -> initial_pc = 'read'
+        pio_sm_init(pio, sm, pio_rotary_encoder_offset_read, &c);
+        // the count starts at 0 and y gets the current values of A and B
+        pio_sm_exec(pio, sm, pio_encode_set(pio_x, 0));
+        pio_sm_exec(pio, sm, pio_encode_in(pio_pins, 2));
+        pio_sm_exec(pio, sm, pio_encode_mov(pio_y, pio_isr));
         // enable the sm
         pio_sm_set_enabled(pio, sm, true);
     }
@@ -49,42 +61,144 @@ public:
     // set the current rotation to a specific value
     void set_rotation(int _rotation)
     {
-        rotation = _rotation;
+        // stop the sm: it could be in the middle of changing x (the 3 instructions of a
+        // clockwise step)
+        pio_sm_set_enabled(pio, sm, false);
+        // put the value in x via the OSR (the program doesn't use the OSR)
+        pio_sm_put_blocking(pio, sm, (uint32_t)_rotation);
+        pio_sm_exec(pio, sm, pio_encode_pull(false, true));
+        pio_sm_exec(pio, sm, pio_encode_mov(pio_x, pio_osr));
+        // continue with a new reading (y still has the previous values of A and B)
+        pio_sm_exec(pio, sm, pio_encode_jmp(pio_rotary_encoder_offset_read));
+        pio_sm_set_enabled(pio, sm, true);
+        previous_count = _rotation;
     }
 
     // get the current rotation
     int get_rotation(void)
     {
-        return rotation;
+        // the sm pushes the count continuously (and drops it if the FIFO is full):
+        // clear the FIFO and wait (a few clock cycles) for the latest count
+        pio_sm_clear_fifos(pio, sm);
+        return (int)pio_sm_get_blocking(pio, sm);
     }
 
-private:
-    static void pio_irq_handler()
+    // estimate the velocity, call this regularly (e.g. every ms in the control loop)
+    // - if the count has changed: the number of steps since the last change divided by
+    //   the time since that change (at low speed this is the period between edges)
+    // - if the count hasn't changed: the velocity can't be larger than 1 step divided by
+    //   the time since the last change, so it decays to 0 when the rotation stops
+    void update_velocity(void)
     {
-        // test if irq 0 was raised
-        if (pio0_hw->irq & 1)
+        uint64_t now = time_us_64();
+        int count = get_rotation();
+        if (count != previous_count)
         {
-            rotation = rotation - 1;
+            if (previous_change_us != 0)
+                velocity = (float)(count - previous_count) * 1000000.f / (float)(now - previous_change_us);
+            previous_count = count;
+            previous_change_us = now;
         }
-        // test if irq 1 was raised
-        if (pio0_hw->irq & 2)
+        else if (previous_change_us != 0)
         {
-            rotation = rotation + 1;
+            float max_velocity = 1000000.f / (float)(now - previous_change_us);
+            if (velocity > max_velocity)
+                velocity = max_velocity;
+            else if (velocity < -max_velocity)
+                velocity = -max_velocity;
         }
-        // clear both interrupts
-        pio0_hw->irq = 3;
+        velocity_timestamp_us = now;
+    }
+
+    // get the velocity (steps per second, negative = clockwise, as in the original code) of the
+    // last update_velocity(), and when it was made
+    float get_velocity(uint64_t *timestamp_us = NULL)
+    {
+        if (timestamp_us != NULL)
+            *timestamp_us = velocity_timestamp_us;
+        return velocity;
     }
 
+private:
     // the pio instance
     PIO pio;
     // the state machine
     uint sm;
-    // the current location of rotation
-    static int rotation;
+    // for the velocity estimate: the count and time of the last change
+    int previous_count = 0;
+    uint64_t previous_change_us = 0;
+    float velocity = 0;
+    uint64_t velocity_timestamp_us = 0;
 };
 
-// Initialize static member of class Rotary_encoder
-int RotaryEncoder::rotation = 0;
+#ifdef BENCHMARK
+/*
+The benchmark build (make benchmarks): the cost of reading the encoder
+
+There is no interrupt per step (the sm counts), so the cost is in the reads: get_rotation()
+and update_velocity(), and the latency from a step until the count has changed.
+The steps are made by the cpu: it drives the pins of A and B (the sm still reads them), so no
+encoder must be connected.
+*/
+// the gray code of A (bit 0) and B (bit 1) for one direction
+static const uint8_t gray_code[4] = {0b00, 0b01, 0b11, 0b10};
+
+void benchmark_step(uint pin_A, uint step)
+{
+    uint8_t ab = gray_code[step % 4];
+    gpio_put_masked(3u << pin_A, (uint32_t)ab << pin_A);
+}
+
+void run_benchmarks(RotaryEncoder &encoder, uint pin_A)
+{
+    benchmark_init("rotary_encoder");
+    // the cpu drives A and B
+    gpio_init_mask(3u << pin_A);
+    gpio_put_masked(3u << pin_A, 0);
+    gpio_set_dir_out_masked(3u << pin_A);
+    sleep_us(10);
+    encoder.set_rotation(0);
+
+    benchmark_stats stats;
+    benchmark_stats_init(&stats, "get_rotation", "cycles");
+    for (uint i = 0; i < 100; i++)
+    {
+        uint32_t start = benchmark_start();
+        encoder.get_rotation();
+        benchmark_stats_add(&stats, benchmark_stop(start));
+    }
+    benchmark_report(&stats);
+
+    benchmark_stats_init(&stats, "update_velocity", "cycles");
+    for (uint i = 0; i < 100; i++)
+    {
+        uint32_t start = benchmark_start();
+        encoder.update_velocity();
+        benchmark_stats_add(&stats, benchmark_stop(start));
+    }
+    benchmark_report(&stats);
+
+    // the latency: from a step until get_rotation() returns the new count
+    benchmark_stats_init(&stats, "step_latency", "cycles");
+    int count = encoder.get_rotation();
+    for (uint step = 1; step <= 1000; step++)
+    {
+        uint32_t start = benchmark_start();
+        benchmark_step(pin_A, step);
+        int new_count;
+        while ((new_count = encoder.get_rotation()) == count && benchmark_stop(start) < 100000)
+            ;
+        uint32_t cycles = benchmark_stop(start);
+        if (new_count != count)
+            benchmark_stats_add(&stats, cycles);
+        count = new_count;
+    }
+    benchmark_report(&stats);
+    // all steps must have been counted (the sign depends on the direction)
+    benchmark_report_value("steps_counted", "steps", (float)abs(count));
+    benchmark_done();
+}
+#endif
 
 int main()
 {
@@ -94,9 +208,19 @@ int main()
     RotaryEncoder my_encoder(16);
     // initialize the rotatry encoder rotation as 0
     my_encoder.set_rotation(0);
-    // infinite loop to print the current rotation
+#ifdef BENCHMARK
+    // the benchmark build (make benchmarks): measure the reads, then stop
+    run_benchmarks(my_encoder, 16);
+    while (true)
+        tight_loop_contents();
+#endif
+    // infinite loop to print the current rotation and velocity
+    uint loops = 0;
     while (true)
     {
-        printf("rotation=%d\n", my_encoder.get_rotation());
+        my_encoder.update_velocity();
+        if (++loops % 100 == 0)
+            printf("rotation=%d velocity=%f steps/s\n", my_encoder.get_rotation(), my_encoder.get_velocity());
+        sleep_ms(1);
     }
-}
\ No newline at end of file
+}
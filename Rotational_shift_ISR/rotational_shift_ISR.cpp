@@ -6,6 +6,13 @@
 #include "hardware/pio.h"
 
 #include "rotational_shift_ISR.pio.h"
+#include "byte_stream.h"
+
+// the original example: rotate one word in the ISR and print every step
+// comment out for the byte stream (rotation, reversal and crc of a buffer, without the cpu)
+// #define ROTATE_ONE_WORD
+// the number of bytes in the byte stream
+#define NUM_OF_BYTES 4096
 
 // handy function to print the value of 'number' in bits
 void printBits(uint32_t number)
@@ -24,6 +31,7 @@ void printBits(uint32_t number)
     }
 }
 
+#ifdef ROTATE_ONE_WORD
 int main()
 {
     // needed for printf
@@ -77,4 +85,101 @@ int main()
 
         printf("----------------------------------------------------------\n");
     }
-}
\ No newline at end of file
+}
+#else
+uint8_t bytes_in[NUM_OF_BYTES];
+uint8_t bytes_out[NUM_OF_BYTES];
+
+// the references for the check (the cpu computes them the slow way)
+uint8_t rotate_right(uint8_t b, uint n)
+{
+    return (uint8_t)((b >> n) | (b << ((8 - n) & 7)));
+}
+
+uint8_t reverse(uint8_t b)
+{
+    uint8_t r = 0;
+    for (int i = 0; i < 8; i++)
+        if (b & (1 << i))
+            r |= 0x80 >> i;
+    return r;
+}
+
+uint32_t crc32(const uint8_t *data, uint n)
+{
+    uint32_t crc = 0xFFFFFFFF;
+    for (uint i = 0; i < n; i++)
+    {
+        crc ^= data[i];
+        for (int b = 0; b < 8; b++)
+            crc = (crc >> 1) ^ (0xEDB88320 & -(crc & 1));
+    }
+    return ~crc;
+}
+
+// stream the bytes through a byte stream with these operations, check the output with the cpu
+// and the check of the sniffer with a crc32 of the expected output
+void stream(uint rotate, bool rev, bool invert)
+{
+    byte_stream bs;
+    if (!byte_stream_init(&bs, rotate, rev, invert))
+    {
+        printf("byte stream: no free state machine\n");
+        return;
+    }
+    byte_stream_set_check(&bs, BYTE_STREAM_CRC32, false);
+    uint64_t start = time_us_64();
+    byte_stream_start(&bs, bytes_in, bytes_out, NUM_OF_BYTES);
+    uint32_t crc = byte_stream_wait(&bs);
+    uint32_t us = time_us_64() - start;
+    byte_stream_release(&bs);
+
+    uint errors = 0;
+    for (uint i = 0; i < NUM_OF_BYTES; i++)
+    {
+        uint8_t expected = rotate_right(bytes_in[i], rotate);
+        if (rev)
+            expected = reverse(expected);
+        if (invert)
+            expected = ~expected;
+        if (bytes_out[i] != expected)
+            errors++;
+    }
+    printf("rotate %d%s%s: %d bytes in %d us (%f MB/s), %d errors, crc32 %08x (expected %08x)\n", rotate,
+           rev ? ", reverse" : "", invert ? ", invert" : "", NUM_OF_BYTES, us, (float)NUM_OF_BYTES / us, errors,
+           crc, crc32(bytes_out, NUM_OF_BYTES));
+}
+
+int main()
+{
+    // needed for printf
+    stdio_init_all();
+    sleep_ms(1000);
+    for (uint i = 0; i < NUM_OF_BYTES; i++)
+        bytes_in[i] = rand();
+
+    // the operations
+    stream(0, false, false);
+    stream(3, false, false);
+    stream(0, true, false);
+    stream(3, true, true);
+    stream(7, false, true);
+
+    // only the checks of the input (no output buffer), e.g. for a received frame
+    byte_stream bs;
+    byte_stream_init(&bs, 0, false, false);
+    const byte_stream_check checks[] = {BYTE_STREAM_CRC32, BYTE_STREAM_CRC16_CCITT, BYTE_STREAM_PARITY, BYTE_STREAM_SUM};
+    const char *names[] = {"crc32", "crc16-ccitt", "parity", "sum"};
+    for (uint i = 0; i < 4; i++)
+    {
+        byte_stream_set_check(&bs, checks[i], true);
+        byte_stream_start(&bs, bytes_in, NULL, NUM_OF_BYTES);
+        printf("%s of the input: %08x\n", names[i], byte_stream_wait(&bs));
+    }
+    printf("crc32 of the input by the cpu: %08x\n", crc32(bytes_in, NUM_OF_BYTES));
+    byte_stream_release(&bs);
+
+    while (true)
+        ;
+}
+#endif
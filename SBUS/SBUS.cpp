@@ -9,44 +9,239 @@
 #include "pico/stdlib.h"
 #include "hardware/pio.h"
 #include "hardware/clocks.h"
+#include "hardware/dma.h"
+#include "hardware/sync.h"
 
 #include "SBUS.pio.h"
+#include "sbus_decoder.h"
+#include "pio_timing.h"
+// the trace level (see ../trace_ring): TRACE_LEVEL_INFO also traces the bytes skipped
+// while searching for a frame, TRACE_LEVEL_OFF removes the trace
+#define TRACE_LEVEL TRACE_LEVEL_WARNING
+#include "trace_ring.h"
+#ifdef BENCHMARK
+#include "benchmark.h"
+#endif
 
 // The baud rate for the SBUS protocol is 100000
 #define SERIAL_BAUD 100000
 // The RC receiver is attached to pin 5
 #define PIO_RX_PIN 5
-// the max amount of data in a SBUS data packet
-#define MAX_DATA_ITEMS 25
+/*
+Reception via dma into a ring buffer
+
+The sm pushes one byte per word (in the upper 8 bits, with its status in the 8 bits 
+below it, see SBUS.pio). A dma channel reads just these two bytes from the RxFIFO and 
+writes them into a ring buffer, no cpu is involved. The dma channel transfers a large number of bytes before it chains to a 
+control channel that restarts it, the ring keeps the write address wrapping.
+A repeating timer parses the ring buffer for complete frames, so the main loop 
+only has to pick up the latest frame (and printing can not cause data loss).
+Note: the bytes are not packed 4 per word with autopush (as in the OneWire read): the sm
+builds the status of each byte with 'mov ISR ...' on the whole ISR, and the parser needs
+the status of each byte. The cpu doesn't touch the RxFIFO anyway, at 100000 baud one word
+per byte is no load for the dma.
+*/
+// the ring buffer: a power of 2 in size and aligned to its size (for the dma ring)
+// each item: data byte << 8 | status (0xFF = ok, 0x00 = parity error, 0x0F = framing error)
+#define RING_BITS 8
+#define RING_SIZE (1 << RING_BITS)
+uint16_t ring[RING_SIZE] __attribute__((aligned(2 * RING_SIZE)));
+#define STATUS_OK 0xFF
+#define STATUS_PARITY_ERROR 0x00
+// the position of the parser in the ring
+uint ring_tail = 0;
+// the dma channels
+int dma_chan;
+int dma_chan_ctrl;
+// the number of items the dma channel transfers before it is restarted
+uint32_t dma_count = 0xFFFFFFFF;
+
+// the trace events
+#define SBUS_TRACE_BYTE_ERROR TRACE_ID(TRACE_DRIVER_SBUS, 0)
+#define SBUS_TRACE_SKIPPED TRACE_ID(TRACE_DRIVER_SBUS, 1)
+#define SBUS_TRACE_DECODE_ERROR TRACE_ID(TRACE_DRIVER_SBUS, 2)
+const char *const sbus_trace_names[] = {"byte_error", "skipped", "decode_error"};
+
+// the latest frame, published by the parser
+// Note: 'frame_count' is odd while the parser writes 'latest_frame'
+sbus_frame latest_frame;
+volatile uint32_t frame_count = 0;
+
+// set up the dma: RxFIFO of the sm -> ring buffer
+void sbus_configure_dma(PIO pio, uint sm)
+{
+    dma_chan = dma_claim_unused_channel(true);
+    dma_chan_ctrl = dma_claim_unused_channel(true);
+
+    dma_channel_config c = dma_channel_get_default_config(dma_chan);
+    // two bytes: the sm puts the data and status in the upper half of the word, read only that half
+    channel_config_set_transfer_data_size(&c, DMA_SIZE_16);
+    channel_config_set_read_increment(&c, false);
+    channel_config_set_write_increment(&c, true);
+    // wrap the write address at the end of the ring buffer
+    channel_config_set_ring(&c, true, RING_BITS + 1);
+    // the sm determines when there is data
+    channel_config_set_dreq(&c, pio_get_dreq(pio, sm, false));
+    // restart via the control channel when all bytes have been transferred
+    channel_config_set_chain_to(&c, dma_chan_ctrl);
+    dma_channel_configure(dma_chan, &c, ring, (io_rw_16 *)&pio->rxf[sm] + 1, dma_count, false);
+
+    // the control channel writes the transfer count (and triggers) the data channel,
+    // the write address just continues in the ring
+    c = dma_channel_get_default_config(dma_chan_ctrl);
+    channel_config_set_transfer_data_size(&c, DMA_SIZE_32);
+    channel_config_set_read_increment(&c, false);
+    channel_config_set_write_increment(&c, false);
+    dma_channel_configure(dma_chan_ctrl, &c, &dma_hw->ch[dma_chan].al1_transfer_count_trig, &dma_count, 1, false);
+
+    dma_channel_start(dma_chan);
+}
+
+// find complete frames in the ring buffer: a 0x0F header and 24 bytes later a 0x00 footer
+bool parse_ring(repeating_timer_t *rt)
+{
+    // the position of the dma in the ring
+    uint head = (((uint32_t)dma_hw->ch[dma_chan].write_addr - (uint32_t)ring) / 2) % RING_SIZE;
+    uint available = (head - ring_tail) % RING_SIZE;
+    uint skipped = 0;
+    while (available >= SBUS_FRAME_SIZE)
+    {
+        // a frame starts with the header and ends with the footer (both without errors),
+        // otherwise search on. Errors in the other bytes are reported with the frame.
+        if (ring[ring_tail] == (SBUS_HEADER << 8 | STATUS_OK) &&
+            ring[(ring_tail + SBUS_FRAME_SIZE - 1) % RING_SIZE] == (SBUS_FOOTER << 8 | STATUS_OK))
+        {
+            // publish the frame (the barriers keep the writes of the frame between the two counts,
+            // also for the compiler: latest_frame is not volatile)
+            frame_count++;
+            __dmb();
+            uint8_t errors = 0;
+            for (uint i = 0; i < SBUS_FRAME_SIZE; i++)
+            {
+                uint16_t item = ring[(ring_tail + i) % RING_SIZE];
+                latest_frame.data[i] = item >> 8;
+                if ((item & 0xFF) == STATUS_PARITY_ERROR)
+                    errors |= SBUS_PARITY_ERROR;
+                else if ((item & 0xFF) != STATUS_OK)
+                    errors |= SBUS_FRAMING_ERROR;
+            }
+            latest_frame.errors = errors;
+            if (errors)
+                TRACE_WARNING(SBUS_TRACE_BYTE_ERROR, errors);
+            latest_frame.timestamp_us = time_us_64();
+            __dmb();
+            frame_count++;
+            ring_tail = (ring_tail + SBUS_FRAME_SIZE) % RING_SIZE;
+            available -= SBUS_FRAME_SIZE;
+        }
+        else
+        {
+            ring_tail = (ring_tail + 1) % RING_SIZE;
+            available--;
+            skipped++;
+        }
+    }
+    if (skipped)
+        TRACE_INFO(SBUS_TRACE_SKIPPED, skipped);
+    // keep repeating
+    return true;
+}
+
+// get the latest frame, returns false if there is no new frame since the last call
+bool sbus_get_frame(sbus_frame *frame)
+{
+    static uint32_t last_count = 0;
+    uint32_t count;
+    do
+    {
+        count = frame_count;
+        if (count == last_count)
+            return false;
+        __dmb();
+        *frame = latest_frame;
+        __dmb();
+        // try again if the parser was writing the frame
+    } while ((count & 1) || count != frame_count);
+    last_count = count;
+    return true;
+}
+
+#ifdef BENCHMARK
+/*
+The benchmark build (make benchmarks): the cost of the decoder and of the parser
+
+The frames are made by the cpu, no receiver is needed. For the parser the dma channel is
+stopped and its write address is set to the end of the frames in the ring, as if the dma
+had just received them.
+*/
+// a frame with channel data (and the flag byte 0)
+void benchmark_make_frame(sbus_frame &frame)
+{
+    frame.data[0] = SBUS_HEADER;
+    for (uint i = 1; i < SBUS_FRAME_SIZE - 2; i++)
+        frame.data[i] = i * 37;
+    frame.data[SBUS_FRAME_SIZE - 2] = 0;
+    frame.data[SBUS_FRAME_SIZE - 1] = SBUS_FOOTER;
+    frame.errors = 0;
+}
 
-// function to decode the received SBUS data to actual steering commands
-void decode(uint8_t *data)
+void benchmark_decode(const char *name, const sbus_frame &frame)
 {
-    uint16_t channels[16];
-    // see https://platformio.org/lib/show/5622/Bolder%20Flight%20Systems%20SBUS
-    channels[0] = (uint16_t)((data[0] | data[1] << 8) & 0x07FF);
-    channels[1] = (uint16_t)((data[1] >> 3 | data[2] << 5) & 0x07FF);
-    channels[2] = (uint16_t)((data[2] >> 6 | data[3] << 2 | data[4] << 10) & 0x07FF);
-    channels[3] = (uint16_t)((data[4] >> 1 | data[5] << 7) & 0x07FF);
-    channels[4] = (uint16_t)((data[5] >> 4 | data[6] << 4) & 0x07FF);
-    channels[5] = (uint16_t)((data[6] >> 7 | data[7] << 1 | data[8] << 9) & 0x07FF);
-    channels[6] = (uint16_t)((data[8] >> 2 | data[9] << 6) & 0x07FF);
-    channels[7] = (uint16_t)((data[9] >> 5 | data[10] << 3) & 0x07FF);
-    channels[8] = (uint16_t)((data[11] | data[12] << 8) & 0x07FF);
-    channels[9] = (uint16_t)((data[12] >> 3 | data[13] << 5) & 0x07FF);
-    channels[10] = (uint16_t)((data[13] >> 6 | data[14] << 2 | data[15] << 10) & 0x07FF);
-    channels[11] = (uint16_t)((data[15] >> 1 | data[16] << 7) & 0x07FF);
-    channels[12] = (uint16_t)((data[16] >> 4 | data[17] << 4) & 0x07FF);
-    channels[13] = (uint16_t)((data[17] >> 7 | data[18] << 1 | data[19] << 9) & 0x07FF);
-    channels[14] = (uint16_t)((data[19] >> 2 | data[20] << 6) & 0x07FF);
-    channels[15] = (uint16_t)((data[20] >> 5 | data[21] << 3) & 0x07FF);
-    for (int i = 0; i < 16; i++)
+    SbusDecoder decoder;
+    sbus_data data;
+    benchmark_stats stats;
+    benchmark_stats_init(&stats, name, "cycles");
+    for (uint i = 0; i < 100; i++)
     {
-        printf("%d \t", channels[i]);
+        uint32_t start = benchmark_start();
+        decoder.decode(frame, data);
+        benchmark_stats_add(&stats, benchmark_stop(start));
     }
-    printf("\n");
+    benchmark_report(&stats);
 }
 
+// parse 'frames' frames from the start of the ring
+void benchmark_parse(const char *name, uint frames)
+{
+    sbus_frame frame;
+    benchmark_make_frame(frame);
+    for (uint f = 0; f < frames; f++)
+        for (uint i = 0; i < SBUS_FRAME_SIZE; i++)
+            ring[f * SBUS_FRAME_SIZE + i] = frame.data[i] << 8 | STATUS_OK;
+    benchmark_stats stats;
+    benchmark_stats_init(&stats, name, "cycles");
+    for (uint i = 0; i < 100; i++)
+    {
+        ring_tail = 0;
+        dma_channel_set_write_addr(dma_chan, ring + frames * SBUS_FRAME_SIZE, false);
+        uint32_t start = benchmark_start();
+        parse_ring(NULL);
+        benchmark_stats_add(&stats, benchmark_stop(start));
+    }
+    benchmark_report(&stats);
+}
+
+void run_benchmarks()
+{
+    benchmark_init("SBUS");
+    sbus_frame frame;
+    benchmark_make_frame(frame);
+    benchmark_decode("decode", frame);
+    frame.errors = SBUS_PARITY_ERROR;
+    benchmark_decode("decode_byte_error", frame);
+    frame.errors = 0;
+    frame.data[0] = 0;
+    benchmark_decode("decode_frame_error", frame);
+    // stop the dma, the parser only looks at its write address
+    dma_channel_abort(dma_chan);
+    dma_channel_abort(dma_chan_ctrl);
+    benchmark_parse("parse_ring_empty", 0);
+    benchmark_parse("parse_ring_1_frame", 1);
+    benchmark_parse("parse_ring_10_frames", 10);
+    benchmark_done();
+}
+#endif
+
 // Main function
 int main()
 {
@@ -71,50 +266,51 @@ int main()
     sm_config_set_out_shift(&c, false, false, 32);
     // Deeper FIFO as we're not doing any TX
     sm_config_set_fifo_join(&c, PIO_FIFO_JOIN_RX);
-    // SM transmits 1 bit per 8 execution cycles.
-    float div = (float)clock_get_hz(clk_sys) / (8 * SERIAL_BAUD);
-    sm_config_set_clkdiv(&c, div);
     // init and enable the sm
     pio_sm_init(pio, sm, offset, &c);
+    // SM receives 1 bit per 8 execution cycles, at any system clock (see ../pio_timing)
+    pio_timing_register_sm(pio, sm, 8 * SERIAL_BAUD);
     pio_sm_set_enabled(pio, sm, true);
 
-    uint8_t index = 0;
-    uint8_t data[MAX_DATA_ITEMS];
+    // the names of the trace events (printed by trace_drain in the loop below)
+    TRACE_SET_NAMES(TRACE_DRIVER_SBUS, "SBUS", sbus_trace_names);
+    // the received bytes go into the ring buffer via dma
+    sbus_configure_dma(pio, sm);
+#ifdef BENCHMARK
+    // the benchmark build (make benchmarks): measure the decoder and parser, then stop
+    run_benchmarks();
+    while (true)
+        tight_loop_contents();
+#endif
+    // parse the ring buffer every ms (a frame is 25 bytes = 3 ms at 100000 baud)
+    repeating_timer_t timer;
+    add_repeating_timer_ms(-1, parse_ring, NULL, &timer);
 
-    // continuously get the SBUS data from the pio and decode it
+    // the decoder for the frames
+    SbusDecoder decoder;
+    sbus_frame frame;
+    sbus_data data;
+
+    uint64_t previous_timestamp_us = 0;
+    // continuously get the SBUS frames and decode them
     while (true)
     {
-        // Note: 
-        // Although there is sufficient time for receiving and decoding because the clkdiv 
-        // and join (see above), too much printing will cause data loss
-        while (pio_sm_is_rx_fifo_empty(pio, sm))
-            tight_loop_contents();
-        uint8_t data_item = pio_sm_get(pio, sm) >> 24;
-        // search for 0x0f: the start marker
-        if (data_item == 0x0f)
-            index = 0;
-        else if (index < MAX_DATA_ITEMS)
+        // the trace events (of the parser and of the errors below)
+        trace_drain(16);
+        if (sbus_get_frame(&frame))
         {
-            // test if the first end marker is read
-            if (data_item == 0)
+            sbus_result result = decoder.decode(frame, data);
+            printf("%llu us: ", frame.timestamp_us - previous_timestamp_us);
+            previous_timestamp_us = frame.timestamp_us;
+            if (result != SBUS_OK)
             {
-                // read the second end marker
-                while (pio_sm_is_rx_fifo_empty(pio, sm))
-                    tight_loop_contents();
-                data_item = pio_sm_get(pio, sm) >> 24;
-                // the second end marker should also be 0
-                if (data_item != 0)
-                    printf("Error, second end marker not found\n");
-                else
-                    // if all data is received, decode it
-                    if (index == 22)
-                        decode(data);
+                // the value: the result, and the number of frames with parity and framing errors
+                TRACE_WARNING(SBUS_TRACE_DECODE_ERROR, result << 24 | (decoder.parity_errors & 0xFFF) << 12 | (decoder.framing_errors & 0xFFF));
+                continue;
             }
-            else
-                // if not start or end marker, add it to the received data
-                data[index++] = data_item;
+            for (uint i = 0; i < SBUS_NUM_CHANNELS; i++)
+                printf("%d \t", data.channels[i]);
+            printf("%d %d %s%s\n", data.ch17, data.ch18, data.frame_lost ? "frame lost " : "", data.failsafe ? "failsafe" : "");
         }
-        else
-            printf("error\n");
     }
 }
@@ -0,0 +1,55 @@
+#include "sbus_decoder.h"
+
+// the bits in the flags byte (byte 23 of the frame)
+#define SBUS_FLAG_CH17 0x01
+#define SBUS_FLAG_CH18 0x02
+#define SBUS_FLAG_FRAME_LOST 0x04
+#define SBUS_FLAG_FAILSAFE 0x08
+
+// The 16 channels of 11 bits are packed LSB first into the 22 data bytes (byte 1 to 22 of
+// the frame): channel n starts at bit 11 * n. For each channel the table gives the
+// first frame byte and the shift to get the channel from that byte and the next two bytes.
+// Note: the channel data may take 3 bytes, but not for the last channel: byte 23 (the
+//       flags) is read for it, but shifted out
+static const uint8_t channel_table[SBUS_NUM_CHANNELS][2] = {
+    {1, 0}, {2, 3}, {3, 6}, {5, 1}, {6, 4}, {7, 7}, {9, 2}, {10, 5},
+    {12, 0}, {13, 3}, {14, 6}, {16, 1}, {17, 4}, {18, 7}, {20, 2}, {21, 5}};
+
+sbus_result SbusDecoder::decode(const sbus_frame &frame, sbus_data &data)
+{
+    frames++;
+    // check the bytes
+    if (frame.errors != 0)
+    {
+        if (frame.errors & SBUS_PARITY_ERROR)
+            parity_errors++;
+        if (frame.errors & SBUS_FRAMING_ERROR)
+            framing_errors++;
+        return SBUS_BYTE_ERROR;
+    }
+    // check the header and footer
+    const uint8_t *b = frame.data;
+    if (b[0] != SBUS_HEADER || b[SBUS_FRAME_SIZE - 1] != SBUS_FOOTER)
+    {
+        frame_errors++;
+        return SBUS_FRAME_ERROR;
+    }
+    // unpack the channels
+    for (uint i = 0; i < SBUS_NUM_CHANNELS; i++)
+    {
+        const uint8_t *p = b + channel_table[i][0];
+        uint32_t bits = p[0] | p[1] << 8 | p[2] << 16;
+        data.channels[i] = (bits >> channel_table[i][1]) & 0x07FF;
+    }
+    // the flags
+    uint8_t flags = b[23];
+    data.ch17 = flags & SBUS_FLAG_CH17;
+    data.ch18 = flags & SBUS_FLAG_CH18;
+    data.frame_lost = flags & SBUS_FLAG_FRAME_LOST;
+    data.failsafe = flags & SBUS_FLAG_FAILSAFE;
+    if (data.frame_lost)
+        frames_lost++;
+    if (data.failsafe)
+        failsafes++;
+    return SBUS_OK;
+}
@@ -0,0 +1,81 @@
+#ifndef SBUS_DECODER_H
+#define SBUS_DECODER_H
+
+#include "pico/stdlib.h"
+
+// the size of a SBUS data packet (including the header and footer)
+#define SBUS_FRAME_SIZE 25
+// the header and footer of a SBUS data packet
+#define SBUS_HEADER 0x0F
+#define SBUS_FOOTER 0x00
+// the number of proportional channels
+#define SBUS_NUM_CHANNELS 16
+
+// the errors of a received frame (bits, as reported by the pio program per byte)
+#define SBUS_PARITY_ERROR 0x01
+#define SBUS_FRAMING_ERROR 0x02
+
+// a complete SBUS frame as found in the received bytes:
+// 0x0F, 22 bytes channel data, flags, 0x00
+typedef struct
+{
+    uint8_t data[SBUS_FRAME_SIZE];
+    // the errors of the bytes in this frame (SBUS_PARITY_ERROR, SBUS_FRAMING_ERROR)
+    uint8_t errors;
+    // the time the frame was found
+    uint64_t timestamp_us;
+} sbus_frame;
+
+// the decoded content of a frame
+typedef struct __attribute__((packed))
+{
+    // the 16 proportional channels (11 bits: 0 - 2047)
+    uint16_t channels[SBUS_NUM_CHANNELS];
+    // the two digital channels
+    bool ch17;
+    bool ch18;
+    // the receiver has missed a frame from the transmitter
+    bool frame_lost;
+    // the receiver has lost the transmitter, the channels contain the failsafe values
+    bool failsafe;
+} sbus_data;
+
+// the result of decoding a frame
+enum sbus_result
+{
+    SBUS_OK = 0,
+    // a byte of the frame had a parity or framing error (see SBUS_PARITY_ERROR, SBUS_FRAMING_ERROR)
+    SBUS_BYTE_ERROR,
+    // no header or footer
+    SBUS_FRAME_ERROR
+};
+
+/*
+ * class that decodes SBUS frames into channels and flags
+ * it also keeps statistics of the decoded frames
+ */
+class SbusDecoder
+{
+public:
+    /*
+     * decode a frame
+     * @param frame: the received frame
+     * @param data: the decoded frame, only changed if the result is SBUS_OK
+     * returns SBUS_OK, SBUS_BYTE_ERROR or SBUS_FRAME_ERROR
+     */
+    sbus_result decode(const sbus_frame &frame, sbus_data &data);
+
+    // the statistics
+    // the number of frames that were decoded
+    uint32_t frames = 0;
+    // the number of frames with a parity error or framing error in one of its bytes
+    uint32_t parity_errors = 0;
+    uint32_t framing_errors = 0;
+    // the number of frames without a header or footer
+    uint32_t frame_errors = 0;
+    // the number of frames with the 'frame lost' and 'failsafe' flags set
+    uint32_t frames_lost = 0;
+    uint32_t failsafes = 0;
+};
+
+#endif
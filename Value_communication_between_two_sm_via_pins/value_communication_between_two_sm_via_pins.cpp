@@ -3,9 +3,22 @@
 
 #include "pico/stdlib.h"
 #include "hardware/pio.h"
+#include "hardware/dma.h"
+#include "hardware/structs/systick.h"
 
 #include "value_communication_between_two_sm_via_pins.pio.h"
+#include "pio_resources.h"
+#include "sm_channel.h"
 
+// the original example: one bit at a time via a pin
+// comment out for the sm channel (via dma, no pin)
+// #define VIA_PINS
+// the width of the items in the sm channel: 8, 16 or 32 bits
+#define ITEM_WIDTH 32
+// the number of words for the throughput
+#define NUM_OF_WORDS 4096
+
+#ifdef VIA_PINS
 int main()
 {
     // needed for printf
@@ -56,4 +69,127 @@ int main()
         printf("value send by sm0 = %d\n", pio_sm_get(pio, sm0));
         printf("value received by sm1 = %d\n", pio_sm_get(pio, sm1));
     }
-}
\ No newline at end of file
+}
+#else
+// the words sent through the channel, and received
+uint32_t words_in[NUM_OF_WORDS];
+uint32_t words_out[NUM_OF_WORDS];
+// the offset of the forward program
+uint offset;
+
+// a dma channel between memory and a FIFO, paced by the sm
+int memory_channel(volatile void *write_addr, const volatile void *read_addr, PIO pio, uint sm, bool is_tx)
+{
+    int chan = dma_claim_unused_channel(true);
+    dma_channel_config c = dma_channel_get_default_config(chan);
+    channel_config_set_transfer_data_size(&c, DMA_SIZE_32);
+    channel_config_set_read_increment(&c, is_tx);
+    channel_config_set_write_increment(&c, !is_tx);
+    channel_config_set_dreq(&c, pio_get_dreq(pio, sm, is_tx));
+    dma_channel_configure(chan, &c, write_addr, read_addr, NUM_OF_WORDS, false);
+    return chan;
+}
+
+// the throughput of a channel: memory -> dma -> sender -> channel -> receiver -> dma -> memory
+// (the cpu only starts it and waits) and the latency of one word
+void measure(sm_channel_transport transport, const char *name, PIO pio, uint sender, uint receiver, float receiver_clkdiv)
+{
+    // the receiver at its speed, both at the start of their program
+    pio_sm_set_clkdiv(pio, receiver, receiver_clkdiv);
+    pio_sm_clear_fifos(pio, sender);
+    pio_sm_clear_fifos(pio, receiver);
+    // the channel between the two state machines
+    sm_channel ch;
+    sm_channel_init(&ch, pio, sender, pio, receiver, ITEM_WIDTH, transport);
+    sm_channel_start(&ch);
+    pio_sm_set_enabled(pio, sender, true);
+    pio_sm_set_enabled(pio, receiver, true);
+
+    // the latency of one word: from the put into the sender until it is in the RX FIFO of the
+    // receiver, minus the time the cpu needs to do that with the receiver alone (in clock cycles)
+    uint32_t start = systick_hw->cvr;
+    pio_sm_put(pio, receiver, 1);
+    while (pio_sm_is_rx_fifo_empty(pio, receiver))
+        ;
+    uint32_t direct = (start - systick_hw->cvr) & 0xFFFFFF;
+    pio_sm_get(pio, receiver);
+    start = systick_hw->cvr;
+    pio_sm_put(pio, sender, 2);
+    while (pio_sm_is_rx_fifo_empty(pio, receiver))
+        ;
+    uint32_t through_channel = (start - systick_hw->cvr) & 0xFFFFFF;
+    pio_sm_get(pio, receiver);
+
+    // the throughput
+    for (uint i = 0; i < NUM_OF_WORDS; i++)
+        words_in[i] = i * 0x01010101;
+    int feed = memory_channel(&pio->txf[sender], words_in, pio, sender, true);
+    int sink = memory_channel(words_out, &pio->rxf[receiver], pio, receiver, false);
+    uint64_t start_us = time_us_64();
+    dma_channel_start(sink);
+    dma_channel_start(feed);
+    // with lost words the sink never finishes: give up after 100 ms
+    while (dma_channel_is_busy(sink) && time_us_64() - start_us < 100000)
+        ;
+    uint64_t us = time_us_64() - start_us;
+    uint received = NUM_OF_WORDS - dma_hw->ch[sink].transfer_count;
+    uint errors = 0;
+    for (uint i = 0; i < received; i++)
+        if (words_out[i] != words_in[i])
+            errors++;
+    bool overflowed = sm_channel_overflowed(&ch);
+
+    // clean up
+    pio_sm_set_enabled(pio, sender, false);
+    pio_sm_set_enabled(pio, receiver, false);
+    dma_channel_abort(feed);
+    dma_channel_abort(sink);
+    dma_channel_unclaim(feed);
+    dma_channel_unclaim(sink);
+    sm_channel_release(&ch);
+    // both back at the start of their program
+    pio_sm_clear_fifos(pio, sender);
+    pio_sm_clear_fifos(pio, receiver);
+    pio_sm_restart(pio, sender);
+    pio_sm_restart(pio, receiver);
+    pio_sm_exec(pio, sender, pio_encode_jmp(offset));
+    pio_sm_exec(pio, receiver, pio_encode_jmp(offset));
+
+    printf("%s, receiver clkdiv %.0f:\n", name, receiver_clkdiv);
+    printf("    latency %d clock cycles (%d with the receiver alone)\n", through_channel - direct, direct);
+    printf("    %d of %d words received in %d us (%f MB/s), %d errors%s\n", received, NUM_OF_WORDS, (uint32_t)us,
+           (float)(4 * received) / (float)us, errors, overflowed ? ", words lost (TX FIFO of the receiver overflowed)" : "");
+}
+
+int main()
+{
+    // needed for printf
+    stdio_init_all();
+    sleep_ms(1000);
+    // the SysTick counts clock cycles for the latency
+    systick_hw->rvr = 0xFFFFFF;
+    systick_hw->csr = M0PLUS_SYST_CSR_CLKSOURCE_BITS | M0PLUS_SYST_CSR_ENABLE_BITS;
+
+    // two state machines (sm0 and sm1 of the same pio) with the forward program (loaded once)
+    PIO pio;
+    uint sender = 0, receiver = 1;
+    if (!pio_resources_claim_sm_mask(&forward_program, 0b11, &pio, &offset))
+    {
+        printf("value communication: no free state machines\n");
+        while (true)
+            ;
+    }
+    pio_sm_config c = forward_program_get_default_config(offset);
+    pio_sm_init(pio, sender, offset, &c);
+    pio_sm_init(pio, receiver, offset, &c);
+
+    // the receiver as fast as the sender, and 4 times slower
+    measure(SM_CHANNEL_DMA, "dma", pio, sender, receiver, 1);
+    measure(SM_CHANNEL_DMA_BACKPRESSURE, "dma with backpressure", pio, sender, receiver, 1);
+    measure(SM_CHANNEL_DMA, "dma", pio, sender, receiver, 4);
+    measure(SM_CHANNEL_DMA_BACKPRESSURE, "dma with backpressure", pio, sender, receiver, 4);
+
+    while (true)
+        ;
+}
+#endif
@@ -2,8 +2,127 @@
 #include "pico/stdlib.h"
 #include "hardware/pio.h"
 #include "hardware/vreg.h"
-// the .pio.h file also defines (in this order): D0 (8 bits), A0 (8 bits), RW, WR, DIR, OE
+#include "hardware/dma.h"
+#include "pico/multicore.h"
+#include "pio_timing.h"
+// the .pio.h file also defines (in this order): D0 (8 bits), A0 (16 bits), RW, WR, DIR, OE
 #include "Z80.pio.h"
+#ifdef BENCHMARK
+#include "benchmark.h"
+#endif
+
+// The trace level (see ../trace_ring): with TRACE_LEVEL_VERBOSE all bus cycles are printed
+// by core 0 (via trace rings, so this does not slow down the bus), with TRACE_LEVEL_WARNING
+// only the writes to ROM, with TRACE_LEVEL_OFF there is only the fast path
+#define TRACE_LEVEL TRACE_LEVEL_VERBOSE
+#include "trace_ring.h"
+
+/*
+The memory map
+
+The 64 kB address space of the Z80 is divided into 16 pages of 4 kB. Each page can be
+mapped to RAM, ROM or IO (memory mapped):
+    RAM:    a 4 kB block of the SRAM of the pico
+    ROM:    a 4 kB block in flash. It is read via XIP, it is not copied to SRAM. 
+            Writes are ignored.
+    IO:     a 4 kB block of SRAM that can be read by the Z80, writes are stored and
+            passed to io_write() (on core 1)
+Bank switching is done by mapping another block to a page (map_page), which is just
+writing a page table entry. So the lookup of a byte always takes the same time: the
+entry of the page and then the byte (see Z80.pio and configure_dma)
+Note: XIP reads that miss the flash cache take longer, for ROM that is read often (e.g.
+a boot ROM) this is no problem, otherwise map a RAM page and copy the ROM into it.
+*/
+#define PAGE_BITS 12
+#define PAGE_SIZE (1 << PAGE_BITS)
+#define NUM_PAGES 16
+typedef enum { PAGE_RAM, PAGE_ROM, PAGE_IO } page_type;
+
+// the page table for reads: for each page the memory address >> 12
+// Note: 64 byte aligned, such that the sm can make the address of an entry (see Z80.pio)
+uint32_t page_table[NUM_PAGES] __attribute__((aligned(64)));
+// for writes: the memory of each page, NULL for ROM
+uint8_t *page_write[NUM_PAGES];
+// the type of each page
+page_type page_types[NUM_PAGES];
+
+// the RAM: 64 kB for the whole address space + 4 kB for IO + 4 banks of 4 kB
+// Note: all blocks must be 4 kB aligned
+#define RAM_BLOCKS (NUM_PAGES + 1 + 4)
+uint8_t ram[RAM_BLOCKS][PAGE_SIZE] __attribute__((aligned(PAGE_SIZE)));
+// the block for memory mapped IO
+#define IO_BLOCK NUM_PAGES
+// the first of the extra banks
+#define BANK_BLOCK (NUM_PAGES + 1)
+
+// The ROM image in flash, e.g. the boot loader of CP/M (it must be 4 kB aligned).
+// Replace the contents by the ROM image to boot; this example has two pages with nops
+// followed by a jump to 0 ('jp 0').
+const uint8_t rom_image[2 * PAGE_SIZE] __attribute__((aligned(PAGE_SIZE))) = {
+    [2 * PAGE_SIZE - 3] = 0xC3, 0x00, 0x00};
+
+// map a 4 kB block of memory to a page of the Z80 address space
+void map_page(uint page, const uint8_t *block, page_type type)
+{
+    page_types[page] = type;
+    page_write[page] = (type == PAGE_ROM) ? NULL : (uint8_t *)block;
+    // the entry for reads: written last, with one write, so a read concurrently with 
+    // the bank switch reads either the old or the new block
+    page_table[page] = (uint32_t)block >> PAGE_BITS;
+}
+
+// the type of the page a byte was served from, by its memory address (for the trace):
+// the ROM is in flash, the IO page is its own block of RAM
+const char *const page_type_names[] = {"RAM", "ROM", "IO"};
+page_type served_page_type(uint32_t memory_address)
+{
+    if (memory_address >= (uint32_t)rom_image && memory_address < (uint32_t)rom_image + sizeof(rom_image))
+        return PAGE_ROM;
+    if ((memory_address >> PAGE_BITS) == (uint32_t)ram[IO_BLOCK] >> PAGE_BITS)
+        return PAGE_IO;
+    return PAGE_RAM;
+}
+
+// The example memory map (like a CP/M system):
+//      0x0000 - 0x1FFF     ROM (boot), until it is switched off (see io_write)
+//      0x2000 - 0xEFFF     RAM
+//      0xF000 - 0xFFFF     IO
+void configure_memory_map()
+{
+    for (uint page = 0; page < NUM_PAGES; page++)
+        map_page(page, ram[page], PAGE_RAM);
+    map_page(0, rom_image, PAGE_ROM);
+    map_page(1, rom_image + PAGE_SIZE, PAGE_ROM);
+    map_page(0xF, ram[IO_BLOCK], PAGE_IO);
+}
+
+// A write to the IO page (called on core 1), the example IO registers:
+//      0xF000: 1 = switch the boot ROM off (RAM at 0x0000 - 0x1FFF), 0 = switch it on
+//      0xF001: the bank (0 - 4) for 0x8000 - 0xBFFF: 0 = the normal RAM, 1 - 4 = the extra banks
+// Note: the extra banks are 4 kB each, so a bank covers one page (0x8000 - 0x8FFF)
+void io_write(uint16_t offset, uint8_t data)
+{
+    if (offset == 0x000)
+    {
+        if (data)
+        {
+            map_page(0, ram[0], PAGE_RAM);
+            map_page(1, ram[1], PAGE_RAM);
+        }
+        else
+        {
+            map_page(0, rom_image, PAGE_ROM);
+            map_page(1, rom_image + PAGE_SIZE, PAGE_ROM);
+        }
+    }
+    else if (offset == 0x001)
+    {
+        if (data == 0)
+            map_page(0x8, ram[0x8], PAGE_RAM);
+        else if (data <= 4)
+            map_page(0x8, ram[BANK_BLOCK + data - 1], PAGE_RAM);
+    }
+}
 
 // PIO and state machine
 PIO pio;
@@ -40,9 +159,9 @@ void configure_pio_sm()
     // set initial pindirs: D0 - D7 are (also) output
     pio_sm_set_consecutive_pindirs(pio, sm_rd, D0, 8, true);
     pio_sm_set_consecutive_pindirs(pio, sm_wr, D0, 8, true);
-    // set initial pindirs: A0 - A7 are input
-    pio_sm_set_consecutive_pindirs(pio, sm_rd, A0, 8, false);
-    pio_sm_set_consecutive_pindirs(pio, sm_wr, A0, 8, false);
+    // set initial pindirs: A0 - A15 are input
+    pio_sm_set_consecutive_pindirs(pio, sm_rd, A0, 16, false);
+    pio_sm_set_consecutive_pindirs(pio, sm_wr, A0, 16, false);
     // set initial pindirs: RD, WR are input
     pio_sm_set_consecutive_pindirs(pio, sm_rd, RD, 1, false);
     pio_sm_set_consecutive_pindirs(pio, sm_wr, RD, 1, false);
@@ -54,8 +173,8 @@ void configure_pio_sm()
     pio_sm_set_consecutive_pindirs(pio, sm_rd, OE, 1, true);
     pio_sm_set_consecutive_pindirs(pio, sm_wr, OE, 1, true);
 
-    // pio 'in' pins: inputs start at the first data bit (D0)
-    sm_config_set_in_pins(&smc_rd, D0);
+    // pio 'in' pins: for a read only the address is needed, inputs start at the first address bit (A0)
+    sm_config_set_in_pins(&smc_rd, A0);
     // pio 'out' pins: data D0-D7 can also be output
     sm_config_set_out_pins(&smc_rd, D0, 8);
     // pio 'set' pins: DIR (LSB) and OE (MSB)
@@ -81,35 +200,229 @@ void configure_pio_sm()
     // init the pio sm with the config
     pio_sm_init(pio, sm_rd, offset_rd, &smc_rd);
     pio_sm_init(pio, sm_wr, offset_wr, &smc_wr);
+    // the read sm needs the upper address bits of the page table in y (see Z80.pio)
+    pio_sm_put(pio, sm_rd, (uint32_t)page_table >> 6);
+    pio_sm_exec(pio, sm_rd, pio_encode_pull(false, true));
+    pio_sm_exec(pio, sm_rd, pio_encode_mov(pio_y, pio_osr));
     // enable the sm
     pio_sm_set_enabled(pio, sm_rd, true);
     pio_sm_set_enabled(pio, sm_wr, true);
 }
 
-// in the current version the address bus is only 8 bits
-// the first half is ROM, the second half is RAM
-uint8_t ROM[128];
-uint8_t RAM[128];
+/*
+The fast path for reads: a dma lookup chain
+
+The read sm pushes the address of the page table entry, the memory address of the
+byte and (after the byte has been put on the bus) the bus address. Then:
+    dma_page:           RxFIFO of the read sm -> read address trigger of dma_page_entry
+    dma_page_entry:     the page table entry -> TxFIFO of the read sm, then chains to dma_addr
+    dma_addr:           RxFIFO of the read sm -> read address trigger of dma_data
+    dma_data:           the byte at that address -> TxFIFO of the read sm, then chains to dma_trace
+    dma_trace:          RxFIFO of the read sm (the bus address << 8 | the byte) -> the read trace
+                        ring (with TRACE_LEVEL_VERBOSE) or a dummy variable, then chains to
+                        dma_trace_addr (with TRACE_LEVEL_VERBOSE) or back to dma_page
+    dma_trace_addr:     the read address of dma_data (the memory address of the byte, which
+                        tells if it came from ROM, RAM or IO) -> the second read trace ring,
+                        then chains back to dma_page
+No cpu is involved, so a read takes only a few system clock cycles.
+*/
+int dma_page;
+int dma_page_entry;
+int dma_addr;
+int dma_data;
+int dma_trace;
+int dma_trace_addr;
+
+// the trace events of core 1 (the reads are traced by dma_trace)
+#define Z80_TRACE_WRITE TRACE_ID(TRACE_DRIVER_Z80, 0)
+#define Z80_TRACE_ROM_WRITE TRACE_ID(TRACE_DRIVER_Z80, 1)
+const char *const z80_trace_names[] = {"write", "rom_not_writable"};
+
+#if TRACE_LEVEL >= TRACE_LEVEL_VERBOSE
+// the read trace ring: the size is a power of 2 (the dma 'ring' wraps the write address)
+#define READ_TRACE_BITS 8
+#define READ_TRACE_SIZE (1 << READ_TRACE_BITS)
+// written by dma_trace: the bus address << 8 | the served byte of each read, and by
+// dma_trace_addr: the memory address the byte was served from (at the same index)
+// Note: the rings must be aligned to their size (in bytes)
+uint32_t read_trace[READ_TRACE_SIZE / 4] __attribute__((aligned(READ_TRACE_SIZE)));
+uint32_t read_trace_addr[READ_TRACE_SIZE / 4] __attribute__((aligned(READ_TRACE_SIZE)));
+#else
+// without trace the bus address of reads is written here
+uint32_t read_trace_dummy;
+#endif
+
+// a dma channel that reads from the RxFIFO of the read sm and writes to 'write_addr'
+void configure_from_rxfifo(int chan, volatile void *write_addr, bool increment, int chain_to)
+{
+    dma_channel_config c = dma_channel_get_default_config(chan);
+    channel_config_set_transfer_data_size(&c, DMA_SIZE_32);
+    channel_config_set_read_increment(&c, false);
+    channel_config_set_write_increment(&c, increment);
+    // let the read sm determine when there is data
+    channel_config_set_dreq(&c, pio_get_dreq(pio, sm_rd, false));
+    if (chain_to >= 0)
+        channel_config_set_chain_to(&c, chain_to);
+#if TRACE_LEVEL >= TRACE_LEVEL_VERBOSE
+    // the trace wraps the write address at the end of the ring
+    if (increment)
+        channel_config_set_ring(&c, true, READ_TRACE_BITS);
+#endif
+    dma_channel_configure(chan, &c, write_addr, &pio->rxf[sm_rd], 1, false);
+}
+
+// a dma channel that sends the value at its read address (set by the previous channel) to the TxFIFO of the read sm
+void configure_to_txfifo(int chan, enum dma_channel_transfer_size size, int chain_to)
+{
+    dma_channel_config c = dma_channel_get_default_config(chan);
+    channel_config_set_transfer_data_size(&c, size);
+    channel_config_set_read_increment(&c, false);
+    channel_config_set_write_increment(&c, false);
+    channel_config_set_chain_to(&c, chain_to);
+    dma_channel_configure(chan, &c, &pio->txf[sm_rd], NULL, 1, false);
+}
+
+void configure_dma()
+{
+    dma_page = dma_claim_unused_channel(true);
+    dma_page_entry = dma_claim_unused_channel(true);
+    dma_addr = dma_claim_unused_channel(true);
+    dma_data = dma_claim_unused_channel(true);
+    dma_trace = dma_claim_unused_channel(true);
+
+    // the page table entry
+    configure_from_rxfifo(dma_page, &dma_hw->ch[dma_page_entry].al3_read_addr_trig, false, -1);
+    configure_to_txfifo(dma_page_entry, DMA_SIZE_32, dma_addr);
+    // the byte
+    configure_from_rxfifo(dma_addr, &dma_hw->ch[dma_data].al3_read_addr_trig, false, -1);
+    configure_to_txfifo(dma_data, DMA_SIZE_8, dma_trace);
+    // the trace
+#if TRACE_LEVEL >= TRACE_LEVEL_VERBOSE
+    dma_trace_addr = dma_claim_unused_channel(true);
+    configure_from_rxfifo(dma_trace, read_trace, true, dma_trace_addr);
+    // the memory address the byte was served from: the read address of dma_data (it doesn't
+    // increment), unpaced
+    dma_channel_config c = dma_channel_get_default_config(dma_trace_addr);
+    channel_config_set_transfer_data_size(&c, DMA_SIZE_32);
+    channel_config_set_read_increment(&c, false);
+    channel_config_set_write_increment(&c, true);
+    channel_config_set_ring(&c, true, READ_TRACE_BITS);
+    channel_config_set_chain_to(&c, dma_page);
+    dma_channel_configure(dma_trace_addr, &c, read_trace_addr, &dma_hw->ch[dma_data].read_addr, 1, false);
+#else
+    configure_from_rxfifo(dma_trace, &read_trace_dummy, false, dma_page);
+#endif
+
+    // wait for the first read
+    dma_channel_start(dma_page);
+}
+
+// Core 1 handles the writes in a tight loop (the Z80 does not wait for them)
+void core1_writes()
+{
+    while (1)
+    {
+        // get the data from the RxFIFO
+        uint32_t addr_data = pio_sm_get_blocking(pio, sm_wr);
+        // the lowest 8 bits are the data and the next 16 bits are the address
+        uint8_t data = addr_data & 0xFF;
+        uint16_t address = addr_data >> 8;
+        uint page = address >> PAGE_BITS;
+        // the ROM is not writable
+        if (page_write[page])
+            page_write[page][address & (PAGE_SIZE - 1)] = data;
+        else
+            TRACE_WARNING(Z80_TRACE_ROM_WRITE, address);
+        // IO
+        if (page_types[page] == PAGE_IO)
+            io_write(address & (PAGE_SIZE - 1), data);
+        // the value: the address << 8 | the data
+        TRACE_VERBOSE(Z80_TRACE_WRITE, addr_data);
+    }
+}
+
+#ifdef BENCHMARK
+/*
+The benchmark build (make benchmarks): the latency of a read, without a Z80
+
+The cpu drives RD (and keeps WR high) itself: gpio_init() switches the pins from the pio to
+the cpu, the state machines still read them. The latency is the number of system clock
+cycles from RD = 0 until the read sm enables the level shifter (OE = 0), at which point the
+data is on the bus. It includes the two dma lookups, and a few cycles of the polling by the
+cpu. The address lines are pulled down, so address 0x0000 is read: from the boot ROM in
+flash, and after switching it off, from RAM.
+*/
+// the maximum number of clock cycles to wait for the read sm
+#define READ_TIMEOUT_CYCLES 100000
+
+void benchmark_read(const char *name)
+{
+    benchmark_stats stats;
+    benchmark_stats_init(&stats, name, "cycles");
+    uint timeouts = 0;
+    for (uint i = 0; i < 1000; i++)
+    {
+        uint32_t start = benchmark_start();
+        gpio_put(RD, 0);
+        while (gpio_get(OE) && benchmark_stop(start) < READ_TIMEOUT_CYCLES)
+            ;
+        uint32_t cycles = benchmark_stop(start);
+        gpio_put(RD, 1);
+        if (cycles >= READ_TIMEOUT_CYCLES)
+        {
+            timeouts++;
+            continue;
+        }
+        benchmark_stats_add(&stats, cycles);
+        // the sm waits for RD = 1 (and 3 cycles) and then sets OE = 1 again
+        start = benchmark_start();
+        while (!gpio_get(OE) && benchmark_stop(start) < READ_TIMEOUT_CYCLES)
+            ;
+    }
+    benchmark_report(&stats);
+    if (timeouts > 0)
+        printf("%s: %d reads timed out\n", name, timeouts);
+}
+
+void run_benchmarks()
+{
+    benchmark_init("Z80");
+    // the cpu drives RD and WR, both start high (no bus cycle)
+    gpio_init(WR);
+    gpio_put(WR, 1);
+    gpio_set_dir(WR, GPIO_OUT);
+    gpio_init(RD);
+    gpio_put(RD, 1);
+    gpio_set_dir(RD, GPIO_OUT);
+    // the address lines are pulled down: page 0
+    benchmark_read("read_rom");
+    io_write(0x000, 1);
+    benchmark_read("read_ram");
+    benchmark_done();
+}
+#endif
 
 int main()
 {
     // set the voltage a bit higher than default
     vreg_set_voltage(0b1100); // 1.15v
-    // overclock to 270MHz
-    set_sys_clock_khz(270000, true);
-
-    // fill the ROM and RAM with numbers
-    uint8_t num;
-    for (num=0; num<128; num++) {
-        ROM[num] = num;
-        RAM[num] = 128+num;
-    }
+    // overclock to 270MHz (the drivers that use pio_timing keep their timing)
+    pio_timing_set_sys_clock_khz(270000, true);
+
+    // set up the memory map
+    configure_memory_map();
+    // the names of the trace events of core 1
+    TRACE_SET_NAMES(TRACE_DRIVER_Z80, "Z80", z80_trace_names);
 
     // needed for printf
     stdio_init_all();
 
     // initialize the state machine
     configure_pio_sm();
+    // start the read lookup chain
+    configure_dma();
+    // start handling the writes
+    multicore_launch_core1(core1_writes);
 
     // print the gpio assignments
     printf("D0=%d\n", D0);
@@ -119,64 +432,47 @@ int main()
     printf("DIR=%d\n", DIR);
     printf("OE=%d\n", OE);
 
-    // a counter to simulate the data in memory (or after some calculations)
-    uint16_t counter = 0;
-    // the received data from pio is a combination of the data and the address
-    uint32_t addr_data;
-    // the data part
-    uint8_t data;
-    // the address part
-    uint16_t address;
-    // used for checking whether the sm has returned to the default state
-    uint8_t current_pc;
-
     // start in the default situation
     // Note: if this is in reality set by an external system (e.g. via pullup/down resistors, ths can be removed)
     pio_sm_exec(pio, sm_rd, offset_rd + Z80_read_offset_set_default);
     pio_sm_exec(pio, sm_wr, offset_wr + Z80_write_offset_set_default);
 
-    uint bitoffs;
-    const uint32_t mask = PIO_FLEVEL_RX0_BITS >> PIO_FLEVEL_RX0_LSB;
+#ifdef BENCHMARK
+    // the benchmark build (make benchmarks): measure the reads, then stop
+    run_benchmarks();
+    while (1)
+        tight_loop_contents();
+#endif
 
+#if TRACE_LEVEL > TRACE_LEVEL_OFF
+    // print the traces
+    // Note: if the printing can not keep up, the oldest reads are overwritten and the
+    //       newest writes are dropped (trace_drain prints how many)
+#if TRACE_LEVEL >= TRACE_LEVEL_VERBOSE
+    uint read_tail = 0;
+#endif
     while (1)
     {
-        // test if there is something in RxFIFO of sm0 (a read)
-        bitoffs = PIO_FLEVEL_RX0_LSB + sm_rd * (PIO_FLEVEL_RX1_LSB - PIO_FLEVEL_RX0_LSB);
-        if ((pio->flevel >> bitoffs) & mask > 0)
-        {
-            // get the data from the RxFIFO
-            addr_data = pio->rxf[sm_rd];
-            // the lowest 8 bits are the data and the next 8 bits are the address
-            // data = addr_data & 0xFF;
-            address = addr_data >> 8;
-
-            // determine if it is ROM or RAM, then get the value from ROM or RAM
-            if (address<128) {
-                data = ROM[address];
-                printf("read ROM address %d results in %d\n", address, data);
-            } else {
-                data = RAM[address-128];
-                printf("read RAM address %d results in %d\n", address-128, data);
-            }
-            // send the data to the pio for writing it to the data bits
-            pio->txf[sm_rd] = data;
-        }
-
-        // test if there is something in RxFIFO of sm1 (a write)
-        bitoffs = PIO_FLEVEL_RX0_LSB + sm_wr * (PIO_FLEVEL_RX1_LSB - PIO_FLEVEL_RX0_LSB);
-        if ((pio->flevel >> bitoffs) & mask > 0)
+#if TRACE_LEVEL >= TRACE_LEVEL_VERBOSE
+        // the reads: the position in the rings follows from the write address of dma_trace_addr
+        // (it writes the second ring, after dma_trace has written the first)
+        uint read_head = (dma_hw->ch[dma_trace_addr].write_addr - (uint32_t)read_trace_addr) / 4;
+        while (read_tail != read_head)
         {
-            // get the data from the RxFIFO
-            addr_data = pio->rxf[sm_wr];
-            data = addr_data & 0xFF;
-            address = addr_data >> 8;
-            if (address<128) {
-                printf("ROM not writable\n");
-            } else {
-                RAM[address-128] = data;
-                printf("Wrote %d to RAM address %d\n", data, address-128);
-            }
-
+            // the bus address and the byte that was served, and where it came from
+            uint16_t address = (read_trace[read_tail] >> 8) & 0xFFFF;
+            uint8_t data = read_trace[read_tail] & 0xFF;
+            page_type type = served_page_type(read_trace_addr[read_tail]);
+            printf("read %s address 0x%04x results in %d\n", page_type_names[type], address, data);
+            read_tail = (read_tail + 1) % (READ_TRACE_SIZE / 4);
         }
+#endif
+        // the writes (and writes to ROM) of core 1
+        trace_drain(16);
     }
-}
\ No newline at end of file
+#else
+    // nothing to do for core 0: reads are handled by the dma, writes by core 1
+    while (1)
+        tight_loop_contents();
+#endif
+}
@@ -0,0 +1,215 @@
+#include "hardware/sync.h"
+
+#include "adc_capture.h"
+
+// the adc clock (it always runs from the 48 MHz usb pll) and the number of its cycles per sample
+#define ADC_CLOCK_HZ 48000000
+#define ADC_CYCLES_PER_SAMPLE 96
+
+// the rings, shared by all instances (there is only one adc)
+uint16_t adc_capture::rings[ADC_CAPTURE_MAX_INPUTS][ADC_CAPTURE_RING_SIZE] __attribute__((aligned(2 * ADC_CAPTURE_RING_SIZE)));
+
+adc_capture::adc_capture(uint input_mask, uint32_t sample_rate, uint32_t process_ms)
+{
+    input_mask &= (1u << ADC_CAPTURE_MAX_INPUTS) - 1;
+    uint num_of_inputs = __builtin_popcount(input_mask);
+    if (num_of_inputs == 0)
+    {
+        printf("adc_capture: no inputs\n");
+        return;
+    }
+    // the inputs
+    adc_init();
+    for (uint i = 0; i < ADC_CAPTURE_MAX_INPUTS; i++)
+    {
+        input_data &in = inputs[i];
+        in.used = input_mask & (1u << i);
+        in.tail = 0;
+        in.count = 0;
+        in.sum = 0;
+        in.min = 0xFFFF;
+        in.max = 0;
+        // no thresholds
+        in.low = 0;
+        in.high = 0xFFFF;
+        in.above = false;
+        if (in.used)
+        {
+            adc_gpio_init(26 + i);
+            in.dma_chan = dma_claim_unused_channel(true);
+        }
+    }
+    // the adc: round-robin over the inputs, starting with the lowest
+    adc_select_input(__builtin_ctz(input_mask));
+    adc_set_round_robin(input_mask);
+    adc_fifo_setup(
+        true,  // Write each completed conversion to the sample FIFO
+        true,  // Enable DMA data request (DREQ)
+        1,     // DREQ (and IRQ) asserted when at least 1 sample present
+        false, // disable ERR bit
+        false  // Do not shift each sample to 8 bits when pushing to FIFO, i.e. keep it 12 bit resolution
+    );
+    // the sample rate of all inputs together: a sample every (1 + div) adc clock cycles, at least 96
+    float div = (float)ADC_CLOCK_HZ / ((float)sample_rate * num_of_inputs) - 1;
+    if (div < ADC_CYCLES_PER_SAMPLE - 1)
+        div = 0;
+    adc_set_clkdiv(div);
+
+    // the dma channels: each transfers 1 sample into its ring and triggers the channel of the
+    // next input, the last triggers the first. The write address of each channel just continues.
+    // A single input can't chain to itself, it is re-armed by a control channel.
+    input_data *first = &inputs[__builtin_ctz(input_mask)];
+    for (uint i = 0; i < ADC_CAPTURE_MAX_INPUTS; i++)
+    {
+        if (!inputs[i].used)
+            continue;
+        // the channel of the next used input (round-robin)
+        input_data *next = first;
+        for (uint j = i + 1; j < ADC_CAPTURE_MAX_INPUTS; j++)
+            if (inputs[j].used)
+            {
+                next = &inputs[j];
+                break;
+            }
+        dma_channel_config c = dma_channel_get_default_config(inputs[i].dma_chan);
+        channel_config_set_transfer_data_size(&c, DMA_SIZE_16);
+        channel_config_set_read_increment(&c, false);
+        channel_config_set_write_increment(&c, true);
+        // wrap the write address at the end of the ring
+        channel_config_set_ring(&c, true, ADC_CAPTURE_RING_BITS + 1);
+        // pace transfers based on availability of ADC samples
+        channel_config_set_dreq(&c, DREQ_ADC);
+        if (next != &inputs[i])
+        {
+            channel_config_set_chain_to(&c, next->dma_chan);
+            dma_channel_configure(inputs[i].dma_chan, &c, rings[i], &adc_hw->fifo, 1, false);
+        }
+        else
+        {
+            // a single input: chaining a channel to itself disables the chaining, so this channel
+            // gets a large count and a control channel re-arms it when the count runs out
+            dma_count = 0xFFFFFFFF;
+            dma_chan_ctrl = dma_claim_unused_channel(true);
+            channel_config_set_chain_to(&c, dma_chan_ctrl);
+            dma_channel_configure(inputs[i].dma_chan, &c, rings[i], &adc_hw->fifo, dma_count, false);
+
+            dma_channel_config c_ctrl = dma_channel_get_default_config(dma_chan_ctrl);
+            channel_config_set_transfer_data_size(&c_ctrl, DMA_SIZE_32);
+            channel_config_set_read_increment(&c_ctrl, false);
+            channel_config_set_write_increment(&c_ctrl, false);
+            // write the count to the data channel (and trigger it), the write address just continues
+            dma_channel_configure(dma_chan_ctrl, &c_ctrl, &dma_hw->ch[inputs[i].dma_chan].al1_transfer_count_trig, &dma_count, 1, false);
+        }
+    }
+    // start: the first channel waits for the first sample
+    adc_fifo_drain();
+    dma_channel_start(first->dma_chan);
+    adc_run(true);
+    // process the samples regularly
+    add_repeating_timer_ms(-(int32_t)process_ms, process, this, &timer);
+}
+
+bool adc_capture::process(repeating_timer_t *rt)
+{
+    adc_capture *a = (adc_capture *)rt->user_data;
+    uint64_t now = time_us_64();
+    for (uint i = 0; i < ADC_CAPTURE_MAX_INPUTS; i++)
+    {
+        input_data &in = a->inputs[i];
+        if (!in.used)
+            continue;
+        // the position of the dma in the ring of this input
+        uint head = (((uint32_t)dma_hw->ch[in.dma_chan].write_addr - (uint32_t)rings[i]) / 2) % ADC_CAPTURE_RING_SIZE;
+        // the statistics of the new samples, in local variables
+        uint32_t count = 0, sum = 0;
+        uint16_t min = in.min, max = in.max;
+        bool above = in.above;
+        for (uint t = in.tail; t != head; t = (t + 1) % ADC_CAPTURE_RING_SIZE)
+        {
+            uint16_t value = rings[i][t];
+            count++;
+            sum += value;
+            if (value < min)
+                min = value;
+            if (value > max)
+                max = value;
+            // the thresholds (with hysteresis)
+            if (above ? (value < in.low) : (value > in.high))
+            {
+                above = !above;
+                if (a->head - a->tail == ADC_CAPTURE_EVENT_QUEUE_SIZE)
+                    a->lost++;
+                else
+                {
+                    adc_capture_event &e = a->events[a->head % ADC_CAPTURE_EVENT_QUEUE_SIZE];
+                    e.input = i;
+                    e.above = above;
+                    e.value = value;
+                    e.timestamp_us = now;
+                    a->head++;
+                }
+            }
+        }
+        in.tail = head;
+        in.above = above;
+        // Note: a ring of 12 bit samples sums to at most 22 bits, no overflow in 32 bits
+        in.sum += sum;
+        in.count += count;
+        in.min = min;
+        in.max = max;
+    }
+    // keep repeating
+    return true;
+}
+
+bool adc_capture::get_stats(uint input, adc_capture_stats *stats, bool reset)
+{
+    if (input >= ADC_CAPTURE_MAX_INPUTS || !inputs[input].used)
+        return false;
+    input_data &in = inputs[input];
+    // the timer must not change the statistics while copying (and resetting) them
+    uint32_t status = save_and_disable_interrupts();
+    stats->count = in.count;
+    stats->sum = in.sum;
+    stats->min = in.min;
+    stats->max = in.max;
+    if (reset)
+    {
+        in.count = 0;
+        in.sum = 0;
+        in.min = 0xFFFF;
+        in.max = 0;
+    }
+    restore_interrupts(status);
+    return true;
+}
+
+void adc_capture::set_threshold(uint input, uint16_t low, uint16_t high)
+{
+    if (input >= ADC_CAPTURE_MAX_INPUTS)
+        return;
+    inputs[input].low = low;
+    inputs[input].high = high;
+}
+
+bool adc_capture::get_event(adc_capture_event *event)
+{
+    if (tail == head)
+        return false;
+    *event = events[tail % ADC_CAPTURE_EVENT_QUEUE_SIZE];
+    tail++;
+    return true;
+}
+
+uint32_t adc_capture::lost_events(void)
+{
+    return lost;
+}
+
+uint16_t adc_capture::latest(uint input)
+{
+    if (input >= ADC_CAPTURE_MAX_INPUTS || !inputs[input].used)
+        return 0;
+    uint head = (((uint32_t)dma_hw->ch[inputs[input].dma_chan].write_addr - (uint32_t)rings[input]) / 2) % ADC_CAPTURE_RING_SIZE;
+    return rings[input][(head - 1) % ADC_CAPTURE_RING_SIZE];
+}
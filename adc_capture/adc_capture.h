@@ -0,0 +1,101 @@
+#ifndef ADC_CAPTURE_H
+#define ADC_CAPTURE_H
+
+#include <stdio.h>
+
+#include "pico/stdlib.h"
+#include "hardware/adc.h"
+#include "hardware/dma.h"
+
+// the maximum number of adc inputs (gpio 26 to 29)
+#define ADC_CAPTURE_MAX_INPUTS 4
+// the number of samples kept in the ring of each input, a power of 2
+#define ADC_CAPTURE_RING_BITS 10
+#define ADC_CAPTURE_RING_SIZE (1 << ADC_CAPTURE_RING_BITS)
+// the number of threshold events that can be queued
+#define ADC_CAPTURE_EVENT_QUEUE_SIZE 32
+
+// the statistics of an input since the previous reset: all integer
+typedef struct
+{
+    uint32_t count;
+    uint64_t sum;
+    uint16_t min;
+    uint16_t max;
+} adc_capture_stats;
+
+// a threshold event: an input went above the high threshold or below the low threshold
+typedef struct
+{
+    uint8_t input;
+    bool above;
+    uint16_t value;
+    uint64_t timestamp_us;
+} adc_capture_event;
+
+// class that captures up to 4 adc inputs continuously, without the cpu per sample
+// The adc samples the inputs in turn (round-robin) at full speed, a chain of dma channels (one
+// per input, each transferring 1 sample and then triggering the next) de-interleaves the samples
+// into a ring for each input. A repeating timer processes the new samples of each ring in one go:
+// per input the sum, min, max and threshold events, in integer math.
+class adc_capture
+{
+public:
+    // constructor
+    // input_mask: the adc inputs to capture (bit i = adc input i = gpio 26 + i)
+    // sample_rate: the number of samples per second of each input (the adc does at most 500000
+    //              samples per second for all inputs together)
+    // process_ms: how often the timer processes the new samples, at most a ring of samples per input
+    adc_capture(uint input_mask, uint32_t sample_rate, uint32_t process_ms = 1);
+
+    // the statistics of an input since the previous call with reset (or since the start)
+    // returns false if the input isn't captured
+    bool get_stats(uint input, adc_capture_stats *stats, bool reset = true);
+
+    // set the thresholds of an input (12 bit values): an event is given when the input goes above
+    // 'high' and when it goes below 'low' again (the difference is the hysteresis)
+    void set_threshold(uint input, uint16_t low, uint16_t high);
+
+    // get the oldest threshold event from the queue, returns false if there is none
+    bool get_event(adc_capture_event *event);
+
+    // the number of events that were lost because the queue was full
+    uint32_t lost_events(void);
+
+    // the latest sample of an input
+    uint16_t latest(uint input);
+
+private:
+    // the timer: process the new samples of all inputs
+    static bool process(repeating_timer_t *rt);
+    // the data of an input
+    struct input_data
+    {
+        bool used;
+        // the dma channel that writes into the ring of this input
+        int dma_chan;
+        // the position of the processing in the ring
+        uint tail;
+        // the statistics (since the previous reset)
+        volatile uint32_t count;
+        volatile uint64_t sum;
+        volatile uint16_t min, max;
+        // the thresholds and if the input is above the high threshold
+        uint16_t low, high;
+        bool above;
+    };
+    input_data inputs[ADC_CAPTURE_MAX_INPUTS];
+    // a single input: the control channel that re-arms its dma channel, and its count
+    int dma_chan_ctrl = -1;
+    uint32_t dma_count;
+    // the rings: a power of 2 in size and aligned to their size (for the dma ring)
+    static uint16_t rings[ADC_CAPTURE_MAX_INPUTS][ADC_CAPTURE_RING_SIZE];
+    // the queue of threshold events
+    adc_capture_event events[ADC_CAPTURE_EVENT_QUEUE_SIZE];
+    volatile uint32_t head = 0;
+    volatile uint32_t tail = 0;
+    volatile uint32_t lost = 0;
+    repeating_timer_t timer;
+};
+
+#endif
@@ -0,0 +1,35 @@
+#include <stdio.h>
+
+#include "pico/stdlib.h"
+
+#include "adc_capture.h"
+
+// monitor two LED/photodiode pairs: the photodiodes are on adc input 0 (gpio 26) and 1 (gpio 27)
+int main()
+{
+    // needed for printf
+    stdio_init_all();
+    // capture adc input 0 and 1, 100000 samples per second each
+    adc_capture capture(0b0011, 100000);
+    // an event when a photodiode goes above 3000 (and when it goes below 2500 again)
+    capture.set_threshold(0, 2500, 3000);
+    capture.set_threshold(1, 2500, 3000);
+    // infinite loop to print the statistics (every second) and the threshold events
+    while (true)
+    {
+        for (int i = 0; i < 100; i++)
+        {
+            adc_capture_event e;
+            while (capture.get_event(&e))
+                printf("input %d %s: %d (at %d ms)\n", e.input, e.above ? "above" : "below", e.value, (uint32_t)(e.timestamp_us / 1000));
+            sleep_ms(10);
+        }
+        for (uint input = 0; input < 2; input++)
+        {
+            adc_capture_stats s;
+            if (capture.get_stats(input, &s))
+                printf("input %d: %d samples, average = %d, min = %d, max = %d\n", input, s.count,
+                       s.count ? (uint32_t)(s.sum / s.count) : 0, s.min, s.max);
+        }
+    }
+}
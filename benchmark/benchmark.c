@@ -0,0 +1,91 @@
+#include <stdio.h>
+
+#include "hardware/clocks.h"
+
+#include "benchmark.h"
+
+// the SysTick counts down from its 24 bit reload value at the system clock
+#define SYSTICK_MASK 0xFFFFFF
+// how long benchmark_init() waits for the USB serial to be connected
+#define USB_TIMEOUT_MS 10000
+
+// the suite that is running (the second column of the results)
+static const char *current_suite = "";
+// the clock cycles of an empty measurement
+static uint32_t overhead_cycles = 0;
+
+void benchmark_init(const char *suite)
+{
+    current_suite = suite;
+    // free running at the system clock (the same as the pio overlays use)
+    if (!(systick_hw->csr & M0PLUS_SYST_CSR_ENABLE_BITS))
+    {
+        systick_hw->rvr = SYSTICK_MASK;
+        systick_hw->cvr = 0;
+        systick_hw->csr = M0PLUS_SYST_CSR_CLKSOURCE_BITS | M0PLUS_SYST_CSR_ENABLE_BITS;
+    }
+#if LIB_PICO_STDIO_USB
+    // the results printed before the host has opened the serial port would be lost
+    for (uint ms = 0; ms < USB_TIMEOUT_MS && !stdio_usb_connected(); ms += 10)
+        sleep_ms(10);
+#endif
+    // the overhead: the smallest of a few empty measurements
+    overhead_cycles = SYSTICK_MASK;
+    for (uint i = 0; i < 16; i++)
+    {
+        uint32_t start = benchmark_start();
+        uint32_t cycles = (start - systick_hw->cvr) & SYSTICK_MASK;
+        if (cycles < overhead_cycles)
+            overhead_cycles = cycles;
+    }
+    printf("BENCH,suite,name,unit,n,min,mean,max\n");
+    benchmark_report_value("sys_clk", "Hz", (float)clock_get_hz(clk_sys));
+}
+
+uint32_t benchmark_stop(uint32_t start)
+{
+    // the SysTick counts down
+    uint32_t cycles = (start - systick_hw->cvr) & SYSTICK_MASK;
+    return (cycles > overhead_cycles) ? cycles - overhead_cycles : 0;
+}
+
+void benchmark_stats_init(benchmark_stats *stats, const char *name, const char *unit)
+{
+    stats->name = name;
+    stats->unit = unit;
+    stats->n = 0;
+    stats->sum = 0;
+    stats->min = 0xFFFFFFFF;
+    stats->max = 0;
+}
+
+void benchmark_stats_add(benchmark_stats *stats, uint32_t value)
+{
+    stats->n++;
+    stats->sum += value;
+    if (value < stats->min)
+        stats->min = value;
+    if (value > stats->max)
+        stats->max = value;
+}
+
+void benchmark_report(const benchmark_stats *stats)
+{
+    if (stats->n == 0)
+    {
+        printf("BENCH,%s,%s,%s,0,,,\n", current_suite, stats->name, stats->unit);
+        return;
+    }
+    printf("BENCH,%s,%s,%s,%u,%u,%.1f,%u\n", current_suite, stats->name, stats->unit,
+           (uint)stats->n, (uint)stats->min, (double)stats->sum / stats->n, (uint)stats->max);
+}
+
+void benchmark_report_value(const char *name, const char *unit, float value)
+{
+    printf("BENCH,%s,%s,%s,1,%.3f,%.3f,%.3f\n", current_suite, name, unit, value, value, value);
+}
+
+void benchmark_done(void)
+{
+    printf("BENCH,%s,done\n", current_suite);
+}
@@ -0,0 +1,82 @@
+#ifndef BENCHMARK_H
+#define BENCHMARK_H
+
+#include "pico/stdlib.h"
+#include "hardware/structs/systick.h"
+
+/*
+ * A harness for benchmarks on the target
+ *
+ * - cycles: the SysTick timer of the core counts down at the system clock. It has 24 bits,
+ *   so one measurement can be at most 2^24 clock cycles (134 ms at 125 MHz). The overhead of
+ *   benchmark_start() and benchmark_stop() is measured by benchmark_init() and subtracted.
+ *   Note: each core has its own SysTick, start and stop a measurement on the same core
+ * - time: the hardware timer (us, 64 bits) for longer measurements, e.g. a refresh rate
+ * - the results are printed (via USB serial) one per line in a machine readable format:
+ *       BENCH,<suite>,<name>,<unit>,<n>,<min>,<mean>,<max>
+ *   e.g.
+ *       BENCH,ledpanel,encode_lookup_table,cycles,16,429873,429901.2,430012
+ *   A value that is measured once has n = 1 (and min = mean = max). Lines that don't start
+ *   with "BENCH," are for humans (e.g. the normal printf output of a driver).
+ *   benchmark_init() prints the column names and the system clock, benchmark_done() prints
+ *   "BENCH,<suite>,done" so a script on the host knows that all results are in.
+ */
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+// the statistics of a measurement that is repeated (the values can be in any unit)
+typedef struct
+{
+    const char *name;
+    const char *unit;
+    uint32_t n;
+    uint64_t sum;
+    uint32_t min;
+    uint32_t max;
+} benchmark_stats;
+
+/*
+ * Start the benchmarks of a suite (e.g. the name of the driver): start the SysTick (if it
+ * isn't running), wait (at most 10 s) until the USB serial is connected, so no results are lost,
+ * and print the header
+ * Note: call stdio_init_all() first (the driver does that in its main())
+ */
+void benchmark_init(const char *suite);
+
+// the SysTick value at the start of a measurement
+static inline uint32_t benchmark_start(void)
+{
+    return systick_hw->cvr;
+}
+
+// the clock cycles since benchmark_start() (without the overhead of the measurement itself)
+uint32_t benchmark_stop(uint32_t start);
+
+// the time in us of the hardware timer (for measurements longer than the SysTick can do)
+static inline uint64_t benchmark_time_us(void)
+{
+    return time_us_64();
+}
+
+// start collecting the statistics of a repeated measurement
+void benchmark_stats_init(benchmark_stats *stats, const char *name, const char *unit);
+
+// add one value (e.g. the result of benchmark_stop())
+void benchmark_stats_add(benchmark_stats *stats, uint32_t value);
+
+// print the statistics as one line
+void benchmark_report(const benchmark_stats *stats);
+
+// print a value that is measured once (e.g. a rate) as one line
+void benchmark_report_value(const char *name, const char *unit, float value);
+
+// print the end of the suite
+void benchmark_done(void);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
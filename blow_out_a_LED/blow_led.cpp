@@ -17,12 +17,22 @@ So, there is no need to sum the values yourself afterwards.
 
 The code does the following:
 - it turns the LED on for at least 1s to warm it up
-- it starts a repeat timer to call "repeating_timer_callback"
-- in that callback the adc is read NUM_ADC_SAMPLES times through dma, 
-  the samples are summed by the dma sniffer
-- an array of the obtained sums is kept up to date to determine the average of the sums
+- it starts the adc free running at full speed (500 ksps)
+- a dma channel reads the adc samples into two buffers of NUM_ADC_SAMPLES samples, ping-pong:
+  while the cpu can use the samples in one buffer, the dma fills the other
+  the samples are summed by the dma sniffer (which keeps running)
+- when a buffer is full, the dma channel chains to a dma channel that copies the sniffer sum
+  into a ring, which chains to a dma channel that switches the buffer and restarts the first channel,
+  so the stream never stops and no cpu is involved (no samples are missed or delayed)
+- the sum channel gives an interrupt: the handler takes the sum of the block (the difference of
+  two consecutive sniffer sums) for the moving average
+- an array of the obtained sums (of every AV_BLOCK_INTERVAL-th block, i.e. about every 10 ms)
+  is kept up to date to determine the average of the sums (over about 650 ms)
 - if the read summed value deviates sufficiently from the average, a flag is set to switch the LED off
 - in the main loop the flag is checked and when set the LED goes off for 1s and then 1s on to warm it up
+
+Note: there is only one dma sniffer, it follows one channel. That is why the ping-pong is done by
+      one data channel whose write address is switched, instead of two data channels.
 */
 
 #include <stdio.h>
@@ -31,61 +41,92 @@ The code does the following:
 #include "hardware/gpio.h"
 #include "hardware/adc.h"
 #include "hardware/dma.h"
+#include "hardware/irq.h"
 
 // LED Connections: PLUS pin - resistor - ADC pin - LED - GND
 #define PLUS 22
 // pin for ADC goes between resistor and LED
 #define MEASURE 26
-// Number of adc samples to take. Only used in dma_channel_configure
+// Number of adc samples in a block (at 500 ksps a block takes about 1 ms)
 #define NUM_ADC_SAMPLES 512
-// Number of samples to determine the average
+// Number of samples (blocks) to determine the average
 #define NUM_AV_SAMPLES 64
+// a block goes into the average every AV_BLOCK_INTERVAL blocks (about every 10 ms, as the
+// earlier 10 ms timer did): the average is over about 650 ms, not 65 ms
+#define AV_BLOCK_INTERVAL 10
 // Minimum jump for blow out
 // depends on the resistor value and type of LED
 #define BLOWN 400
+// the number of sniffer sums kept in the ring (a power of 2), the interrupt handler
+// can be this many blocks late without missing one
+#define SUM_RING_BITS 3
+#define SUM_RING_SIZE (1 << SUM_RING_BITS)
 
 // the array with NUM_ADC_SAMPLES summed adc samples
 float summed_adc_values[NUM_AV_SAMPLES];
 // keeps track of where in the summed_adc_values array the new value is to be written
 uint8_t sample_num;
-// dma channel number
-uint dma_chan;
+// dma channel numbers: the adc samples, the sniffer sums and the buffer switch
+uint dma_data;
+uint dma_sum;
+uint dma_switch;
 // the total of the summed_adc_values array
 float total;
 // flag to indicate it the led should be turned off
-bool light_out;
-// the variable into which the dma channel dumps all adc readings!
-uint32_t temp;
-
-// the callback function that is called automatically (see add_repeating_timer_ms below)
-bool repeating_timer_callback(struct repeating_timer *t)
+volatile bool light_out;
+
+// the two sample buffers (ping-pong)
+uint16_t adc_buffer[2][NUM_ADC_SAMPLES];
+// the buffer addresses for the switch channel: it reads them in turn (a ring of 2 words),
+// the first block goes into adc_buffer[0] so the first switch is to adc_buffer[1]
+uint16_t *buffer_address[2] __attribute__((aligned(2 * sizeof(uint16_t *)))) = {adc_buffer[1], adc_buffer[0]};
+// the sniffer sum at the end of each block (the ring must be aligned to its size in bytes)
+uint32_t sniff_sums[SUM_RING_SIZE] __attribute__((aligned(4 * SUM_RING_SIZE)));
+// the number of blocks handled by the interrupt handler and the sniffer sum at the end of the last one
+uint32_t blocks_handled;
+uint32_t previous_sniff_sum;
+// the latest complete block of samples: it can be used without waiting until the dma
+// has filled the other buffer (about 1 ms)
+volatile uint16_t *latest_block;
+
+// the interrupt handler: the sniffer sum of a block has been captured
+void dma_handler()
 {
-    // start the sniff sum at 0
-    dma_hw->sniff_data = 0;
-    // start the dma_channel. NOTE: it doesn't write to a buffer, it writes to a single variable
-    // the samples are summed by the sniffer functionality!
-    dma_channel_set_write_addr(dma_chan, &temp, true);
-    // wait for it to finish
-    dma_channel_wait_for_finish_blocking(dma_chan);
-
-    // check whether the deviations of the current sample deviates more than BLOWN from the average
-    // the value of BLOWN depends on many things, e.g. resistor, type of LED, NUM_AV_SAMPLES, and NUM_ADC_SAMPLES
-    // the print statement can be used to determine which BLOWN value will work for you
-    // printf("%f\n", (total / 64.) - summed_adc_values[sample_num]);
-    if (((total / 64.) - dma_hw->sniff_data) > BLOWN)
-        light_out = true;
-
-    // save the summed adc values in the summed_adc_values array
-    // total is the sum of all elements in that array
-    total -= summed_adc_values[sample_num];
-    summed_adc_values[sample_num] = dma_hw->sniff_data;
-    total += summed_adc_values[sample_num];
-
-    // make the array a ring
-    if (++sample_num == NUM_AV_SAMPLES)
-        sample_num = 0;
-
-    return true;
+    // acknowledge the interrupt
+    dma_hw->ints0 = 1u << dma_sum;
+    // the number of blocks captured: the position of the sum channel in its ring
+    uint head = (((uint32_t)dma_hw->ch[dma_sum].write_addr - (uint32_t)sniff_sums) / 4) % SUM_RING_SIZE;
+    // handle all blocks since the previous interrupt
+    while (blocks_handled % SUM_RING_SIZE != head)
+    {
+        uint32_t sniff_sum = sniff_sums[blocks_handled % SUM_RING_SIZE];
+        // the sum of the block: the sniffer keeps summing (modulo 2^32)
+        float block_sum = (float)(sniff_sum - previous_sniff_sum);
+        previous_sniff_sum = sniff_sum;
+        // block k was written into adc_buffer[k % 2]
+        latest_block = adc_buffer[blocks_handled % 2];
+        blocks_handled++;
+
+        // check whether the deviations of the current sample deviates more than BLOWN from the average
+        // the value of BLOWN depends on many things, e.g. resistor, type of LED, NUM_AV_SAMPLES, and NUM_ADC_SAMPLES
+        // the print statement can be used to determine which BLOWN value will work for you
+        // printf("%f\n", (total / 64.) - block_sum);
+        if (((total / 64.) - block_sum) > BLOWN)
+            light_out = true;
+
+        // each block is checked, but only one every AV_BLOCK_INTERVAL is used for the average
+        if (blocks_handled % AV_BLOCK_INTERVAL != 0)
+            continue;
+        // save the summed adc values in the summed_adc_values array
+        // total is the sum of all elements in that array
+        total -= summed_adc_values[sample_num];
+        summed_adc_values[sample_num] = block_sum;
+        total += summed_adc_values[sample_num];
+
+        // make the array a ring
+        if (++sample_num == NUM_AV_SAMPLES)
+            sample_num = 0;
+    }
 }
 
 int main()
@@ -105,6 +146,9 @@ int main()
     total = 0;
     for (int i = 0; i < NUM_AV_SAMPLES; i++)
         summed_adc_values[i] = 0;
+    blocks_handled = 0;
+    previous_sniff_sum = 0;
+    latest_block = NULL;
 
     // ========== ADC setup ===================
     adc_init();
@@ -115,37 +159,62 @@ int main()
         false, // disable ERR bit
         false  // Do not shift each sample to 8 bits when pushing to FIFO, i.e. keep it 12 bit resolution
     );
-    // Divisor of 0 -> full speed.
+    // Divisor of 0 -> full speed (500 ksps).
     adc_set_clkdiv(0);
-    // start the adc
-    adc_run(true);
 
     // ========== DMA setup ===================
-    // Set up the DMA to start transferring data as soon as it appears in FIFO
-    dma_chan = dma_claim_unused_channel(true);
-    dma_channel_config cfg = dma_channel_get_default_config(dma_chan);
-    // data size is 32 bits (it should be at least 12)
-    channel_config_set_transfer_data_size(&cfg, DMA_SIZE_32);
-    // Reading from AND WRITING to a constant address
+    dma_data = dma_claim_unused_channel(true);
+    dma_sum = dma_claim_unused_channel(true);
+    dma_switch = dma_claim_unused_channel(true);
+
+    // the data channel: transfer the samples into a buffer as soon as they appear in FIFO
+    dma_channel_config cfg = dma_channel_get_default_config(dma_data);
+    // data size is 16 bits (it should be at least 12)
+    channel_config_set_transfer_data_size(&cfg, DMA_SIZE_16);
+    // Reading from a constant address, writing into the buffer
     channel_config_set_read_increment(&cfg, false);
-    channel_config_set_write_increment(&cfg, false);
+    channel_config_set_write_increment(&cfg, true);
     // Pace transfers based on availability of ADC samples
     channel_config_set_dreq(&cfg, DREQ_ADC);
+    // when the buffer is full: capture the sniffer sum
+    channel_config_set_chain_to(&cfg, dma_sum);
     // configure sniff to automatically sum (mode=0xf) all the data
-    dma_sniffer_enable(dma_chan, 0xf, true);
+    dma_sniffer_enable(dma_data, 0xf, true);
+    dma_hw->sniff_data = 0;
     // enable sniff
     channel_config_set_sniff_enable(&cfg, true);
     // configure the channel
-    dma_channel_configure(dma_chan, &cfg,
-                          NULL,            // dst
+    dma_channel_configure(dma_data, &cfg,
+                          adc_buffer[0],   // dst
                           &adc_hw->fifo,   // src
-                          NUM_ADC_SAMPLES, // transfer count
-                          false            // start immediately
+                          NUM_ADC_SAMPLES, // transfer count (reloaded at each restart)
+                          false            // don't start yet
     );
 
-    // ===========TIMER setup =================
-    struct repeating_timer timer;
-    add_repeating_timer_ms(10, repeating_timer_callback, NULL, &timer);
+    // the sum channel: copy the sniffer sum into the ring, then switch the buffer
+    cfg = dma_channel_get_default_config(dma_sum);
+    channel_config_set_transfer_data_size(&cfg, DMA_SIZE_32);
+    channel_config_set_read_increment(&cfg, false);
+    channel_config_set_write_increment(&cfg, true);
+    channel_config_set_ring(&cfg, true, SUM_RING_BITS + 2);
+    channel_config_set_chain_to(&cfg, dma_switch);
+    dma_channel_configure(dma_sum, &cfg, sniff_sums, &dma_hw->sniff_data, 1, false);
+    // the interrupt for the block-complete handler
+    dma_channel_set_irq0_enabled(dma_sum, true);
+    irq_set_exclusive_handler(DMA_IRQ_0, dma_handler);
+    irq_set_enabled(DMA_IRQ_0, true);
+
+    // the switch channel: write the address of the other buffer into the data channel (and trigger it)
+    cfg = dma_channel_get_default_config(dma_switch);
+    channel_config_set_transfer_data_size(&cfg, DMA_SIZE_32);
+    channel_config_set_read_increment(&cfg, true);
+    channel_config_set_write_increment(&cfg, false);
+    channel_config_set_ring(&cfg, false, 3);
+    dma_channel_configure(dma_switch, &cfg, &dma_hw->ch[dma_data].al2_write_addr_trig, buffer_address, 1, false);
+
+    // start the stream: the dma waits for the first sample
+    dma_channel_start(dma_data);
+    adc_run(true);
     // ========================================
 
     while (true)
@@ -2,24 +2,54 @@
 
 #include "pico/stdlib.h"
 #include "hardware/pio.h"
+#include "hardware/irq.h"
+#include "hardware/clocks.h"
 
 #include "4x4_button_matrix.pio.h"
+#include "pio_resources.h"
+#include "pio_timing.h"
 
-// class that sets up and reads the 4x4 button matrix
-class button_matrix_4x4
+// the number of key events that can be queued (per matrix)
+#define EVENT_QUEUE_SIZE 32
+// the number of clock cycles to scan one row ('set pins [31]' + 'in pins')
+#define CYCLES_PER_ROW 33
+
+// a key event: a key is pressed or released
+typedef struct
+{
+    uint8_t key;
+    bool pressed;
+    uint64_t timestamp_us;
+} key_event;
+
+// class that sets up and reads a 4x4 or an 8x8 button matrix
+// The state machine only pushes the state of the keys when it changes, this causes an interrupt
+// which turns the changes into press/release events in a queue. All keys are read (n-key
+// rollover), the state of all keys is available with read_all().
+// A 4x4 matrix uses one state machine, an 8x8 matrix uses two (sm and sm+2) of the same pio,
+// the matrices are spread over pio0 and pio1: e.g. 8 4x4 matrices or 4 8x8 matrices.
+class button_matrix
 {
 public:
     // constructor
-    // base_input is the starting gpio for the 4 input pins
-    // base_output is the starting gpio for the 4 output pins
-    button_matrix_4x4(uint base_input, uint base_output)
+    // base_input is the starting gpio for the 4 (or 8) input pins
+    // base_output is the starting gpio for the 4 (or 8) output pins
+    // size is 4 for a 4x4 matrix or 8 for an 8x8 matrix
+    // scan_rate is the number of scans of the whole matrix per second, a lower scan rate
+    // gives less events caused by bouncing keys
+    button_matrix(uint base_input, uint base_output, uint size = 4, float scan_rate = 1000)
     {
-        // pio 0 is used
-        pio = pio0;
-        // state machine 0
-        sm = 0;
+        num_of_halves = (size == 8) ? 2 : 1;
+        // claim the state machine(s) (pio0 first) and load the pio program, once for each pio
+        const pio_program_t *program = (size == 8) ? &button_matrix_8x8_program : &button_matrix_program;
+        uint program_offset;
+        if (!claim_state_machines(program, &program_offset))
+        {
+            printf("button_matrix: no free state machine\n");
+            return;
+        }
         // configure the used pins
-        for (int i = 0; i < 4; i++)
+        for (uint i = 0; i < size; i++)
         {
             // output pins
             pio_gpio_init(pio, base_output + i);
@@ -27,58 +57,132 @@ public:
             pio_gpio_init(pio, base_input + i);
             gpio_pull_down(base_input + i);
         }
-        // load the pio program into the pio memory
-        uint offset = pio_add_program(pio, &button_matrix_program);
-        // make a sm config
-        pio_sm_config c = button_matrix_program_get_default_config(offset);
-        // set the 'in' pins
-        sm_config_set_in_pins(&c, base_input);
-        // set the 4 output pins to output
-        pio_sm_set_consecutive_pindirs(pio, sm, base_output, 4, true);
-        // set the 'set' pins
-        sm_config_set_set_pins(&c, base_output, 4);
-        // set shift such that bits shifted by 'in' end up in the lower 16 bits
-        sm_config_set_in_shift(&c, 0, 0, 0);
-        // init the pio sm with the config
-        pio_sm_init(pio, sm, offset, &c);
-        // enable the sm
-        pio_sm_set_enabled(pio, sm, true);
+        // the frequency of the state machines for the scan rate
+        float sm_hz = scan_rate * CYCLES_PER_ROW * size;
+        for (uint h = 0; h < num_of_halves; h++)
+        {
+            uint s = sm[h];
+            // the interrupt handler of the sm
+            pio_resources_set_irq_handler(pio, s, rx_fifo_handler, this);
+            // make a sm config
+            pio_sm_config c = (size == 8) ? button_matrix_8x8_program_get_default_config(program_offset)
+                                          : button_matrix_program_get_default_config(program_offset);
+            // set the 'in' pins
+            sm_config_set_in_pins(&c, base_input);
+            // set the 4 output pins (of this half) to output
+            pio_sm_set_consecutive_pindirs(pio, s, base_output + 4 * h, 4, true);
+            // set the 'set' pins
+            sm_config_set_set_pins(&c, base_output + 4 * h, 4);
+            // set shift such that bits shifted by 'in' end up in the lower bits
+            sm_config_set_in_shift(&c, 0, 0, 0);
+            // init the pio sm with the config
+            pio_sm_init(pio, s, program_offset, &c);
+            // the scan rate, at any system clock (see ../pio_timing)
+            pio_timing_register_sm(pio, s, sm_hz);
+            // no keys pressed yet
+            pio_sm_exec(pio, s, pio_encode_set(pio_y, 0));
+            // the interrupt when the state of the keys has changed
+            pio_set_irq0_source_enabled(pio, (pio_interrupt_source)(pis_sm0_rx_fifo_not_empty + s), true);
+            // enable the sm
+            pio_sm_set_enabled(pio, s, true);
+        }
+        // an 8x8 matrix: give the first half its turn
+        if (num_of_halves == 2)
+            pio->irq_force = 1u << sm[0];
     }
 
-    // read the 4x4 matrix
+    // read the matrix: returns the lowest pressed key (0 to 15, or 0 to 63), or -1 if no key is pressed
+    // this does not wait
     int read(void)
     {
-        // value is used to read from the fifo
-        uint32_t value = 0;
-        // clear the FIFO, we only want a currently pressed key
-        pio_sm_clear_fifos(pio, sm);
-        // give the sm some time to fill the FIFO if a key is being pressed
-        sleep_ms(1);
-        // check that the FIFO isn't empty
-        if (pio_sm_is_rx_fifo_empty(pio, sm))
-        {
+        uint64_t keys = read_all();
+        if (keys == 0)
             return -1;
-        }
-        // read one data item from the FIFO
-        value = pio_sm_get(pio, sm);
-        // translate from a bit position in value to a key number from 0 to 15.
-        for (int i = 0; i < 16; i++)
+        return __builtin_ctzll(keys);
+    }
+
+    // the state of all keys: bit i is set if key i is pressed
+    // for a 4x4 matrix the lower 16 bits are used, for an 8x8 matrix all 64
+    uint64_t read_all(void)
+    {
+        return (uint64_t)state[0] | (uint64_t)state[1] << 32;
+    }
+
+    // get the oldest key event from the queue, returns false if there is none
+    bool get_event(key_event *event)
+    {
+        if (tail == head)
+            return false;
+        *event = events[tail % EVENT_QUEUE_SIZE];
+        tail++;
+        return true;
+    }
+
+    // the number of events that were lost because the queue was full
+    uint32_t lost_events(void)
+    {
+        return lost;
+    }
+
+private:
+    // claim the state machines and load the program, returns false if there are not enough free state machines
+    // an 8x8 matrix needs sm and sm+2 (they pass the turn to each other with 'irq set 2 rel')
+    bool claim_state_machines(const pio_program_t *program, uint *program_offset)
+    {
+        if (num_of_halves == 1)
+            return pio_resources_claim_sm(program, &pio, &sm[0], program_offset);
+        for (uint s = 0; s < 2; s++)
+            if (pio_resources_claim_sm_mask(program, 0b101 << s, &pio, program_offset))
+            {
+                sm[0] = s;
+                sm[1] = s + 2;
+                return true;
+            }
+        return false;
+    }
+
+    // the interrupt handler (called by the pio resources for the sm of a matrix): the state of the keys has changed
+    static void rx_fifo_handler(PIO pio, uint s, void *user_data)
+    {
+        uint64_t now = time_us_64();
+        button_matrix *m = (button_matrix *)user_data;
+        uint h = (s == m->sm[0]) ? 0 : 1;
+        while (!pio_sm_is_rx_fifo_empty(pio, s))
         {
-            // test a bit to see if it is set
-            if ((value & (0x1 << i)) != 0)
+            uint32_t new_state = pio_sm_get(pio, s);
+            // an event for each key that has changed
+            uint32_t changed = new_state ^ m->state[h];
+            while (changed)
             {
-                //the bit is set -> return 'i' as the key number
-                return i;
+                uint bit = __builtin_ctz(changed);
+                changed &= changed - 1;
+                if (m->head - m->tail == EVENT_QUEUE_SIZE)
+                {
+                    m->lost++;
+                    continue;
+                }
+                key_event &e = m->events[m->head % EVENT_QUEUE_SIZE];
+                e.key = 32 * h + bit;
+                e.pressed = (new_state >> bit) & 1;
+                e.timestamp_us = now;
+                m->head++;
             }
+            m->state[h] = new_state;
         }
-        return -1;
     }
 
-private:
     // the pio instance
     PIO pio;
-    // the state machine
-    uint sm;
+    // the state machine(s) and the number of halves (state machines) of the matrix
+    uint sm[2];
+    uint num_of_halves;
+    // the state of the keys (for each half)
+    volatile uint32_t state[2] = {0, 0};
+    // the queue of key events
+    key_event events[EVENT_QUEUE_SIZE];
+    volatile uint32_t head = 0;
+    volatile uint32_t tail = 0;
+    volatile uint32_t lost = 0;
 };
 
 int main()
@@ -86,16 +190,16 @@ int main()
     // needed for printf
     stdio_init_all();
     // the instance of the button matrix: input gpio: 10, 11, 12, and 13, output gpio: 18, 19, 20, and 21
-    button_matrix_4x4 my_matrix(10, 18);
-    // infinite loop to print pressed keys
+    button_matrix my_matrix(10, 18);
+    // an 8x8 matrix would be: input gpio 2 to 9, output gpio 10 to 17
+    //     button_matrix my_matrix(2, 10, 8);
+    // infinite loop to print the key events
     while (true)
     {
-        // read the matrix of buttons
-        int key = my_matrix.read();
-        if (key >= 0)
-        { // a key was pressed: print its number
-            printf("key pressed = %d\n", key);
-        }
-        sleep_ms(1000);
+        key_event e;
+        while (my_matrix.get_event(&e))
+            printf("key %d %s (at %d ms), keys pressed = %04x\n", e.key, e.pressed ? "pressed" : "released",
+                   (uint32_t)(e.timestamp_us / 1000), (uint32_t)my_matrix.read_all());
+        sleep_ms(10);
     }
-}
\ No newline at end of file
+}
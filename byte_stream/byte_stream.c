@@ -0,0 +1,123 @@
+#include "pio_resources.h"
+#include "byte_stream.h"
+
+bool byte_stream_init(byte_stream *bs, uint rotate, bool reverse, bool invert)
+{
+    rotate &= 7;
+    // the program: get the byte (in all four byte lanes), rotate it by shifting the word: the
+    // lowest byte lane gets the bits of the lane above it, or with a reversal (which brings the
+    // highest byte lane to the lowest): shift left, which rotates right by 8 - n
+    uint shift = reverse ? (8 - rotate) & 7 : rotate;
+    uint n = 0;
+    bs->instructions[n++] = pio_encode_pull(false, true);
+    if (shift > 0)
+        bs->instructions[n++] = pio_encode_out(pio_null, shift);
+    if (reverse)
+        bs->instructions[n++] = pio_encode_mov_reverse(pio_isr, pio_osr);
+    else if (invert)
+        bs->instructions[n++] = pio_encode_mov_not(pio_isr, pio_osr);
+    else
+        bs->instructions[n++] = pio_encode_mov(pio_isr, pio_osr);
+    // there is one operation in a mov: invert after the reversal
+    if (reverse && invert)
+        bs->instructions[n++] = pio_encode_mov_not(pio_isr, pio_isr);
+    bs->instructions[n++] = pio_encode_push(false, true);
+    bs->program.instructions = bs->instructions;
+    bs->program.length = n;
+    bs->program.origin = -1;
+
+    // claim a sm and load the program (an identical stream shares it)
+    uint offset;
+    if (!pio_resources_claim_sm(&bs->program, &bs->pio, &bs->sm, &offset))
+        return false;
+    pio_sm_config c = pio_get_default_sm_config();
+    sm_config_set_wrap(&c, offset, offset + n - 1);
+    // the shift direction for the rotation, no autopull or autopush
+    sm_config_set_out_shift(&c, !reverse, false, 32);
+    pio_sm_init(bs->pio, bs->sm, offset, &c);
+    pio_sm_set_enabled(bs->pio, bs->sm, true);
+
+    // the dma channels: bytes from memory into the TX FIFO and from the RX FIFO into memory,
+    // each paced by the sm
+    bs->dma_in = dma_claim_unused_channel(true);
+    bs->dma_out = dma_claim_unused_channel(true);
+    bs->check = BYTE_STREAM_NO_CHECK;
+    bs->check_input = false;
+    return true;
+}
+
+void byte_stream_set_check(byte_stream *bs, byte_stream_check check, bool input)
+{
+    bs->check = check;
+    bs->check_input = input;
+}
+
+void byte_stream_start(byte_stream *bs, const uint8_t *in, uint8_t *out, uint n)
+{
+    int checked = bs->check_input ? bs->dma_in : bs->dma_out;
+    if (bs->check != BYTE_STREAM_NO_CHECK)
+    {
+        // the mode, the initial value and the reflection and final xor of the result
+        uint mode = DMA_SNIFF_CTRL_CALC_VALUE_SUM;
+        uint32_t seed = 0;
+        bool reflect = false;
+        if (bs->check == BYTE_STREAM_CRC32)
+        {
+            // the bits of each byte go in lsb first
+            mode = DMA_SNIFF_CTRL_CALC_VALUE_CRC32R;
+            seed = 0xFFFFFFFF;
+            reflect = true;
+        }
+        else if (bs->check == BYTE_STREAM_CRC16_CCITT)
+        {
+            mode = DMA_SNIFF_CTRL_CALC_VALUE_CRC16;
+            seed = 0xFFFF;
+        }
+        else if (bs->check == BYTE_STREAM_PARITY)
+            mode = DMA_SNIFF_CTRL_CALC_VALUE_EVEN;
+        dma_sniffer_enable(checked, mode, true);
+        dma_sniffer_set_output_reverse_enabled(reflect);
+        dma_sniffer_set_output_invert_enabled(reflect);
+        dma_sniffer_set_data_accumulator(seed);
+    }
+
+    dma_channel_config c = dma_channel_get_default_config(bs->dma_out);
+    channel_config_set_transfer_data_size(&c, DMA_SIZE_8);
+    channel_config_set_read_increment(&c, false);
+    // without an output buffer: write everything into one byte
+    channel_config_set_write_increment(&c, out != NULL);
+    channel_config_set_dreq(&c, pio_get_dreq(bs->pio, bs->sm, false));
+    channel_config_set_sniff_enable(&c, bs->check != BYTE_STREAM_NO_CHECK && checked == bs->dma_out);
+    dma_channel_configure(bs->dma_out, &c, (out != NULL) ? out : &bs->discard, &bs->pio->rxf[bs->sm], n, true);
+
+    c = dma_channel_get_default_config(bs->dma_in);
+    channel_config_set_transfer_data_size(&c, DMA_SIZE_8);
+    channel_config_set_read_increment(&c, true);
+    channel_config_set_write_increment(&c, false);
+    channel_config_set_dreq(&c, pio_get_dreq(bs->pio, bs->sm, true));
+    channel_config_set_sniff_enable(&c, bs->check != BYTE_STREAM_NO_CHECK && checked == bs->dma_in);
+    dma_channel_configure(bs->dma_in, &c, &bs->pio->txf[bs->sm], in, n, true);
+}
+
+uint32_t byte_stream_wait(byte_stream *bs)
+{
+    dma_channel_wait_for_finish_blocking(bs->dma_out);
+    if (bs->check == BYTE_STREAM_NO_CHECK)
+        return 0;
+    uint32_t result = dma_sniffer_get_data_accumulator();
+    dma_sniffer_disable();
+    if (bs->check == BYTE_STREAM_CRC16_CCITT)
+        return result & 0xFFFF;
+    if (bs->check == BYTE_STREAM_PARITY)
+        return result & 1;
+    return result;
+}
+
+void byte_stream_release(byte_stream *bs)
+{
+    dma_channel_abort(bs->dma_in);
+    dma_channel_abort(bs->dma_out);
+    dma_channel_unclaim(bs->dma_in);
+    dma_channel_unclaim(bs->dma_out);
+    pio_resources_release_sm(bs->pio, bs->sm, &bs->program);
+}
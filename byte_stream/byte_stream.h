@@ -0,0 +1,95 @@
+#ifndef BYTE_STREAM_H
+#define BYTE_STREAM_H
+
+#include "hardware/pio.h"
+#include "hardware/dma.h"
+
+/*
+ * A stream of bytes from memory, through a state machine, to memory, with an integrity check
+ *     buffer -> dma -> sm (rotate, reverse, invert) -> dma -> buffer
+ *                         the dma sniffer: crc, parity or sum of the input or the output
+ *
+ * - the state machine runs a program that is made in c for the operations (4 or 5 instructions):
+ *   the byte is rotated right, then its bits are reversed and/or inverted. A narrow (8 bit)
+ *   dma write into the TX FIFO puts the byte in all four byte lanes of the word, so shifting
+ *   the word and taking one byte lane rotates the byte (see the rotations in Rotational_shift_ISR)
+ * - the check is done by the dma sniffer on the input or on the output: a CRC-32 (as in
+ *   ethernet and zip), a CRC-16-CCITT, the parity (xor of all bits) or a 32 bit sum
+ * - the cpu only starts the stream and reads the result of the check, it doesn't touch the bytes
+ *
+ * Note: there is only one dma sniffer, it can't be used by something else (e.g. a sniffer stage
+ *       of a dma pipeline) while a stream runs
+ */
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+// the integrity checks of the dma sniffer
+typedef enum
+{
+    BYTE_STREAM_NO_CHECK,
+    // CRC-32 (IEEE 802.3, as zlib): reflected, initial value and final xor 0xFFFFFFFF
+    BYTE_STREAM_CRC32,
+    // CRC-16-CCITT (polynomial 0x1021, initial value 0xFFFF, not reflected), in the lower 16 bits
+    BYTE_STREAM_CRC16_CCITT,
+    // the xor of all bits: 1 if the number of ones is odd
+    BYTE_STREAM_PARITY,
+    // the sum of all bytes
+    BYTE_STREAM_SUM
+} byte_stream_check;
+
+// a byte stream
+typedef struct
+{
+    PIO pio;
+    uint sm;
+    // the program made for the operations
+    uint16_t instructions[5];
+    pio_program_t program;
+    // the dma channels: into the TX FIFO, out of the RX FIFO
+    int dma_in;
+    int dma_out;
+    // the check
+    byte_stream_check check;
+    bool check_input;
+    // the output is discarded into this (if there is no output buffer)
+    uint8_t discard;
+} byte_stream;
+
+/*
+ * Set up a byte stream: claim a state machine and two dma channels, make and load the program
+ * @param rotate: rotate each byte right by this number of bits (0 to 7)
+ * @param reverse: reverse the bits of each byte (after the rotation)
+ * @param invert: invert the bits of each byte
+ * returns false if there is no free state machine or no room for the program
+ */
+bool byte_stream_init(byte_stream *bs, uint rotate, bool reverse, bool invert);
+
+/*
+ * Set the integrity check, of the bytes going into the state machine (input) or coming out
+ */
+void byte_stream_set_check(byte_stream *bs, byte_stream_check check, bool input);
+
+/*
+ * Start streaming n bytes (this does not wait)
+ * @param out: the buffer for the output, NULL to only check the output
+ */
+void byte_stream_start(byte_stream *bs, const uint8_t *in, uint8_t *out, uint n);
+
+/*
+ * Wait until all bytes have come out of the state machine
+ * returns the result of the check
+ */
+uint32_t byte_stream_wait(byte_stream *bs);
+
+/*
+ * Release the state machine, the program and the dma channels
+ */
+void byte_stream_release(byte_stream *bs);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
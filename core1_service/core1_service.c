@@ -0,0 +1,116 @@
+#include "pico/stdlib.h"
+#include "pico/multicore.h"
+#include "hardware/sync.h"
+
+#include "core1_service.h"
+
+// the word core 1 pushes in the multicore FIFO when the setup is done
+#define SETUP_DONE 0xC0DE0001
+
+// a task and when it is called next
+typedef struct
+{
+    core1_service_task task;
+    void *user_data;
+    uint32_t next_us;
+    volatile uint32_t max_late_us;
+} scheduled_task;
+
+static scheduled_task tasks[CORE1_SERVICE_MAX_TASKS];
+static uint num_of_tasks = 0;
+// the setup on core 1
+static core1_service_setup setup_function;
+static void *setup_user_data;
+
+int core1_service_add_task(core1_service_task task, void *user_data, uint32_t first_us)
+{
+    if (num_of_tasks == CORE1_SERVICE_MAX_TASKS)
+        return -1;
+    scheduled_task *t = &tasks[num_of_tasks];
+    t->task = task;
+    t->user_data = user_data;
+    t->next_us = time_us_32() + first_us;
+    t->max_late_us = 0;
+    return num_of_tasks++;
+}
+
+// the loop of core 1
+static void core1_loop(void)
+{
+    if (setup_function != NULL)
+        setup_function(setup_user_data);
+    // core 0 can continue
+    multicore_fifo_push_blocking(SETUP_DONE);
+    while (true)
+        for (uint i = 0; i < num_of_tasks; i++)
+        {
+            scheduled_task *t = &tasks[i];
+            if (t->task == NULL)
+                continue;
+            // the time since the step was due (with the 32 bit timer wrapping around)
+            uint32_t now = time_us_32();
+            int32_t late = (int32_t)(now - t->next_us);
+            if (late < 0)
+                continue;
+            if ((uint32_t)late > t->max_late_us)
+                t->max_late_us = late;
+            uint32_t delay = t->task(t->user_data);
+            if (delay == CORE1_TASK_STOP)
+                t->task = NULL;
+            else
+                // from when it was due, so a period doesn't drift (unless it is too late)
+                t->next_us = ((uint32_t)late > delay) ? now + delay : t->next_us + delay;
+        }
+}
+
+void core1_service_start(core1_service_setup setup, void *user_data)
+{
+    setup_function = setup;
+    setup_user_data = user_data;
+    multicore_launch_core1(core1_loop);
+    // wait for the setup (e.g. the drivers are there before core 0 reads their mailboxes)
+    while (multicore_fifo_pop_blocking() != SETUP_DONE)
+        ;
+}
+
+uint32_t core1_service_max_late_us(uint task)
+{
+    if (task >= num_of_tasks)
+        return 0;
+    return tasks[task].max_late_us;
+}
+
+void core1_mailbox_publish(core1_mailbox *mailbox, const uint32_t *words, uint num_words)
+{
+    if (num_words > CORE1_MAILBOX_WORDS)
+        num_words = CORE1_MAILBOX_WORDS;
+    // odd: a publish is in progress
+    mailbox->sequence = mailbox->sequence + 1;
+    __dmb();
+    for (uint i = 0; i < num_words; i++)
+        mailbox->words[i] = words[i];
+    __dmb();
+    mailbox->sequence = mailbox->sequence + 1;
+}
+
+uint32_t core1_mailbox_read(core1_mailbox *mailbox, uint32_t *words, uint num_words)
+{
+    if (num_words > CORE1_MAILBOX_WORDS)
+        num_words = CORE1_MAILBOX_WORDS;
+    uint32_t copy[CORE1_MAILBOX_WORDS];
+    uint32_t sequence;
+    // copy again if the writer was publishing (odd), or has published while copying
+    do
+    {
+        sequence = mailbox->sequence;
+        __dmb();
+        for (uint i = 0; i < num_words; i++)
+            copy[i] = mailbox->words[i];
+        __dmb();
+    } while ((sequence & 1) || sequence != mailbox->sequence);
+    if (sequence == 0)
+        return 0;
+    for (uint i = 0; i < num_words; i++)
+        words[i] = copy[i];
+    return sequence / 2;
+}
@@ -0,0 +1,80 @@
+#ifndef CORE1_SERVICE_H
+#define CORE1_SERVICE_H
+
+#include "pico/stdlib.h"
+
+/*
+ * A real-time service loop on core 1 that hosts drivers as cooperative tasks
+ *
+ * Drivers that wait (for a conversion, an echo, a pulse train) block the loop of core 0 with
+ * sleeps and spin-waits. With this library they run on core 1 instead:
+ * - setup: core1_service_start() launches core 1, which first calls a setup function: the
+ *   drivers made there have their interrupts on core 1. core1_service_start() returns when
+ *   the setup is done (core 1 signals it via the multicore FIFO)
+ * - tasks: a task is a function that does one step of the state machine of a driver (start a
+ *   reading, check if it is done, ...) and returns the time (us) until it wants its next
+ *   step. It must not wait itself: the tasks share core 1, one task that waits delays all
+ *   others. The loop calls each task when its time has come, in the order they were added
+ * - results: a task publishes its results in a mailbox, core 0 reads the latest result when
+ *   its control loop wants it. A mailbox has one writer and is lock-free: the reader never
+ *   waits for the writer (it copies again if a publish came in while copying), the writer
+ *   never waits for the reader
+ * So core 0 keeps a predictable period, e.g. with sleep_until() on a fixed schedule.
+ * Note: core 1 can't be used for anything else (e.g. the ledpanel or the Z80 also use core 1)
+ */
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+// the maximum number of tasks
+#define CORE1_SERVICE_MAX_TASKS 8
+// the number of 32 bit words in a mailbox
+#define CORE1_MAILBOX_WORDS 4
+// returned by a task that is done: it isn't called again
+#define CORE1_TASK_STOP 0xFFFFFFFF
+
+// a task: does one step and returns the time (us) until the next step (0: as soon as possible)
+typedef uint32_t (*core1_service_task)(void *user_data);
+// the setup on core 1, e.g. make the drivers and add their tasks
+typedef void (*core1_service_setup)(void *user_data);
+
+// a mailbox: the latest result of a task
+typedef struct
+{
+    // the number of publishes * 2, odd while a publish is in progress
+    volatile uint32_t sequence;
+    volatile uint32_t words[CORE1_MAILBOX_WORDS];
+} core1_mailbox;
+
+/*
+ * Add a task (before core1_service_start() or in the setup on core 1)
+ * @param first_us: the time until the first step
+ * returns the number of the task, or -1 if there are already CORE1_SERVICE_MAX_TASKS
+ */
+int core1_service_add_task(core1_service_task task, void *user_data, uint32_t first_us);
+
+/*
+ * Launch core 1: call the setup there (if not NULL) and then run the tasks
+ * returns when the setup on core 1 is done
+ */
+void core1_service_start(core1_service_setup setup, void *user_data);
+
+// the most a task was called too late (us), e.g. because of a task that took too long
+uint32_t core1_service_max_late_us(uint task);
+
+// publish a result (at most CORE1_MAILBOX_WORDS words), by one writer
+void core1_mailbox_publish(core1_mailbox *mailbox, const uint32_t *words, uint num_words);
+
+/*
+ * Read the latest result of a mailbox, this does not wait for the writer
+ * returns the number of publishes so far (0: nothing has been published, words is unchanged),
+ * e.g. to see if there is a new result since the previous read
+ */
+uint32_t core1_mailbox_read(core1_mailbox *mailbox, uint32_t *words, uint num_words);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
@@ -3,30 +3,56 @@
 #include "pico/stdlib.h"
 #include "hardware/irq.h"
 #include "hardware/pio.h"
+#include "hardware/dma.h"
+#include "hardware/clocks.h"
+#include "hardware/structs/timer.h"
 
 #include "count_pulses_with_pause.pio.h"
+#include "pio_resources.h"
+#include "pio_timing.h"
+
+// the number of pulse trains (bursts) kept in the ring buffer, a power of 2
+#define RING_BITS 6
+#define RING_SIZE (1 << RING_BITS)
+
+// a pulse train: the number of pulses and when the pause after it was detected
+// (the timer in us, the lower 32 bits: the pulse train ended 'pause_us' earlier)
+typedef struct
+{
+    uint32_t pulses;
+    uint32_t timestamp_us;
+} burst;
 
 /*
 This class can be used for protocols where the data is encoded by a number of pulses in a pulse train followed by a pause.
 E.g. the LMT01 temperature sensor uses this (see https://www.reddit.com/r/raspberrypipico/comments/nis1ew/made_a_pulse_counter_for_the_lmt01_temperature/)
 
-The class itself only starts the state machine and, when called, read_pulses() gives the data the state machine has put in the Rx FIFO
+Every completed pulse train is streamed into a ring buffer without the cpu:
+- a dma channel takes the count from the Rx FIFO (paced by the sm) and chains to
+- a dma channel that copies the (lower 32 bits of the) timer into the ring of timestamps,
+  which chains back to the first channel.
+Both channels wrap their write address in their ring. The reader (get_burst) follows the
+write address of the timestamp channel, so no pulse train is lost between two reads (as long
+as the reader keeps up with the ring), and the sm never waits for the cpu.
 */
 
 class count_pulses_with_pause
 {
 public:
     // input = pin that receives the pulses.
-    count_pulses_with_pause(uint input)
+    // pause_us = the minimum pause between two pulse trains in us, it must be longer than the
+    //            longest time between two pulses in a pulse train (e.g. 10 Hz pulses: > 100000 us)
+    count_pulses_with_pause(uint input, uint32_t pause_us = 40000)
     {
-        // pio 0 is used
-        pio = pio0;
-        // state machine 0
-        sm = 0;
+        // claim a state machine (in any pio) and load the pio program into the pio memory
+        uint offset;
+        if (!pio_resources_claim_sm(&count_pulses_with_pause_program, &pio, &sm, &offset))
+        {
+            printf("count_pulses_with_pause: no free state machine\n");
+            return;
+        }
         // configure the used pin
         pio_gpio_init(pio, input);
-        // load the pio program into the pio memory
-        uint offset = pio_add_program(pio, &count_pulses_with_pause_program);
         // make a sm config
         pio_sm_config c = count_pulses_with_pause_program_get_default_config(offset);
         // set the 'jmp' pin
@@ -37,40 +63,155 @@ public:
         sm_config_set_in_shift(&c, false, false, 0);
         // init the pio sm with the config
         pio_sm_init(pio, sm, offset, &c);
+        // the pause, set again when the system clock changes (see ../pio_timing)
+        set_pause(pause_us);
+        pio_timing_add_callback(clock_changed, this);
+        // the dma channels: sm -> ring of counts -> ring of timestamps
+        configure_dma();
         // enable the sm
         pio_sm_set_enabled(pio, sm, true);
     }
 
-    // read the number of pulses in a pulse train
+    // set the minimum pause (us) between two pulse trains
+    // Note: the test loop of the sm is 2 clock cycles, so the time_counter is half the number of
+    //       clock cycles of the pause
+    void set_pause(uint32_t pause_us)
+    {
+        pause = pause_us;
+        uint32_t time_counter = pio_timing_cycles_us(pause_us) / 2;
+        if (time_counter == 0)
+            time_counter = 1;
+        // put it in the OSR, where it stays (the sm takes it at the start of each pause)
+        bool enabled = pio->ctrl & (1u << sm);
+        pio_sm_set_enabled(pio, sm, false);
+        pio_sm_put_blocking(pio, sm, time_counter);
+        pio_sm_exec(pio, sm, pio_encode_pull(false, true));
+        pio_sm_set_enabled(pio, sm, enabled);
+    }
+
+    // get the oldest pulse train from the ring buffer, returns false if there is none
+    // this does not wait
+    bool get_burst(burst *b)
+    {
+        uint head = ring_head();
+        if (head == tail)
+            return false;
+        // if the dma has gone round the ring since the previous read, even the slot it is about
+        // to overwrite is newer than the last read pulse train: skip to the oldest one
+        if ((int32_t)(timestamps[head] - last_timestamp) > 0)
+        {
+            lost = true;
+            tail = head;
+        }
+        b->pulses = counts[tail];
+        b->timestamp_us = timestamps[tail];
+        last_timestamp = b->timestamp_us;
+        tail = (tail + 1) % RING_SIZE;
+        return true;
+    }
+
+    // true if pulse trains were lost (overwritten in the ring before being read) since the
+    // previous call
+    bool overrun(void)
+    {
+        bool l = lost;
+        lost = false;
+        return l;
+    }
+
+    // read the number of pulses in the next pulse train
+    // this waits for the next pulse train that hasn't been read yet, no pulse trains are
+    // skipped (use get_burst() to not wait)
     uint32_t read_pulses(void)
     {
-        // clear the FIFO: do a new measurement
-        pio_sm_clear_fifos(pio, sm);
-        // wait for the FIFO to contain a data item
-        while (pio_sm_get_rx_fifo_level(pio, sm) < 1)
-            ;
-        // read the Rx FIFO and return the value: the number of pulses measured
-        return (pio_sm_get(pio, sm));
+        burst b;
+        while (!get_burst(&b))
+            tight_loop_contents();
+        return b.pulses;
     }
 
 private:
+    // the time_counter of the pause follows from the system clock
+    static void clock_changed(uint32_t clock_hz, void *user_data)
+    {
+        count_pulses_with_pause *c = (count_pulses_with_pause *)user_data;
+        c->set_pause(c->pause);
+    }
+
+    // the minimum pause (us)
+    uint32_t pause;
+
+    // set up the dma channels
+    void configure_dma(void)
+    {
+        // nothing has been read yet, the empty slots get the current time (see get_burst)
+        tail = 0;
+        last_timestamp = timer_hw->timerawl;
+        for (uint i = 0; i < RING_SIZE; i++)
+            timestamps[i] = last_timestamp;
+        dma_count = dma_claim_unused_channel(true);
+        dma_time = dma_claim_unused_channel(true);
+        // the timestamp channel: copy the timer into the ring of timestamps, unpaced
+        dma_channel_config c = dma_channel_get_default_config(dma_time);
+        channel_config_set_transfer_data_size(&c, DMA_SIZE_32);
+        channel_config_set_read_increment(&c, false);
+        channel_config_set_write_increment(&c, true);
+        // wrap the write address at the end of the ring
+        channel_config_set_ring(&c, true, RING_BITS + 2);
+        // wait for the next count
+        channel_config_set_chain_to(&c, dma_count);
+        dma_channel_configure(dma_time, &c, timestamps, &timer_hw->timerawl, 1, false);
+        // the count channel: the Rx FIFO into the ring of counts, paced by the sm
+        c = dma_channel_get_default_config(dma_count);
+        channel_config_set_transfer_data_size(&c, DMA_SIZE_32);
+        channel_config_set_read_increment(&c, false);
+        channel_config_set_write_increment(&c, true);
+        channel_config_set_ring(&c, true, RING_BITS + 2);
+        channel_config_set_dreq(&c, pio_get_dreq(pio, sm, false));
+        // then take the timestamp
+        channel_config_set_chain_to(&c, dma_time);
+        // each channel transfers 1 word, and is restarted (with 1 word) by the other channel
+        dma_channel_configure(dma_count, &c, counts, &pio->rxf[sm], 1, true);
+    }
+
+    // the position of the dma in the ring: a pulse train is complete when its timestamp is written
+    uint ring_head(void)
+    {
+        return (((uint32_t)dma_hw->ch[dma_time].write_addr - (uint32_t)timestamps) / 4) % RING_SIZE;
+    }
+
     // the pio instance
     PIO pio;
     // the state machine
     uint sm;
+    // the dma channels
+    int dma_count;
+    int dma_time;
+    // the rings: a power of 2 in size and aligned to their size (for the dma ring)
+    uint32_t counts[RING_SIZE] __attribute__((aligned(4 * RING_SIZE))) = {0};
+    uint32_t timestamps[RING_SIZE] __attribute__((aligned(4 * RING_SIZE))) = {0};
+    // the position of the reader in the ring and the timestamp of the last read pulse train
+    uint tail = 0;
+    uint32_t last_timestamp = 0;
+    bool lost = false;
 };
 
 int main()
 {
     // needed for printf
     stdio_init_all();
-    // the instance of the count_pulses_with_pause. Note the input pin is 28 in this example
-    count_pulses_with_pause my_count_pulses_with_pause(28);
+    // the instance of the count_pulses_with_pause. Note the input pin is 28 in this example,
+    // pulse trains are separated by at least 40 ms
+    count_pulses_with_pause my_count_pulses_with_pause(28, 40000);
     // infinite loop to print pulse measurements
     while (true)
     {
-        int num_pulses = my_count_pulses_with_pause.read_pulses();
-        printf("number of pulses = %zu\n", num_pulses);
+        // all pulse trains that came in (the dma keeps collecting them while printing)
+        burst b;
+        while (my_count_pulses_with_pause.get_burst(&b))
+            printf("number of pulses = %d (at %d ms)\n", b.pulses, b.timestamp_us / 1000);
+        if (my_count_pulses_with_pause.overrun())
+            printf("pulse trains were lost\n");
         sleep_ms(100);
     }
 }
@@ -0,0 +1,454 @@
+#include <stdio.h>
+
+#include "pico/stdlib.h"
+#include "hardware/adc.h"
+#include "hardware/irq.h"
+#include "hardware/sync.h"
+
+#include "dma_pipeline.h"
+
+// the DREQ for transfers that are not paced (as fast as possible)
+#define DREQ_UNPACED 0x3f
+// the maximum number of pipelines with a ping-pong sink (for the interrupt handler)
+#define MAX_PINGPONG_PIPELINES 4
+
+// the pipelines with a ping-pong sink, and if the interrupt handler is set
+static dma_pipeline *pingpong_pipelines[MAX_PINGPONG_PIPELINES];
+static bool irq_handler_set = false;
+
+static const char *stage_names[] = {"sm", "buffer", "adc", "sniffer"};
+
+void dma_pipeline_init(dma_pipeline *p, enum dma_channel_transfer_size size)
+{
+    p->size = size;
+    p->num_of_stages = 0;
+    p->endless = true;
+    p->started = false;
+    p->reload_count = 0xFFFFFFFF;
+}
+
+// add a stage, returns a pointer to it (or NULL if the pipeline is full)
+static dma_pipeline_stage *add_stage(dma_pipeline *p, dma_pipeline_stage_type type, float rate)
+{
+    if (p->started || p->num_of_stages == DMA_PIPELINE_MAX_STAGES)
+        return NULL;
+    dma_pipeline_stage *s = &p->stages[p->num_of_stages++];
+    s->type = type;
+    s->rate = rate;
+    s->buffer = NULL;
+    s->length = 0;
+    s->mode = DMA_PIPELINE_RING;
+    return s;
+}
+
+int dma_pipeline_add_sm(dma_pipeline *p, PIO pio, uint sm, float rate)
+{
+    dma_pipeline_stage *s = add_stage(p, DMA_PIPELINE_SM, rate);
+    if (s == NULL)
+        return -1;
+    s->pio = pio;
+    s->sm = sm;
+    return p->num_of_stages - 1;
+}
+
+int dma_pipeline_add_buffer(dma_pipeline *p, void *buffer, uint32_t length, dma_pipeline_buffer_mode mode)
+{
+    dma_pipeline_stage *s = add_stage(p, DMA_PIPELINE_BUFFER, 0);
+    if (s == NULL)
+        return -1;
+    s->buffer = buffer;
+    s->length = length;
+    s->mode = mode;
+    return p->num_of_stages - 1;
+}
+
+int dma_pipeline_add_adc(dma_pipeline *p, float rate)
+{
+    if (add_stage(p, DMA_PIPELINE_ADC, rate) == NULL)
+        return -1;
+    return p->num_of_stages - 1;
+}
+
+int dma_pipeline_add_sniffer(dma_pipeline *p, uint mode)
+{
+    dma_pipeline_stage *s = add_stage(p, DMA_PIPELINE_SNIFFER, 0);
+    if (s == NULL)
+        return -1;
+    s->sniff_mode = mode;
+    return p->num_of_stages - 1;
+}
+
+// the DREQ of a stage as the source of a link (or sink if is_tx), returns false if it has none
+static bool stage_dreq(dma_pipeline_stage *s, bool is_tx, uint *dreq)
+{
+    if (s->type == DMA_PIPELINE_SM)
+        *dreq = pio_get_dreq(s->pio, s->sm, is_tx);
+    else if (s->type == DMA_PIPELINE_ADC && !is_tx)
+        *dreq = DREQ_ADC;
+    else
+        return false;
+    return true;
+}
+
+// the rate of a stage, 0 means as fast as the dma
+static float stage_rate(dma_pipeline_stage *s)
+{
+    return (s->rate > 0) ? s->rate : 1e12f;
+}
+
+// the ring size (log2 of the bytes) of a buffer, returns 0 if it can't be a ring
+static uint ring_bits(dma_pipeline *p, dma_pipeline_stage *s)
+{
+    uint32_t bytes = s->length << p->size;
+    if (bytes < 2 || bytes > (1u << 15) || (bytes & (bytes - 1)) != 0 || ((uintptr_t)s->buffer & (bytes - 1)) != 0)
+        return 0;
+    return __builtin_ctz(bytes);
+}
+
+// the interrupt handler: a half of a ping-pong sink is full
+static void dma_irq_handler(void)
+{
+    for (int i = 0; i < MAX_PINGPONG_PIPELINES; i++)
+    {
+        dma_pipeline *p = pingpong_pipelines[i];
+        if (p == NULL)
+            continue;
+        dma_pipeline_link *l = &p->links[p->num_of_stages - 2];
+        if (dma_hw->ints0 & (1u << l->data_chan))
+        {
+            dma_hw->ints0 = 1u << l->data_chan;
+            l->blocks++;
+        }
+    }
+}
+
+// the free place for a pipeline with a ping-pong sink, returns -1 if there is none
+static int free_pingpong_place(void)
+{
+    for (int i = 0; i < MAX_PINGPONG_PIPELINES; i++)
+        if (pingpong_pipelines[i] == NULL)
+            return i;
+    return -1;
+}
+
+// register a pipeline with a ping-pong sink for the interrupt handler (in place 'place')
+static void add_pingpong_pipeline(dma_pipeline *p, int place)
+{
+    pingpong_pipelines[place] = p;
+    if (!irq_handler_set)
+    {
+        irq_add_shared_handler(DMA_IRQ_0, dma_irq_handler, PICO_SHARED_IRQ_HANDLER_DEFAULT_ORDER_PRIORITY);
+        irq_set_enabled(DMA_IRQ_0, true);
+        irq_handler_set = true;
+    }
+}
+
+// check the stages, and find the number of items if the pipeline is used once
+static bool check_stages(dma_pipeline *p)
+{
+    if (p->num_of_stages < 2)
+        return false;
+    p->endless = true;
+    p->reload_count = 0xFFFFFFFF;
+    for (uint i = 0; i < p->num_of_stages; i++)
+    {
+        dma_pipeline_stage *s = &p->stages[i];
+        bool first = (i == 0), last = (i == p->num_of_stages - 1);
+        if ((s->type == DMA_PIPELINE_BUFFER && !first && !last) || (s->type == DMA_PIPELINE_ADC && !first) ||
+            (s->type == DMA_PIPELINE_SNIFFER && !last))
+        {
+            printf("dma_pipeline: a %s can't be stage %d\n", stage_names[s->type], i);
+            return false;
+        }
+        if (s->type != DMA_PIPELINE_BUFFER)
+            continue;
+        if (s->mode == DMA_PIPELINE_ONCE)
+        {
+            // the shortest buffer that is used once determines the number of items
+            if (p->endless || s->length < p->reload_count)
+                p->reload_count = s->length;
+            p->endless = false;
+        }
+        else if (s->mode == DMA_PIPELINE_RING && ring_bits(p, s) == 0)
+        {
+            printf("dma_pipeline: the ring of stage %d must be a power of 2 in size and aligned to its size\n", i);
+            return false;
+        }
+        else if (s->mode == DMA_PIPELINE_PINGPONG && !last)
+        {
+            printf("dma_pipeline: a ping-pong buffer must be the last stage\n");
+            return false;
+        }
+    }
+    // a dma channel has one ring: a ring can't be copied to a ring
+    dma_pipeline_stage *first = &p->stages[0], *last = &p->stages[p->num_of_stages - 1];
+    if (p->num_of_stages == 2 && first->type == DMA_PIPELINE_BUFFER && first->mode == DMA_PIPELINE_RING &&
+        last->type == DMA_PIPELINE_BUFFER && last->mode == DMA_PIPELINE_RING)
+    {
+        printf("dma_pipeline: a ring can't be copied to a ring (a dma channel wraps one address)\n");
+        return false;
+    }
+    for (uint i = 0; i < p->num_of_stages; i++)
+        if (!p->endless && p->stages[i].type == DMA_PIPELINE_BUFFER && p->stages[i].mode == DMA_PIPELINE_PINGPONG)
+        {
+            printf("dma_pipeline: a ping-pong buffer needs an endless pipeline\n");
+            return false;
+        }
+    return true;
+}
+
+// configure the link from stage i to stage i+1
+static void configure_link(dma_pipeline *p, uint i, int pingpong_place)
+{
+    dma_pipeline_stage *src = &p->stages[i];
+    dma_pipeline_stage *dst = &p->stages[i + 1];
+    dma_pipeline_link *l = &p->links[i];
+    l->data_chan = dma_claim_unused_channel(true);
+    l->ctrl_chan = -1;
+    l->blocks = 0;
+    l->count = p->reload_count;
+
+    dma_channel_config c = dma_channel_get_default_config(l->data_chan);
+    channel_config_set_transfer_data_size(&c, p->size);
+
+    // the source: a FIFO (no increment) or a buffer
+    const volatile void *read_addr;
+    if (src->type == DMA_PIPELINE_SM)
+        read_addr = &src->pio->rxf[src->sm];
+    else if (src->type == DMA_PIPELINE_ADC)
+        read_addr = &adc_hw->fifo;
+    else
+        read_addr = src->buffer;
+    channel_config_set_read_increment(&c, src->type == DMA_PIPELINE_BUFFER);
+
+    // the sink: a FIFO, the sniffer dummy (no increment) or a buffer
+    volatile void *write_addr;
+    if (dst->type == DMA_PIPELINE_SM)
+        write_addr = &dst->pio->txf[dst->sm];
+    else if (dst->type == DMA_PIPELINE_SNIFFER)
+        write_addr = &p->sniff_dummy;
+    else
+        write_addr = dst->buffer;
+    channel_config_set_write_increment(&c, dst->type == DMA_PIPELINE_BUFFER);
+
+    // the ring (a channel has only one, see check_stages): the sink or the source
+    if (dst->type == DMA_PIPELINE_BUFFER && dst->mode == DMA_PIPELINE_RING)
+        channel_config_set_ring(&c, true, ring_bits(p, dst));
+    else if (src->type == DMA_PIPELINE_BUFFER && src->mode == DMA_PIPELINE_RING)
+        channel_config_set_ring(&c, false, ring_bits(p, src));
+
+    // the pacing: the slowest of the two stages that have a DREQ
+    uint src_dreq, dst_dreq;
+    bool src_has = stage_dreq(src, false, &src_dreq);
+    bool dst_has = stage_dreq(dst, true, &dst_dreq);
+    if (src_has && dst_has)
+    {
+        bool dst_slowest = stage_rate(dst) <= stage_rate(src);
+        l->dreq = dst_slowest ? dst_dreq : src_dreq;
+        l->pacing_stage = dst_slowest ? i + 1 : i;
+    }
+    else if (src_has || dst_has)
+    {
+        l->dreq = src_has ? src_dreq : dst_dreq;
+        l->pacing_stage = src_has ? i : i + 1;
+    }
+    else
+    {
+        l->dreq = DREQ_UNPACED;
+        l->pacing_stage = -1;
+    }
+    channel_config_set_dreq(&c, l->dreq);
+
+    // the sniffer follows the data channel into it
+    if (dst->type == DMA_PIPELINE_SNIFFER)
+    {
+        dma_sniffer_enable(l->data_chan, dst->sniff_mode, true);
+        channel_config_set_sniff_enable(&c, true);
+        dma_hw->sniff_data = 0;
+    }
+
+    if (p->endless)
+    {
+        l->ctrl_chan = dma_claim_unused_channel(true);
+        dma_channel_config cc = dma_channel_get_default_config(l->ctrl_chan);
+        channel_config_set_transfer_data_size(&cc, DMA_SIZE_32);
+        channel_config_set_write_increment(&cc, false);
+        if (dst->type == DMA_PIPELINE_BUFFER && dst->mode == DMA_PIPELINE_PINGPONG)
+        {
+            // a ping-pong sink: a half at a time, the control channel writes the address of
+            // the other half (and triggers the data channel), the halves are read in turn
+            l->count = dst->length;
+            p->pingpong_address[0] = (uint8_t *)dst->buffer + (dst->length << p->size);
+            p->pingpong_address[1] = dst->buffer;
+            channel_config_set_read_increment(&cc, true);
+            channel_config_set_ring(&cc, false, __builtin_ctz(sizeof(p->pingpong_address)));
+            dma_channel_configure(l->ctrl_chan, &cc, &dma_hw->ch[l->data_chan].al2_write_addr_trig,
+                                  p->pingpong_address, 1, false);
+            // count the halves (the place is checked in dma_pipeline_start)
+            add_pingpong_pipeline(p, pingpong_place);
+            dma_channel_set_irq0_enabled(l->data_chan, true);
+        }
+        else
+        {
+            // the control channel writes the transfer count (and triggers) the data channel,
+            // the addresses just continue (in the rings)
+            channel_config_set_read_increment(&cc, false);
+            dma_channel_configure(l->ctrl_chan, &cc, &dma_hw->ch[l->data_chan].al1_transfer_count_trig,
+                                  &p->reload_count, 1, false);
+        }
+        channel_config_set_chain_to(&c, l->ctrl_chan);
+    }
+    dma_channel_configure(l->data_chan, &c, write_addr, read_addr, l->count, false);
+}
+
+bool dma_pipeline_start(dma_pipeline *p)
+{
+    if (p->started || !check_stages(p))
+        return false;
+    // a ping-pong sink needs a place for the interrupt handler, before anything is claimed
+    dma_pipeline_stage *last = &p->stages[p->num_of_stages - 1];
+    int pingpong_place = -1;
+    if (last->type == DMA_PIPELINE_BUFFER && last->mode == DMA_PIPELINE_PINGPONG)
+    {
+        pingpong_place = free_pingpong_place();
+        if (pingpong_place < 0)
+        {
+            printf("dma_pipeline: more than %d pipelines with a ping-pong buffer\n", MAX_PINGPONG_PIPELINES);
+            return false;
+        }
+    }
+    uint32_t channels = 0;
+    for (uint i = 0; i < p->num_of_stages - 1; i++)
+    {
+        configure_link(p, i, pingpong_place);
+        channels |= 1u << p->links[i].data_chan;
+    }
+    // enable the state machines, the last stage first: a sm that produces data just waits
+    // (on a full RxFIFO) until the dma takes it
+    for (int i = p->num_of_stages - 1; i >= 0; i--)
+        if (p->stages[i].type == DMA_PIPELINE_SM)
+            pio_sm_set_enabled(p->stages[i].pio, p->stages[i].sm, true);
+    // start all links at the same time, then the adc
+    dma_start_channel_mask(channels);
+    if (p->stages[0].type == DMA_PIPELINE_ADC)
+        adc_run(true);
+    p->started = true;
+    return true;
+}
+
+void dma_pipeline_stop(dma_pipeline *p)
+{
+    if (!p->started)
+        return;
+    if (p->stages[0].type == DMA_PIPELINE_ADC)
+        adc_run(false);
+    for (uint i = 0; i < p->num_of_stages; i++)
+        if (p->stages[i].type == DMA_PIPELINE_SM)
+            pio_sm_set_enabled(p->stages[i].pio, p->stages[i].sm, false);
+    for (uint i = 0; i < p->num_of_stages - 1; i++)
+    {
+        dma_pipeline_link *l = &p->links[i];
+        dma_channel_set_irq0_enabled(l->data_chan, false);
+        // abort the control channel before and after the data channel: the data channel can
+        // trigger it when it is aborted
+        if (l->ctrl_chan >= 0)
+            dma_channel_abort(l->ctrl_chan);
+        dma_channel_abort(l->data_chan);
+        if (l->ctrl_chan >= 0)
+        {
+            dma_channel_abort(l->ctrl_chan);
+            dma_channel_unclaim(l->ctrl_chan);
+        }
+        dma_channel_unclaim(l->data_chan);
+    }
+    for (int i = 0; i < MAX_PINGPONG_PIPELINES; i++)
+        if (pingpong_pipelines[i] == p)
+            pingpong_pipelines[i] = NULL;
+    p->started = false;
+}
+
+void dma_pipeline_wait(dma_pipeline *p)
+{
+    if (!p->started || p->endless)
+        return;
+    for (uint i = 0; i < p->num_of_stages - 1; i++)
+        dma_channel_wait_for_finish_blocking(p->links[i].data_chan);
+}
+
+uint32_t dma_pipeline_items(dma_pipeline *p, uint link)
+{
+    if (!p->started || link >= p->num_of_stages - 1)
+        return 0;
+    dma_pipeline_link *l = &p->links[link];
+    // only the link into a ping-pong sink counts its halves (in the interrupt)
+    dma_pipeline_stage *dst = &p->stages[link + 1];
+    bool pingpong = dst->type == DMA_PIPELINE_BUFFER && dst->mode == DMA_PIPELINE_PINGPONG;
+    uint32_t blocks, remaining, again;
+    bool pending;
+    do
+    {
+        // the interrupt that counts a completed half can't come in between here, a half that
+        // was completed before the count was read is still pending
+        uint32_t status = save_and_disable_interrupts();
+        blocks = l->blocks;
+        remaining = dma_hw->ch[l->data_chan].transfer_count;
+        pending = pingpong && (dma_hw->intr & (1u << l->data_chan));
+        again = dma_hw->ch[l->data_chan].transfer_count;
+        restore_interrupts(status);
+        // try again if the count was reloaded while reading (then it isn't known if the pending
+        // half is in it), or the control channel is just reloading it, or the other core counted
+    } while (again > remaining || (pingpong && remaining == 0) || blocks != l->blocks);
+    if (pending)
+        blocks++;
+    return blocks * l->count + (l->count - remaining);
+}
+
+void dma_pipeline_measure(dma_pipeline *p, float *items_per_second, uint32_t interval_us)
+{
+    uint32_t start[DMA_PIPELINE_MAX_STAGES - 1];
+    for (uint i = 0; i < p->num_of_stages - 1; i++)
+        start[i] = dma_pipeline_items(p, i);
+    sleep_us(interval_us);
+    for (uint i = 0; i < p->num_of_stages - 1; i++)
+        items_per_second[i] = (float)(dma_pipeline_items(p, i) - start[i]) * 1000000.f / interval_us;
+}
+
+int dma_pipeline_ready_half(dma_pipeline *p)
+{
+    if (!p->started || p->num_of_stages < 2)
+        return -1;
+    uint32_t blocks = p->links[p->num_of_stages - 2].blocks;
+    if (blocks == 0)
+        return -1;
+    return (blocks - 1) % 2;
+}
+
+uint32_t dma_pipeline_sniffer_result(dma_pipeline *p)
+{
+    return dma_hw->sniff_data;
+}
+
+void dma_pipeline_print(dma_pipeline *p)
+{
+    for (uint i = 0; i < p->num_of_stages; i++)
+    {
+        dma_pipeline_stage *s = &p->stages[i];
+        printf("stage %d: %s", i, stage_names[s->type]);
+        if (s->type == DMA_PIPELINE_SM)
+            printf(" (pio%d sm%d)", pio_get_index(s->pio), s->sm);
+        if (s->rate > 0)
+            printf(", %f items/s", s->rate);
+        printf("\n");
+        if (p->started && i < p->num_of_stages - 1)
+        {
+            dma_pipeline_link *l = &p->links[i];
+            printf("  link: dma channel %d", l->data_chan);
+            if (l->ctrl_chan >= 0)
+                printf(" (control %d)", l->ctrl_chan);
+            if (l->pacing_stage >= 0)
+                printf(", paced by stage %d (dreq %d)\n", l->pacing_stage, l->dreq);
+            else
+                printf(", unpaced\n");
+        }
+    }
+}
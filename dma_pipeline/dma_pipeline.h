@@ -0,0 +1,189 @@
+#ifndef DMA_PIPELINE_H
+#define DMA_PIPELINE_H
+
+#include "hardware/pio.h"
+#include "hardware/dma.h"
+
+/*
+ * A pipeline of stages connected by dma channels, e.g.
+ *     sm0 -> dma -> sm1 -> dma -> buffer
+ *     adc -> dma -> sm -> dma -> sniffer
+ *
+ * - stages: a state machine (in the middle or at either end), a memory buffer (first or last),
+ *   the adc (first) or the dma sniffer (last, it sums or checksums all items that reach it)
+ * - between each two stages is a dma channel (a link). Its data request (DREQ) is chosen
+ *   automatically: if both stages have a DREQ (e.g. sm -> sm), the slowest of the two paces
+ *   the link (see the nominal rates of the stages), otherwise the stage that has one
+ * - if one of the buffers is used once (DMA_PIPELINE_ONCE) the pipeline moves that number of
+ *   items and stops, otherwise it runs endlessly: a control channel restarts each link,
+ *   a buffer is then a ring (DMA_PIPELINE_RING) or two halves (DMA_PIPELINE_PINGPONG, last stage
+ *   only) of which one is filled while the other can be used
+ * - the throughput of each link can be measured
+ *
+ * Note: the sm programs themselves are loaded and configured by the caller, the pipeline
+ *       enables the state machines when it starts.
+ */
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+// the maximum number of stages in a pipeline
+#define DMA_PIPELINE_MAX_STAGES 8
+
+// the kinds of stages
+typedef enum
+{
+    DMA_PIPELINE_SM,
+    DMA_PIPELINE_BUFFER,
+    DMA_PIPELINE_ADC,
+    DMA_PIPELINE_SNIFFER
+} dma_pipeline_stage_type;
+
+// how a buffer is used
+typedef enum
+{
+    // the items are moved once, then the pipeline stops
+    DMA_PIPELINE_ONCE,
+    // endless: the buffer is a ring (its size in bytes must be a power of 2, and it must be
+    // aligned to its size)
+    DMA_PIPELINE_RING,
+    // endless, for the last stage: the buffer has two halves, one is filled while the other can be used
+    DMA_PIPELINE_PINGPONG
+} dma_pipeline_buffer_mode;
+
+// a stage
+typedef struct
+{
+    dma_pipeline_stage_type type;
+    // a sm stage
+    PIO pio;
+    uint sm;
+    // the nominal rate in items per second (0 = as fast as the dma, e.g. a buffer)
+    float rate;
+    // a buffer stage: the buffer, the number of items (for a ping-pong buffer: of each half)
+    void *buffer;
+    uint32_t length;
+    dma_pipeline_buffer_mode mode;
+    // a sniffer stage: the calculation (e.g. 0xf = sum)
+    uint sniff_mode;
+} dma_pipeline_stage;
+
+// a link: the dma channel between two stages, with a control channel if the pipeline is endless
+typedef struct
+{
+    int data_chan;
+    int ctrl_chan;
+    // the DREQ that paces the link and the stage it belongs to
+    uint dreq;
+    int pacing_stage;
+    // the number of items the data channel transfers before it is restarted (or stops)
+    uint32_t count;
+    // the number of times the data channel was restarted (counted for ping-pong only)
+    volatile uint32_t blocks;
+} dma_pipeline_link;
+
+// a pipeline
+typedef struct
+{
+    // the size of the items
+    enum dma_channel_transfer_size size;
+    uint num_of_stages;
+    dma_pipeline_stage stages[DMA_PIPELINE_MAX_STAGES];
+    dma_pipeline_link links[DMA_PIPELINE_MAX_STAGES - 1];
+    bool endless;
+    bool started;
+    // the transfer count that the control channels write into the data channels
+    uint32_t reload_count;
+    // a ping-pong sink: the addresses of the two halves (read in turn by its control channel)
+    void *pingpong_address[2] __attribute__((aligned(2 * sizeof(void *))));
+    // a sniffer sink: the data channel writes everything into this word
+    uint32_t sniff_dummy;
+} dma_pipeline;
+
+/*
+ * Initialize an empty pipeline
+ * @param size: the size of the items (DMA_SIZE_8, DMA_SIZE_16 or DMA_SIZE_32)
+ */
+void dma_pipeline_init(dma_pipeline *p, enum dma_channel_transfer_size size);
+
+/*
+ * Add a state machine stage
+ * @param rate: the nominal number of items per second the sm can handle, e.g. the system clock
+ *              divided by (the clkdiv times the number of instructions per item)
+ * returns the number of the stage, or -1 if the pipeline is full
+ */
+int dma_pipeline_add_sm(dma_pipeline *p, PIO pio, uint sm, float rate);
+
+/*
+ * Add a buffer stage (first or last stage)
+ * @param length: the number of items, for a ping-pong buffer the number of items in each half
+ * returns the number of the stage, or -1 if the pipeline is full
+ */
+int dma_pipeline_add_buffer(dma_pipeline *p, void *buffer, uint32_t length, dma_pipeline_buffer_mode mode);
+
+/*
+ * Add the adc as source (first stage), the adc itself is set up by the caller
+ * (adc_fifo_setup with DREQ enabled, the inputs and the clkdiv) and it is started by the pipeline
+ * @param rate: the number of samples per second
+ */
+int dma_pipeline_add_adc(dma_pipeline *p, float rate);
+
+/*
+ * Add the dma sniffer as sink (last stage), there is only one sniffer
+ * @param mode: the calculation, e.g. 0xf (sum), 0x0 (crc32)
+ */
+int dma_pipeline_add_sniffer(dma_pipeline *p, uint mode);
+
+/*
+ * Claim and configure the dma channels, enable the state machines and start the pipeline
+ * returns false if the pipeline isn't valid (e.g. a buffer in the middle, a ring that isn't
+ * a power of 2, or a ring to a ring: a dma channel wraps only one address), or if there are
+ * already 4 pipelines with a ping-pong buffer
+ */
+bool dma_pipeline_start(dma_pipeline *p);
+
+/*
+ * Stop the pipeline: the dma channels are aborted and unclaimed, the state machines disabled
+ * (and the adc stopped), the stages stay in the pipeline so it can be started again
+ */
+void dma_pipeline_stop(dma_pipeline *p);
+
+/*
+ * Wait until a pipeline that is used once has moved all items
+ */
+void dma_pipeline_wait(dma_pipeline *p);
+
+/*
+ * The number of items moved by a link (from stage 'link' to stage 'link' + 1) since the start
+ * Note: an endless link counts modulo 2^32
+ */
+uint32_t dma_pipeline_items(dma_pipeline *p, uint link);
+
+/*
+ * Measure the throughput of each link: the items per second during interval_us
+ * @param items_per_second: an array with a value for each link (num_of_stages - 1)
+ */
+void dma_pipeline_measure(dma_pipeline *p, float *items_per_second, uint32_t interval_us);
+
+/*
+ * The half of a ping-pong sink that was filled last (0 or 1), or -1 if none is complete yet
+ * it can be used until the other half is full
+ */
+int dma_pipeline_ready_half(dma_pipeline *p);
+
+/*
+ * The result of a sniffer sink
+ */
+uint32_t dma_pipeline_sniffer_result(dma_pipeline *p);
+
+/*
+ * Print the stages, the DREQs that pace the links and the dma channels
+ */
+void dma_pipeline_print(dma_pipeline *p);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
@@ -1,5 +1,6 @@
 
 #include "stdio.h"
+#include "string.h"
 #include "pico/stdlib.h"
 #include "hardware/pio.h"
 #include "hardware/dma.h"
@@ -8,15 +9,24 @@
 #include "ledpanel.pio.h"
 #include "pico/multicore.h"
 #include "ledpanel.h"
+#ifdef BENCHMARK
+#include "benchmark.h"
+#endif
 
-// Overall brightness: a number from 0 (dim) to 7 (brightest)
-uint overall_brightness = 7;
+// Overall brightness: a number from 0 (dim) to max_overall_brightness (brightest)
+uint overall_brightness = max_overall_brightness;
 
 // the image to be displayed (a pointer) and the two actual variables for double buffering
 uint currently_drawing = 1;
-uint (*image)[num_of_displays * columns_of_display];
-uint image1[rows_of_display][num_of_displays * columns_of_display];
-uint image2[rows_of_display][num_of_displays * columns_of_display];
+uint16_t *image;
+uint16_t image1[max_pixels];
+uint16_t image2[max_pixels];
+
+// the configuration of the chain of panels (see configure_panels)
+uint num_of_displays = 2;
+uint columns_of_display = 64;
+uint rows_of_display = 64;
+uint half_rows_of_display = 32;
 
 // 0 = no image ready or processing finished
 // 1 = producer (core 0, in this file) has finished producing image 1
@@ -24,26 +34,73 @@ uint image2[rows_of_display][num_of_displays * columns_of_display];
 uint image_ready = 0;
 uint image_processing = 0;
 
+// the changed half rows of image1 and image2, for both encoded images on core 1
+// all rows start as changed: nothing has been encoded yet
+uint32_t image_dirty_rows[2][2] = {{all_rows_dirty, all_rows_dirty}, {all_rows_dirty, all_rows_dirty}};
+
+// set the configuration of the chain of panels (before core 1 is started)
+// displays: the number of panels in the chain
+// columns, rows: the size of one panel
+bool configure_panels(uint displays, uint columns, uint rows)
+{
+    // two columns go into one item for the sm (and the columns are divided over the sm's),
+    // row and row+rows/2 are sent together
+    if (displays == 0 || (displays * columns) % (2 * num_of_sms) != 0 || rows % 2 != 0 || rows == 0 || rows / 2 > max_half_rows)
+    {
+        printf("configure_panels: %d panels of %d x %d is not supported\n", displays, columns, rows);
+        return false;
+    }
+    // the image has to fit in the image variables
+    if (displays * columns * rows > max_pixels)
+    {
+        printf("configure_panels: %d pixels do not fit, raise max_pixels in ledpanel.h\n", displays * columns * rows);
+        return false;
+    }
+    num_of_displays = displays;
+    columns_of_display = columns;
+    rows_of_display = rows;
+    half_rows_of_display = rows / 2;
+    return true;
+}
+
 /******************************************************************************
  * some simple routines to draw the image for the test patterns
  *****************************************************************************/
 
+// mark a row of the image that is being drawn as changed, so core 1 encodes it again
+void mark_row_dirty(uint row)
+{
+    // row and row+32 are encoded together
+    uint32_t half_row = 1u << (row % half_rows_of_display);
+    image_dirty_rows[currently_drawing - 1][0] |= half_row;
+    image_dirty_rows[currently_drawing - 1][1] |= half_row;
+}
+
+// the position of R, G and B in a pixel: Red no shift, Green 8 bits, Blue 4 bits
+static const uint color_shift[3] = {0, 8, 4};
+
 // set the color + brightness for a pixel
 void set_pixel(uint row, uint column, uint c, uint brightness)
 {
+    uint16_t old_value = pixel(image, row, column);
     // leave the other two colors untouched to allow mixing
-    if (c == R) // Red: do not shift
-        image[row][column] |= brightness;
-    else if (c == G) // Green: shift over 8 bits
-        image[row][column] |= brightness << 8;
-    else // Blue: shift 4 bits
-        image[row][column] |= brightness << 4;
+    uint16_t new_value = old_value | brightness << color_shift[c];
+    if (new_value != old_value)
+    {
+        pixel(image, row, column) = new_value;
+        mark_row_dirty(row);
+    }
 }
 
 // set the individual colors + brightnesses for a pixel
 void set_pixel_c(uint row, uint column, uint R_brightness, uint G_brightness, uint B_brightness)
 {
-    image[row][column] = R_brightness | G_brightness << 8 | B_brightness << 4;
+    uint16_t new_value = color(R_brightness, G_brightness, B_brightness);
+    if (pixel(image, row, column) != new_value)
+    {
+        pixel(image, row, column) = new_value;
+        mark_row_dirty(row);
+    }
 }
 
 // draw a horizontal line
@@ -61,11 +118,16 @@ void column_line(uint column, uint row_start, uint row_end, uint c, uint brightn
 }
 
 // make an empty image
+// Note: only rows that were not already empty are marked as changed
 void clear_image()
 {
     for (uint x = 0; x < rows_of_display; x++)
         for (uint y = 0; y < num_of_displays * columns_of_display; y++)
-            image[x][y] = 0;
+            if (pixel(image, x, y) != 0)
+            {
+                pixel(image, x, y) = 0;
+                mark_row_dirty(x);
+            }
 }
 
 // color wheel (from Adafruit strand test)
@@ -127,25 +189,85 @@ int main()
     image = image1;
     currently_drawing = 1;
 
-    // TODO: remove (only for testing purposes)
-    gpio_init(timing_pin_build_image);
-    gpio_set_dir(timing_pin_build_image, GPIO_OUT);
+    // the timing pin of core 0 (only with USE_TIMING_PINS)
+    timing_pin_init(timing_pin_build_image);
 
     // needed for printf
     stdio_init_all();
 
+    // the chain of panels: two 64x64 panels
+    configure_panels(2, 64, 64);
+    printf("refresh rate: %.1f Hz\n", refresh_rate());
+
     // start with an empty image
     clear_image();
 
+#ifdef BENCHMARK
+    // the benchmark build (make benchmarks): encode and show a rainbow pattern on core 0
+    benchmark_init("ledpanel");
+    for (uint row = 0; row < rows_of_display; row++)
+        for (uint column = 0; column < num_of_displays * columns_of_display; column++)
+        {
+            uint r, g, b;
+            wheel((row + column) % 256, &r, &g, &b);
+            set_pixel_c(row, column, (int)(r * 0.0627), (int)(g * 0.04), (int)(b * 0.0627));
+        }
+    ledpanel_benchmark();
+    benchmark_done();
+    while (true)
+        tight_loop_contents();
+#endif
+
     // Start core 1. Core 1 continuously transcodes the image
     // to a format that can be used with the pio code on the
     // state machine..
     multicore_launch_core1(core1_worker);
 
+#ifdef STREAM_FROM_USB
+    // show the frames sent by the host (see ledpanel_stream.py) forever
+    while (true)
+        if (stream_frame(1000000))
+            switch_buffer();
+#endif
+
     // show the test patterns forever
     while (true)
     {
 
+        // /*
+        //
+        // Test pattern 4: the blitter, a text scrolls over a rectangle and a ball bounces
+        //
+
+        // the ball: a sprite with transparent corners
+        static const uint16_t o = transparent, w = color(15, 15, 15), y = color(15, 10, 0);
+        static const uint16_t ball_pixels[] = {
+            o, o, y, y, o, o,
+            o, y, w, y, y, o,
+            y, w, y, y, y, y,
+            y, y, y, y, y, y,
+            o, y, y, y, y, o,
+            o, o, y, y, o, o};
+        static const sprite ball = {6, 6, ball_pixels};
+        const char *text = "Hello from the blitter!";
+        int text_width = strlen(text) * (font_5x7.width + 1);
+        int ball_row = 0, ball_step = 1;
+        for (int column = num_of_displays * columns_of_display; column > -text_width; column--)
+        {
+            clear_image();
+            fill_rect(rows_of_display / 2 - 6, 0, 12, num_of_displays * columns_of_display, color(0, 0, 4));
+            draw_text(&font_5x7, rows_of_display / 2 - 3, column, text, color(15, 15, 0));
+            draw_sprite(&ball, ball_row, (column + text_width) % (num_of_displays * columns_of_display));
+            // bounce between the top and the bottom
+            ball_row += ball_step;
+            if (ball_row == 0 || ball_row == (int)rows_of_display - 6)
+                ball_step = -ball_step;
+            // signal to core 1 that the image is ready, and switch image buffer
+            switch_buffer();
+            sleep_ms(20);
+        }
+        // */
+
         // /*
         //
         // Test pattern 3: make the rainbow pattern that shifts with time
@@ -153,7 +275,7 @@ int main()
 
         for (int current_t = 0; current_t < 255; current_t++)
         {
-            gpio_put(timing_pin_build_image, 1); // TODO: remove (only for testing purposes)
+            timing_pin_put(timing_pin_build_image, 1);
             uint r, g, b;
             // make a rainbow pattern
             for (uint row = 0; row < rows_of_display; row++)
@@ -164,7 +286,7 @@ int main()
                     set_pixel_c(row, column, (int)(r * 0.0627), (int)(g * 0.04), (int)(b * 0.0627));
                 }
 
-            gpio_put(timing_pin_build_image, 0); // TODO: remove (only for testing purposes)
+            timing_pin_put(timing_pin_build_image, 0);
             // signal to core 1 that the image is ready, and switch image buffer
             switch_buffer();
         }
@@ -176,9 +298,9 @@ int main()
         //
 
         // change the overall brightness
-        for (uint b = 0; b <= 7; b++)
+        for (uint b = 0; b <= max_overall_brightness; b++)
         {
-            gpio_put(timing_pin_build_image, 1); // TODO: remove (only for testing purposes)
+            timing_pin_put(timing_pin_build_image, 1);
 
             clear_image();
 
@@ -204,7 +326,7 @@ int main()
             }
 
             overall_brightness = b;
-            gpio_put(timing_pin_build_image, 0); // TODO: remove (only for testing purposes)
+            timing_pin_put(timing_pin_build_image, 0);
             // signal to core 1 that the image is ready, and switch image buffer
             switch_buffer();
             // pause 1 seconds
@@ -222,7 +344,7 @@ int main()
         {
             for (uint current_t = 0; current_t < num_of_displays * columns_of_display; current_t++)
             {
-                gpio_put(timing_pin_build_image, 1); // TODO: remove (only for testing purposes)
+                timing_pin_put(timing_pin_build_image, 1);
                 uint current_x = current_t % rows_of_display;
                 uint current_y = current_t;
                 // prepare an empty image
@@ -231,7 +353,7 @@ int main()
                 column_line(current_y, 0, rows_of_display, R, 15);
                 column_line((current_y + 64) % (num_of_displays * columns_of_display), 0, rows_of_display, G, 15);
                 row_line(current_x, 0, num_of_displays * columns_of_display, B, 15);
-                gpio_put(timing_pin_build_image, 0); // TODO: remove (only for testing purposes)
+                timing_pin_put(timing_pin_build_image, 0);
                 // signal to core 1 that the image is ready, and switch image buffer
                 switch_buffer();
             }
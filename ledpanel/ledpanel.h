@@ -12,11 +12,14 @@ clock settings (=125MHz.)
 
 Concept of operation
 The user prepares an image. In this code this happens on core 0. 
-The main function has code for three test patterns, that each produce several 
+The main function has code for four test patterns, that each produce several 
 images to make a small animation.
 These images are transcoded on core 1 to a datastructure suitable for the pio 
 state machine (sm) to control the display. The pio state machine (sm) 
 continuously updates the display via direct memory access (DMA).
+The transcoded data is also double buffered: core 1 transcodes into one buffer
+while the DMA sends the other one to the sm. A second DMA channel restarts the
+first one at the end of each frame, switching buffers only at that boundary.
 
 
 */
@@ -33,14 +36,35 @@ continuously updates the display via direct memory access (DMA).
  * Display settings
  *****************************************************************************/
 
-// The display configuration:
-//      I use two 64x64 ledpanels. to use a smaller configuration: just let part
-//      of the image blank (0 brightness)
-// Do not change (the PIO code assumes this configuration hard coded):
-#define num_of_displays 2
-#define columns_of_display 64
-#define rows_of_display 64
-#define half_rows_of_display 32
+/*
+The display configuration
+
+I use two 64x64 ledpanels, but the panels are set at runtime with configure_panels()
+(call it before core 1 is started): the number of panels in the chain and the
+columns and rows of one panel, for example:
+    configure_panels(2, 64, 64)    two 64x64 panels (1/32 scan), the default
+    configure_panels(1, 32, 32)    one 32x32 panel (1/16 scan)
+    configure_panels(4, 64, 32)    a chain of four 64x32 panels (1/16 scan)
+    configure_panels(8, 32, 32)    a chain of eight 32x32 panels (1/16 scan)
+Rows r and r+rows/2 are always sent together, so a panel with 64 rows is 1/32 scan 
+and a panel with 32 rows is 1/16 scan (address line E is then not used).
+The image and encoded image buffers are allocated for max_pixels, this determines
+the largest chain. Raising it costs memory: 2 bytes per pixel for each of the two 
+images and (in the encoded images) 4 bytes per 4 pixels for each bit plane.
+The refresh rate follows from the configuration, see refresh_rate().
+*/
+#define max_pixels (128 * 64)
+// rows r and r+half_rows_of_display are sent together: 5 address lines -> 32
+#define max_half_rows 32
+// the configuration (set by configure_panels)
+extern uint num_of_displays;
+extern uint columns_of_display;
+extern uint rows_of_display;
+extern uint half_rows_of_display;
+// set the configuration of the chain of panels, returns false if it does not fit
+extern bool configure_panels(uint displays, uint columns, uint rows);
+// the refresh rate (Hz) of the display for the configuration and overall brightness
+extern float refresh_rate();
 
 /* 
   The pin assignment has been chosen such that the PIO sm can use 'out PINS' 
@@ -84,10 +108,52 @@ continuously updates the display via direct memory access (DMA).
 #define clock_p 14
 #define blank 15
 
-// TODO: remove (only for testing purposes)
+/*
+Two state machines
+
+For long chains the panels can be split over two connectors: the first half of the
+columns is sent by one sm on the pins above, the second half by a second sm on its own
+RGB pins (panel2_r1 to panel2_b2). The address, latch, clock and blank pins are shared
+by both connectors: the two sm's run the same program in lockstep, so they produce the
+same values for them. Each sm has to shift out only half of the columns, so the time
+per row for the pixel data is halved (see refresh_rate()).
+Uncomment the next line to use two state machines:
+*/
+// #define USE_TWO_STATE_MACHINES
+#ifdef USE_TWO_STATE_MACHINES
+#define num_of_sms 2
+#define panel2_r1 19
+#define panel2_g1 20
+#define panel2_b1 21
+#define panel2_r2 22
+#define panel2_g2 23
+#define panel2_b2 24
+#else
+#define num_of_sms 1
+#endif
+
+/*
+Timing pins (for a logic analyzer)
+- timing_pin_DMA is high while core 1 waits for the end of a frame to reuse an encoded image
+- timing_pin_convert is high while core 1 transcodes an image
+- timing_pin_build_image is high while core 0 builds an image of a test pattern
+Uncomment the next line to use them, otherwise the pins are not touched.
+*/
+// #define USE_TIMING_PINS
+#ifdef USE_TIMING_PINS
 #define timing_pin_DMA 16
 #define timing_pin_convert 17
 #define timing_pin_build_image 18
+#define timing_pin_init(pin)         \
+    {                                \
+        gpio_init(pin);              \
+        gpio_set_dir(pin, GPIO_OUT); \
+    }
+#define timing_pin_put(pin, value) gpio_put(pin, value)
+#else
+#define timing_pin_init(pin)
+#define timing_pin_put(pin, value)
+#endif
 
 /******************************************************************************
  * Image and its encoding for the state machine
@@ -108,10 +174,27 @@ The time the LEDs are on is the longest for the 4th bit and the shortest for
 the 1st bit.
 
 
+Bit planes and gamma (binary code modulation):
+The image always has 4 bits for each color, but more bit planes can be displayed:
+with gamma correction the 16 color values are mapped onto 'bit_planes' bits
+(e.g. 8 bit planes = 256 levels of which the 16 used ones follow the gamma curve), 
+which makes the dark colors much smoother. Each bit plane is displayed twice as
+long as the bit plane below it (binary code modulation). More bit planes need more
+time per frame, so the maximum overall brightness is lowered to keep the refresh
+rate at or above 120 Hz (at 125 MHz):
+    bit_planes  max_overall_brightness  refresh rate
+    4           7                       144 Hz
+    6           5                       133 Hz
+    7           4                       130 Hz
+    8           3                       127 Hz
+More than 4 bit planes and gamma correction require the lookup table encoder 
+(see below).
+
 Setting the overall brightness:
 The variable 'overall_brightness' controls overall brightness in addition to the 
-16 brightness levels of each red, green, and blue pixel values. It does this by
-bit-shifting the delay time to higher values. It can take on values from 0 to 7.
+brightness levels of each red, green, and blue pixel values. It does this by
+bit-shifting the delay time to higher values. It can take on values from 0 to 
+max_overall_brightness (7 for 4 bit planes).
 Taking the 4 bits encoding of the color, and shifting it by a maximum of 7 bits 
 results in a 11-bit number. This number is used as the counter for the delay loop.
 
@@ -121,8 +204,31 @@ More 'nop' statements can be added. But this will also lower the update rate
 of the display.
 
 */
+// the number of bit planes that are displayed: 4 to 8
+#define bit_planes 4
+// the delay for a bit plane is an 11 bit number: 1 << (overall_brightness + bit plane)
+#define max_overall_brightness (11 - bit_planes)
+// comment out to display the 4 bit colors linearly
+// #define USE_GAMMA_CORRECTION
+#define gamma_correction 2.2f
+#if bit_planes < 4 || bit_planes > 8
+#error "bit_planes must be 4 to 8"
+#endif
+
 extern uint overall_brightness;
 
+/*
+Encoder
+
+Core 1 transcodes the image for the sm with one of two encoders (see ledpanel_worker.c):
+- the interpolator hardware reorders the bits of each pixel for each brightness level
+- lookup tables give the bits of a pixel for all bit planes at once (and apply the gamma correction)
+The time each takes can be compared on the timing_pin_convert pin (see USE_TIMING_PINS), or with the benchmark
+build (make benchmarks, see ../benchmark).
+Comment out the next line to use the interpolator.
+*/
+#define USE_LOOKUP_TABLE_ENCODER
+
 // Just for ease of use: assign numbers 0, 1 and 2 to Red, Green, and Blue
 #define R 0
 #define G 1
@@ -138,13 +244,109 @@ Green (shift 8 bits). So the values in image look like:
 g4, g3, g2, g1, b4, b3, b2, b1, r4, r3, r2, r1
 where g4 is the highest brightness bit of green, g1 is the lowest brightness 
 bit of green, similar for blue and red
+These 12 bits are packed in 16 bits per pixel (the upper 4 bits are 0), the 
+color() macro makes such a value.
+
+Since the size of the image is set at runtime (see configure_panels), the rows 
+of the image follow each other in the image variable:
+    image[row * num_of_displays * columns_of_display + column]
+use the pixel() macro for that.
 
 Double buffering is used, so two image variables:
 */
-extern uint image1[rows_of_display][num_of_displays * columns_of_display];
-extern uint image2[rows_of_display][num_of_displays * columns_of_display];
+extern uint16_t image1[max_pixels];
+extern uint16_t image2[max_pixels];
 // the pointer to one of the two above image variables
-extern uint (*image)[num_of_displays * columns_of_display];
+extern uint16_t *image;
+// a pixel of an image
+#define pixel(img, row, column) ((img)[(row) * num_of_displays * columns_of_display + (column)])
+// the packed value of a color (each 0 to 15)
+#define color(red, green, blue) ((uint16_t)((red) | (green) << 8 | (blue) << 4))
+
+/*
+Changed (dirty) rows
+
+Core 1 only encodes the parts of an image that have changed. The drawing functions
+in ledpanel.c (set_pixel, set_pixel_c, row_line, column_line and clear_image) keep
+track of which rows have changed: bit r is set when row r or row r+32 (they are
+encoded together) has changed. If 'image' is written to directly, mark_row_dirty()
+has to be called for the changed rows.
+Core 1 has two encoded images (see ledpanel_worker.c), each of which has to catch up
+with the changes separately, thus the changes are kept for both of them:
+    image_dirty_rows[image number - 1][encoded image]
+*/
+#define all_rows_dirty 0xFFFFFFFF
+extern uint32_t image_dirty_rows[2][2];
+// mark a row of the image that is being drawn as changed
+extern void mark_row_dirty(uint row);
+// signal to core 1 that the image is ready, and switch to the other image (see ledpanel.c)
+extern void switch_buffer();
+
+/*
+Blitter
+
+Drawing functions (ledpanel_blit.c) that write whole rows of the image at once, 
+clipped to the image (a sprite or text can be partly outside it), and mark only the
+rows that have changed:
+    fill_rect(row, column, height, width, color)
+    draw_sprite(&s, row, column)   a sprite: packed pixels, 'transparent' pixels are
+                                   not drawn (the bits above the 12 color bits)
+    draw_text(&font_5x7, row, column, "text", color)
+                                   a 1-bit font: a column of (up to 8) pixels per byte,
+                                   the lowest bit is the top row. Only the set bits are
+                                   drawn (the background stays as it is)
+*/
+#define transparent 0x8000
+typedef struct
+{
+    uint width;
+    uint height;
+    // the pixels, row after row
+    const uint16_t *pixels;
+} sprite;
+typedef struct
+{
+    uint8_t width;
+    uint8_t height;
+    // the first and last character in the font
+    uint8_t first;
+    uint8_t last;
+    // 'width' bytes (columns) for each character
+    const uint8_t *columns;
+} font;
+// a 5x7 font of the ascii characters 32 to 126
+extern const font font_5x7;
+extern void fill_rect(int row, int column, uint height, uint width, uint16_t c);
+extern void draw_sprite(const sprite *s, int row, int column);
+// returns the column after the text (characters are 1 column apart)
+extern int draw_text(const font *f, int row, int column, const char *text, uint16_t c);
+
+/*
+Streaming frames
+
+With STREAM_FROM_USB the main loop receives the images over USB serial (stdio) instead
+of drawing the test patterns, e.g. live video from a host. A frame is compressed:
+    'L', 'P'                the start of a frame (the receiver syncs on it)
+    records, for the pixels in order (row after row):
+        n = 1 to 127        a run of n pixels of the color that follows (2 bytes,
+                            little endian)
+        n = 128 to 255      skip n - 127 pixels: they are the same as in the
+                            previous frame (delta)
+        n = 0               the end of the frame
+A frame with only runs is a complete (RLE) frame, a frame with skips only sends what
+has changed. The records are decoded straight into the image, and only the rows with
+runs are marked as changed (so core 1 only encodes those). Because of the double
+buffering the image has the frame before the previous one: the rows that the previous
+frame changed are copied from the other image first, not the whole image.
+A frame has to cover all pixels of the image. If a frame is not complete (a timeout) or
+doesn't cover the image, the rows it changed are copied back from the last complete frame,
+and from then on frames with skips are refused until a frame without skips arrives: the
+host has to send such a complete frame regularly (the first frame has to be one too).
+*/
+// #define STREAM_FROM_USB
+// receive one frame into the image, returns false if the frame was not complete (timeout),
+// didn't cover the image or had skips while a complete frame is needed
+extern bool stream_frame(uint32_t timeout_us);
 
 /*
 Both cores of the Pico are used:
@@ -162,4 +364,9 @@ extern uint image_ready;
 // indicates which image is being processed on core 1
 extern uint image_processing;
 
+#ifdef BENCHMARK
+// the benchmark build (make benchmarks): encode and show image1 on core 0 and print the results
+extern void ledpanel_benchmark();
+#endif
+
 #endif 
@@ -0,0 +1,321 @@
+#include "stdio.h"
+#include "string.h"
+#include "pico/stdlib.h"
+#include "ledpanel.h"
+
+/******************************************************************************
+ * the blitter: rectangles, sprites and text (see ledpanel.h)
+ *****************************************************************************/
+
+// the number of columns of the image
+#define image_columns (num_of_displays * columns_of_display)
+
+// the 5x7 font: 5 columns per character, the lowest bit is the top row
+static const uint8_t font_5x7_columns[] = {
+    0x00, 0x00, 0x00, 0x00, 0x00, // ' '
+    0x00, 0x00, 0x5F, 0x00, 0x00, // !
+    0x00, 0x07, 0x00, 0x07, 0x00, // "
+    0x14, 0x7F, 0x14, 0x7F, 0x14, // #
+    0x24, 0x2A, 0x7F, 0x2A, 0x12, // $
+    0x23, 0x13, 0x08, 0x64, 0x62, // %
+    0x36, 0x49, 0x55, 0x22, 0x50, // &
+    0x00, 0x05, 0x03, 0x00, 0x00, // '
+    0x00, 0x1C, 0x22, 0x41, 0x00, // (
+    0x00, 0x41, 0x22, 0x1C, 0x00, // )
+    0x14, 0x08, 0x3E, 0x08, 0x14, // *
+    0x08, 0x08, 0x3E, 0x08, 0x08, // +
+    0x00, 0x50, 0x30, 0x00, 0x00, // ,
+    0x08, 0x08, 0x08, 0x08, 0x08, // -
+    0x00, 0x60, 0x60, 0x00, 0x00, // .
+    0x20, 0x10, 0x08, 0x04, 0x02, // /
+    0x3E, 0x51, 0x49, 0x45, 0x3E, // 0
+    0x00, 0x42, 0x7F, 0x40, 0x00, // 1
+    0x42, 0x61, 0x51, 0x49, 0x46, // 2
+    0x21, 0x41, 0x45, 0x4B, 0x31, // 3
+    0x18, 0x14, 0x12, 0x7F, 0x10, // 4
+    0x27, 0x45, 0x45, 0x45, 0x39, // 5
+    0x3C, 0x4A, 0x49, 0x49, 0x30, // 6
+    0x01, 0x71, 0x09, 0x05, 0x03, // 7
+    0x36, 0x49, 0x49, 0x49, 0x36, // 8
+    0x06, 0x49, 0x49, 0x29, 0x1E, // 9
+    0x00, 0x36, 0x36, 0x00, 0x00, // :
+    0x00, 0x56, 0x36, 0x00, 0x00, // ;
+    0x08, 0x14, 0x22, 0x41, 0x00, // <
+    0x14, 0x14, 0x14, 0x14, 0x14, // =
+    0x00, 0x41, 0x22, 0x14, 0x08, // >
+    0x02, 0x01, 0x51, 0x09, 0x06, // ?
+    0x32, 0x49, 0x79, 0x41, 0x3E, // @
+    0x7E, 0x11, 0x11, 0x11, 0x7E, // A
+    0x7F, 0x49, 0x49, 0x49, 0x36, // B
+    0x3E, 0x41, 0x41, 0x41, 0x22, // C
+    0x7F, 0x41, 0x41, 0x22, 0x1C, // D
+    0x7F, 0x49, 0x49, 0x49, 0x41, // E
+    0x7F, 0x09, 0x09, 0x09, 0x01, // F
+    0x3E, 0x41, 0x49, 0x49, 0x7A, // G
+    0x7F, 0x08, 0x08, 0x08, 0x7F, // H
+    0x00, 0x41, 0x7F, 0x41, 0x00, // I
+    0x20, 0x40, 0x41, 0x3F, 0x01, // J
+    0x7F, 0x08, 0x14, 0x22, 0x41, // K
+    0x7F, 0x40, 0x40, 0x40, 0x40, // L
+    0x7F, 0x02, 0x0C, 0x02, 0x7F, // M
+    0x7F, 0x04, 0x08, 0x10, 0x7F, // N
+    0x3E, 0x41, 0x41, 0x41, 0x3E, // O
+    0x7F, 0x09, 0x09, 0x09, 0x06, // P
+    0x3E, 0x41, 0x51, 0x21, 0x5E, // Q
+    0x7F, 0x09, 0x19, 0x29, 0x46, // R
+    0x46, 0x49, 0x49, 0x49, 0x31, // S
+    0x01, 0x01, 0x7F, 0x01, 0x01, // T
+    0x3F, 0x40, 0x40, 0x40, 0x3F, // U
+    0x1F, 0x20, 0x40, 0x20, 0x1F, // V
+    0x3F, 0x40, 0x38, 0x40, 0x3F, // W
+    0x63, 0x14, 0x08, 0x14, 0x63, // X
+    0x07, 0x08, 0x70, 0x08, 0x07, // Y
+    0x61, 0x51, 0x49, 0x45, 0x43, // Z
+    0x00, 0x7F, 0x41, 0x41, 0x00, // [
+    0x02, 0x04, 0x08, 0x10, 0x20, // backslash
+    0x00, 0x41, 0x41, 0x7F, 0x00, // ]
+    0x04, 0x02, 0x01, 0x02, 0x04, // ^
+    0x40, 0x40, 0x40, 0x40, 0x40, // _
+    0x00, 0x01, 0x02, 0x04, 0x00, // `
+    0x20, 0x54, 0x54, 0x54, 0x78, // a
+    0x7F, 0x48, 0x44, 0x44, 0x38, // b
+    0x38, 0x44, 0x44, 0x44, 0x20, // c
+    0x38, 0x44, 0x44, 0x48, 0x7F, // d
+    0x38, 0x54, 0x54, 0x54, 0x18, // e
+    0x08, 0x7E, 0x09, 0x01, 0x02, // f
+    0x0C, 0x52, 0x52, 0x52, 0x3E, // g
+    0x7F, 0x08, 0x04, 0x04, 0x78, // h
+    0x00, 0x44, 0x7D, 0x40, 0x00, // i
+    0x20, 0x40, 0x44, 0x3D, 0x00, // j
+    0x7F, 0x10, 0x28, 0x44, 0x00, // k
+    0x00, 0x41, 0x7F, 0x40, 0x00, // l
+    0x7C, 0x04, 0x18, 0x04, 0x78, // m
+    0x7C, 0x08, 0x04, 0x04, 0x78, // n
+    0x38, 0x44, 0x44, 0x44, 0x38, // o
+    0x7C, 0x14, 0x14, 0x14, 0x08, // p
+    0x08, 0x14, 0x14, 0x18, 0x7C, // q
+    0x7C, 0x08, 0x04, 0x04, 0x08, // r
+    0x48, 0x54, 0x54, 0x54, 0x20, // s
+    0x04, 0x3F, 0x44, 0x40, 0x20, // t
+    0x3C, 0x40, 0x40, 0x20, 0x7C, // u
+    0x1C, 0x20, 0x40, 0x20, 0x1C, // v
+    0x3C, 0x40, 0x30, 0x40, 0x3C, // w
+    0x44, 0x28, 0x10, 0x28, 0x44, // x
+    0x0C, 0x50, 0x50, 0x50, 0x3C, // y
+    0x44, 0x64, 0x54, 0x4C, 0x44, // z
+    0x00, 0x08, 0x36, 0x41, 0x00, // {
+    0x00, 0x00, 0x7F, 0x00, 0x00, // |
+    0x00, 0x41, 0x36, 0x08, 0x00, // }
+    0x08, 0x04, 0x08, 0x10, 0x08, // ~
+};
+const font font_5x7 = {5, 7, ' ', '~', font_5x7_columns};
+
+// fill a rectangle with a color
+void fill_rect(int row, int column, uint height, uint width, uint16_t c)
+{
+    // clip the rectangle to the image
+    int row_end = row + (int)height;
+    int column_end = column + (int)width;
+    if (row < 0)
+        row = 0;
+    if (column < 0)
+        column = 0;
+    if (row_end > (int)rows_of_display)
+        row_end = rows_of_display;
+    if (column_end > (int)image_columns)
+        column_end = image_columns;
+    for (int r = row; r < row_end; r++)
+    {
+        uint16_t *p = &pixel(image, r, 0);
+        bool changed = false;
+        for (int x = column; x < column_end; x++)
+            if (p[x] != c)
+            {
+                p[x] = c;
+                changed = true;
+            }
+        if (changed)
+            mark_row_dirty(r);
+    }
+}
+
+// draw a sprite with its top left corner at (row, column), without its transparent pixels
+void draw_sprite(const sprite *s, int row, int column)
+{
+    for (uint y = 0; y < s->height; y++)
+    {
+        int r = row + (int)y;
+        if (r < 0 || r >= (int)rows_of_display)
+            continue;
+        uint16_t *p = &pixel(image, r, 0);
+        const uint16_t *from = s->pixels + y * s->width;
+        bool changed = false;
+        for (uint x = 0; x < s->width; x++)
+        {
+            int i = column + (int)x;
+            if (i < 0 || i >= (int)image_columns || (from[x] & transparent))
+                continue;
+            if (p[i] != from[x])
+            {
+                p[i] = from[x];
+                changed = true;
+            }
+        }
+        if (changed)
+            mark_row_dirty(r);
+    }
+}
+
+// draw a text with its top left corner at (row, column), only the pixels of the characters
+int draw_text(const font *f, int row, int column, const char *text, uint16_t c)
+{
+    for (; *text != 0; text++, column += f->width + 1)
+    {
+        uint8_t ch = *text;
+        if (ch < f->first || ch > f->last)
+            continue;
+        const uint8_t *columns = f->columns + (ch - f->first) * f->width;
+        for (uint x = 0; x < f->width; x++)
+        {
+            int i = column + (int)x;
+            if (i < 0 || i >= (int)image_columns)
+                continue;
+            for (uint y = 0; y < f->height; y++)
+            {
+                int r = row + (int)y;
+                if ((columns[x] & (1u << y)) == 0 || r < 0 || r >= (int)rows_of_display)
+                    continue;
+                if (pixel(image, r, i) != c)
+                {
+                    pixel(image, r, i) = c;
+                    mark_row_dirty(r);
+                }
+            }
+        }
+    }
+    return column;
+}
+
+/******************************************************************************
+ * streaming compressed frames over USB serial (see ledpanel.h)
+ *****************************************************************************/
+
+// the image the last complete frame was received in, and its rows with runs
+static uint16_t *last_frame = NULL;
+static uint64_t last_frame_rows = 0;
+// the image that has been brought up to date with the last frame, and the rows with runs
+// in the frame that is being received in it
+static uint16_t *prepared = NULL;
+static uint64_t frame_rows = 0;
+// after a failed frame the skips of the next frames are relative to a frame that isn't in
+// the image (and the sync may have been on 'L', 'P' in the pixel data): only a frame
+// without skips is accepted then. There is no frame before the first one either
+static bool need_full_frame = true;
+
+// the next byte from the host, -1 on a timeout
+static int next_byte(uint32_t timeout_us)
+{
+    int c = getchar_timeout_us(timeout_us);
+    return (c == PICO_ERROR_TIMEOUT) ? -1 : c;
+}
+
+// a frame is not complete (a timeout) or doesn't fit: undo the rows it changed, so the image
+// is the last complete frame again, and wait for a frame without skips. Returns false
+static bool frame_failed(void)
+{
+    uint width = image_columns;
+    if (last_frame != NULL && last_frame != image)
+        for (uint r = 0; r < rows_of_display; r++)
+            if (frame_rows & (1ull << r))
+            {
+                memcpy(&pixel(image, r, 0), &pixel(last_frame, r, 0), width * sizeof(uint16_t));
+                mark_row_dirty(r);
+            }
+    frame_rows = 0;
+    need_full_frame = true;
+    return false;
+}
+
+bool stream_frame(uint32_t timeout_us)
+{
+    uint width = image_columns;
+    uint num_of_pixels = rows_of_display * width;
+    // because of the double buffering the image has the frame before the previous one:
+    // copy the rows that the previous frame changed (once, also if a frame is incomplete)
+    if (prepared != image)
+    {
+        if (last_frame != NULL && last_frame != image)
+            for (uint r = 0; r < rows_of_display; r++)
+                if (last_frame_rows & (1ull << r))
+                {
+                    memcpy(&pixel(image, r, 0), &pixel(last_frame, r, 0), width * sizeof(uint16_t));
+                    mark_row_dirty(r);
+                }
+        prepared = image;
+        frame_rows = 0;
+    }
+    // sync on the start of a frame: 'L', 'P'
+    int c = 0;
+    do
+    {
+        int previous = c;
+        c = next_byte(timeout_us);
+        if (c < 0)
+            return false;
+        if (previous == 'L' && c == 'P')
+            break;
+    } while (true);
+    // the records, up to the end of the frame
+    uint p = 0;
+    while (true)
+    {
+        int n = next_byte(timeout_us);
+        if (n < 0)
+            return frame_failed();
+        if (n == 0)
+            break;
+        if (n >= 128)
+        {
+            // skip: the pixels are the same as in the previous frame
+            if (need_full_frame)
+                return frame_failed();
+            p += n - 127;
+            continue;
+        }
+        int low = next_byte(timeout_us);
+        int high = next_byte(timeout_us);
+        if (low < 0 || high < 0)
+            return frame_failed();
+        uint16_t value = (uint16_t)((high << 8 | low) & 0x0FFF);
+        // a run of n pixels, the part outside the image is ignored (and fails the frame)
+        uint run_end = p + n;
+        uint end = (run_end < num_of_pixels) ? run_end : num_of_pixels;
+        while (p < end)
+        {
+            uint r = p / width;
+            uint16_t *row = &pixel(image, r, 0);
+            uint last = (end - r * width < width) ? end - r * width : width;
+            bool changed = false;
+            for (uint x = p - r * width; x < last; x++)
+                if (row[x] != value)
+                {
+                    row[x] = value;
+                    changed = true;
+                }
+            if (changed)
+            {
+                mark_row_dirty(r);
+                frame_rows |= 1ull << r;
+            }
+            p = r * width + last;
+        }
+        p = run_end;
+    }
+    // a frame has exactly the pixels of the image (this also catches most false syncs)
+    if (p != num_of_pixels)
+        return frame_failed();
+    last_frame = image;
+    last_frame_rows = frame_rows;
+    need_full_frame = false;
+    return true;
+}
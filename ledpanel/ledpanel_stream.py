@@ -0,0 +1,70 @@
+#!/usr/bin/env python3
+# Send compressed frames to the ledpanel built with STREAM_FROM_USB (see ledpanel.h)
+#
+# usage: python3 ledpanel_stream.py /dev/ttyACM0
+# A frame is a list of rows of packed pixels (red | green << 8 | blue << 4, each 0 to 15).
+# encode_frame() makes the runs of the pixels that have changed since the previous frame and
+# skips the others. The demo sends a rainbow that shifts with time, with a complete frame every
+# second: after a lost frame the ledpanel refuses frames with skips until a complete one arrives.
+
+import sys
+import time
+
+ROWS = 64
+COLUMNS = 128
+# a complete frame (without skips) every FULL_FRAME_INTERVAL frames
+FULL_FRAME_INTERVAL = 50
+
+
+def encode_frame(frame, previous=None):
+    # the pixels row after row
+    pixels = [p for row in frame for p in row]
+    old = [p for row in previous for p in row] if previous else None
+    data = bytearray(b"LP")
+    i = 0
+    while i < len(pixels):
+        if old is not None and pixels[i] == old[i]:
+            # skip the unchanged pixels, at most 128 per record
+            n = 1
+            while i + n < len(pixels) and n < 128 and pixels[i + n] == old[i + n]:
+                n += 1
+            data.append(127 + n)
+        else:
+            # a run of the same color, at most 127 per record
+            n = 1
+            while i + n < len(pixels) and n < 127 and pixels[i + n] == pixels[i]:
+                n += 1
+            data += bytes([n, pixels[i] & 0xFF, pixels[i] >> 8])
+        i += n
+    # the end of the frame
+    data.append(0)
+    return bytes(data)
+
+
+# the color wheel of ledpanel.c, as a packed pixel
+def wheel(pos):
+    if pos < 85:
+        r, g, b = pos * 3, 255 - pos * 3, 0
+    elif pos < 170:
+        pos -= 85
+        r, g, b = 255 - pos * 3, 0, pos * 3
+    else:
+        pos -= 170
+        r, g, b = 0, pos * 3, 255 - pos * 3
+    return r // 16 | (g // 24) << 8 | (b // 16) << 4
+
+
+if __name__ == "__main__":
+    with open(sys.argv[1], "wb", buffering=0) as port:
+        previous = None
+        t = 0
+        frames = 0
+        while True:
+            frame = [[wheel((t + row + column) % 256) for column in range(COLUMNS)] for row in range(ROWS)]
+            data = encode_frame(frame, previous if frames % FULL_FRAME_INTERVAL else None)
+            port.write(data)
+            print("frame %d: %d bytes" % (t, len(data)))
+            previous = frame
+            t = (t + 1) % 256
+            frames += 1
+            time.sleep(0.02)
@@ -6,40 +6,83 @@
 #include "ledpanel.pio.h"
 #include "pico/multicore.h"
 #include "hardware/interp.h"
+#include "math.h"
+#include "hardware/clocks.h"
 
 #include "ledpanel.h"
+#ifdef BENCHMARK
+#include "benchmark.h"
+#endif
 
 // local (i.e. core 1) pointer to the image variable that contains the image information
-uint (*image_to_encode)[num_of_displays * columns_of_display];
+uint16_t *image_to_encode;
 
 // the image is encoded for output to the sm in the variable "encoded_image"
 // Because of the construction of the led panel, you always send (x,y) and (x+32, y) pixels.
 // Additionally, with each set of pixels the address is given.
 // So, from MSB to LSB: E, F, D, C, B, A, g(row+32), b(row+32), r(row+32), g(row), b(row), r(row)
+//      (row+32 is row+half_rows_of_display for the configured panels, see configure_panels)
 //      where E,F,D,C,B and A encode the row address.
-//      and where g, b and r are bits for a brightness level, each color is encoded with 4 bits. See the
-//      loop 'for (int b = 3; b >= 0; b--)' in the code below.
+//      and where g, b and r are bits for a bit plane, each color is encoded with 'bit_planes' bits. See the
+//      loop 'for (int b = bit_planes - 1; b >= 0; b--)' in the code below.
 // This is 11 bits, so: two of these fit in a uint32_t (with room to spare: 10 bits)
 
-// The size of the transcoded image for tranmission to the sm follows from:
+// The size of the transcoded image for tranmission to the sm follows from (for two 64x64 panels):
 //      128 lines
 //      32 rows (two rows are transmitted simultaneously)
-//      4 brightness level
+//      'bit_planes' bit planes (e.g. 4)
 //      2 pixels (and the address) per uint32_t
 // -> 128*32*4 / 2 = 8192
-//      additionally the overall brightness is set for each of the 32 rows and each of the 4 brightness levels
-// -> 8192 + 32*4 = 8320
-#define MAX_ITEMS 8320
-uint32_t encoded_image[MAX_ITEMS];
+//      additionally the delay is set for each of the 32 rows and each of the bit planes
+// -> 8192 + 32*4 = 8320 (for 8 bit planes: 16640)
+// With two state machines (see USE_TWO_STATE_MACHINES in ledpanel.h) each sm gets half of
+// the columns, and the encoded image consists of two slices (one per sm) that follow each other.
+#define columns_per_sm (num_of_displays * columns_of_display / num_of_sms)
+// The encoded data for one half row (row and row+32) of one sm: for each bit plane 64 items + 1 delay item
+// Note: these follow from the configuration of the panels, they are not constants
+#define ITEMS_PER_HALF_ROW ((columns_per_sm / 2 + 1) * bit_planes)
+// The encoded data for one sm (one slice of the encoded image)
+#define ITEMS_PER_IMAGE (ITEMS_PER_HALF_ROW * half_rows_of_display)
+// The size of the encoded image variables: enough for the largest configuration
+// (max_pixels / 4 items for the pixels and the delay items for at most max_half_rows for each sm)
+#define MAX_ITEMS ((max_pixels / 4 + max_half_rows * num_of_sms) * bit_planes)
+// Two encoded images are used (double buffering): the dma streams one to the sm
+// while core 1 encodes the next image into the other. They are swapped only at the
+// end of a frame, so the display never shows half of one image and half of another.
+uint32_t encoded_image[2][MAX_ITEMS];
+// the encoded image that is currently being sent to the sm (0 or 1), the other one
+// is free to be (re)written by encode_image()
+uint encoded_image_showing;
+// pointer to the encoded image that encode_image writes into
+uint32_t *encoded_image_to_fill;
+// set when the dma has been told to switch to the shown encoded image, but may still be
+// sending the other one (until the end of the current frame)
+bool switch_pending = false;
+// wait until the dma has switched to the shown encoded image (defined below)
+void wait_for_encoded_image_to_fill();
 
-// number of items to send to the sm via dma
+// number of items to send to each sm via dma
 uint num_of_items_to_dma;
 
-// encode the image to be suitable for sending it to the sm
-void encode_image()
+// the interpolator can only reorder the 4 bits that are in the image
+#if !defined(USE_LOOKUP_TABLE_ENCODER) && (bit_planes != 4 || defined(USE_GAMMA_CORRECTION))
+#error "more than 4 bit planes or gamma correction requires USE_LOOKUP_TABLE_ENCODER"
+#endif
+
+// The item that ends bit plane b: the number of delay loops the sm shows it.
+// Binary code modulation: each bit plane is shown twice as long as the one below it.
+// In order not to disturb the 22 bit autopull, the 11 bit delay is sent twice
+static inline uint32_t plane_delay(uint b)
 {
-    gpio_put(timing_pin_convert, 1);// TODO: remove (only for testing purposes)
+    // the delay must fit in 11 bits
+    uint brightness = overall_brightness > max_overall_brightness ? max_overall_brightness : overall_brightness;
+    uint32_t delay = 1 << (brightness + b);
+    return delay | delay << 11;
+}
 
+// encode the image using the interpolator (see encode_image below)
+void encode_image_interpolator(uint32_t rows_to_encode)
+{
     // variable to hold the data to be send to the sm
     uint32_t address_and_pixels;
     // counter to keep track of the number of items to be send
@@ -67,7 +110,7 @@ void encode_image()
     - the input is the pixel color information shifted over b bits
     - The Base 2 variable contains the b'th bit for red
         see the lines in the code below:
-            uint value = image_to_encode[row][i] >> b;
+            uint value = pixel(image_to_encode, row, i) >> b;
             interp0->base[2] = value & 0x01;
         so, the first bit in interpolator's 'Result 2' is the b'th bit for red
     - Lane 0 shifts the pixel info three bits right and masks the result in
@@ -92,82 +135,267 @@ void encode_image()
     interp_config_set_mask(&cfg1, 2, 2);
     interp_set_config(interp0, 1, &cfg1);
 
-    // 64 rows, but row i and i+1 are drawn simultaneously -> 32 rows
-    for (uint8_t row = 0; row < half_rows_of_display; row++)
+    // each sm has its own slice of the encoded image with its own columns
+    for (uint s = 0; s < num_of_sms; s++)
     {
-        // 4 brightness level bits for color in each pixel
-        for (int b = 3; b >= 0; b--)
+        // 64 rows, but row i and i+1 are drawn simultaneously -> 32 rows
+        for (uint row = 0; row < half_rows_of_display; row++)
         {
-            // all columns
-            for (uint8_t i = 0; i < num_of_displays * columns_of_display; i += 2)
+            // skip the half rows that have not changed
+            if ((rows_to_encode & (1u << row)) == 0)
+                continue;
+            // the location of this half row in the encoded image
+            num_of_items = s * ITEMS_PER_IMAGE + row * ITEMS_PER_HALF_ROW;
+            // 4 brightness level bits for color in each pixel
+            for (int b = 3; b >= 0; b--)
             {
-                // ledpanel displays put the x and x+32 rows on the display at the same time.
-                // Additionally, two pixels fit in one byte to be displayed. So, code the y and y+1 pixels
-
-                // pixel (x,y)
-                uint value = image_to_encode[row][i] >> b;
-                // printf("1 image_to_encode=%d value=%d\n", image_to_encode[row][i], value);
-                interp0->base[2] = value & 0x01;
-                interp0->accum[0] = value;
-                interp0->accum[1] = value;
-                address_and_pixels = interp0->peek[2];
-                // pixel (x+32, y)
-                value = image_to_encode[row + 32][i] >> b;
-                // printf("2 image_to_encode=%d value=%d\n", image_to_encode[row + 32][i], value);
-                interp0->base[2] = value & 0x01;
-                interp0->accum[0] = value;
-                interp0->accum[1] = value;
-                address_and_pixels |= interp0->peek[2] << 3;
-                // add the row address
-                address_and_pixels |= row << 6;
-                // pixel (x,y+1)
-                value = image_to_encode[row][i + 1] >> b;
-                // printf("3 image_to_encode=%d value=%d\n",image_to_encode[row][i + 1], value);
-                interp0->base[2] = value & 0x01;
-                interp0->accum[0] = value;
-                interp0->accum[1] = value;
-                address_and_pixels |= interp0->peek[2] << 11;
-                // pixel (x+32, y+1)
-                value = image_to_encode[row + 32][i + 1] >> b;
-                // printf("4 image_to_encode=%d value=%d\n",image_to_encode[row + 32][i + 1], value);
-                interp0->base[2] = value & 0x01;
-                interp0->accum[0] = value;
-                interp0->accum[1] = value;
-                address_and_pixels |= interp0->peek[2] << 14;
-                // add the row address
-                address_and_pixels |= row << 17;
-                // add the data to the encoded image array to be sent to the pio sm
+                // all columns of this sm
+                for (uint i = s * columns_per_sm; i < (s + 1) * columns_per_sm; i += 2)
+                {
+                    // ledpanel displays put the x and x+32 rows on the display at the same time.
+                    // Additionally, two pixels fit in one byte to be displayed. So, code the y and y+1 pixels
+
+                    // pixel (x,y)
+                    uint value = pixel(image_to_encode, row, i) >> b;
+                    // printf("1 image_to_encode=%d value=%d\n", pixel(image_to_encode, row, i), value);
+                    interp0->base[2] = value & 0x01;
+                    interp0->accum[0] = value;
+                    interp0->accum[1] = value;
+                    address_and_pixels = interp0->peek[2];
+                    // pixel (x+32, y)
+                    value = pixel(image_to_encode, row + half_rows_of_display, i) >> b;
+                    // printf("2 image_to_encode=%d value=%d\n", pixel(image_to_encode, row + half_rows_of_display, i), value);
+                    interp0->base[2] = value & 0x01;
+                    interp0->accum[0] = value;
+                    interp0->accum[1] = value;
+                    address_and_pixels |= interp0->peek[2] << 3;
+                    // add the row address
+                    address_and_pixels |= row << 6;
+                    // pixel (x,y+1)
+                    value = pixel(image_to_encode, row, i + 1) >> b;
+                    // printf("3 image_to_encode=%d value=%d\n",pixel(image_to_encode, row, i + 1), value);
+                    interp0->base[2] = value & 0x01;
+                    interp0->accum[0] = value;
+                    interp0->accum[1] = value;
+                    address_and_pixels |= interp0->peek[2] << 11;
+                    // pixel (x+32, y+1)
+                    value = pixel(image_to_encode, row + half_rows_of_display, i + 1) >> b;
+                    // printf("4 image_to_encode=%d value=%d\n",pixel(image_to_encode, row + half_rows_of_display, i + 1), value);
+                    interp0->base[2] = value & 0x01;
+                    interp0->accum[0] = value;
+                    interp0->accum[1] = value;
+                    address_and_pixels |= interp0->peek[2] << 14;
+                    // add the row address
+                    address_and_pixels |= row << 17;
+                    // add the data to the encoded image array to be sent to the pio sm
+                    if (num_of_items < MAX_ITEMS)
+                        encoded_image_to_fill[num_of_items++] = address_and_pixels;
+                }
+                // This controlls the overall brightness of the panels
                 if (num_of_items < MAX_ITEMS)
-                    encoded_image[num_of_items++] = address_and_pixels;
+                    encoded_image_to_fill[num_of_items++] = plane_delay(b);
+            }
+        }
+    }
+}
+
+/*
+The alternative to the interpolator: lookup tables
+
+Instead of reordering the bits of a pixel for each of the bit planes separately,
+a lookup table gives the bits for all bit planes at once. Bits 3b, 3b+1 and 3b+2
+of the looked up value contain the bits for bit plane b:
+    bit 3b = r(b), bit 3b+1 = b(b), bit 3b+2 = g(b)
+which is the same order the interpolator produces. A table for all 4096 colors
+would take 16kB, so the lookup is split into a table for the red and blue bits
+(the lowest 8 bits of a pixel) and a table for the green bits (the highest 4 bits).
+
+The gamma correction (see ledpanel.h) is applied while filling the tables: the
+4 bit color values of the image are looked up in 'gamma_table' to give the
+'bit_planes' bits that are actually displayed. So gamma costs no time while encoding.
+
+For each pair of columns there are only 4 lookups, after which the bit planes are
+just shifts and masks.
+*/
+uint32_t lut_red_blue[256];
+uint32_t lut_green[16];
+
+// the displayed value (bit_planes bits) for each of the 16 color values in the image
+uint8_t gamma_table[16];
+
+// fill the gamma table and the lookup tables
+void init_lookup_tables()
+{
+    // the highest value that can be displayed with bit_planes bits
+    const uint max_value = (1 << bit_planes) - 1;
+    for (uint c = 0; c < 16; c++)
+#ifdef USE_GAMMA_CORRECTION
+        gamma_table[c] = (uint8_t)(powf(c / 15.f, gamma_correction) * max_value + 0.5f);
+#else
+        // no gamma: just scale the 4 bits to the number of bit planes
+        gamma_table[c] = (uint8_t)((c * max_value + 7) / 15);
+#endif
+
+    for (uint v = 0; v < 256; v++)
+    {
+        uint red = gamma_table[v & 0x0F];
+        uint blue = gamma_table[v >> 4];
+        lut_red_blue[v] = 0;
+        for (uint b = 0; b < bit_planes; b++)
+        {
+            // red: bit b -> bit 3b
+            lut_red_blue[v] |= ((red >> b) & 1) << (3 * b);
+            // blue: bit b -> bit 3b+1
+            lut_red_blue[v] |= ((blue >> b) & 1) << (3 * b + 1);
+        }
+    }
+    for (uint v = 0; v < 16; v++)
+    {
+        uint green = gamma_table[v];
+        lut_green[v] = 0;
+        // green: bit b -> bit 3b+2
+        for (uint b = 0; b < bit_planes; b++)
+            lut_green[v] |= ((green >> b) & 1) << (3 * b + 2);
+    }
+}
+
+// all bit planes of the colors of a pixel (bits 3b to 3b+2 are bit plane b)
+static inline uint32_t lookup_pixel(uint value)
+{
+    return lut_red_blue[value & 0xFF] | lut_green[(value >> 8) & 0x0F];
+}
+
+// encode the image using the lookup tables (see encode_image below)
+void encode_image_lookup_table(uint32_t rows_to_encode)
+{
+    // the number of items for one bit plane of a half row
+    const uint plane_items = ITEMS_PER_HALF_ROW / bit_planes;
+
+    // each sm has its own slice of the encoded image with its own columns
+    for (uint s = 0; s < num_of_sms; s++)
+    {
+        for (uint row = 0; row < half_rows_of_display; row++)
+        {
+            // skip the half rows that have not changed
+            if ((rows_to_encode & (1u << row)) == 0)
+                continue;
+            // the location of this half row in the encoded image
+            uint32_t *half_row = encoded_image_to_fill + s * ITEMS_PER_IMAGE + row * ITEMS_PER_HALF_ROW;
+            // the row address for both pixel sets in an item
+            uint32_t address = row << 6 | row << 17;
+            // the first column of this sm
+            uint first_column = s * columns_per_sm;
+            // all columns of this sm, two per item
+            for (uint i = first_column; i < first_column + columns_per_sm; i += 2)
+            {
+                // pixels (x,y), (x+32,y), (x,y+1) and (x+32,y+1)
+                uint32_t p0 = lookup_pixel(pixel(image_to_encode, row, i));
+                uint32_t p1 = lookup_pixel(pixel(image_to_encode, row + half_rows_of_display, i));
+                uint32_t p2 = lookup_pixel(pixel(image_to_encode, row, i + 1));
+                uint32_t p3 = lookup_pixel(pixel(image_to_encode, row + half_rows_of_display, i + 1));
+                // the highest bit plane is sent first
+                uint32_t *item = half_row + (i - first_column) / 2;
+                for (int b = bit_planes - 1; b >= 0; b--)
+                {
+                    uint shift = 3 * b;
+                    *item = ((p0 >> shift) & 7) | ((p1 >> shift) & 7) << 3 | ((p2 >> shift) & 7) << 11 | ((p3 >> shift) & 7) << 14 | address;
+                    item += plane_items;
+                }
             }
-            // This controlls the overall brightness of the panels
-            // In order not to disturb the 22 bit autopull, it is sent twice
-            address_and_pixels = 1 << (overall_brightness + b);
-            address_and_pixels |= address_and_pixels << 11;
-            if (num_of_items < MAX_ITEMS)
-                encoded_image[num_of_items++] = address_and_pixels;
+            // the delay items that end each bit plane (see plane_delay)
+            for (int b = bit_planes - 1; b >= 0; b--)
+                half_row[(bit_planes - b) * plane_items - 1] = plane_delay(b);
         }
     }
-    // set the number of dataitems to be sent to the sm via dma
-    num_of_items_to_dma = num_of_items;
+}
+
+// encode the image to be suitable for sending it to the sm
+// rows_to_encode: bit r is set if half row r (i.e. rows r and r+32) has to be encoded,
+//                 the other half rows are left as they are in encoded_image_to_fill
+void encode_image(uint32_t rows_to_encode)
+{
+    // the dma may still be sending the encoded image that is going to be filled
+    wait_for_encoded_image_to_fill();
+
+    timing_pin_put(timing_pin_convert, 1);
+#ifdef USE_LOOKUP_TABLE_ENCODER
+    encode_image_lookup_table(rows_to_encode);
+#else
+    encode_image_interpolator(rows_to_encode);
+#endif
+    timing_pin_put(timing_pin_convert, 0);
+}
 
-    gpio_put(timing_pin_convert, 0);// TODO: remove (only for testing purposes)
+// for each of the two encoded images: the image (1 or 2) it was last encoded from (0 = none yet)
+uint encoded_from_image[2] = {0, 0};
+// for each of the two encoded images: the overall brightness it was encoded with
+uint encoded_with_brightness[2];
+
+// encode only the half rows of image 'image_number' (1 or 2) that have changed since it was
+// last encoded into encoded_image_to_fill. If encoded_image_to_fill holds another image (or
+// another overall brightness) all half rows are encoded.
+void encode_changed_rows(uint image_number)
+{
+    // the encoded image that is going to be filled (0 or 1)
+    uint fill = (encoded_image_to_fill == encoded_image[0]) ? 0 : 1;
+    // get the changed half rows and clear them: from now on changes are relative to this encoding
+    uint32_t rows_to_encode = image_dirty_rows[image_number - 1][fill];
+    image_dirty_rows[image_number - 1][fill] = 0;
+    // check that the encoded image indeed contains an earlier version of this image
+    if (encoded_from_image[fill] != image_number || encoded_with_brightness[fill] != overall_brightness)
+        rows_to_encode = all_rows_dirty;
+    encoded_from_image[fill] = image_number;
+    encoded_with_brightness[fill] = overall_brightness;
+    // do the encoding
+    encode_image(rows_to_encode);
 }
 
 /******************************************************************************
  * configuration of the sm and dma
  *****************************************************************************/
 
-// variables for the pio and state machine (sm) to be used
+// variables for the pio and state machines (sm) to be used
+// Note: with two sm's both are on the same pio, such that they can be started in sync
 PIO pio;
-uint sm;
+uint sm[num_of_sms];
 // the sm program offset and sm configuration
 uint sm_offset;
 pio_sm_config smc;
-// the dma channel
-uint dma_chan;
+// the dma channels (for each sm):
+//      dma_chan sends the encoded image to the sm
+//      dma_chan_ctrl restarts dma_chan at the start of the encoded image after each frame
+uint dma_chan[num_of_sms];
+uint dma_chan_ctrl[num_of_sms];
+// the start address of the encoded image (slice) to be sent to the sm in the next frame.
+// dma_chan_ctrl copies this into the read address of dma_chan (and thereby triggers it)
+// Note: volatile because it is read by the dma, not by the code
+uint32_t *volatile dma_read_address[num_of_sms];
+
+// set the start addresses for the dma of the encoded image that has to be shown
+void set_dma_read_addresses()
+{
+    for (uint s = 0; s < num_of_sms; s++)
+        dma_read_address[s] = encoded_image[encoded_image_showing] + s * num_of_items_to_dma;
+}
+
+// the refresh rate (Hz) of the display
+// It follows from the number of sm clock cycles per frame (see ledpanel.pio), for each
+// half row and for each bit plane:
+//      1               mov x ISR
+//      4 per column    out PINS [2], jmp x--
+//      2               out x, out x
+//      13 per loop     3x nop [3], jmp x-- (the delay loop runs delay+1 times)
+float refresh_rate()
+{
+    uint brightness = overall_brightness > max_overall_brightness ? max_overall_brightness : overall_brightness;
+    uint32_t cycles_per_half_row = 0;
+    for (uint b = 0; b < bit_planes; b++)
+        cycles_per_half_row += 1 + 4 * columns_per_sm + 2 + 13 * ((1 << (brightness + b)) + 1);
+    return (float)clock_get_hz(clk_sys) / (cycles_per_half_row * half_rows_of_display);
+}
 
-// configure the state machine
+// configure the state machine(s)
+// Note: the sm's are started in start_dma()
 void configure_pio_sm()
 {
     // pio to use
@@ -175,76 +403,182 @@ void configure_pio_sm()
     // set the GPIO to be used by the pio
     for (uint pin = panel_r1; pin <= blank; pin++)
         pio_gpio_init(pio, pin);
-    // state machine to use
-    sm = 0;
-    // load the sm program into the pio memory
+#ifdef USE_TWO_STATE_MACHINES
+    for (uint pin = panel2_r1; pin <= panel2_b2; pin++)
+        pio_gpio_init(pio, pin);
+#endif
+    // load the sm program into the pio memory (both sm's run the same program)
     sm_offset = pio_add_program(pio, &ledpanel_program);
-    // make a sm config
-    smc = ledpanel_program_get_default_config(sm_offset);
-    // set pindirs all pins are under control of the PIO sm as output
-    pio_sm_set_consecutive_pindirs(pio, sm, panel_r1, 14, true);
-    // set out pin (r1, g1, b1, r2, g2, b2, a, b, c, d, e)
-    sm_config_set_out_pins(&smc, panel_r1, 11);
-    // set side-set pins (latch, clock, blank)
-    sm_config_set_sideset_pins(&smc, latch);
-    // set the correct ISR shift direction (see the .pio file)
-    sm_config_set_in_shift(&smc, true, false, 0);
-    // set autopull for out: NOTE: one set of pixels is 11 bits,
-    // there are two sets per doubleword (32 bits) send to the Tx FIFO
-    sm_config_set_out_shift(&smc, true, true, 22);
-    // init the pio sm with the config
-    pio_sm_init(pio, sm, sm_offset, &smc);
-    // enable the state machines
-    pio_sm_set_enabled(pio, sm, true);
+    for (uint s = 0; s < num_of_sms; s++)
+    {
+        // state machine to use
+        sm[s] = pio_claim_unused_sm(pio, true);
+        // make a sm config
+        smc = ledpanel_program_get_default_config(sm_offset);
+        if (s == 0)
+        {
+            // set pindirs all pins are under control of the PIO sm as output
+            pio_sm_set_consecutive_pindirs(pio, sm[s], panel_r1, 14, true);
+            // set out pin (r1, g1, b1, r2, g2, b2, a, b, c, d, e)
+            sm_config_set_out_pins(&smc, panel_r1, 11);
+        }
+#ifdef USE_TWO_STATE_MACHINES
+        else
+        {
+            // the second sm only has its own RGB pins
+            pio_sm_set_consecutive_pindirs(pio, sm[s], panel2_r1, 6, true);
+            // set out pin (r1, g1, b1, r2, g2, b2): the address bits fall off the end.
+            // The first sm sets the address, which is the same for both
+            sm_config_set_out_pins(&smc, panel2_r1, 6);
+        }
+#endif
+        // set side-set pins (latch, clock, blank)
+        // Note: for two sm's both set them. Because they run in lockstep, they set the same values
+        sm_config_set_sideset_pins(&smc, latch);
+        // set autopull for out: NOTE: one set of pixels is 11 bits,
+        // there are two sets per doubleword (32 bits) send to the Tx FIFO
+        sm_config_set_out_shift(&smc, true, true, 22);
+        // join the FIFOs: a deeper TxFIFO gives the dma more slack at the end of a frame
+        sm_config_set_fifo_join(&smc, PIO_FIFO_JOIN_TX);
+        // init the pio sm with the config
+        pio_sm_init(pio, sm[s], sm_offset, &smc);
+        // the sm sends 'number of columns' items per row: put the loop count (columns - 1) in the ISR.
+        // It is the only data that is not sent via the dma: put it in the TxFIFO, pull it
+        // into the OSR, copy it to the ISR and empty the OSR again, such that autopull
+        // continues with the first item of the dma
+        pio_sm_put(pio, sm[s], columns_per_sm - 1);
+        pio_sm_exec(pio, sm[s], pio_encode_pull(false, true));
+        pio_sm_exec(pio, sm[s], pio_encode_mov(pio_isr, pio_osr));
+        pio_sm_exec(pio, sm[s], pio_encode_out(pio_null, 32));
+    }
+}
+
+// configure the direct memory access
+//
+// Two dma channels are used (for each sm), no interrupt is needed to keep the display going:
+//      dma_chan:       encoded image -> TxFIFO of the sm, paced by the sm. When all
+//                      items have been sent it chains to dma_chan_ctrl
+//      dma_chan_ctrl:  copies dma_read_address into the read address trigger register
+//                      of dma_chan. This starts dma_chan again for the next frame.
+// Since the transfer count of dma_chan is reloaded at each trigger, only the read
+// address needs to be rewritten. Changing dma_read_address thus switches to the other
+// encoded image exactly at a frame boundary.
+void configure_dma()
+{
+    // all encoded images have the same number of items (it follows from the configuration of the panels)
+    num_of_items_to_dma = ITEMS_PER_IMAGE;
+    // start with showing the first encoded image
+    encoded_image_showing = 0;
+    set_dma_read_addresses();
+    // the first image is encoded before the dma is started, so directly into the shown encoded image
+    encoded_image_to_fill = encoded_image[encoded_image_showing];
+    for (uint s = 0; s < num_of_sms; s++)
+    {
+        // Get free DMA channels, panic() if there are none
+        dma_chan[s] = dma_claim_unused_channel(true);
+        dma_chan_ctrl[s] = dma_claim_unused_channel(true);
+
+        // make DMA configs for the data channel
+        dma_channel_config dma_conf = dma_channel_get_default_config(dma_chan[s]);
+        // transfer uint32_t
+        channel_config_set_transfer_data_size(&dma_conf, DMA_SIZE_32);
+        // the buffer increment of read pointer
+        channel_config_set_read_increment(&dma_conf, true);
+        // the TxFIFO is fixed in memory -> no increment write pointer
+        channel_config_set_write_increment(&dma_conf, false);
+        // let the sm of pio determine the speed
+        channel_config_set_dreq(&dma_conf, pio_get_dreq(pio, sm[s], true));
+        // when the whole encoded image has been sent, start the control channel
+        channel_config_set_chain_to(&dma_conf, dma_chan_ctrl[s]);
+        // configure the dma channel to write to sm TxFIFO from buffer
+        dma_channel_configure(dma_chan[s], &dma_conf, &pio->txf[sm[s]], NULL, num_of_items_to_dma, false);
+
+        // make DMA configs for the control channel
+        dma_channel_config dma_conf_ctrl = dma_channel_get_default_config(dma_chan_ctrl[s]);
+        // transfer one pointer
+        channel_config_set_transfer_data_size(&dma_conf_ctrl, DMA_SIZE_32);
+        // always read dma_read_address and always write to the same register
+        channel_config_set_read_increment(&dma_conf_ctrl, false);
+        channel_config_set_write_increment(&dma_conf_ctrl, false);
+        // configure the control channel to write the read address (and trigger) the data channel
+        dma_channel_configure(dma_chan_ctrl[s], &dma_conf_ctrl,
+                              &dma_hw->ch[dma_chan[s]].al3_read_addr_trig, // write to the data channel read address trigger
+                              &dma_read_address[s],                        // read the start address of the encoded image
+                              1,                                           // one pointer
+                              false);                                      // do not start yet
+    }
 }
 
-// interrupt handler for the direct memory access
-void dma_handler()
+// start showing the encoded image (via the control channel, which starts the data channel)
+// and start the sm('s)
+void start_dma()
 {
-    gpio_put(timing_pin_DMA, 1);// TODO: remove (only for testing purposes)
-    // Clear the interrupt request
-    dma_hw->ints0 = 1u << dma_chan;
-    // set the number of data items to transfer
-    dma_channel_set_trans_count(dma_chan, num_of_items_to_dma, false);
-    // set the read address, this will trigger the DMA to start again
-    dma_channel_set_read_addr(dma_chan, encoded_image, true);
-    gpio_put(timing_pin_DMA, 0);// TODO: remove (only for testing purposes)
+    for (uint s = 0; s < num_of_sms; s++)
+        dma_channel_start(dma_chan_ctrl[s]);
+    // wait until the dma has filled the TxFIFOs: the sm's then start with data available and
+    // stay in lockstep (they take the same number of clock cycles for each item)
+    for (uint s = 0; s < num_of_sms; s++)
+        while (!pio_sm_is_tx_fifo_full(pio, sm[s]))
+            ;
+    // start the sm's at exactly the same clock cycle. Not with pio_sync_start(): its restart
+    // would clear the loop count in the ISR (see configure_pio_sm()), the sm's are just
+    // initialized, so enabling them (and their clock dividers) with one write is enough
+    uint mask = 0;
+    for (uint s = 0; s < num_of_sms; s++)
+        mask |= 1u << sm[s];
+    pio_enable_sm_mask_in_sync(pio, mask);
+    // from now on encode into the encoded image that is not shown
+    encoded_image_to_fill = encoded_image[1 - encoded_image_showing];
 }
 
-// configure the direct memory access
-void configure_dma()
+// Make the just encoded image the one that is shown from the next frame on.
+// Note: this does not wait, the dma may still be sending the previously shown encoded
+// image. See wait_for_encoded_image_to_fill().
+void show_encoded_image()
+{
+    // the next frame starts with the just encoded image
+    encoded_image_showing = 1 - encoded_image_showing;
+    set_dma_read_addresses();
+    // the next image is encoded into the previously shown encoded image
+    encoded_image_to_fill = encoded_image[1 - encoded_image_showing];
+    switch_pending = true;
+}
+
+// Wait until the dma has switched to the shown encoded image (i.e. the frame boundary
+// has passed). After that the other encoded image is no longer read by the dma and can
+// be filled by encode_image()
+void wait_for_encoded_image_to_fill()
 {
-    // init variable to hold the number of items to send via dma
-    num_of_items_to_dma = 0;
-    // Get free DMA channels, panic() if there are none
-    dma_chan = dma_claim_unused_channel(true);
-    // make DMA configs
-    dma_channel_config dma_conf = dma_channel_get_default_config(dma_chan);
-    // transfer uint32_t
-    channel_config_set_transfer_data_size(&dma_conf, DMA_SIZE_32);
-    // the buffer increment of read pointer
-    channel_config_set_read_increment(&dma_conf, true);
-    // the TxFIFO is fixed in memory -> no increment write pointer
-    channel_config_set_write_increment(&dma_conf, false);
-    // let the sm of pio determine the speed
-    channel_config_set_dreq(&dma_conf, pio_get_dreq(pio, sm, true));
-    // configure the dma channel to write to sm TxFIFO from buffer
-    dma_channel_configure(dma_chan, &dma_conf, &pio0_hw->txf[0], NULL, 0, false);
-    // enable IRQ for the channel
-    dma_channel_set_irq0_enabled(dma_chan, true);
-    // set the handler
-    irq_set_exclusive_handler(DMA_IRQ_0, dma_handler);
-    // enable IRQ
-    irq_set_enabled(DMA_IRQ_0, true);
+    if (!switch_pending)
+        return;
+    timing_pin_put(timing_pin_DMA, 1);
+    // each data channel has to be in its slice of the shown encoded image. The read address
+    // alone can't tell: the end of one slice is the start of the next (the other encoded
+    // image or the slice of the other sm). The start of the slice the channel is reading
+    // follows from its read address and the number of items it still has to transfer
+    for (uint s = 0; s < num_of_sms; s++)
+    {
+        uint32_t start = (uint32_t)dma_read_address[s];
+        uint32_t slice_start = 0;
+        do
+        {
+            uint32_t read_addr = dma_hw->ch[dma_chan[s]].read_addr;
+            uint32_t remaining = dma_hw->ch[dma_chan[s]].transfer_count;
+            // the dma may have moved on between the two reads: then they don't match, read again
+            if (read_addr != dma_hw->ch[dma_chan[s]].read_addr)
+                continue;
+            slice_start = read_addr - 4 * (num_of_items_to_dma - remaining);
+        } while (slice_start != start);
+    }
+    switch_pending = false;
+    timing_pin_put(timing_pin_DMA, 0);
 }
 
 void core1_worker()
 {
-    // TODO: remove (only for testing purposes)
-    gpio_init(timing_pin_DMA);
-    gpio_set_dir(timing_pin_DMA, GPIO_OUT);
-    gpio_init(timing_pin_convert);
-    gpio_set_dir(timing_pin_convert, GPIO_OUT);
+    // the timing pins of core 1 (only with USE_TIMING_PINS)
+    timing_pin_init(timing_pin_DMA);
+    timing_pin_init(timing_pin_convert);
 
     // wait for an image to be finished by core 0
     while (image_ready == 0)
@@ -264,15 +598,19 @@ void core1_worker()
         image_processing = image_ready;
     }
 
+#ifdef USE_LOOKUP_TABLE_ENCODER
+    // prepare the lookup tables for the encoder
+    init_lookup_tables();
+#endif
     // prepare the sm
     configure_pio_sm();
     // prepare the dma
     configure_dma();
     // convert the image to data for the pio sm
-    encode_image();
-    // start the dma
-    dma_handler();
+    encode_changed_rows(image_processing);
     image_processing = 0;
+    // start the dma
+    start_dma();
 
     while (true)
     {
@@ -285,10 +623,12 @@ void core1_worker()
             // indicate that core 0 can continue with generating a new image
             image_ready = 0;
             image_to_encode = image1;
-            // do the encoding
-            encode_image();
+            // do the encoding (only of what has changed)
+            encode_changed_rows(1);
             // indicate transcoding has finished
             image_processing = 0;
+            // display the newly encoded image from the next frame on
+            show_encoded_image();
         }
         else if (image_ready == 2)
         {
@@ -298,10 +638,94 @@ void core1_worker()
             image_ready = 0;
             // indicate that core 0 can continue with generating a new image
             image_to_encode = image2;
-            // do the encoding
-            encode_image();
+            // do the encoding (only of what has changed)
+            encode_changed_rows(2);
             // indicate transcoding has finished
             image_processing = 0;
+            // display the newly encoded image from the next frame on
+            show_encoded_image();
         }
     }
 }
+
+#ifdef BENCHMARK
+/******************************************************************************
+ * the benchmark build (make benchmarks): on core 0 instead of core1_worker()
+ *****************************************************************************/
+
+// encode the image n times with an encoder and report the clock cycles
+static void benchmark_encoder(const char *name, void (*encoder)(uint32_t), uint32_t rows_to_encode)
+{
+    benchmark_stats stats;
+    benchmark_stats_init(&stats, name, "cycles");
+    for (uint i = 0; i < 16; i++)
+    {
+        uint32_t start = benchmark_start();
+        encoder(rows_to_encode);
+        benchmark_stats_add(&stats, benchmark_stop(start));
+    }
+    benchmark_report(&stats);
+}
+
+// The time to encode image1 (all half rows, and one half row as for a small change) with
+// each encoder, and the refresh rate the dma and the sm(s) achieve compared to refresh_rate()
+void ledpanel_benchmark()
+{
+    image_to_encode = image1;
+    init_lookup_tables();
+    configure_pio_sm();
+    configure_dma();
+
+    benchmark_encoder("encode_lookup_table", encode_image_lookup_table, all_rows_dirty);
+    benchmark_encoder("encode_lookup_table_one_row", encode_image_lookup_table, 1);
+#if bit_planes == 4 && !defined(USE_GAMMA_CORRECTION)
+    // the interpolator can only do 4 bit planes without gamma correction
+    benchmark_encoder("encode_interpolator", encode_image_interpolator, all_rows_dirty);
+    benchmark_encoder("encode_interpolator_one_row", encode_image_interpolator, 1);
+#endif
+
+    // show the encoded image: the refresh rate follows from the time between the frames,
+    // a new frame starts when the data channel (of the first sm) starts at the beginning again
+    encode_image(all_rows_dirty);
+    start_dma();
+    benchmark_stats frame_time;
+    benchmark_stats_init(&frame_time, "frame_time", "us");
+    uint32_t previous_addr = dma_hw->ch[dma_chan[0]].read_addr;
+    uint64_t start = benchmark_time_us();
+    uint64_t previous_frame = 0;
+    uint64_t first_frame = 0;
+    uint frames = 0;
+    while (benchmark_time_us() - start < 1000000)
+    {
+        uint32_t read_addr = dma_hw->ch[dma_chan[0]].read_addr;
+        if (read_addr < previous_addr)
+        {
+            uint64_t now = benchmark_time_us();
+            if (frames == 0)
+                first_frame = now;
+            else
+                benchmark_stats_add(&frame_time, now - previous_frame);
+            previous_frame = now;
+            frames++;
+        }
+        previous_addr = read_addr;
+    }
+    benchmark_report(&frame_time);
+    if (frames > 1)
+        benchmark_report_value("refresh_rate", "Hz", (frames - 1) * 1000000.f / (previous_frame - first_frame));
+    benchmark_report_value("refresh_rate_calculated", "Hz", refresh_rate());
+
+    // double buffering: how long the encoding waits (at most a frame) until the dma has switched
+    benchmark_stats switch_wait;
+    benchmark_stats_init(&switch_wait, "switch_wait", "us");
+    for (uint i = 0; i < 16; i++)
+    {
+        show_encoded_image();
+        uint64_t wait_start = benchmark_time_us();
+        wait_for_encoded_image_to_fill();
+        benchmark_stats_add(&switch_wait, benchmark_time_us() - wait_start);
+        encode_image_lookup_table(all_rows_dirty);
+    }
+    benchmark_report(&switch_wait);
+}
+#endif
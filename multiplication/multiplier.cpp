@@ -2,39 +2,254 @@
 
 #include "pico/stdlib.h"
 #include "hardware/pio.h"
+#include "hardware/dma.h"
+#include "hardware/interp.h"
 
 #include "multiplier.pio.h"
+#include "pio_resources.h"
+#ifdef BENCHMARK
+#include "benchmark.h"
+#endif
 
-// the pio instance
-PIO pio;
-// the state machine
-uint sm;
+// the number of state machines that multiply in parallel (all four of a pio)
+#define NUM_MUL_SM 4
+// the maximum number of multiplications in one pio_mul_array() (the size of the buffer with
+// the interleaved operand pairs)
+#define MAX_BATCH 1024
 
+/*
+Batched multiplication: each sm gets a part of the batch, a dma channel streams the operand
+pairs (m1, m2) of that part into its TxFIFO, and another dma channel collects the products
+from its RxFIFO. The sm program pulls m1 and then m2 from the same FIFO, so the operands have
+to be interleaved in memory: pio_mul_pairs() takes them like that, pio_mul_array() interleaves
+two separate arrays first (with the cpu).
+The dma channels are paced by their own sm, so the different (data dependent) run times
+of the state machines don't matter.
+*/
+
+// the pio instances and state machines
+PIO pio[NUM_MUL_SM];
+uint sm[NUM_MUL_SM];
+// the dma channels: operand pairs to the sm, products from the sm
+int dma_tx[NUM_MUL_SM];
+int dma_rx[NUM_MUL_SM];
+// the number of state machines that were claimed
+uint num_of_sm = 0;
+// the interleaved operand pairs for pio_mul_array()
+uint32_t pairs[2 * MAX_BATCH];
+
+// claim the state machines, load the program and set up the dma channels
+void pio_mul_init(void)
+{
+    for (num_of_sm = 0; num_of_sm < NUM_MUL_SM; num_of_sm++)
+    {
+        uint s = num_of_sm;
+        uint offset;
+        if (!pio_resources_claim_sm(&multiplier_program, &pio[s], &sm[s], &offset))
+            break;
+        // make a sm config
+        pio_sm_config c = multiplier_program_get_default_config(offset);
+        // init the pio sm with the config
+        pio_sm_init(pio[s], sm[s], offset, &c);
+        // enable the sm
+        pio_sm_set_enabled(pio[s], sm[s], true);
+
+        // the operand pairs: from memory into the TxFIFO, paced by the sm
+        dma_tx[s] = dma_claim_unused_channel(true);
+        dma_channel_config dc = dma_channel_get_default_config(dma_tx[s]);
+        channel_config_set_transfer_data_size(&dc, DMA_SIZE_32);
+        channel_config_set_read_increment(&dc, true);
+        channel_config_set_write_increment(&dc, false);
+        channel_config_set_dreq(&dc, pio_get_dreq(pio[s], sm[s], true));
+        dma_channel_configure(dma_tx[s], &dc, &pio[s]->txf[sm[s]], NULL, 0, false);
+        // the products: from the RxFIFO into memory, paced by the sm
+        dma_rx[s] = dma_claim_unused_channel(true);
+        dc = dma_channel_get_default_config(dma_rx[s]);
+        channel_config_set_transfer_data_size(&dc, DMA_SIZE_32);
+        channel_config_set_read_increment(&dc, false);
+        channel_config_set_write_increment(&dc, true);
+        channel_config_set_dreq(&dc, pio_get_dreq(pio[s], sm[s], false));
+        dma_channel_configure(dma_rx[s], &dc, NULL, &pio[s]->rxf[sm[s]], 0, false);
+    }
+    if (num_of_sm == 0)
+        printf("multiplier: no free state machine\n");
+}
+
+// multiply two numbers with the first sm and print the result (the cpu waits for the result)
 void pio_mul(int a, int b)
 {
-    pio_sm_put(pio, sm, a);
-    pio_sm_put(pio, sm, b);
-    printf("%d * %d = %d\n", a, b, pio_sm_get_blocking(pio, sm));
+    pio_sm_put(pio[0], sm[0], a);
+    pio_sm_put(pio[0], sm[0], b);
+    printf("%d * %d = %d\n", a, b, pio_sm_get_blocking(pio[0], sm[0]));
+}
+
+// start n multiplications of interleaved operand pairs (m1, m2, m1, m2, ...), this does not wait
+// the products are in out[] after pio_mul_wait()
+void pio_mul_pairs_start(const uint32_t *operand_pairs, uint32_t *out, uint n)
+{
+    for (uint s = 0; s < num_of_sm; s++)
+    {
+        // the part of the batch for this sm
+        uint first = s * n / num_of_sm;
+        uint last = (s + 1) * n / num_of_sm;
+        if (last == first)
+            continue;
+        dma_channel_set_write_addr(dma_rx[s], out + first, false);
+        dma_channel_set_trans_count(dma_rx[s], last - first, true);
+        dma_channel_set_read_addr(dma_tx[s], operand_pairs + 2 * first, false);
+        dma_channel_set_trans_count(dma_tx[s], 2 * (last - first), true);
+    }
+}
+
+// wait until all products of the batch are in memory
+void pio_mul_wait(void)
+{
+    for (uint s = 0; s < num_of_sm; s++)
+        dma_channel_wait_for_finish_blocking(dma_rx[s]);
 }
 
+// n multiplications: out[i] = a[i] * b[i] (n at most MAX_BATCH), this waits for the products
+void pio_mul_array(const uint32_t *a, const uint32_t *b, uint32_t *out, uint n)
+{
+    if (n > MAX_BATCH)
+        n = MAX_BATCH;
+    // the sm needs the operands interleaved
+    for (uint i = 0; i < n; i++)
+    {
+        pairs[2 * i] = a[i];
+        pairs[2 * i + 1] = b[i];
+    }
+    pio_mul_pairs_start(pairs, out, n);
+    pio_mul_wait();
+}
+
+// the benchmarks: the products of n pairs of operands below max_operand
+// - the core: the single cycle multiplier of the M0+
+// - the interpolator: it has no general multiplier, its blend mode gives a * alpha / 256
+//   for an 8 bit alpha (so at most max_operand 256, and it is a fractional multiply)
+// - the pio: pio_mul_array (with the interleaving) and pio_mul_pairs (the cpu is free
+//   while the state machines multiply)
+#define BENCHMARK_N 1024
+uint32_t bench_a[BENCHMARK_N], bench_b[BENCHMARK_N], bench_pairs[2 * BENCHMARK_N], bench_out[BENCHMARK_N];
+
+void benchmark(uint32_t max_operand)
+{
+    // the operands (pseudo random)
+    uint32_t r = 12345;
+    for (uint i = 0; i < BENCHMARK_N; i++)
+    {
+        r = r * 1103515245 + 12345;
+        bench_a[i] = (r >> 16) % max_operand;
+        r = r * 1103515245 + 12345;
+        bench_b[i] = (r >> 16) % max_operand;
+        bench_pairs[2 * i] = bench_a[i];
+        bench_pairs[2 * i + 1] = bench_b[i];
+    }
+
+    // the core
+    uint32_t start = time_us_32();
+    for (uint i = 0; i < BENCHMARK_N; i++)
+        bench_out[i] = bench_a[i] * bench_b[i];
+    uint32_t core_us = time_us_32() - start;
+
+    // the interpolator: lane 0 blends between base 0 (0) and base 1 (a) with alpha = b
+    interp_config cfg = interp_default_config();
+    interp_config_set_blend(&cfg, true);
+    interp_set_config(interp0, 0, &cfg);
+    cfg = interp_default_config();
+    interp_set_config(interp0, 1, &cfg);
+    interp0->base[0] = 0;
+    start = time_us_32();
+    for (uint i = 0; i < BENCHMARK_N; i++)
+    {
+        interp0->base[1] = bench_a[i];
+        interp0->accum[1] = bench_b[i];
+        bench_out[i] = interp0->peek[1];
+    }
+    uint32_t interp_us = time_us_32() - start;
+
+    // the pio, with the interleaving
+    start = time_us_32();
+    pio_mul_array(bench_a, bench_b, bench_out, BENCHMARK_N);
+    uint32_t pio_us = time_us_32() - start;
+    // check the products
+    uint errors = 0;
+    for (uint i = 0; i < BENCHMARK_N; i++)
+        if (bench_out[i] != bench_a[i] * bench_b[i])
+            errors++;
+
+    // the pio with interleaved operands: the time the cpu is busy (starting) and the total
+    start = time_us_32();
+    pio_mul_pairs_start(bench_pairs, bench_out, BENCHMARK_N);
+    uint32_t pio_start_us = time_us_32() - start;
+    pio_mul_wait();
+    uint32_t pio_pairs_us = time_us_32() - start;
+
+    printf("%d multiplications, operands < %d:\n", BENCHMARK_N, max_operand);
+    printf("    core: %d us, interpolator (a * b / 256): %d us\n", core_us, interp_us);
+    printf("    pio (%d sm): %d us with interleaving, %d us interleaved (of which %d us cpu), %d errors\n",
+           num_of_sm, pio_us, pio_pairs_us, pio_start_us, errors);
+#ifdef BENCHMARK
+    // the same in the format of the benchmark harness: e.g. batch_256_core
+    char name[32];
+    snprintf(name, sizeof(name), "batch_%d_core", max_operand);
+    benchmark_report_value(name, "us", core_us);
+    snprintf(name, sizeof(name), "batch_%d_interpolator", max_operand);
+    benchmark_report_value(name, "us", interp_us);
+    snprintf(name, sizeof(name), "batch_%d_pio", max_operand);
+    benchmark_report_value(name, "us", pio_us);
+    snprintf(name, sizeof(name), "batch_%d_pio_pairs", max_operand);
+    benchmark_report_value(name, "us", pio_pairs_us);
+    snprintf(name, sizeof(name), "batch_%d_pio_pairs_cpu", max_operand);
+    benchmark_report_value(name, "us", pio_start_us);
+    snprintf(name, sizeof(name), "batch_%d_errors", max_operand);
+    benchmark_report_value(name, "count", errors);
+#endif
+}
+
+#ifdef BENCHMARK
+// the benchmark build (make benchmarks): the round trip of pio_mul(), from putting the two
+// operands in the TxFIFO until the product is taken from the RxFIFO (about m1 * m2 cycles of the sm)
+void benchmark_round_trip(uint32_t operand)
+{
+    char name[32];
+    snprintf(name, sizeof(name), "round_trip_%dx%d", operand, operand);
+    benchmark_stats stats;
+    benchmark_stats_init(&stats, name, "cycles");
+    for (uint i = 0; i < 100; i++)
+    {
+        uint32_t start = benchmark_start();
+        pio_sm_put(pio[0], sm[0], operand);
+        pio_sm_put(pio[0], sm[0], operand);
+        pio_sm_get_blocking(pio[0], sm[0]);
+        benchmark_stats_add(&stats, benchmark_stop(start));
+    }
+    benchmark_report(&stats);
+}
+#endif
+
 int main()
 {
     // needed for printf
     stdio_init_all();
 
-    // pio 0 is used
-    pio = pio0;
-    // state machine 0
-    sm = 0;
-    // load the pio program into the pio memory
-    uint offset = pio_add_program(pio, &multiplier_program);
-    // make a sm config
-    pio_sm_config c = multiplier_program_get_default_config(offset);
-    // init the pio sm with the config
-    pio_sm_init(pio, sm, offset, &c);
-    // enable the sm
-    pio_sm_set_enabled(pio, sm, true);
+    // the state machines and dma channels
+    pio_mul_init();
 
+#ifdef BENCHMARK
+    // the benchmark build (make benchmarks): the round trips and the batches below, then stop
+    benchmark_init("multiplier");
+    if (num_of_sm == 0)
+    {
+        benchmark_done();
+        while (true)
+            tight_loop_contents();
+    }
+    benchmark_round_trip(0);
+    benchmark_round_trip(1);
+    benchmark_round_trip(4);
+    benchmark_round_trip(16);
+#else
     pio_mul(1, 1);
     pio_mul(0, 1);
     pio_mul(5, 0);
@@ -49,8 +264,19 @@ int main()
     pio_mul(12, 12);
     pio_mul(100, 101);
     pio_mul(1001, 1000);
+#endif
+
+    // the benchmarks: the pio needs about m1 * m2 clock cycles per multiplication, so it only
+    // makes sense for small operands, and only if the cpu has something else to do meanwhile
+    benchmark(4);
+    benchmark(16);
+    benchmark(64);
+    benchmark(256);
+#ifdef BENCHMARK
+    benchmark_done();
+#endif
 
     while (true)
     {
     }
-}
\ No newline at end of file
+}
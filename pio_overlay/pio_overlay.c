@@ -0,0 +1,231 @@
+#include <stdio.h>
+
+#include "hardware/sync.h"
+#include "hardware/structs/systick.h"
+
+#include "pio_resources.h"
+#include "pio_overlay.h"
+
+// the SysTick counts down from its 24 bit reload value at the system clock
+#define SYSTICK_MASK 0xFFFFFF
+
+// the instructions used by the loaded programs of the catalog
+static uint used_instructions(pio_overlay *ov)
+{
+    uint used = 0;
+    for (uint e = 0; e < ov->num_of_entries; e++)
+        if (ov->offset[e] >= 0)
+            used += ov->catalog[e].program->length;
+    return used;
+}
+
+// is the program running on a state machine
+static bool is_running(pio_overlay *ov, uint entry)
+{
+    for (uint sm = 0; sm < 4; sm++)
+        if (ov->current[sm] == (int)entry)
+            return true;
+    return false;
+}
+
+// the loaded program that hasn't been used the longest and isn't running (-1: none)
+static int least_recently_used(pio_overlay *ov)
+{
+    int lru = -1;
+    for (uint e = 0; e < ov->num_of_entries; e++)
+        if (ov->offset[e] >= 0 && !is_running(ov, e) && (lru < 0 || ov->last_used[e] < ov->last_used[lru]))
+            lru = e;
+    return lru;
+}
+
+// load a program if there is room (without unloading others)
+static int try_load(pio_overlay *ov, uint entry)
+{
+    const pio_program_t *program = ov->catalog[entry].program;
+    if (used_instructions(ov) + program->length > ov->max_instructions)
+        return -1;
+    // the sdk relocates the jmp instructions to the offset
+    int offset = pio_resources_add_program(ov->pio, program);
+    if (offset < 0)
+        return -1;
+    ov->offset[entry] = offset;
+    ov->loads++;
+    return offset;
+}
+
+// unload a program (it must not be running)
+static void unload(pio_overlay *ov, uint entry)
+{
+    pio_resources_remove_program(ov->pio, ov->catalog[entry].program);
+    ov->offset[entry] = -1;
+    ov->unloads++;
+}
+
+void pio_overlay_init(pio_overlay *ov, PIO pio, const pio_overlay_entry *catalog, uint num_of_entries, uint max_instructions)
+{
+    ov->pio = pio;
+    ov->catalog = catalog;
+    ov->num_of_entries = (num_of_entries > PIO_OVERLAY_MAX_ENTRIES) ? PIO_OVERLAY_MAX_ENTRIES : num_of_entries;
+    ov->max_instructions = (max_instructions > 32) ? 32 : max_instructions;
+    for (uint e = 0; e < PIO_OVERLAY_MAX_ENTRIES; e++)
+    {
+        ov->offset[e] = -1;
+        ov->last_used[e] = 0;
+    }
+    for (uint sm = 0; sm < 4; sm++)
+        ov->current[sm] = -1;
+    ov->switches = 0;
+    ov->slow_switches = 0;
+    ov->loads = 0;
+    ov->unloads = 0;
+    ov->last_glitch_cycles = 0;
+    ov->max_glitch_cycles = 0;
+    // the SysTick measures the glitch: free running at the system clock
+    if (!(systick_hw->csr & M0PLUS_SYST_CSR_ENABLE_BITS))
+    {
+        systick_hw->rvr = SYSTICK_MASK;
+        systick_hw->cvr = 0;
+        systick_hw->csr = M0PLUS_SYST_CSR_CLKSOURCE_BITS | M0PLUS_SYST_CSR_ENABLE_BITS;
+    }
+}
+
+int pio_overlay_load(pio_overlay *ov, uint entry)
+{
+    if (entry >= ov->num_of_entries)
+        return -1;
+    if (ov->offset[entry] >= 0)
+        return ov->offset[entry];
+    // make room: unload the least recently used programs until it fits
+    int offset;
+    while ((offset = try_load(ov, entry)) < 0)
+    {
+        int lru = least_recently_used(ov);
+        if (lru < 0)
+            return -1;
+        unload(ov, lru);
+    }
+    return offset;
+}
+
+bool pio_overlay_unload(pio_overlay *ov, uint entry)
+{
+    if (entry >= ov->num_of_entries || is_running(ov, entry))
+        return false;
+    if (ov->offset[entry] >= 0)
+        unload(ov, entry);
+    return true;
+}
+
+// the glitch: stop the sm, set the config, jump to the start of the program and run again
+// the fifos, the scratch registers and the pins are kept
+static inline void restart_at(PIO pio, uint sm, uint offset, const pio_sm_config *c)
+{
+    pio_sm_set_enabled(pio, sm, false);
+    pio_sm_set_config(pio, sm, c);
+    pio_sm_exec(pio, sm, pio_encode_jmp(offset));
+    pio_sm_set_enabled(pio, sm, true);
+}
+
+bool pio_overlay_switch(pio_overlay *ov, uint sm, uint entry)
+{
+    if (entry >= ov->num_of_entries)
+        return false;
+    const pio_overlay_entry *e = &ov->catalog[entry];
+    int previous = ov->current[sm];
+    ov->switches++;
+    ov->last_used[entry] = ov->switches;
+    uint32_t start, end;
+    bool switched = true;
+    int offset = pio_overlay_load(ov, entry);
+    if (offset >= 0)
+    {
+        // fast switch: the program is loaded, only the config and the jump are in the glitch
+        pio_sm_config c = e->get_config(offset);
+        uint32_t status = save_and_disable_interrupts();
+        start = systick_hw->cvr;
+        restart_at(ov->pio, sm, offset, &c);
+        end = systick_hw->cvr;
+        restore_interrupts(status);
+    }
+    else
+    {
+        // slow switch: only possible if the program of this sm makes room (and no other sm runs it)
+        if (previous < 0 || previous == (int)entry)
+        {
+            ov->switches--;
+            return false;
+        }
+        ov->current[sm] = -1;
+        bool shared = is_running(ov, previous);
+        ov->current[sm] = previous;
+        if (shared)
+        {
+            ov->switches--;
+            return false;
+        }
+        // the other programs that aren't running have been unloaded by pio_overlay_load(), so the
+        // room this program needs can be checked before the sm is stopped
+        uint free_room = ov->max_instructions - used_instructions(ov) + ov->catalog[previous].program->length;
+        if (e->program->length > free_room)
+        {
+            ov->switches--;
+            return false;
+        }
+        uint32_t status = save_and_disable_interrupts();
+        start = systick_hw->cvr;
+        pio_sm_set_enabled(ov->pio, sm, false);
+        ov->current[sm] = -1;
+        unload(ov, previous);
+        offset = try_load(ov, entry);
+        if (offset < 0)
+        {
+            // doesn't fit after all (another driver's program is in the way): back to the previous program
+            entry = previous;
+            e = &ov->catalog[entry];
+            switched = false;
+            offset = try_load(ov, entry);
+            if (offset < 0)
+            {
+                // the previous program doesn't fit either (its room was taken in between):
+                // the sm stays stopped and runs no program
+                restore_interrupts(status);
+                ov->slow_switches++;
+                return false;
+            }
+        }
+        pio_sm_config c = e->get_config(offset);
+        restart_at(ov->pio, sm, offset, &c);
+        end = systick_hw->cvr;
+        restore_interrupts(status);
+        ov->slow_switches++;
+    }
+    ov->current[sm] = entry;
+    // the SysTick counts down
+    ov->last_glitch_cycles = (start - end) & SYSTICK_MASK;
+    if (ov->last_glitch_cycles > ov->max_glitch_cycles)
+        ov->max_glitch_cycles = ov->last_glitch_cycles;
+    return switched;
+}
+
+void pio_overlay_stop(pio_overlay *ov, uint sm)
+{
+    pio_sm_set_enabled(ov->pio, sm, false);
+    ov->current[sm] = -1;
+}
+
+void pio_overlay_print(pio_overlay *ov)
+{
+    printf("pio%d overlays: %d of %d instructions used\n", pio_get_index(ov->pio), used_instructions(ov), ov->max_instructions);
+    for (uint e = 0; e < ov->num_of_entries; e++)
+    {
+        printf("    %-16s", ov->catalog[e].name);
+        if (ov->offset[e] >= 0)
+            printf(" loaded at %2d-%2d", ov->offset[e], ov->offset[e] + ov->catalog[e].program->length - 1);
+        for (uint sm = 0; sm < 4; sm++)
+            if (ov->current[sm] == (int)e)
+                printf(", running on sm %d", sm);
+        printf("\n");
+    }
+    printf("    %d switches (%d slow), %d loads, %d unloads, glitch: last %d, max %d clock cycles\n",
+           ov->switches, ov->slow_switches, ov->loads, ov->unloads, ov->last_glitch_cycles, ov->max_glitch_cycles);
+}
@@ -0,0 +1,107 @@
+#ifndef PIO_OVERLAY_H
+#define PIO_OVERLAY_H
+
+#include "hardware/pio.h"
+
+/*
+ * Overlays of pio programs: more programs than fit in the 32 instructions of a pio
+ *
+ * - the catalog: the programs (in flash) that the state machines of one pio can run, each
+ *   with the function that makes its sm config for the offset it is loaded at
+ * - loading and unloading on demand: a program is loaded when a state machine is switched to
+ *   it (or with pio_overlay_load()), and if there is no room the least recently used programs
+ *   that no state machine runs are unloaded. The loading is done via the shared pio resources,
+ *   so the room used by other drivers is respected
+ * - relocation: the 'jmp' instructions of a program are encoded relative to the start of the
+ *   program, they are relocated to the offset where it is loaded (by pio_add_program() of
+ *   the sdk), and the sm config (wrap, initial pc) is made for that offset
+ * - switching: the state machine stops, gets the config of the new program, jumps to its
+ *   start and runs again. This is done with the interrupts disabled, so the time the state
+ *   machine doesn't run (the glitch) is bounded: it is measured in clock cycles with the
+ *   SysTick timer. If the new program can only be loaded by unloading the program the state
+ *   machine is running, the loading happens during the glitch (slow switch), otherwise it
+ *   happens before (fast switch). The pins keep their state during the glitch.
+ */
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+// the maximum number of programs in the catalog
+#define PIO_OVERLAY_MAX_ENTRIES 16
+
+// a program in the catalog
+typedef struct
+{
+    const char *name;
+    const pio_program_t *program;
+    // the sm config of the program loaded at offset (pins, clock divider, wrap etc.)
+    pio_sm_config (*get_config)(uint offset);
+} pio_overlay_entry;
+
+// the overlay manager of one pio
+typedef struct
+{
+    PIO pio;
+    const pio_overlay_entry *catalog;
+    uint num_of_entries;
+    // the maximum number of instructions the overlays may use (at most 32)
+    uint max_instructions;
+    // the offset of each program in the pio memory (-1: not loaded)
+    int offset[PIO_OVERLAY_MAX_ENTRIES];
+    // for the least recently used: the switch count when a program was last used
+    uint32_t last_used[PIO_OVERLAY_MAX_ENTRIES];
+    // the program each state machine runs (-1: none or not via the overlays)
+    int current[4];
+    // the statistics
+    uint32_t switches;
+    uint32_t slow_switches;
+    uint32_t loads;
+    uint32_t unloads;
+    uint32_t last_glitch_cycles;
+    uint32_t max_glitch_cycles;
+} pio_overlay;
+
+/*
+ * Initialize an overlay manager
+ * @param catalog: the programs (at most PIO_OVERLAY_MAX_ENTRIES), it must stay valid (e.g. const)
+ * @param max_instructions: the instructions the overlays may use in the pio (32: all free room)
+ */
+void pio_overlay_init(pio_overlay *ov, PIO pio, const pio_overlay_entry *catalog, uint num_of_entries, uint max_instructions);
+
+/*
+ * Load a program of the catalog (if it isn't loaded yet), unloading the least recently used
+ * programs that aren't running if there is no room
+ * returns the offset of the program, or -1 if it can't be loaded
+ */
+int pio_overlay_load(pio_overlay *ov, uint entry);
+
+/*
+ * Unload a program of the catalog, returns false if it is running on a state machine
+ */
+bool pio_overlay_unload(pio_overlay *ov, uint entry);
+
+/*
+ * Switch a state machine to a program of the catalog (loading it if needed) and run it
+ * the state machine must be claimed by the caller, its pins initialized with pio_gpio_init()
+ * returns false if the program can't be loaded (the state machine keeps running its program,
+ * or, in the rare case that its program can't be loaded again either, it is stopped and
+ * runs no program)
+ */
+bool pio_overlay_switch(pio_overlay *ov, uint sm, uint entry);
+
+/*
+ * Stop a state machine, its program is no longer running (it may be unloaded)
+ */
+void pio_overlay_stop(pio_overlay *ov, uint sm);
+
+/*
+ * Print the loaded programs and the switch statistics
+ */
+void pio_overlay_print(pio_overlay *ov);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
@@ -0,0 +1,91 @@
+#include <string.h>
+
+#include "pio_program_cache.h"
+
+// the number of instructions in the memory of a pio
+#define PIO_MEMORY_SIZE 32
+
+// a loaded program: its content, the offset in the pio memory and the number of users
+typedef struct
+{
+    const uint16_t *instructions;
+    uint8_t length;
+    int8_t origin;
+    uint8_t offset;
+    uint8_t users;
+} cached_program;
+
+// the loaded programs for each pio, users == 0 means the entry is free
+static cached_program cache[NUM_PIOS][PIO_PROGRAM_CACHE_SIZE];
+// a copy of the instructions of the loaded programs (as given, not relocated), at their offset:
+// the program of a driver can be made at run time in memory that doesn't outlive the driver
+// (e.g. byte_stream), so the cache doesn't keep a pointer to it
+static uint16_t instructions[NUM_PIOS][PIO_MEMORY_SIZE];
+
+// find a loaded program with the same content, returns NULL if there is none
+static cached_program *find_program(PIO pio, const pio_program_t *program)
+{
+    cached_program *entries = cache[pio_get_index(pio)];
+    for (int i = 0; i < PIO_PROGRAM_CACHE_SIZE; i++)
+        if (entries[i].users > 0 && entries[i].length == program->length && entries[i].origin == program->origin &&
+            memcmp(entries[i].instructions, program->instructions, program->length * sizeof(uint16_t)) == 0)
+            return &entries[i];
+    return NULL;
+}
+
+int pio_program_cache_add(PIO pio, const pio_program_t *program)
+{
+    // already loaded: one more user
+    cached_program *p = find_program(pio, program);
+    if (p != NULL)
+    {
+        p->users++;
+        return p->offset;
+    }
+    // find a free entry
+    cached_program *entries = cache[pio_get_index(pio)];
+    for (int i = 0; i < PIO_PROGRAM_CACHE_SIZE; i++)
+        if (entries[i].users == 0)
+        {
+            // check that the program fits (pio_add_program panics if it doesn't)
+            if (!pio_can_add_program(pio, program))
+                return -1;
+            entries[i].length = program->length;
+            entries[i].origin = program->origin;
+            entries[i].offset = pio_add_program(pio, program);
+            // loaded programs don't overlap in the pio memory, so their copies don't either
+            entries[i].instructions = &instructions[pio_get_index(pio)][entries[i].offset];
+            memcpy(&instructions[pio_get_index(pio)][entries[i].offset], program->instructions, program->length * sizeof(uint16_t));
+            entries[i].users = 1;
+            return entries[i].offset;
+        }
+    return -1;
+}
+
+void pio_program_cache_remove(PIO pio, const pio_program_t *program)
+{
+    cached_program *p = find_program(pio, program);
+    if (p == NULL)
+        return;
+    p->users--;
+    // the last user: remove the program from the pio memory
+    if (p->users == 0)
+        pio_remove_program(pio, program, p->offset);
+}
+
+uint pio_program_cache_users(PIO pio, const pio_program_t *program)
+{
+    cached_program *p = find_program(pio, program);
+    return (p == NULL) ? 0 : p->users;
+}
+
+uint pio_program_cache_entry(PIO pio, uint index, uint *offset, uint *length)
+{
+    cached_program *p = &cache[pio_get_index(pio)][index];
+    if (p->users > 0)
+    {
+        *offset = p->offset;
+        *length = p->length;
+    }
+    return p->users;
+}
@@ -0,0 +1,57 @@
+#ifndef PIO_PROGRAM_CACHE_H
+#define PIO_PROGRAM_CACHE_H
+
+#include "hardware/pio.h"
+
+/*
+ * A cache of the programs loaded into the pio instruction memory, shared by all drivers
+ * (the MicroPython modules and the C/C++ drivers in the same firmware, pio_resources uses it too).
+ * Programs are recognized by their content (instructions, length and origin), so an
+ * identical program that is requested by several drivers is loaded only once per pio.
+ * Each request is counted, the program is removed from the pio when the last user
+ * has released it. The instructions are copied, so a program made at run time doesn't
+ * have to outlive its first user.
+ */
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/*
+ * Load a program into a pio, or use the copy that is already loaded
+ * @param pio: the pio (pio0 or pio1)
+ * @param program: the program
+ * returns the offset of the program in the pio memory, or -1 if it doesn't fit
+ */
+int pio_program_cache_add(PIO pio, const pio_program_t *program);
+
+/*
+ * Release a program that was requested with pio_program_cache_add()
+ * the program is removed from the pio memory after the last release
+ * @param pio: the pio (pio0 or pio1)
+ * @param program: the program
+ */
+void pio_program_cache_remove(PIO pio, const pio_program_t *program);
+
+/*
+ * The number of users of a program in a pio (0 if it isn't loaded)
+ */
+uint pio_program_cache_users(PIO pio, const pio_program_t *program);
+
+// the number of entries of the cache in each pio
+#define PIO_PROGRAM_CACHE_SIZE 16
+
+/*
+ * An entry of the cache (e.g. to report the memory usage)
+ * @param index: the entry, 0 to PIO_PROGRAM_CACHE_SIZE - 1
+ * @param offset: the offset of the program in the pio memory
+ * @param length: the number of instructions of the program
+ * returns the number of users of the entry, 0 if it is free (offset and length are not set)
+ */
+uint pio_program_cache_entry(PIO pio, uint index, uint *offset, uint *length);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
@@ -0,0 +1,193 @@
+#include <stdio.h>
+
+#include "hardware/irq.h"
+
+#include "pio_program_cache.h"
+#include "pio_resources.h"
+
+// the handler of a state machine
+typedef struct
+{
+    pio_resources_irq_handler handler;
+    void *user_data;
+} sm_handler;
+
+// the pio blocks
+#if NUM_PIOS > 2
+static const PIO pio_list[NUM_PIOS] = {pio0, pio1, pio2};
+static const uint pio_irq[NUM_PIOS] = {PIO0_IRQ_0, PIO1_IRQ_0, PIO2_IRQ_0};
+#else
+static const PIO pio_list[NUM_PIOS] = {pio0, pio1};
+static const uint pio_irq[NUM_PIOS] = {PIO0_IRQ_0, PIO1_IRQ_0};
+#endif
+// the interrupt handlers of the state machines, and if the pio handler is set
+static sm_handler handlers[NUM_PIOS][4];
+static bool irq_handler_set[NUM_PIOS];
+
+// check if a program is loaded or can be loaded in a pio
+static bool program_fits(PIO pio, const pio_program_t *program)
+{
+    return program == NULL || pio_program_cache_users(pio, program) > 0 || pio_can_add_program(pio, program);
+}
+
+// the programs are loaded via the shared program cache (also used by the MicroPython debouncer)
+int pio_resources_add_program(PIO pio, const pio_program_t *program)
+{
+    return pio_program_cache_add(pio, program);
+}
+
+void pio_resources_remove_program(PIO pio, const pio_program_t *program)
+{
+    pio_program_cache_remove(pio, program);
+}
+
+uint pio_resources_program_users(PIO pio, const pio_program_t *program)
+{
+    return pio_program_cache_users(pio, program);
+}
+
+bool pio_resources_claim_sm(const pio_program_t *program, PIO *pio, uint *sm, uint *offset)
+{
+    for (uint p = 0; p < NUM_PIOS; p++)
+    {
+        if (!program_fits(pio_list[p], program))
+            continue;
+        int s = pio_claim_unused_sm(pio_list[p], false);
+        if (s < 0)
+            continue;
+        if (program != NULL)
+        {
+            // the cache can be full: then try the next pio
+            int o = pio_resources_add_program(pio_list[p], program);
+            if (o < 0)
+            {
+                pio_sm_unclaim(pio_list[p], s);
+                continue;
+            }
+            *offset = o;
+        }
+        *pio = pio_list[p];
+        *sm = s;
+        return true;
+    }
+    return false;
+}
+
+bool pio_resources_claim_sm_mask(const pio_program_t *program, uint sm_mask, PIO *pio, uint *offset)
+{
+    for (uint p = 0; p < NUM_PIOS; p++)
+    {
+        if (!program_fits(pio_list[p], program))
+            continue;
+        // all state machines of the mask have to be free
+        uint s;
+        for (s = 0; s < 4; s++)
+            if ((sm_mask & (1u << s)) && pio_sm_is_claimed(pio_list[p], s))
+                break;
+        if (s < 4)
+            continue;
+        if (program != NULL)
+        {
+            // the cache can be full: then try the next pio
+            int o = pio_resources_add_program(pio_list[p], program);
+            if (o < 0)
+                continue;
+            *offset = o;
+        }
+        pio_claim_sm_mask(pio_list[p], sm_mask);
+        *pio = pio_list[p];
+        return true;
+    }
+    return false;
+}
+
+void pio_resources_release_sm(PIO pio, uint sm, const pio_program_t *program)
+{
+    pio_sm_set_enabled(pio, sm, false);
+    // the interrupt sources of the sm, so they don't fire for the next user
+    pio_set_irq0_source_enabled(pio, (pio_interrupt_source)(pis_sm0_rx_fifo_not_empty + sm), false);
+    pio_set_irq0_source_enabled(pio, (pio_interrupt_source)(pis_sm0_tx_fifo_not_full + sm), false);
+    pio_set_irq0_source_enabled(pio, (pio_interrupt_source)(pis_interrupt0 + sm), false);
+    pio_resources_remove_irq_handler(pio, sm);
+    pio_sm_unclaim(pio, sm);
+    if (program != NULL)
+        pio_resources_remove_program(pio, program);
+}
+
+// the interrupt handler for all pio blocks: call the handlers of the state machines with a pending interrupt
+static void pio_irq_handler(void)
+{
+    for (uint p = 0; p < NUM_PIOS; p++)
+    {
+        if (!irq_handler_set[p])
+            continue;
+        // the pending interrupt sources: bits 0-3 RX FIFO not empty, 4-7 TX FIFO not full, 8-11 irq flags
+        uint32_t ints = pio_list[p]->ints0;
+        // the state machines with a pending source, only those are visited (bit scan)
+        uint32_t pending = (ints | ints >> 4 | ints >> 8) & 0xF;
+        while (pending)
+        {
+            uint sm = __builtin_ctz(pending);
+            pending &= pending - 1;
+            if (handlers[p][sm].handler != NULL)
+                handlers[p][sm].handler(pio_list[p], sm, handlers[p][sm].user_data);
+        }
+    }
+}
+
+void pio_resources_set_irq_handler(PIO pio, uint sm, pio_resources_irq_handler handler, void *user_data)
+{
+    uint p = pio_get_index(pio);
+    handlers[p][sm].handler = handler;
+    handlers[p][sm].user_data = user_data;
+    // the first handler for this pio: set the interrupt handler of the pio
+    if (!irq_handler_set[p])
+    {
+        irq_set_exclusive_handler(pio_irq[p], pio_irq_handler);
+        irq_set_enabled(pio_irq[p], true);
+        irq_handler_set[p] = true;
+    }
+}
+
+void pio_resources_remove_irq_handler(PIO pio, uint sm)
+{
+    uint p = pio_get_index(pio);
+    handlers[p][sm].handler = NULL;
+    // no handlers left: remove the interrupt handler of the pio
+    for (uint s = 0; s < 4; s++)
+        if (handlers[p][s].handler != NULL)
+            return;
+    if (irq_handler_set[p])
+    {
+        irq_set_enabled(pio_irq[p], false);
+        irq_remove_handler(pio_irq[p], pio_irq_handler);
+        irq_handler_set[p] = false;
+    }
+}
+
+uint pio_resources_used_instructions(PIO pio)
+{
+    uint used = 0;
+    uint offset, length;
+    for (uint i = 0; i < PIO_PROGRAM_CACHE_SIZE; i++)
+        if (pio_program_cache_entry(pio, i, &offset, &length) > 0)
+            used += length;
+    return used;
+}
+
+void pio_resources_print_usage(void)
+{
+    for (uint p = 0; p < NUM_PIOS; p++)
+    {
+        PIO pio = pio_list[p];
+        printf("pio%d: state machines claimed:", p);
+        for (uint sm = 0; sm < 4; sm++)
+            if (pio_sm_is_claimed(pio, sm))
+                printf(" %d", sm);
+        printf(", %d of 32 instructions used\n", pio_resources_used_instructions(pio));
+        uint offset, length, users;
+        for (uint i = 0; i < PIO_PROGRAM_CACHE_SIZE; i++)
+            if ((users = pio_program_cache_entry(pio, i, &offset, &length)) > 0)
+                printf("    program at %2d-%2d, %d users\n", offset, offset + length - 1, users);
+    }
+}
@@ -0,0 +1,104 @@
+#ifndef PIO_RESOURCES_H
+#define PIO_RESOURCES_H
+
+#include "hardware/pio.h"
+
+/*
+ * Shared management of the pio resources for all drivers in one firmware
+ *
+ * - state machines: claimed over all pio blocks (pio0 first), on a pio that has the program
+ *   already loaded or has room for it
+ * - programs (the program cache): recognized by their content (instructions, length and origin),
+ *   so an identical program requested by several drivers is loaded only once in each pio.
+ *   Each request is counted, the program is removed when its last user releases it
+ * - interrupts: one handler for the PIOx_IRQ_0 interrupt of each pio, which calls the handler
+ *   that a driver has set for its state machine when one of the interrupt sources of that state
+ *   machine (RX FIFO not empty, TX FIFO not full or irq flag 'sm') is pending
+ * - the use of the instruction memory can be reported
+ *
+ * Note: programs that are loaded with pio_add_program() directly (not via this library) are not
+ *       known to the program cache, but they do take up room: pio_can_add_program() is used to
+ *       check if a program fits.
+ */
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+// the function that is called for the interrupts of a state machine
+typedef void (*pio_resources_irq_handler)(PIO pio, uint sm, void *user_data);
+
+/*
+ * Claim a state machine and load its program (or use the copy that is already loaded)
+ * the pio blocks are tried in order, pio0 first
+ * @param program: the program the state machine is going to run (NULL: only claim a sm)
+ * @param pio: the pio of the claimed state machine
+ * @param sm: the claimed state machine
+ * @param offset: the offset of the program in the pio memory (not used if program is NULL)
+ * returns false if no pio has both a free state machine and room for the program
+ */
+bool pio_resources_claim_sm(const pio_program_t *program, PIO *pio, uint *sm, uint *offset);
+
+/*
+ * Claim a specific set of state machines in the same pio and load their program
+ * (e.g. for state machines that have to work together via the irq flags)
+ * @param program: the program the state machines are going to run (NULL: only claim)
+ * @param sm_mask: the state machines to claim (bit i = sm i)
+ * @param pio: the pio of the claimed state machines
+ * @param offset: the offset of the program in the pio memory
+ * returns false if no pio has these state machines free and room for the program
+ */
+bool pio_resources_claim_sm_mask(const pio_program_t *program, uint sm_mask, PIO *pio, uint *offset);
+
+/*
+ * Release a state machine: it is disabled, its interrupt handler is removed, it is unclaimed
+ * and its program is released
+ * @param program: the program it used (NULL if no program was loaded with the claim)
+ */
+void pio_resources_release_sm(PIO pio, uint sm, const pio_program_t *program);
+
+/*
+ * Load a program into a pio, or use the copy that is already loaded
+ * returns the offset of the program in the pio memory, or -1 if it doesn't fit
+ */
+int pio_resources_add_program(PIO pio, const pio_program_t *program);
+
+/*
+ * Release a program that was loaded with pio_resources_add_program()
+ * the program is removed from the pio memory after the last release
+ */
+void pio_resources_remove_program(PIO pio, const pio_program_t *program);
+
+/*
+ * The number of users of a program in a pio (0 if it isn't loaded)
+ */
+uint pio_resources_program_users(PIO pio, const pio_program_t *program);
+
+/*
+ * Set the interrupt handler of a state machine
+ * the interrupt sources themselves have to be enabled by the driver with
+ * pio_set_irq0_source_enabled(), e.g. pis_sm0_rx_fifo_not_empty + sm
+ * @param handler: the function to call, it gets the pio, the sm and user_data
+ */
+void pio_resources_set_irq_handler(PIO pio, uint sm, pio_resources_irq_handler handler, void *user_data);
+
+/*
+ * Remove the interrupt handler of a state machine
+ */
+void pio_resources_remove_irq_handler(PIO pio, uint sm);
+
+/*
+ * The number of instructions in the pio memory used by the programs loaded via this library
+ */
+uint pio_resources_used_instructions(PIO pio);
+
+/*
+ * Print the use of all pio blocks: the claimed state machines and the loaded programs
+ */
+void pio_resources_print_usage(void);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
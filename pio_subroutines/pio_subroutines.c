@@ -0,0 +1,84 @@
+#include "pio_resources.h"
+#include "pio_subroutines.h"
+
+// the instructions that are changed by the linker
+#define JMP_MASK 0xE000
+#define JMP_BITS 0x0000
+// the return address: 'set y <address>'
+#define SET_Y_MASK 0xE0E0
+#define SET_Y_BITS 0xE040
+#define ADDRESS_MASK 0x1F
+
+// link a program for an offset: relocate the return addresses (the calls are pointed at the
+// routines after loading, see point_calls)
+static bool link(const pio_program_t *program, const pio_subroutines_call *calls, uint num_of_calls,
+                 uint offset, pio_subroutines_linked *linked)
+{
+    for (uint i = 0; i < program->length; i++)
+        linked->instructions[i] = program->instructions[i];
+    for (uint c = 0; c < num_of_calls; c++)
+    {
+        uint call = calls[c].call;
+        if (call == 0 || call >= program->length ||
+            (linked->instructions[call] & JMP_MASK) != JMP_BITS ||
+            (linked->instructions[call - 1] & SET_Y_MASK) != SET_Y_BITS)
+            return false;
+        uint16_t *set = &linked->instructions[call - 1];
+        *set = (*set & ~ADDRESS_MASK) | ((*set + offset) & ADDRESS_MASK);
+    }
+    linked->program.instructions = linked->instructions;
+    linked->program.length = program->length;
+    // it is loaded at this offset
+    linked->program.origin = offset;
+    return true;
+}
+
+// point the calls of a loaded program at the routines: pio_add_program() relocates every jmp
+// by adding the offset of the program, that doesn't wrap around the 32 instructions, so the
+// calls are written into the pio memory after loading
+static void point_calls(PIO pio, uint offset, const pio_subroutines_call *calls, uint num_of_calls,
+                        uint routines_offset, pio_subroutines_linked *linked)
+{
+    for (uint c = 0; c < num_of_calls; c++)
+    {
+        uint call = calls[c].call;
+        pio->instr_mem[offset + call] = (linked->instructions[call] & ~ADDRESS_MASK) | (routines_offset + calls[c].routine);
+    }
+}
+
+int pio_subroutines_add_program(PIO pio, const pio_program_t *program, const pio_subroutines_call *calls, uint num_of_calls,
+                                pio_subroutines_linked *linked)
+{
+    if (program->length > 32 || program->origin >= 0)
+        return -1;
+    int routines_offset = pio_resources_add_program(pio, &pio_subroutines_program);
+    if (routines_offset < 0)
+        return -1;
+    // the same program already linked in this pio (e.g. by another instance of the driver), otherwise
+    // the highest free offset (as pio_add_program does)
+    // Note: linked may be the memory of the loaded program, so the candidates are made elsewhere
+    pio_subroutines_linked candidate;
+    int offset = -1;
+    for (int o = 32 - program->length; o >= 0 && offset < 0; o--)
+        if (link(program, calls, num_of_calls, o, &candidate) && pio_resources_program_users(pio, &candidate.program) > 0)
+            offset = o;
+    for (int o = 32 - program->length; o >= 0 && offset < 0; o--)
+        if (link(program, calls, num_of_calls, o, &candidate) && pio_can_add_program(pio, &candidate.program))
+            offset = o;
+    if (offset >= 0)
+    {
+        *linked = candidate;
+        linked->program.instructions = linked->instructions;
+        pio_resources_add_program(pio, &linked->program);
+        point_calls(pio, offset, calls, num_of_calls, routines_offset, linked);
+        return offset;
+    }
+    pio_resources_remove_program(pio, &pio_subroutines_program);
+    return -1;
+}
+
+void pio_subroutines_remove_program(PIO pio, pio_subroutines_linked *linked)
+{
+    pio_resources_remove_program(pio, &linked->program);
+    pio_resources_remove_program(pio, &pio_subroutines_program);
+}
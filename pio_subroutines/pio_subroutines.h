@@ -0,0 +1,56 @@
+#ifndef PIO_SUBROUTINES_H
+#define PIO_SUBROUTINES_H
+
+#include "hardware/pio.h"
+
+#include "pio_subroutines.pio.h"
+
+/*
+ * Shared pio subroutines (see pio_subroutines.pio for the routines and the calling convention)
+ *
+ * The routines are one program, loaded once in each pio (via the shared pio resources). A
+ * program of a driver that calls them is linked when it is loaded: the return addresses
+ * ('set y <label>' before each call) are relocated to the offset of the program, and the call
+ * ('jmp 0' at a public label) is pointed at the routine in the loaded routines program.
+ * The linked program is kept in memory given by the driver; the same program linked in the
+ * same pio is loaded only once.
+ */
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+// a call in a program: the index of its jmp (the public label) and the routine
+// (pio_subroutines_offset_<name>)
+typedef struct
+{
+    uint8_t call;
+    uint8_t routine;
+} pio_subroutines_call;
+
+// a program linked to the routines in a pio
+typedef struct
+{
+    pio_program_t program;
+    uint16_t instructions[32];
+} pio_subroutines_linked;
+
+/*
+ * Load the routines (if needed) and a program that calls them into a pio
+ * @param calls: the calls in the program
+ * @param linked: the memory for the linked program, it must stay valid while it is loaded
+ * returns the offset of the program, or -1 if the routines and the program don't fit
+ */
+int pio_subroutines_add_program(PIO pio, const pio_program_t *program, const pio_subroutines_call *calls, uint num_of_calls,
+                                pio_subroutines_linked *linked);
+
+/*
+ * Release a linked program (and the routines, after their last user)
+ */
+void pio_subroutines_remove_program(PIO pio, pio_subroutines_linked *linked);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
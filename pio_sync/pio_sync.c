@@ -0,0 +1,65 @@
+#include "pio_resources.h"
+#include "pio_sync.h"
+
+void pio_sync_start(PIO pio, uint sm_mask)
+{
+    // stopped, so all of them start from the same state
+    pio_set_sm_mask_enabled(pio, sm_mask, false);
+    pio_restart_sm_mask(pio, sm_mask);
+    // one write: enable and restart the clock dividers of all of them
+    pio_enable_sm_mask_in_sync(pio, sm_mask);
+}
+
+void pio_sync_stop(PIO pio, uint sm_mask)
+{
+    pio_set_sm_mask_enabled(pio, sm_mask, false);
+}
+
+// enable or disable the interrupt sources of the sm's of the barrier
+static void barrier_set_sources_enabled(pio_sync_barrier *b, uint sm_mask, bool enabled)
+{
+    for (uint sm = 0; sm < 4; sm++)
+        if (sm_mask & (1u << sm))
+            pio_set_irq0_source_enabled(b->pio, (pio_interrupt_source)(pis_interrupt0 + sm), enabled);
+}
+
+// the interrupt handler (called by the pio resources for each sm of the barrier): if all have
+// set their irq flag, clear them at once. The sources are level triggered: an sm that has arrived
+// keeps its flag set, so its source is disabled until the barrier releases (otherwise the
+// interrupt would re-enter until the last sm arrives)
+static void barrier_handler(PIO pio, uint sm, void *user_data)
+{
+    pio_sync_barrier *b = (pio_sync_barrier *)user_data;
+    uint arrived = pio->irq & b->sm_mask;
+    if (arrived == b->sm_mask)
+    {
+        pio->irq = b->sm_mask;
+        b->count++;
+        barrier_set_sources_enabled(b, b->sm_mask, true);
+    }
+    else
+        barrier_set_sources_enabled(b, arrived, false);
+}
+
+void pio_sync_barrier_init(pio_sync_barrier *barrier, PIO pio, uint sm_mask)
+{
+    barrier->pio = pio;
+    barrier->sm_mask = sm_mask & 0xF;
+    barrier->count = 0;
+    // no flags of an earlier barrier
+    pio->irq = barrier->sm_mask;
+    for (uint sm = 0; sm < 4; sm++)
+        if (barrier->sm_mask & (1u << sm))
+            pio_resources_set_irq_handler(pio, sm, barrier_handler, barrier);
+    barrier_set_sources_enabled(barrier, barrier->sm_mask, true);
+}
+
+void pio_sync_barrier_remove(pio_sync_barrier *barrier)
+{
+    barrier_set_sources_enabled(barrier, barrier->sm_mask, false);
+    for (uint sm = 0; sm < 4; sm++)
+        if (barrier->sm_mask & (1u << sm))
+            pio_resources_remove_irq_handler(barrier->pio, sm);
+    // release the state machines that wait at the barrier
+    barrier->pio->irq = barrier->sm_mask;
+}
@@ -0,0 +1,79 @@
+#ifndef PIO_SYNC_H
+#define PIO_SYNC_H
+
+#include "hardware/pio.h"
+
+/*
+ * Lockstep state machines: start a set of state machines of one pio in the same clock cycle,
+ * and let them meet at barriers in their pio code
+ *
+ * - start: the state machines are stopped, restarted (the shift counters, the contents of the
+ *   ISR, the delay and the stalled instruction are cleared, the pc is not changed) and enabled
+ *   with one write to the CTRL register, which also restarts their clock dividers. A value
+ *   preloaded in the ISR is lost: preload it after the start, or only use
+ *   pio_enable_sm_mask_in_sync() on state machines that were just initialized. With the same program length per
+ *   item (and the same clock divider) they stay in phase, e.g. the sm's of parallel outputs
+ * - barrier: each state machine of the set executes 'irq wait 0 rel' (it sets its own irq
+ *   flag, 0 to 3, and stalls until the flag is cleared). When all flags of the set are set,
+ *   the interrupt handler clears them with one write: all state machines continue in the same
+ *   clock cycle, whatever their work before the barrier took. The irq flags of the state
+ *   machines (not their FIFOs) are used, so the handler is set via the shared pio resources.
+ *   Each arrival costs an interrupt, and the release comes a few microseconds after the last
+ *   arrival (the interrupt entry, the dispatch of the pio resources and the handler), so a
+ *   barrier is meant for realigning e.g. every frame or every measurement, not every bit.
+ *
+ * Note: two state machines can also meet without the cpu: one does 'irq wait n', the other
+ *       'irq clear n' (see Two_sm_one_disabled_with_irq), but 'wait irq' clears the flag, so
+ *       this doesn't extend to more than two
+ */
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+// a barrier for a set of state machines of one pio
+typedef struct
+{
+    PIO pio;
+    uint sm_mask;
+    // the number of times all state machines have met
+    volatile uint32_t count;
+} pio_sync_barrier;
+
+/*
+ * Start a set of state machines in the same clock cycle
+ * the state machines must be initialized (pio_sm_init) at the pc where they start
+ * @param sm_mask: the state machines (bit i = sm i)
+ */
+void pio_sync_start(PIO pio, uint sm_mask);
+
+/*
+ * Stop a set of state machines in the same clock cycle
+ */
+void pio_sync_stop(PIO pio, uint sm_mask);
+
+/*
+ * Set up a barrier for a set of state machines: in their pio code 'irq wait 0 rel' waits
+ * until all state machines of the set have reached it
+ * the state machines must be claimed, their irq flags (0-3) are used for the barrier
+ */
+void pio_sync_barrier_init(pio_sync_barrier *barrier, PIO pio, uint sm_mask);
+
+/*
+ * Remove a barrier (the state machines waiting at it are released)
+ */
+void pio_sync_barrier_remove(pio_sync_barrier *barrier);
+
+/*
+ * The barrier instruction, e.g. for pio_sm_exec() or a program made in c
+ */
+static inline uint pio_sync_barrier_instruction(void)
+{
+    return pio_encode_irq_wait(true, 0);
+}
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
@@ -0,0 +1,89 @@
+#include "pico/stdlib.h"
+#include "hardware/clocks.h"
+
+#include "pio_timing.h"
+
+// the clkdiv has 16 integer bits and 8 fractional bits
+#define MAX_CLKDIV (65535.f + 255.f / 256.f)
+
+// the frequency of each registered state machine, 0 = not registered
+static float sm_frequency[NUM_PIOS][4];
+
+// the functions called when the clock changes, NULL = free
+typedef struct
+{
+    pio_timing_callback callback;
+    void *user_data;
+} timing_callback;
+static timing_callback callbacks[PIO_TIMING_MAX_CALLBACKS];
+
+float pio_timing_clkdiv(float sm_hz)
+{
+    float clkdiv = (float)clock_get_hz(clk_sys) / sm_hz;
+    if (clkdiv < 1.f)
+        clkdiv = 1.f;
+    else if (clkdiv > MAX_CLKDIV)
+        clkdiv = MAX_CLKDIV;
+    return clkdiv;
+}
+
+uint32_t pio_timing_cycles_us(float us)
+{
+    return (uint32_t)((double)us * clock_get_hz(clk_sys) / 1e6 + 0.5);
+}
+
+uint32_t pio_timing_cycles_ns(float ns)
+{
+    return (uint32_t)((double)ns * clock_get_hz(clk_sys) / 1e9 + 0.5);
+}
+
+void pio_timing_register_sm(PIO pio, uint sm, float sm_hz)
+{
+    sm_frequency[pio_get_index(pio)][sm] = sm_hz;
+    pio_sm_set_clkdiv(pio, sm, pio_timing_clkdiv(sm_hz));
+}
+
+void pio_timing_unregister_sm(PIO pio, uint sm)
+{
+    sm_frequency[pio_get_index(pio)][sm] = 0;
+}
+
+bool pio_timing_add_callback(pio_timing_callback callback, void *user_data)
+{
+    for (uint i = 0; i < PIO_TIMING_MAX_CALLBACKS; i++)
+        if (callbacks[i].callback == NULL)
+        {
+            callbacks[i].callback = callback;
+            callbacks[i].user_data = user_data;
+            return true;
+        }
+    return false;
+}
+
+void pio_timing_remove_callback(pio_timing_callback callback, void *user_data)
+{
+    for (uint i = 0; i < PIO_TIMING_MAX_CALLBACKS; i++)
+        if (callbacks[i].callback == callback && callbacks[i].user_data == user_data)
+            callbacks[i].callback = NULL;
+}
+
+bool pio_timing_set_sys_clock_khz(uint32_t freq_khz, bool required)
+{
+    if (!set_sys_clock_khz(freq_khz, required))
+        return false;
+    pio_timing_clock_changed();
+    return true;
+}
+
+void pio_timing_clock_changed(void)
+{
+    // the state machines keep running, only their clkdiv changes
+    for (uint p = 0; p < NUM_PIOS; p++)
+        for (uint sm = 0; sm < 4; sm++)
+            if (sm_frequency[p][sm] > 0)
+                pio_sm_set_clkdiv(pio_get_instance(p), sm, pio_timing_clkdiv(sm_frequency[p][sm]));
+    uint32_t sys_clock_hz = clock_get_hz(clk_sys);
+    for (uint i = 0; i < PIO_TIMING_MAX_CALLBACKS; i++)
+        if (callbacks[i].callback != NULL)
+            callbacks[i].callback(sys_clock_hz, callbacks[i].user_data);
+}
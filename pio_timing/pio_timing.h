@@ -0,0 +1,76 @@
+#ifndef PIO_TIMING_H
+#define PIO_TIMING_H
+
+#include "hardware/pio.h"
+
+/*
+ * Timing of the state machines that doesn't depend on the system clock
+ *
+ * The pio programs count clock cycles, so a fixed clkdiv (e.g. 1250 for 10 us per cycle)
+ * only gives the right timing at 125 MHz. With this library:
+ * - a driver asks for the frequency of its sm: pio_timing_clkdiv(100000) is the clkdiv for
+ *   10 us per cycle at the current system clock. pio_timing_cycles_us() and
+ *   pio_timing_cycles_ns() give the number of system clock cycles for a time, e.g. for a
+ *   timeout that a program counts down
+ * - the driver registers the state machine with its frequency (pio_timing_register_sm), or
+ *   a function for times it has calculated itself (pio_timing_add_callback)
+ * - the system clock is changed with pio_timing_set_sys_clock_khz() instead of
+ *   set_sys_clock_khz(), which sets the clkdiv of all registered state machines again and
+ *   calls the functions. If the clock was changed otherwise, call pio_timing_clock_changed()
+ * So one driver can overclock (e.g. the ledpanel or the Z80) without breaking the timing of
+ * the other drivers in the same firmware.
+ * Note: the clkdiv is 1 to 65536, a frequency outside the range that gives is clamped
+ */
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+// the maximum number of functions called when the system clock changes
+#define PIO_TIMING_MAX_CALLBACKS 8
+
+// a function that is called when the system clock has changed
+typedef void (*pio_timing_callback)(uint32_t sys_clock_hz, void *user_data);
+
+// the clkdiv that gives a sm frequency of 'sm_hz' at the current system clock
+float pio_timing_clkdiv(float sm_hz);
+
+// the number of system clock cycles in a time
+uint32_t pio_timing_cycles_us(float us);
+uint32_t pio_timing_cycles_ns(float ns);
+
+/*
+ * Keep the frequency of a state machine: its clkdiv is set now and every time the system
+ * clock changes
+ * @param sm_hz: the frequency of the sm (the instructions per second)
+ */
+void pio_timing_register_sm(PIO pio, uint sm, float sm_hz);
+
+// stop keeping the frequency of a state machine (e.g. when the sm is unclaimed)
+void pio_timing_unregister_sm(PIO pio, uint sm);
+
+/*
+ * Call a function when the system clock changes, e.g. to calculate a conversion from
+ * clock cycles to time again
+ * returns false if there are already PIO_TIMING_MAX_CALLBACKS functions
+ */
+bool pio_timing_add_callback(pio_timing_callback callback, void *user_data);
+
+// remove a function (with the same user_data) added by pio_timing_add_callback
+void pio_timing_remove_callback(pio_timing_callback callback, void *user_data);
+
+/*
+ * Change the system clock (like set_sys_clock_khz) and apply it to the registered state
+ * machines and functions
+ * returns false if the clock can't be set
+ */
+bool pio_timing_set_sys_clock_khz(uint32_t freq_khz, bool required);
+
+// apply the current system clock to the registered state machines and functions
+void pio_timing_clock_changed(void);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
@@ -0,0 +1,88 @@
+#include "sm_channel.h"
+
+// the flag in FDEBUG that is set when the TX FIFO of a sm was written while full
+#define TXOVER_BIT(sm) (1u << (PIO_FDEBUG_TXOVER_LSB + (sm)))
+
+bool sm_channel_init(sm_channel *ch, PIO from_pio, uint from_sm, PIO to_pio, uint to_sm, uint width, sm_channel_transport transport)
+{
+    if (width == 8)
+        ch->size = DMA_SIZE_8;
+    else if (width == 16)
+        ch->size = DMA_SIZE_16;
+    else if (width == 32)
+        ch->size = DMA_SIZE_32;
+    else
+        return false;
+    ch->from_pio = from_pio;
+    ch->from_sm = from_sm;
+    ch->to_pio = to_pio;
+    ch->to_sm = to_sm;
+    ch->transport = transport;
+    ch->relay = 0;
+    ch->dma_chan = dma_claim_unused_channel(true);
+    ch->dma_chan_relay = dma_claim_unused_channel(true);
+
+    dma_channel_config c = dma_channel_get_default_config(ch->dma_chan);
+    channel_config_set_transfer_data_size(&c, ch->size);
+    channel_config_set_read_increment(&c, false);
+    channel_config_set_write_increment(&c, false);
+    // an item of the sender is available
+    channel_config_set_dreq(&c, pio_get_dreq(from_pio, from_sm, false));
+    channel_config_set_chain_to(&c, ch->dma_chan_relay);
+    if (transport == SM_CHANNEL_DMA)
+    {
+        // straight from FIFO to FIFO, the second channel restarts it when its count runs out
+        dma_channel_configure(ch->dma_chan, &c, &to_pio->txf[to_sm], &from_pio->rxf[from_sm], 0xFFFFFFFF, false);
+        static const uint32_t reload_count = 0xFFFFFFFF;
+        c = dma_channel_get_default_config(ch->dma_chan_relay);
+        channel_config_set_transfer_data_size(&c, DMA_SIZE_32);
+        channel_config_set_read_increment(&c, false);
+        channel_config_set_write_increment(&c, false);
+        dma_channel_configure(ch->dma_chan_relay, &c, &dma_hw->ch[ch->dma_chan].al1_transfer_count_trig, &reload_count, 1, false);
+    }
+    else
+    {
+        // one item from the sender into the relay, then the second channel
+        dma_channel_configure(ch->dma_chan, &c, &ch->relay, &from_pio->rxf[from_sm], 1, false);
+        // one item from the relay to the receiver when it has room, then the first channel again
+        // (a chained channel starts again with its transfer count, its addresses don't increment)
+        c = dma_channel_get_default_config(ch->dma_chan_relay);
+        channel_config_set_transfer_data_size(&c, ch->size);
+        channel_config_set_read_increment(&c, false);
+        channel_config_set_write_increment(&c, false);
+        channel_config_set_dreq(&c, pio_get_dreq(to_pio, to_sm, true));
+        channel_config_set_chain_to(&c, ch->dma_chan);
+        dma_channel_configure(ch->dma_chan_relay, &c, &to_pio->txf[to_sm], &ch->relay, 1, false);
+    }
+    return true;
+}
+
+void sm_channel_start(sm_channel *ch)
+{
+    // no overflow from before the start
+    ch->to_pio->fdebug = TXOVER_BIT(ch->to_sm);
+    dma_channel_start(ch->dma_chan);
+}
+
+void sm_channel_stop(sm_channel *ch)
+{
+    // the channels trigger each other: abort the first before and after the second
+    dma_channel_abort(ch->dma_chan);
+    dma_channel_abort(ch->dma_chan_relay);
+    dma_channel_abort(ch->dma_chan);
+}
+
+bool sm_channel_overflowed(sm_channel *ch)
+{
+    bool overflowed = ch->to_pio->fdebug & TXOVER_BIT(ch->to_sm);
+    // the flag is cleared by writing a 1
+    ch->to_pio->fdebug = TXOVER_BIT(ch->to_sm);
+    return overflowed;
+}
+
+void sm_channel_release(sm_channel *ch)
+{
+    sm_channel_stop(ch);
+    dma_channel_unclaim(ch->dma_chan);
+    dma_channel_unclaim(ch->dma_chan_relay);
+}
@@ -0,0 +1,90 @@
+#ifndef SM_CHANNEL_H
+#define SM_CHANNEL_H
+
+#include "hardware/pio.h"
+#include "hardware/dma.h"
+
+/*
+ * A channel from one state machine to another: what the sender pushes into its RX FIFO
+ * arrives in the TX FIFO of the receiver, without the cpu (and without pins)
+ *
+ * The transports:
+ * - SM_CHANNEL_DMA: one dma channel, paced by the RX FIFO of the sender. The fastest, but
+ *   without backpressure: the receiver has to keep up, a word written into its full TX FIFO
+ *   is lost (this is detected: sm_channel_overflowed())
+ * - SM_CHANNEL_DMA_BACKPRESSURE: two dma channels that chain to each other, each moving one
+ *   item: the first waits for an item of the sender and reads it into a relay word, the second
+ *   waits for room in the TX FIFO of the receiver and writes it. If the receiver is slow the
+ *   sender stalls on its 'push block' (its RX FIFO is full), no item is lost
+ *
+ * The width of an item is 8, 16 or 32 bits (the dma transfer size): the low bits of what the
+ * sender pushes are read, and a narrow write into the TX FIFO puts the item in all byte lanes
+ * (8 bits) or both halves (16 bits) of the word, so the receiver can shift out either end.
+ * The sender and receiver can be on different pio blocks.
+ *
+ * Note: the RP2350 can use the RX FIFO of a state machine as registers ('mov rxfifo[y], isr'
+ *       and 'mov osr, rxfifo[y]'), but only the state machine itself and the system bus can get
+ *       to them, not another state machine, so these transports are used on both chips.
+ */
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+// the transports
+typedef enum
+{
+    SM_CHANNEL_DMA,
+    SM_CHANNEL_DMA_BACKPRESSURE
+} sm_channel_transport;
+
+// a channel
+typedef struct
+{
+    PIO from_pio;
+    uint from_sm;
+    PIO to_pio;
+    uint to_sm;
+    sm_channel_transport transport;
+    // the dma transfer size of an item
+    enum dma_channel_transfer_size size;
+    // the dma channels: the data channel, and for backpressure the one from the relay to the receiver
+    int dma_chan;
+    int dma_chan_relay;
+    // the item between the two dma channels (backpressure)
+    uint32_t relay;
+} sm_channel;
+
+/*
+ * Set up a channel between two state machines (they are configured by the caller)
+ * @param width: the number of bits of an item: 8, 16 or 32
+ * returns false if the width is not valid
+ */
+bool sm_channel_init(sm_channel *ch, PIO from_pio, uint from_sm, PIO to_pio, uint to_sm, uint width, sm_channel_transport transport);
+
+/*
+ * Start moving items (the state machines are not enabled by this)
+ */
+void sm_channel_start(sm_channel *ch);
+
+/*
+ * Stop moving items, an item in the relay may be lost
+ */
+void sm_channel_stop(sm_channel *ch);
+
+/*
+ * SM_CHANNEL_DMA: has an item been lost because the TX FIFO of the receiver was full
+ * (since the last call, or since the start)
+ */
+bool sm_channel_overflowed(sm_channel *ch);
+
+/*
+ * Release the dma channels
+ */
+void sm_channel_release(sm_channel *ch);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
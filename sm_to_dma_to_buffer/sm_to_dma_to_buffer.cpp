@@ -3,9 +3,168 @@
 #include "pico/stdlib.h"
 #include "hardware/pio.h"
 #include "hardware/dma.h"
+#include "hardware/vreg.h"
+#include "hardware/structs/bus_ctrl.h"
 
 #include "sm_to_dma_to_buffer.pio.h"
 
+// the original example: capture 100 words into a buffer and stop
+// comment out for the continuous capture into a ring buffer
+// #define ONE_SHOT
+// the continuous capture: capture the gpios (1 word per clock cycle) instead of the counter
+// (3 clock cycles per word, but its values show if words were lost)
+// #define CAPTURE_PINS
+
+// the ring buffer: a power of 2 in size and aligned to its size (for the dma ring), at most 32 kB
+#define RING_BITS 15
+#define RING_WORDS ((1 << RING_BITS) / 4)
+uint32_t ring[RING_WORDS] __attribute__((aligned(1 << RING_BITS)));
+
+// class for a logic analyzer style continuous capture: a sm pushes words, a dma channel writes
+// them into the ring (wrapping the write address), a control channel restarts it when its
+// transfer count runs out. The consumer reads from the ring behind the write pointer, if it
+// falls behind more than the ring it has lost data: this is detected and counted (overruns).
+class continuous_capture
+{
+public:
+    // the sm must be initialized (not enabled) with its program
+    continuous_capture(PIO _pio, uint _sm) : pio(_pio), sm(_sm)
+    {
+        // the dma gets priority on the bus: the cpu reading the ring must not slow it down
+        bus_ctrl_hw->priority = BUSCTRL_BUS_PRIORITY_DMA_W_BITS | BUSCTRL_BUS_PRIORITY_DMA_R_BITS;
+        dma_chan = dma_claim_unused_channel(true);
+        dma_chan_ctrl = dma_claim_unused_channel(true);
+        // the data channel: the RxFIFO into the ring
+        dma_channel_config c = dma_channel_get_default_config(dma_chan);
+        channel_config_set_transfer_data_size(&c, DMA_SIZE_32);
+        channel_config_set_read_increment(&c, false);
+        channel_config_set_write_increment(&c, true);
+        // wrap the write address at the end of the ring
+        channel_config_set_ring(&c, true, RING_BITS);
+        // the sm determines when there is data
+        channel_config_set_dreq(&c, pio_get_dreq(pio, sm, false));
+        // restart via the control channel when all words have been transferred
+        channel_config_set_chain_to(&c, dma_chan_ctrl);
+        dma_channel_configure(dma_chan, &c, ring, &pio->rxf[sm], dma_count, false);
+        // the control channel writes the transfer count (and triggers) the data channel,
+        // the write address just continues in the ring
+        c = dma_channel_get_default_config(dma_chan_ctrl);
+        channel_config_set_transfer_data_size(&c, DMA_SIZE_32);
+        channel_config_set_read_increment(&c, false);
+        channel_config_set_write_increment(&c, false);
+        dma_channel_configure(dma_chan_ctrl, &c, &dma_hw->ch[dma_chan].al1_transfer_count_trig, &dma_count, 1, false);
+    }
+
+    // start capturing (the sm starts, so it should be at the start of its program)
+    void start(void)
+    {
+        written = 0;
+        last_transferred = 0;
+        read_position = 0;
+        overrun_count = 0;
+        // the data channel starts at the beginning of the ring with a full transfer count
+        dma_channel_set_write_addr(dma_chan, ring, false);
+        dma_channel_set_trans_count(dma_chan, dma_count, true);
+        pio_sm_set_enabled(pio, sm, true);
+    }
+
+    // stop capturing
+    void stop(void)
+    {
+        pio_sm_set_enabled(pio, sm, false);
+        // abort the control channel before and after the data channel: the data channel can
+        // trigger it when it is aborted
+        dma_channel_abort(dma_chan_ctrl);
+        dma_channel_abort(dma_chan);
+        dma_channel_abort(dma_chan_ctrl);
+    }
+
+    // the write pointer: the total number of words written into the ring since the start
+    // Note: call this (or read()) at least once every 2^32 words (34 s at 1 word per cycle at 125 MHz)
+    uint64_t write_position(void)
+    {
+        // the words transferred since the last restart of the data channel, a restart is
+        // seen as a decrease
+        uint32_t transferred = dma_count - dma_hw->ch[dma_chan].transfer_count;
+        if (transferred < last_transferred)
+            written += dma_count;
+        last_transferred = transferred;
+        return written + transferred;
+    }
+
+    // the read pointer: the total number of words read (or skipped) by the consumer
+    uint64_t read_pointer(void)
+    {
+        return read_position;
+    }
+
+    // read at most max_words (oldest first) into a buffer, returns the number of words
+    // if the consumer has fallen behind more than the ring, it skips to the newer half of
+    // the ring and an overrun is counted
+    uint read(uint32_t *buffer, uint max_words)
+    {
+        uint64_t head = write_position();
+        // words that have been overwritten: skip ahead (with a margin, the dma keeps writing
+        // while copying)
+        if (head - read_position > RING_WORDS)
+        {
+            overrun_count++;
+            read_position = head - RING_WORDS / 2;
+        }
+        uint n = head - read_position;
+        if (n > max_words)
+            n = max_words;
+        uint64_t first = read_position;
+        for (uint i = 0; i < n; i++)
+            buffer[i] = ring[(first + i) % RING_WORDS];
+        // check that the dma hasn't overwritten the words while they were copied
+        if (write_position() - first > RING_WORDS)
+        {
+            overrun_count++;
+            read_position = write_position();
+            return 0;
+        }
+        read_position = first + n;
+        return n;
+    }
+
+    // the number of times the consumer has fallen behind more than the ring
+    uint32_t overruns(void)
+    {
+        return overrun_count;
+    }
+
+    // measure the throughput in MB/s during interval_us (the consumer doesn't read meanwhile)
+    float measure_MBps(uint32_t interval_us)
+    {
+        uint64_t start_words = write_position();
+        uint64_t start_us = time_us_64();
+        busy_wait_us(interval_us);
+        uint64_t words = write_position() - start_words;
+        uint64_t us = time_us_64() - start_us;
+        // bytes per us = MB/s
+        return (float)(4 * words) / (float)us;
+    }
+
+private:
+    // the pio instance
+    PIO pio;
+    // the state machine
+    uint sm;
+    // the dma channels
+    int dma_chan;
+    int dma_chan_ctrl;
+    // the number of words the data channel transfers before it is restarted
+    uint32_t dma_count = 0xFFFFFFFF;
+    // the words written before the last restart, and the words transferred since then at the last check
+    uint64_t written = 0;
+    uint32_t last_transferred = 0;
+    // the consumer
+    uint64_t read_position = 0;
+    uint32_t overrun_count = 0;
+};
+
+#ifdef ONE_SHOT
 int main()
 {
     // buffer to write to
@@ -61,4 +220,80 @@ int main()
     // endless loop to end this program
     while (true)
         ;
-}
\ No newline at end of file
+}
+#else
+// the system clocks (kHz) at which the throughput is measured
+const uint32_t sys_clocks_khz[] = {125000, 200000, 250000};
+
+int main()
+{
+    // set the voltage a bit higher than default (for the highest clock)
+    vreg_set_voltage(0b1100); // 1.15v
+
+    // pio 0 is used
+    PIO pio = pio0;
+    // state machine 0
+    uint sm0 = 0;
+#ifdef CAPTURE_PINS
+    // sample the gpios every clock cycle
+    uint offset0 = pio_add_program(pio, &capture_pins_program);
+    pio_sm_config smc0 = capture_pins_program_get_default_config(offset0);
+    sm_config_set_in_pins(&smc0, 0);
+    // autopush every 32 bits: each sample
+    sm_config_set_in_shift(&smc0, false, true, 32);
+    const uint cycles_per_word = 1;
+#else
+    // the counter
+    uint offset0 = pio_add_program(pio, &sm_to_dma_to_buffer_program);
+    pio_sm_config smc0 = sm_to_dma_to_buffer_program_get_default_config(offset0);
+    const uint cycles_per_word = 3;
+#endif
+    // only the RxFIFO is used: 8 words deep, to bridge short stalls of the dma
+    sm_config_set_fifo_join(&smc0, PIO_FIFO_JOIN_RX);
+
+    // the words read by the consumer
+    static uint32_t buffer[256];
+    for (uint i = 0; i < sizeof(sys_clocks_khz) / sizeof(sys_clocks_khz[0]); i++)
+    {
+        set_sys_clock_khz(sys_clocks_khz[i], true);
+        // needed for printf (again: the uart follows the changed clock)
+        stdio_init_all();
+        sleep_ms(1000);
+        // init the pio sm0 with the config (this also puts it at the start of its program)
+        pio_sm_init(pio, sm0, offset0, &smc0);
+        static continuous_capture capture(pio, sm0);
+        capture.start();
+        // the throughput without a consumer
+        float mbps = capture.measure_MBps(100000);
+        // one second with a consumer that checks the counter (a gap means lost words)
+        uint64_t words_read = 0;
+        uint32_t gaps = 0;
+        uint32_t previous = 0;
+        bool first = true;
+        absolute_time_t end = make_timeout_time_ms(1000);
+        while (!time_reached(end))
+        {
+            uint n = capture.read(buffer, 256);
+            for (uint j = 0; j < n; j++)
+            {
+                if (!first && buffer[j] != previous + 1)
+                    gaps++;
+                previous = buffer[j];
+                first = false;
+            }
+            words_read += n;
+        }
+        capture.stop();
+        printf("sys clock %d MHz: %f MB/s (%f MB/s expected)\n", sys_clocks_khz[i] / 1000, mbps,
+               4.f * sys_clocks_khz[i] / 1000.f / cycles_per_word);
+        printf("    consumer: %d words read in 1 s, %d overruns detected", (uint32_t)words_read, capture.overruns());
+#ifndef CAPTURE_PINS
+        printf(", %d gaps in the counter", gaps);
+#endif
+        printf("\n");
+    }
+    // endless loop to end this program
+    while (true)
+        ;
+}
+#endif
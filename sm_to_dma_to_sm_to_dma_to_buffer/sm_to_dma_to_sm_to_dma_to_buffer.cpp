@@ -9,6 +9,13 @@ In between sm0 and sm1 there is a DMA channel, and between sm1 and the buffere t
 
 sm0 -> dma_chan_2 -> sm1 -> dma_chan_1 -> buffer
 
+The dma channels, their DREQs and the order of starting are done by the dma pipeline builder
+(see ../dma_pipeline): the stages are given with their nominal rate (items per second), the
+slowest of the two state machines paces the dma channel between them.
+
+After the single run into the buffer, the same state machines run endlessly into a ping-pong
+buffer and the throughput of each link is measured.
+
 */
 
 #include <stdio.h>
@@ -16,15 +23,33 @@ sm0 -> dma_chan_2 -> sm1 -> dma_chan_1 -> buffer
 #include "pico/stdlib.h"
 #include "hardware/pio.h"
 #include "hardware/dma.h"
+#include "hardware/clocks.h"
 
 #include "sm_to_dma_to_sm_to_dma_to_buffer.pio.h"
+#include "dma_pipeline.h"
 
-int main()
+// the number of instructions per item of the programs (see the pio file)
+#define TESTER0_INSTRUCTIONS 3
+#define TESTER1_INSTRUCTIONS 4
+
+// the number of samples in the buffer
+#define NUM_SAMPLES 1000
+// buffer to write to
+uint32_t buffer[NUM_SAMPLES];
+// the ping-pong buffer: two halves of NUM_SAMPLES / 2
+uint32_t pingpong[NUM_SAMPLES];
+
+// (re)start the state machines at the beginning of their programs with empty FIFOs
+void reset_sm(PIO pio, uint sm, uint offset)
 {
-    uint32_t num_samples = 1000;
-    // buffer to write to
-    uint32_t buffer[num_samples];
+    pio_sm_set_enabled(pio, sm, false);
+    pio_sm_clear_fifos(pio, sm);
+    pio_sm_restart(pio, sm);
+    pio_sm_exec(pio, sm, pio_encode_jmp(offset));
+}
 
+int main()
+{
     // needed for printf
     stdio_init_all();
 
@@ -50,74 +75,47 @@ int main()
     pio_sm_clear_fifos(pio, sm0);
     pio_sm_clear_fifos(pio, sm1);
 
-    // DMA channel from sm1 to a buffer in memory
-    // NOTES:
-    // - this channel is paced (dreq) by reading output from sm1 (is_tx is false)
-    // - this channel may start immediately
-
-    // Get a free DMA channel, panic() if there are none
-    int dma_chan_1 = dma_claim_unused_channel(true);
-    // make a dma config
-    dma_channel_config dma_conf_1 = dma_channel_get_default_config(dma_chan_1);
-    // transfer uint32_t
-    channel_config_set_transfer_data_size(&dma_conf_1, DMA_SIZE_32);
-    // a FIFO is read -> no increment of read pointer
-    channel_config_set_read_increment(&dma_conf_1, false);
-    // a buffer in memory is written to -> increment write pointer
-    channel_config_set_write_increment(&dma_conf_1, true);
-    // let the sm0 of pio determine the speed
-    channel_config_set_dreq(&dma_conf_1, pio_get_dreq(pio, sm1, false));
-    // configure the dma channel to read num_samples uint32_t from sm1 to the buffer
-    dma_channel_configure(dma_chan_1, &dma_conf_1,
-                          buffer,         // Destinatinon pointer
-                          &pio->rxf[sm1], // Source pointer
-                          num_samples,    // Number of transfers
-                          true            // Start immediately
-    );
-
-    // DMA channel from sm0 output to sm1 input
-    // NOTES:
-    // - this channel is paced (dreq) by writing to sm1 (is_tx is true).
-    //   The PIO program of sm1 is 4 instructions, sm0 is 3 instructions
-    //   If sm0 is made slower than sm1, then dreq should depend on sm0 (is_tx is false)
-    // - this channel should not start immediately. First enable the state machines
-
-    // Get a free channel, panic() if there are none
-    int dma_chan_2 = dma_claim_unused_channel(true);
-    // make a dma config
-    dma_channel_config dma_conf_2 = dma_channel_get_default_config(dma_chan_2);
-    // transfer uint32_t
-    channel_config_set_transfer_data_size(&dma_conf_2, DMA_SIZE_32);
-    // a FIFO is read -> no increment of read pointer
-    channel_config_set_read_increment(&dma_conf_2, false);
-    // a FIFO is written to -> no increment of write pointer
-    channel_config_set_write_increment(&dma_conf_2, false);
-    // let writing to sm1 determine the speed if sm1 is slower than sm0
-    channel_config_set_dreq(&dma_conf_2, pio_get_dreq(pio, sm1, true));
-    // let writing to sm0 determine the speed if sm0 is slower than sm1
-    // channel_config_set_dreq(&dma_conf_2, pio_get_dreq(pio, sm0, false));
-    // configure the dma channel to read num_samples uint32_t from sm0 to sm1
-    dma_channel_configure(dma_chan_2, &dma_conf_2,
-                          &pio->txf[sm1], // Destinatinon pointer
-                          &pio->rxf[sm0], // Source pointer
-                          num_samples,    // Number of transfers
-                          false           // Start immediately
-    );
-
-    // enable the state machines
-    pio_sm_set_enabled(pio, sm1, true);
-    pio_sm_set_enabled(pio, sm0, true);
-
-    // start the dma channel from sm0 to sm1: start producing data
-    dma_channel_start(dma_chan_2);
-    // wait for dma channel from sm1 to the buffer to finish
-    dma_channel_wait_for_finish_blocking(dma_chan_1);
+    // the nominal rates of the state machines (clkdiv 1)
+    float rate0 = (float)clock_get_hz(clk_sys) / TESTER0_INSTRUCTIONS;
+    float rate1 = (float)clock_get_hz(clk_sys) / TESTER1_INSTRUCTIONS;
+
+    // sm0 -> dma -> sm1 -> dma -> buffer, once
+    dma_pipeline once;
+    dma_pipeline_init(&once, DMA_SIZE_32);
+    dma_pipeline_add_sm(&once, pio, sm0, rate0);
+    dma_pipeline_add_sm(&once, pio, sm1, rate1);
+    dma_pipeline_add_buffer(&once, buffer, NUM_SAMPLES, DMA_PIPELINE_ONCE);
+    // start (it enables the state machines, sm1 first) and wait for it to finish
+    dma_pipeline_start(&once);
+    dma_pipeline_wait(&once);
+    dma_pipeline_print(&once);
 
     // print the result in the buffer
-    for (int i = 0; i < num_samples; i++)
+    for (int i = 0; i < NUM_SAMPLES; i++)
     {
         printf("buffer = %d\n", buffer[i]);
     }
+    dma_pipeline_stop(&once);
+
+    // sm0 -> dma -> sm1 -> dma -> ping-pong buffer, endless
+    reset_sm(pio, sm0, offset0);
+    reset_sm(pio, sm1, offset1);
+    dma_pipeline endless;
+    dma_pipeline_init(&endless, DMA_SIZE_32);
+    dma_pipeline_add_sm(&endless, pio, sm0, rate0);
+    dma_pipeline_add_sm(&endless, pio, sm1, rate1);
+    dma_pipeline_add_buffer(&endless, pingpong, NUM_SAMPLES / 2, DMA_PIPELINE_PINGPONG);
+    dma_pipeline_start(&endless);
+    dma_pipeline_print(&endless);
+
+    // infinite loop to print the throughput of the links and the first value of the latest half
     while (true)
-        ;
-}
\ No newline at end of file
+    {
+        float items_per_second[2];
+        dma_pipeline_measure(&endless, items_per_second, 100000);
+        int half = dma_pipeline_ready_half(&endless);
+        printf("sm0 -> sm1: %f items/s, sm1 -> buffer: %f items/s, latest half %d starts with %d\n",
+               items_per_second[0], items_per_second[1], half, half < 0 ? 0 : pingpong[half * NUM_SAMPLES / 2]);
+        sleep_ms(900);
+    }
+}
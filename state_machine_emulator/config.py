@@ -2,3 +2,7 @@ SAVE_TEST_DATA = False
 
 EMULATION_STEPS = 500
 STATEMACHINE_NUMBER = 0
+# the default number of steps in headless mode (no GUI)
+HEADLESS_STEPS = 100000
+# the number of clock cycles between a dma channel reading a word and writing it
+DMA_LATENCY = 2
@@ -0,0 +1,167 @@
+from config import DMA_LATENCY
+
+
+class dma_channel:
+    """ the configuration and the state of one dma channel """
+
+    def __init__(self, number):
+        self.number = number
+        # where the channel reads from and writes to: 'mem', or ('rx', sm) / ('tx', sm) for the FIFO of a state machine
+        self.read_from = 'mem'
+        self.write_to = 'mem'
+        # the DREQ that paces the channel: ('rx', sm), ('tx', sm), or None for no pacing (memory to memory)
+        # if it isn't set, it is the RxFIFO that is read or the TxFIFO that is written
+        self.dreq = None
+        self.dreq_is_set = False
+        # the memory the channel reads from, and the index of the next word to read
+        self.data = []
+        self.read_index = 0
+        # the reading of the memory wraps around to the start (e.g. for an endlessly repeated frame)
+        self.ring = False
+        # the channel that is started when this channel has finished (-1 means none)
+        self.chain_to = -1
+        # the number of transfers when the channel is started (also when it is started by chaining)
+        self.count = 0
+        # the number of transfers still to do, and whether the channel is busy
+        self.transfer_count = 0
+        self.busy = False
+        # the words that have been read but not yet written: (time of the write, value)
+        self.in_flight = []
+        # statistics: the number of transfers, when the first and last were done, and the number of
+        # clock cycles the channel had transfers to do but had to wait for its DREQ
+        self.transfers = 0
+        self.first_transfer = -1
+        self.last_transfer = -1
+        self.dreq_waits = 0
+
+
+class dma:
+    """ This class is a simple model of the dma of the RP2040
+        - at most one transfer is started per clock cycle (the channels share the bus), the channels take turns
+        - a transfer is only started when its DREQ allows it: the RxFIFO isn't empty, or the TxFIFO (with the
+          words that are still on their way to it) isn't full
+        - a word is written DMA_LATENCY clock cycles after it was read
+        These are approximations of the real hardware, but they are good enough to see stalls and throughput.
+    """
+
+    def __init__(self, state_machines, number_of_channels=12):
+        # the state machines (of one PIO) whose FIFOs the channels use, index 0 to 3
+        self.state_machines = state_machines
+        self.channels = [dma_channel(n) for n in range(number_of_channels)]
+        # the channel that gets the first turn in the next clock cycle
+        self.next_channel = 0
+
+    def fifo(self, argument):
+        """ convert 'mem', 'rx0' ... 'rx3' and 'tx0' ... 'tx3' to what is used in the channel """
+        if argument == 'mem':
+            return 'mem'
+        if isinstance(argument, str) and argument[:2] in ['rx', 'tx'] and argument[2:] in ['0', '1', '2', '3']:
+            return (argument[:2], int(argument[2:]))
+        return None
+
+    def command(self, number, command, argument):
+        """ execute a c-program statement for dma channel 'number', returns the warnings """
+        if number < 0 or number >= len(self.channels):
+            return ["Warning: there is no dma channel " + str(number) + ", continuing\n"]
+        channel = self.channels[number]
+        if command in ['read', 'write', 'dreq']:
+            fifo = self.fifo(argument)
+            if fifo is None or (command == 'read' and fifo != 'mem' and fifo[0] != 'rx') or (command == 'write' and fifo != 'mem' and fifo[0] != 'tx'):
+                return ["Warning: dma" + str(number) + " " + command + " can't be " + str(argument) + ", continuing\n"]
+            if command == 'read':
+                channel.read_from = fifo
+            elif command == 'write':
+                channel.write_to = fifo
+            else:
+                channel.dreq = None if fifo == 'mem' else fifo
+                channel.dreq_is_set = True
+        elif command == 'data':
+            channel.data.append(argument)
+        elif command == 'ring':
+            channel.ring = argument
+        elif command == 'chain_to':
+            channel.chain_to = argument
+        elif command == 'start':
+            channel.count = argument
+            self.start(channel)
+        elif command == 'abort':
+            channel.busy = False
+            channel.transfer_count = 0
+            channel.in_flight = []
+        return []
+
+    def start(self, channel):
+        """ start (trigger) a channel: it reads the memory from the start """
+        channel.transfer_count = channel.count
+        channel.read_index = 0
+        channel.busy = channel.count > 0
+        # if not set explicitly the FIFO that is read or written is the DREQ
+        if not channel.dreq_is_set:
+            channel.dreq = channel.read_from if channel.read_from != 'mem' else channel.write_to if channel.write_to != 'mem' else None
+
+    def dreq_asserted(self, channel):
+        """ may the channel start a transfer in this clock cycle """
+        if channel.dreq is None:
+            return True
+        sm = self.state_machines[channel.dreq[1]]
+        if channel.dreq[0] == 'rx':
+            return sm.vars["RxFIFO_count"] > 0
+        # the words that are still on their way to the TxFIFO (from all channels) also take room
+        on_the_way = sum(len(c.in_flight) for c in self.channels if c.write_to == channel.dreq)
+        return sm.vars["TxFIFO_count"] + on_the_way < 4
+
+    def time_step(self, time):
+        """ emulate one clock cycle of the dma, returns the warnings and the words written to memory (channel, value) """
+        warnings = []
+        written = []
+        # first write the words that were read DMA_LATENCY clock cycles ago
+        for channel in self.channels:
+            while channel.in_flight and channel.in_flight[0][0] <= time:
+                _, value = channel.in_flight.pop(0)
+                if channel.write_to == 'mem':
+                    written.append((channel.number, value))
+                elif not self.state_machines[channel.write_to[1]].put_to_TxFIFO(value):
+                    warnings.append("Warning: dma" + str(channel.number) + " writes to the full TxFIFO of sm" + str(channel.write_to[1]) + ", the data is lost\n")
+            # the channel has finished: start the chained channel
+            if channel.busy and channel.transfer_count == 0 and not channel.in_flight:
+                channel.busy = False
+                if 0 <= channel.chain_to < len(self.channels) and channel.chain_to != channel.number:
+                    self.start(self.channels[channel.chain_to])
+
+        # then start at most one transfer, the channels take turns
+        started = None
+        for i in range(len(self.channels)):
+            channel = self.channels[(self.next_channel + i) % len(self.channels)]
+            if not channel.busy or channel.transfer_count == 0:
+                continue
+            if not self.dreq_asserted(channel):
+                channel.dreq_waits += 1
+                continue
+            if started is not None:
+                # it has to wait for its turn, not for its DREQ
+                continue
+            started = channel
+            # read the word
+            if channel.read_from == 'mem':
+                if channel.read_index >= len(channel.data) and channel.ring and channel.data:
+                    channel.read_index = 0
+                if channel.read_index < len(channel.data):
+                    value = channel.data[channel.read_index]
+                else:
+                    warnings.append("Warning: dma" + str(channel.number) + " reads beyond its data, 0 is used, continuing\n")
+                    value = 0
+                channel.read_index += 1
+            else:
+                value = self.state_machines[channel.read_from[1]].get_from_RxFIFO()
+                if value is None:
+                    warnings.append("Warning: dma" + str(channel.number) + " reads the empty RxFIFO of sm" + str(channel.read_from[1]) + ", 0 is used, continuing\n")
+                    value = 0
+            channel.in_flight.append((time + DMA_LATENCY, value))
+            channel.transfer_count -= 1
+            channel.transfers += 1
+            if channel.first_transfer < 0:
+                channel.first_transfer = time
+            channel.last_transfer = time
+        if started is not None:
+            self.next_channel = (started.number + 1) % len(self.channels)
+        return warnings, written
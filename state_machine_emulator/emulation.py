@@ -4,12 +4,15 @@ from copy import deepcopy
 class emulation:
     """ This class controls the emulation of the sm of a RP2040 """
 
-    def __init__(self, state_machine, pin_program, c_program):
+    def __init__(self, state_machine, pin_program, c_program, state_machines=None, dma=None):
         """ init makes the list with the emulation results (output) and
             the variables needed for highlights in the GUI
         """
-        # the emulator for the RP2040:
+        # the emulator for the RP2040: the sm shown in the GUI, and all state machines of the PIO (index 0 to 3)
         self.state_machine = state_machine
+        self.state_machines = state_machines if state_machines else [state_machine]
+        # the (optional) dma, it runs before the state machines in each step
+        self.dma = dma
         # the (user) changes made to the pins:
         self.pin_program = pin_program
         # the user c-program that influences the PIO and sm
@@ -21,6 +24,17 @@ class emulation:
         self.emulation_highlight_c_program = []
         self.emulation_output_c_program = []
         self.emulation_highlight_output_c_program = []
+        # the statements (index in the program) of the pin and c program for each time step,
+        # then the programs don't have to be searched at every step (long runs in headless mode)
+        self.pin_program_at = {}
+        for index, g in enumerate(self.pin_program):
+            self.pin_program_at.setdefault(g[0], []).append(index)
+        self.c_program_at = {}
+        for index, c in enumerate(self.c_program):
+            self.c_program_at.setdefault(c[0], []).append(index)
+        # headless mode: the sampled full states and the warnings (with their count and first time step)
+        self.checkpoints = []
+        self.warning_counts = {}
 
     def emulate(self, number_of_steps):
         """ emulate a number of steps """
@@ -31,8 +45,8 @@ class emulation:
             warnings = self.execute_pin_and_c_program()
             if warnings:
                 self.warning_messages.extend(warnings)
-            # then run the PIO code in the emulator
-            warnings = self.state_machine.time_step()
+            # then run the dma and the PIO code in the emulator
+            warnings = self.run_dma_and_state_machines()
             if warnings:
                 self.warning_messages.extend(warnings)
             # copy the current state and append it to the list with all data
@@ -51,6 +65,59 @@ class emulation:
             self.emulation_highlight_output_c_program = []
 
 
+    def emulate_headless(self, number_of_steps, vcd=None, checkpoint_interval=0):
+        """ emulate a number of steps without the history for the GUI (no copy of the state at every step)
+            the changes of the signals are written to the vcd_writer (if given), the full state is only
+            copied every checkpoint_interval steps (0 means never)
+        """
+        for step in range(number_of_steps):
+            time = self.state_machine.clock
+            # first execute the pin and c_program statements, then run the PIO code in the emulator
+            warnings = self.execute_pin_and_c_program()
+            warnings.extend(self.run_dma_and_state_machines())
+            # a warning can occur at every step (e.g. a stalling pull), so only count them
+            for w in warnings:
+                if w in self.warning_counts:
+                    self.warning_counts[w][0] += 1
+                else:
+                    self.warning_counts[w] = [1, time]
+            # write the changes of the signals
+            if vcd:
+                vcd.sample(time)
+            # copy the current state at a checkpoint (of all state machines)
+            if checkpoint_interval > 0 and time % checkpoint_interval == 0:
+                self.checkpoints.append((time,
+                                         deepcopy(self.state_machine.GPIO_data),
+                                         [deepcopy(sm.vars) for sm in self.state_machines],
+                                         [deepcopy(sm.settings) for sm in self.state_machines],
+                                         deepcopy(self.state_machine.sm_irq)))
+            # the highlights are only used by the GUI
+            self.emulation_highlight_pin_program = []
+            self.emulation_highlight_c_program = []
+            self.emulation_highlight_output_c_program = []
+
+
+    def run_dma_and_state_machines(self):
+        """ emulate one clock cycle of the dma and the state machines (in the order of their number)
+            the words that a dma channel writes to memory are put in the output
+        """
+        time = self.state_machine.clock
+        warnings = []
+        if self.dma:
+            dma_warnings, written = self.dma.time_step(time)
+            warnings.extend(dma_warnings)
+            for (channel, value) in written:
+                self.emulation_highlight_output_c_program.append(len(self.emulation_output_c_program))
+                self.emulation_output_c_program.append(str(time) + " : dma" + str(channel) + " " + str(value) + " = " + self.bit_string(value))
+        for sm in self.state_machines:
+            sm_warnings = sm.time_step()
+            # the warnings of the other state machines say which sm has them
+            if sm is not self.state_machine:
+                sm_warnings = ["sm" + str(sm.sm_number) + ": " + w for w in sm_warnings]
+            warnings.extend(sm_warnings)
+        return warnings
+
+
     def bit_string(self, value):
         """ function to produce a string with the binary representation of a value """
         return str().join(["0" if (value & (1 << i)) == 0 else "1" for i in reversed(range(32))])
@@ -64,117 +131,114 @@ class emulation:
         warning_messages = []
 
         # set all the GPIO's according to the pin states
-        for index, g in enumerate(self.pin_program):
-            if g[0] == time:  # TODO? wasteful to go through the whole list each time. Keep an index or something (but then again, 500 steps takes almost no time ... so why bother)
-                # all pin_statements for this time step are to be highlighted
-                self.emulation_highlight_pin_program.append(index)
-                # handle the GPIO and 'all' statements
-                if 'GPIO' in g[1]:
-                    gpio = int(g[1].replace('GPIO', ''))
+        for index in self.pin_program_at.get(time, []):
+            g = self.pin_program[index]
+            # all pin_statements for this time step are to be highlighted
+            self.emulation_highlight_pin_program.append(index)
+            # handle the GPIO and 'all' statements
+            if 'GPIO' in g[1]:
+                gpio = int(g[1].replace('GPIO', ''))
+                self.state_machine.GPIO_data["GPIO_external"][gpio] = int(g[2])
+                # also set the real GPIO since external always wins!
+                self.state_machine.GPIO_data["GPIO"][gpio] = int(g[2])
+            elif 'all' in g[1]:
+                for gpio in range(32):
                     self.state_machine.GPIO_data["GPIO_external"][gpio] = int(g[2])
                     # also set the real GPIO since external always wins!
                     self.state_machine.GPIO_data["GPIO"][gpio] = int(g[2])
-                elif 'all' in g[1]:
-                    for gpio in range(32):
-                        self.state_machine.GPIO_data["GPIO_external"][gpio] = int(g[2])
-                        # also set the real GPIO since external always wins!
-                        self.state_machine.GPIO_data["GPIO"][gpio] = int(g[2])
-                else:
-                    # should already have been filtered out when parsing the file, but anyway:
-                    warning_messages.append("Warning: unknown pin_program statement"+str(g[0])+str(g[1])+str(g[2])+"\n")
+            else:
+                # should already have been filtered out when parsing the file, but anyway:
+                warning_messages.append("Warning: unknown pin_program statement"+str(g[0])+str(g[1])+str(g[2])+"\n")
 
         # set c_program settings
         # go through the c-program, and at the right time, execute the statements
-        for index, c in enumerate(self.c_program):
-            if c[0] == time:  # TODO? wasteful to go through the whole list each time. Keep an index or something (but then again, 500 steps takes almost no time ... so why bother)
-                # all c_statements for this time step are to be highlighted in the GUI
-                self.emulation_highlight_c_program.append(index)
-                # handle all possible c_statements
-                if c[1] == 'put':
-                    # place a value in the Tx FIFO
-                    if self.state_machine.vars["TxFIFO_count"] < 4:
-                        # there is still room in the TxFIFO: add the value c[2] and increase the number of items in the TxFIFO
-                        self.state_machine.vars["TxFIFO"][self.state_machine.vars["TxFIFO_count"]] = c[2]
-                        self.state_machine.vars["TxFIFO_count"] += 1
-                        # make sure the 'status' is correct
-                        if self.state_machine.settings['status_sel'] == 0:
-                            if self.state_machine.vars["TxFIFO_count"] < self.state_machine.settings['FIFO_level_N']:
-                                self.state_machine.vars["status"] = 0xFFFFFFFF; # binary all ones 
-                            else:
-                                self.state_machine.vars["status"] = 0;  # binary all zeroes
-
-                elif c[1] == 'get':
-                    # get a value from the Rx FIFO, and put it in output
-                    if self.state_machine.vars["RxFIFO_count"] > 0:
-                        # there are items in RxFIFO
-                        self.emulation_highlight_output_c_program.append(
-                            len(self.emulation_output_c_program))
-                        self.emulation_output_c_program.append(
-                            str(time) + " : " + str(self.state_machine.vars["RxFIFO"][0]) + " = " + self.bit_string(self.state_machine.vars["RxFIFO"][0]))
-                        # shift FIFO entries 1 to 4 back one place
-                        for i in range(0, 3):
-                            self.state_machine.vars["RxFIFO"][i] = self.state_machine.vars["RxFIFO"][i+1]
-                        # set the last entry to 0 (this may not happen in reality!)
-                        self.state_machine.vars["RxFIFO"][3] = 0
-                        # there is now one less item in the Rx FIFO
-                        self.state_machine.vars["RxFIFO_count"] -= 1
-                        # make sure the 'status' is correct
-                        if self.state_machine.settings['status_sel'] == 1:
-                            if self.state_machine.vars["RxFIFO_count"] < self.state_machine.settings['FIFO_level_N']:
-                                self.state_machine.vars["status"] = 0xFFFFFFFF; # binary all ones
-                            else:
-                                self.state_machine.vars["status"] = 0; # binary all zeroes
-                elif c[1] in ['set_base', 'set_count', 'in_base', 'jmp_pin', 'sideset_base', 'sideset_count', 'sideset_opt', 'sideset_pindirs', 'out_base', 'out_count', 'out_shift_right', 'out_shift_autopull', 'pull_threshold', 'in_shift_right', 'in_shift_autopush', 'push_threshold']:
-                    self.state_machine.settings[c[1]] = c[2]
-                elif c[1] == 'get_pc':
-                    # note: the c_program is executed before an emulation step. Thus get_pc shows the previous pc in the gui
-                    self.emulation_highlight_output_c_program.append(len(self.emulation_output_c_program))
-                    self.emulation_output_c_program.append(str(time) + " : " + "pc=" + str(self.state_machine.vars["pc"]))
-                elif c[1] == 'set_pc':
-                    # note: this should (maybe) only be used at t=0, the c_program is executed before an emulation step. Thus set_pc can set the starting point
-                    # note: If not set explicitly, pc = -1 at the start, so the pc first adds 1 to start at 0. Here the 1 must first be subtracted
-                    self.state_machine.vars["pc"] = c[2]-1 
-                elif c[1] == 'irq':
-                    # clear the bit in c[2]. Note that in c++, when clearing an irq, you have to set the corresponding bit with:
-                    # pio0_hw->irq = 1<<irq
-                    # Also note that here all irq are visible to the c-program, normally only irq 0-3 are visible!
-                    if self.state_machine.sm_irq[c[2]] == 0:
-                        # if the irq bit was not set, set it
-                        self.state_machine.sm_irq[c[2]] = 1
-                    else:
-                        # if the irq bit was set, clear it
-                        self.state_machine.sm_irq[c[2]] = 0
-                elif c[1] == 'set_N':
-                    # set the # items in FIFOs that sets status (used in 'mov' instruction)  
-                    self.state_machine.settings['FIFO_level_N'] = c[2]
-                elif c[1] == 'status_sel':
-                    # set the # items in FIFOs that sets status (used in 'mov' instruction)  
-                    self.state_machine.settings['status_sel'] = c[2]
-                elif c[1] == 'dir_out':
-                    # set the pin to output 
-                    self.state_machine.GPIO_data["GPIO_pindirs"][c[2]] = 0
-                elif c[1] == 'dir_in':
-                    # set the pin direction to in 
-                    self.state_machine.GPIO_data["GPIO_pindirs"][c[2]] = 1
-                elif c[1] == 'dir_non':
-                    # unset the pin direction  
-                    self.state_machine.GPIO_data["GPIO_pindirs"][c[2]] = -1
+        for index in self.c_program_at.get(time, []):
+            c = self.c_program[index]
+            # all c_statements for this time step are to be highlighted in the GUI
+            self.emulation_highlight_c_program.append(index)
+            # handle all possible c_statements
+            # the statement may be for another sm ('sm1:put') or for a dma channel ('dma0:start')
+            target, command = c[1].split(':') if ':' in c[1] else (None, c[1])
+            if target and target.startswith('dma'):
+                warning_messages.extend(self.dma.command(int(target[3:]), command, c[2] if len(c) > 2 else None))
+                continue
+            sm = self.state_machine
+            if target:
+                if int(target[2:]) >= len(self.state_machines):
+                    warning_messages.append("Warning: there is no " + target + ", continuing\n")
+                    continue
+                sm = self.state_machines[int(target[2:])]
+            if command == 'put':
+                # place a value in the Tx FIFO (if there is still room)
+                sm.put_to_TxFIFO(c[2])
+
+            elif command == 'get':
+                # get a value from the Rx FIFO, and put it in output
+                value = sm.get_from_RxFIFO()
+                if value is not None:
+                    # there was an item in RxFIFO
+                    self.emulation_highlight_output_c_program.append(
+                        len(self.emulation_output_c_program))
+                    self.emulation_output_c_program.append(
+                        str(time) + " : " + ("" if target is None else target + " ") + str(value) + " = " + self.bit_string(value))
+            elif command in ['set_base', 'set_count', 'in_base', 'jmp_pin', 'sideset_base', 'sideset_count', 'sideset_opt', 'sideset_pindirs', 'out_base', 'out_count', 'out_shift_right', 'out_shift_autopull', 'pull_threshold', 'in_shift_right', 'in_shift_autopush', 'push_threshold']:
+                sm.settings[command] = c[2]
+            elif command == 'get_pc':
+                # note: the c_program is executed before an emulation step. Thus get_pc shows the previous pc in the gui
+                self.emulation_highlight_output_c_program.append(len(self.emulation_output_c_program))
+                self.emulation_output_c_program.append(str(time) + " : " + "pc=" + str(sm.vars["pc"]))
+            elif command == 'set_pc':
+                # note: this should (maybe) only be used at t=0, the c_program is executed before an emulation step. Thus set_pc can set the starting point
+                # note: If not set explicitly, pc = -1 at the start, so the pc first adds 1 to start at 0. Here the 1 must first be subtracted
+                sm.vars["pc"] = c[2]-1 
+            elif command == 'irq':
+                # clear the bit in c[2]. Note that in c++, when clearing an irq, you have to set the corresponding bit with:
+                # pio0_hw->irq = 1<<irq
+                # Also note that here all irq are visible to the c-program, normally only irq 0-3 are visible!
+                if sm.sm_irq[c[2]] == 0:
+                    # if the irq bit was not set, set it
+                    sm.sm_irq[c[2]] = 1
                 else:
-                    # should already have been filtered out when parsing the file, but anyway:
-                    warning_messages.append("Warning: unknown c-program statement: " + str(c[0]) + str(c[1]) + str(c[2])+"\n")
-
-        # if out_base and out_count are set, then make the associated pin an output in GPIO_pindirs
-        if self.state_machine.settings["out_base"] != -1 and self.state_machine.settings["out_count"] != 0:
-            for i in range(self.state_machine.settings["out_base"], self.state_machine.settings["out_base"] + self.state_machine.settings["out_count"]):
-                self.state_machine.GPIO_data["GPIO_pindirs"][i] = 0 # indicate this pin is an output
-        # if set_base and set_count are set, then make the associated pin an output in GPIO_pindirs
-        if self.state_machine.settings["set_base"] != -1 and self.state_machine.settings["set_count"] != 0:
-            for i in range(self.state_machine.settings["set_base"], self.state_machine.settings["set_base"] + self.state_machine.settings["set_count"]):
-                self.state_machine.GPIO_data["GPIO_pindirs"][i] = 0 # indicate this pin is an output
-        # if sideset_base and sideset_count are set, then make the associated pin(s) an output in GPIO_pindirs
-        if self.state_machine.settings["sideset_base"] != -1 and self.state_machine.settings["sideset_count"] != 0:
-            num_of_bits = self.state_machine.settings["sideset_count"] - 1 if self.state_machine.settings["sideset_opt"] else 0
-            for i in range(self.state_machine.settings["sideset_base"], self.state_machine.settings["sideset_base"] + num_of_bits):
-                self.state_machine.GPIO_data["GPIO_pindirs"][i] = 0 # indicate this pin is an output
+                    # if the irq bit was set, clear it
+                    sm.sm_irq[c[2]] = 0
+            elif command == 'set_N':
+                # set the # items in FIFOs that sets status (used in 'mov' instruction)  
+                sm.settings['FIFO_level_N'] = c[2]
+            elif command == 'status_sel':
+                # set the # items in FIFOs that sets status (used in 'mov' instruction)  
+                sm.settings['status_sel'] = c[2]
+            elif command == 'dir_out':
+                # set the pin to output 
+                sm.GPIO_data["GPIO_pindirs"][c[2]] = 0
+            elif command == 'dir_in':
+                # set the pin direction to in 
+                sm.GPIO_data["GPIO_pindirs"][c[2]] = 1
+            elif command == 'dir_non':
+                # unset the pin direction  
+                sm.GPIO_data["GPIO_pindirs"][c[2]] = -1
+            elif command == 'program':
+                # let the sm run a program of the pio file (0 is the first), this also enables it
+                warning_messages.extend(sm.select_program(c[2]))
+            elif command == 'enable':
+                # enable or disable the sm (it continues where it was)
+                sm.enabled = c[2]
+            else:
+                # should already have been filtered out when parsing the file, but anyway:
+                warning_messages.append("Warning: unknown c-program statement: " + str(c[0]) + str(command) + str(c[2])+"\n")
+
+        for sm in self.state_machines:
+            # if out_base and out_count are set, then make the associated pin an output in GPIO_pindirs
+            if sm.settings["out_base"] != -1 and sm.settings["out_count"] != 0:
+                for i in range(sm.settings["out_base"], sm.settings["out_base"] + sm.settings["out_count"]):
+                    sm.GPIO_data["GPIO_pindirs"][i] = 0 # indicate this pin is an output
+            # if set_base and set_count are set, then make the associated pin an output in GPIO_pindirs
+            if sm.settings["set_base"] != -1 and sm.settings["set_count"] != 0:
+                for i in range(sm.settings["set_base"], sm.settings["set_base"] + sm.settings["set_count"]):
+                    sm.GPIO_data["GPIO_pindirs"][i] = 0 # indicate this pin is an output
+            # if sideset_base and sideset_count are set, then make the associated pin(s) an output in GPIO_pindirs
+            if sm.settings["sideset_base"] != -1 and sm.settings["sideset_count"] != 0:
+                num_of_bits = sm.settings["sideset_count"] - 1 if sm.settings["sideset_opt"] else 0
+                for i in range(sm.settings["sideset_base"], sm.settings["sideset_base"] + num_of_bits):
+                    sm.GPIO_data["GPIO_pindirs"][i] = 0 # indicate this pin is an output
 
         return warning_messages
\ No newline at end of file
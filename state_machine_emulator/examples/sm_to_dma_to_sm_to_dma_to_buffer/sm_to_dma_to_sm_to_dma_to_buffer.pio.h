@@ -0,0 +1,71 @@
+// -------------------------------------------------- //
+// This file is autogenerated by pioasm; do not edit! //
+// -------------------------------------------------- //
+
+#pragma once
+
+#if !PICO_NO_HARDWARE
+#include "hardware/pio.h"
+#endif
+
+// ------- //
+// tester0 //
+// ------- //
+
+#define tester0_wrap_target 0
+#define tester0_wrap 4
+
+static const uint16_t tester0_program_instructions[] = {
+            //     .wrap_target
+    0xa02b, //  0: mov    x, !null                   
+    0xa0c9, //  1: mov    isr, !x                    
+    0x8020, //  2: push   block                      
+    0x0041, //  3: jmp    x--, 1                     
+    0x0000, //  4: jmp    0                          
+            //     .wrap
+};
+
+#if !PICO_NO_HARDWARE
+static const struct pio_program tester0_program = {
+    .instructions = tester0_program_instructions,
+    .length = 5,
+    .origin = -1,
+};
+
+static inline pio_sm_config tester0_program_get_default_config(uint offset) {
+    pio_sm_config c = pio_get_default_sm_config();
+    sm_config_set_wrap(&c, offset + tester0_wrap_target, offset + tester0_wrap);
+    return c;
+}
+#endif
+
+// ------- //
+// tester1 //
+// ------- //
+
+#define tester1_wrap_target 0
+#define tester1_wrap 3
+
+static const uint16_t tester1_program_instructions[] = {
+            //     .wrap_target
+    0x80a0, //  0: pull   block                      
+    0xa0c7, //  1: mov    isr, osr                   
+    0x8020, //  2: push   block                      
+    0x0000, //  3: jmp    0                          
+            //     .wrap
+};
+
+#if !PICO_NO_HARDWARE
+static const struct pio_program tester1_program = {
+    .instructions = tester1_program_instructions,
+    .length = 4,
+    .origin = -1,
+};
+
+static inline pio_sm_config tester1_program_get_default_config(uint offset) {
+    pio_sm_config c = pio_get_default_sm_config();
+    sm_config_set_wrap(&c, offset + tester1_wrap_target, offset + tester1_wrap);
+    return c;
+}
+#endif
+
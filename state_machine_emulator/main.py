@@ -12,24 +12,37 @@ TODO:
 from sys import argv, exc_info
 from os import getcwd, path, chdir
 from glob import glob
+from time import perf_counter
 
 from interface import Emulator_Interface
 from emulation import emulation
-from config import EMULATION_STEPS, SAVE_TEST_DATA
+from config import EMULATION_STEPS, HEADLESS_STEPS, SAVE_TEST_DATA, STATEMACHINE_NUMBER
 from state_machine import state_machine
+from dma import dma
+from vcd import vcd_writer
 
 """
 This code emulates a state machine of a RP4020
 It provides a GUI to step through the emulation results.
 """
 
+def new_pio_program(name, offset):
+    """ the definitions of one program in the pio file, it is loaded at offset in the instruction memory """
+    return {'name': name, 'offset': offset, 'length': None, 'origin': -1, 'wrap_target': offset, 'wrap': None, 'sideset': None}
+
+
 def process_file_pio_h(filename, c_program):
-    """ read and parse a pioasm generated header file """
+    """ read and parse a pioasm generated header file
+        if it has more than one program, the programs are placed after each other in the instruction memory
+        (the jmp addresses are relocated), the first program is the one that runs on the sm shown in the GUI
+    """
     pio_program = list()
     pio_program_length = None
     pio_program_origin = -1 # note: not actually used
     pio_program_wrap_target = 0
     pio_program_wrap = None
+    # the definitions of each program
+    pio_programs = list()
 
     try:
         with open(filename, 'r') as pio_file:
@@ -39,47 +52,69 @@ def process_file_pio_h(filename, c_program):
                     pass
                 elif ".length" in line:
                     d = line.strip().split('=')
-                    pio_program_length = int(d[1].replace(',', ''))
+                    pio_programs[-1]['length'] = int(d[1].replace(',', ''))
                 elif ".origin" in line: # note: origin is not actually used
                     d = line.strip().split('=')
-                    pio_program_origin = int(d[1].replace(',', ''))
+                    pio_programs[-1]['origin'] = int(d[1].replace(',', ''))
                 elif "#define" in line:
+                    # pioasm puts the wrap defines before the instructions of each program
                     if "wrap_target" in line:
                         d = line.strip().split(' ')
-                        pio_program_wrap_target = int(d[2])
+                        pio_programs.append(new_pio_program(d[1].replace('_wrap_target', ''), len(pio_program)))
+                        pio_programs[-1]['wrap_target'] = len(pio_program) + int(d[2])
                     elif "wrap" in line:
                         d = line.strip().split(' ')
-                        pio_program_wrap = int(d[2])
+                        pio_programs[-1]['wrap'] = len(pio_program) + int(d[2])
                 elif "static const uint16_t" in line:
+                    if not pio_programs or len(pio_program) > pio_programs[-1]['offset']:
+                        # no wrap defines for this program
+                        pio_programs.append(new_pio_program(line.split()[3].replace('_program_instructions[]', ''), len(pio_program)))
+                    offset = pio_programs[-1]['offset']
                     line = pio_file.readline()
                     while '};' not in line:
                         d = line.strip().split(', //')
                         if len(d) == 2:
+                            instruction = int(d[0], 16)
+                            # relocate the address of a jmp (instruction type 0) to where the program is loaded
+                            if offset > 0 and instruction & 0xE000 == 0:
+                                d[0] = "0x{:04x}".format((instruction & 0xFFE0) | ((instruction + offset) & 0x1F))
                             pio_program.append(d)
                         line = pio_file.readline()
+                    if pio_programs[-1]['wrap'] is None:
+                        pio_programs[-1]['wrap'] = len(pio_program) - 1
                 elif "static inline pio_sm_config" in line:
-                    # add to the c-program at t=0
                     line2 = pio_file.readline()
                     while '}' not in line2:
                         if 'sm_config_set_sideset' in line2:
                             parts = line2.split(',')
                             a1 = int(parts[1].strip())
-                            c_program.append([0, 'sideset_count', a1])
                             a2 = parts[2].strip().lower() == 'true'
-                            c_program.append([0, 'sideset_opt', a2])
                             a3 = parts[3].split(')')[0].strip().lower() == 'true'
-                            c_program.append([0, 'sideset_pindirs', a3])
+                            pio_programs[-1]['sideset'] = (a1, a2, a3)
+                            # for the first program: add to the c-program at t=0
+                            if len(pio_programs) == 1:
+                                c_program.append([0, 'sideset_count', a1])
+                                c_program.append([0, 'sideset_opt', a2])
+                                c_program.append([0, 'sideset_pindirs', a3])
                         line2 = pio_file.readline()
                 line = pio_file.readline()
-        if len(pio_program) != pio_program_length:
-            print("Warning: length specification in pio file doesn't match actual length, continuing anyway")
+        for i, p in enumerate(pio_programs):
+            end = pio_programs[i + 1]['offset'] if i + 1 < len(pio_programs) else len(pio_program)
+            if p['length'] != end - p['offset']:
+                print("Warning: length specification of", p['name'], "in pio file doesn't match actual length, continuing anyway")
         if len(pio_program) > 32:
             print("Warning: program too long, continuing anyway")
+        # the first program runs on the sm shown in the GUI
+        if pio_programs:
+            pio_program_length = pio_programs[0]['length']
+            pio_program_origin = pio_programs[0]['origin']
+            pio_program_wrap_target = pio_programs[0]['wrap_target']
+            pio_program_wrap = pio_programs[0]['wrap']
     except IOError as e:
         print("I/O Error reading pio program file:", e.errno, e.strerror)
     except:
         print("Error reading pio program file:", exc_info()[0])
-    return pio_program, pio_program_length, pio_program_origin, pio_program_wrap_target, pio_program_wrap
+    return pio_program, pio_program_length, pio_program_origin, pio_program_wrap_target, pio_program_wrap, pio_programs
 
 
 def process_file_pin_program(filename, pin_program):
@@ -107,6 +142,25 @@ def process_file_pin_program(filename, pin_program):
         print("Error reading pin program file:", exc_info()[0])
 
 
+# the commands in the c_program for a state machine, and for a dma channel
+SM_COMMANDS = ['put', 'get', 'set_base', 'set_count', 'in_base', 'jmp_pin', 'sideset_base', 'out_base', 'out_count', 'out_shift_right', 'out_shift_autopull', 'pull_threshold', 'in_shift_right', 'in_shift_autopush', 'push_threshold', 'get_pc', 'set_pc', 'irq', 'set_N', 'status_sel', 'dir_out', 'dir_in', 'dir_non', 'program', 'enable']
+DMA_COMMANDS = ['read', 'write', 'dreq', 'data', 'ring', 'chain_to', 'start', 'abort']
+
+
+def valid_c_command(command):
+    """ check a command of the c_program: 'put' for the sm shown in the GUI, 'sm2:put' for sm 2 of the PIO,
+        or 'dma0:start' for dma channel 0
+    """
+    if ':' not in command:
+        return command in SM_COMMANDS
+    target, command = command.split(':', 1)
+    if target in ['sm0', 'sm1', 'sm2', 'sm3']:
+        return command in SM_COMMANDS
+    if target in ['dma' + str(i) for i in range(12)]:
+        return command in DMA_COMMANDS
+    return False
+
+
 def process_file_c_program(filename, c_program):
     """ read the c program file and parse it """
     try:
@@ -120,9 +174,9 @@ def process_file_c_program(filename, c_program):
                     # timestamp, command, and possibly an argument of the command
                     # the timestamp and argument must be integers/bool, the command is a (stripped) string
                     parts = line.strip().split(',')
-                    parts[1] = parts[1].strip()
+                    parts[1] = parts[1].strip().replace(' ', '')
                     # check if the command is valid 
-                    if parts[1].strip() in ['put', 'get', 'set_base', 'set_count', 'in_base', 'jmp_pin', 'sideset_base', 'out_base', 'out_count', 'out_shift_right', 'out_shift_autopull', 'pull_threshold', 'in_shift_right', 'in_shift_autopush', 'push_threshold', 'get_pc', 'set_pc', 'irq', 'set_N', 'status_sel', 'dir_out', 'dir_in', 'dir_non']:
+                    if valid_c_command(parts[1]):
                         parts[0] = int(parts[0])
                         parts[1] = parts[1]
                         if len(parts) == 3:
@@ -132,6 +186,9 @@ def process_file_c_program(filename, c_program):
                                 parts[2] = True
                             elif parts[2] in ["False", "false", "No", "no"]:
                                 parts[2] = False
+                            elif parts[2] in ['mem', 'rx0', 'rx1', 'rx2', 'rx3', 'tx0', 'tx1', 'tx2', 'tx3']:
+                                # the memory or a FIFO for a dma channel
+                                pass
                             else:
                                 parts[2] = int(parts[2])
                         c_program.append(parts)
@@ -148,20 +205,102 @@ def print_usage():
     print("python3", argv[0], "file.pio.h pin_program c_program")
     print("or:")
     print("python3", argv[0], "directory_of_files")
+    print("headless (without GUI), with the options before the files:")
+    print("python3", argv[0], "--headless [--steps N] [--vcd file.vcd] [--checkpoint N] [--profile] directory_of_files")
     exit()
 
 
+def parse_options(arguments):
+    """ take the options for the headless mode out of the arguments
+        --steps, --vcd, --checkpoint and --profile also select the headless mode
+    """
+    options = {'headless': False, 'steps': HEADLESS_STEPS, 'vcd': None, 'checkpoint': 0, 'profile': False}
+    remaining = list()
+    i = 0
+    try:
+        while i < len(arguments):
+            if arguments[i] == '--headless':
+                options['headless'] = True
+            elif arguments[i] == '--steps':
+                options['headless'] = True
+                i += 1
+                options['steps'] = int(arguments[i])
+            elif arguments[i] == '--vcd':
+                options['headless'] = True
+                i += 1
+                # the emulator changes to the directory of the files: make the path absolute
+                options['vcd'] = path.abspath(arguments[i])
+            elif arguments[i] == '--checkpoint':
+                options['headless'] = True
+                i += 1
+                options['checkpoint'] = int(arguments[i])
+            elif arguments[i] == '--profile':
+                options['headless'] = True
+                options['profile'] = True
+            elif arguments[i].startswith('--'):
+                print("Unknown option:", arguments[i])
+                print_usage()
+            else:
+                remaining.append(arguments[i])
+            i += 1
+    except (IndexError, ValueError):
+        print("Option", arguments[i-1], "needs a number or file name")
+        print_usage()
+    return options, remaining
+
+
+def run_headless(my_emulation, options):
+    """ emulate without the GUI and print the results: the c-program output, the checkpoints and the warnings """
+    vcd = vcd_writer(options['vcd'], my_emulation) if options['vcd'] else None
+    start = perf_counter()
+    my_emulation.emulate_headless(options['steps'], vcd, options['checkpoint'])
+    duration = perf_counter() - start
+    if vcd:
+        vcd.close(my_emulation.state_machine.clock)
+    # the output of the c-program ('get' and 'get_pc')
+    for line in my_emulation.emulation_output_c_program:
+        print(line)
+    # the checkpoints (of the state machines that run)
+    running = [sm for sm in my_emulation.state_machines if sm.enabled or sm.pulls or sm.pushes]
+    for (clock, GPIO_data, sm_vars, sm_settings, sm_irq) in my_emulation.checkpoints:
+        GPIO = str().join(['.' if g == -1 else str(g) for g in reversed(GPIO_data["GPIO"])])
+        print("checkpoint", clock, ": irq =", str().join([str(i) for i in reversed(sm_irq)]), "GPIO =", GPIO)
+        for sm in running:
+            vars = sm_vars[my_emulation.state_machines.index(sm)]
+            print("    sm" + str(sm.sm_number), ": pc =", vars["pc"], "x =", vars["x"], "y =", vars["y"],
+                  "ISR =", vars["ISR"], "OSR =", vars["OSR"], "TxFIFO_count =", vars["TxFIFO_count"],
+                  "RxFIFO_count =", vars["RxFIFO_count"])
+    # the FIFO stalls and the throughput of the state machines and the dma channels
+    for sm in running:
+        print("sm" + str(sm.sm_number), ":", sm.pulls, "pulls,", sm.pushes, "pushes, stalled", sm.stall_cycles('TxFIFO empty'),
+              "cycles on an empty TxFIFO and", sm.stall_cycles('RxFIFO full'), "cycles on a full RxFIFO")
+    for channel in my_emulation.dma.channels if my_emulation.dma else []:
+        if channel.transfers > 0:
+            cycles = channel.last_transfer - channel.first_transfer + 1
+            print("dma" + str(channel.number), ":", channel.transfers, "transfers from", channel.first_transfer, "to", channel.last_transfer,
+                  "(" + str(round(channel.transfers / cycles, 3)), "per clock cycle), waited", channel.dreq_waits, "cycles for its DREQ")
+    # the profiles: where the state machines spend their clock cycles
+    if options['profile']:
+        for sm in running:
+            print("\n".join(sm.profile_report()))
+    # the warnings, with how often they occurred and when the first time was
+    for message, (count, first) in my_emulation.warning_counts.items():
+        print(message.strip(), "(" + str(count), "times, first at", str(first) + ")")
+    print(options['steps'], "steps in", round(duration, 2), "s (" + str(int(options['steps'] / max(duration, 1e-6))), "steps/s)")
+
+
 if __name__ == "__main__":
 
-    # process arguments
-    if len(argv) == 4:
+    # process arguments (first the options of the headless mode)
+    options, arguments = parse_options(argv[1:])
+    if len(arguments) == 3:
         # read the three arguments: .pio.h pin-program c-program
-        pio_h_filename = argv[1]
-        pin_program_filename = argv[2]
-        c_program_filename = argv[3]
-    elif len(argv) == 2:
+        pio_h_filename = arguments[0]
+        pin_program_filename = arguments[1]
+        c_program_filename = arguments[2]
+    elif len(arguments) == 1:
         # read one argument: the directory with the files .pio.h pin-program c-program
-        dir_of_files = argv[1]
+        dir_of_files = arguments[0]
         # if the first character isn't a '/', add the full path
         if dir_of_files[0] != '/':
             dirname=getcwd()
@@ -194,20 +333,28 @@ if __name__ == "__main__":
         pin_program = list()
 
         # process the pio.h file (which may already contribute to the c_program)
-        pio_program, pio_program_length, pio_program_origin, pio_program_wrap_target, pio_program_wrap = process_file_pio_h(pio_h_filename, c_program)
+        pio_program, pio_program_length, pio_program_origin, pio_program_wrap_target, pio_program_wrap, pio_programs = process_file_pio_h(pio_h_filename, c_program)
         program_definitions['pio_program'] = pio_program
         program_definitions['pio_program_length'] = pio_program_length
         program_definitions['pio_program_origin'] = pio_program_origin  # note: not used
         program_definitions['pio_program_wrap_target'] = pio_program_wrap_target
         program_definitions['pio_program_wrap'] = pio_program_wrap
+        program_definitions['pio_programs'] = pio_programs
         # process the c_program
         process_file_c_program(c_program_filename, c_program)
         # process the pin_program
         process_file_pin_program(pin_program_filename, pin_program)
 
         # make the RP2040 emulation (and it will make the PIO and sm)
+        # the sm shown in the GUI, and the other state machines of the PIO (sharing the GPIOs and irq with it)
         my_state_machine = state_machine(program_definitions)
-        my_emulation = emulation(my_state_machine, pin_program, c_program)
+        state_machines = [my_state_machine if i == STATEMACHINE_NUMBER % 4 else state_machine(program_definitions, i, my_state_machine.GPIO_data, my_state_machine.sm_irq) for i in range(4)]
+        my_emulation = emulation(my_state_machine, pin_program, c_program, state_machines, dma(state_machines))
+
+        # headless: emulate without keeping the history for the GUI, and stop
+        if options['headless']:
+            run_headless(my_emulation, options)
+            break
 
         # do the emulation
         my_emulation.emulate(EMULATION_STEPS)
@@ -1,48 +1,63 @@
 from config import STATEMACHINE_NUMBER
+from ._decode import decode_program
 
 class state_machine:
     """ this class emulates a state machine (sm) """
 
     from ._time_step import time_step
-    from ._push_pull import push_to_RxFIFO, pull_from_TxFIFO
+    from ._push_pull import push_to_RxFIFO, pull_from_TxFIFO, put_to_TxFIFO, get_from_RxFIFO
+    from ._select_program import select_program
     from ._do_sideset import do_sideset
     from ._set_all_GPIO import set_all_GPIO
+    from ._profile import stall_cycles, profile_report
     from ._execute_instructions import execute_instruction, execute_jmp, execute_wait, execute_in, execute_out, execute_push, execute_pull, execute_mov, execute_irq, execute_set
 
 
-    def __init__(self, program_definitions):
+    def __init__(self, program_definitions, sm_number=None, GPIO_data=None, sm_irq=None):
         """ make the variables (such as x and y registers) and settings
             and make some class variables needed for correct execution
         """
-        # Note: the Pico has two PIOs with 4 state machines each, but this emulator only has one state machine!
-        # You can still set the state_machine_number (in config.py) because it is used in some irq operations
+        # Note: the Pico has two PIOs with 4 state machines each. The emulator runs the 4 state machines of one PIO,
+        # the first one made is the one shown in the GUI, its number is set in config.py because it is used in some irq operations.
+        # The other state machines of the PIO are made with their number (0 to 3) and the GPIO_data and sm_irq of the first:
+        # they share the GPIOs, the irq flags and the instruction memory (the pio program). They are disabled until a program
+        # is selected for them (see select_program()).
 
         # the sm number (used in irq calculations)
-        self.sm_number = STATEMACHINE_NUMBER
-        # the pio program and important parameters
+        self.sm_number = STATEMACHINE_NUMBER if sm_number is None else sm_number
+        # only the first sm runs from the start
+        self.enabled = sm_number is None
+        # the pio program (all programs in the instruction memory) and important parameters
         self.program = program_definitions['pio_program']
+        # the instructions decoded once (not at every time step)
+        self.decoded_program = decode_program(self.program)
+        self.programs = program_definitions.get('pio_programs', [])
         self.wrap_target = program_definitions['pio_program_wrap_target']
         self.wrap = program_definitions['pio_program_wrap']
         # RP2040 clock
         self.clock = 0
-        # define the irq
-        self.sm_irq = [0 for _ in range(8)]
+        # define the irq (shared by the state machines of a PIO)
+        self.sm_irq = [0 for _ in range(8)] if sm_irq is None else sm_irq
 
         # data related to the GPIO (the GPIO themselves, the pindir, external driven GPIO, out, set and sideset)
-        self.GPIO_data = {}
-        # the Pico has 32 GPIO
-        self.GPIO_data["GPIO"] = [-1 for _ in range(32)]
-        # pindir = 1 means Input (default); the '1' looks like an 'I' from 'Input'  
-        # pindir = 0 means output; the '0' looks like an 'O' from 'Output'
-        self.GPIO_data["GPIO_pindirs"] = [1 for _ in range(32)]
-        # externally driven pins
-        self.GPIO_data["GPIO_external"] = [-1 for _ in range(32)]
-        # pins driven by 'out'
-        self.GPIO_data["GPIO_out"] = [-1 for _ in range(32)]
-        # pins driven by 'set'
-        self.GPIO_data["GPIO_set"] = [-1 for _ in range(32)]
-        # pins driven by 'sideset'
-        self.GPIO_data["GPIO_sideset"] = [-1 for _ in range(32)]
+        # shared by the state machines of a PIO
+        if GPIO_data is None:
+            self.GPIO_data = {}
+            # the Pico has 32 GPIO
+            self.GPIO_data["GPIO"] = [-1 for _ in range(32)]
+            # pindir = 1 means Input (default); the '1' looks like an 'I' from 'Input'  
+            # pindir = 0 means output; the '0' looks like an 'O' from 'Output'
+            self.GPIO_data["GPIO_pindirs"] = [1 for _ in range(32)]
+            # externally driven pins
+            self.GPIO_data["GPIO_external"] = [-1 for _ in range(32)]
+            # pins driven by 'out'
+            self.GPIO_data["GPIO_out"] = [-1 for _ in range(32)]
+            # pins driven by 'set'
+            self.GPIO_data["GPIO_set"] = [-1 for _ in range(32)]
+            # pins driven by 'sideset'
+            self.GPIO_data["GPIO_sideset"] = [-1 for _ in range(32)]
+        else:
+            self.GPIO_data = GPIO_data
         
         # the variables used by the sm
         self.vars = {}
@@ -93,4 +108,18 @@ class state_machine:
         self.pull_is_stalling = False
         self.push_is_stalling = False
         # indicates if the irq instruction is already waiting for clearing of the irq
-        self.irq_is_waiting = False
\ No newline at end of file
+        self.irq_is_waiting = False
+
+        # statistics (e.g. for FIFO stalls in headless mode): the number of pulls and pushes
+        self.pulls = 0
+        self.pushes = 0
+        # the profile (see _profile.py): per instruction address the number of times the instruction was executed,
+        # the clock cycles of its delay and the clock cycles it stalled; the clock cycles the sm ran and the bits it
+        # shifted with 'out' and 'in'
+        self.profile_executed = [0 for _ in self.program]
+        self.profile_delay = [0 for _ in self.program]
+        self.profile_stalled = [0 for _ in self.program]
+        self.profile_is_stalling = False
+        self.profile_cycles = 0
+        self.out_bits = 0
+        self.in_bits = 0
@@ -0,0 +1,51 @@
+class decoded_instruction:
+    """ an instruction of the pio program with its fields, decoded once when the program is loaded
+        (instead of at every time step)
+    """
+    __slots__ = ('instruction', 'type', 'delay_sideset', 'is_pull', 'op', 'index', 'bit_count',
+                 'polarity', 'source', 'if_flag', 'block', 'operation', 'mov_source',
+                 'clear', 'wait', 'relative', 'stall_reason')
+
+    def __init__(self, instruction):
+        self.instruction = instruction
+        # the three bits that encode the instruction type
+        self.type = (instruction & 0xE000) >> 13
+        # the five delay/side-set bits
+        self.delay_sideset = (instruction & 0x1F00) >> 8
+        # type 4 is a 'pull' or a 'push'
+        self.is_pull = 1 if (instruction & (1 << 7)) > 0 else 0
+        # bits 7-5: the condition of 'jmp', the source of 'in', the destination of 'out', 'mov' and 'set'
+        self.op = (instruction & 0x00E0) >> 5
+        # bits 4-0: the address of 'jmp', the index of 'wait' and 'irq', the bit count of 'in' and 'out', the data of 'set'
+        self.index = instruction & 0x001F
+        # a bit count of 0 means 32
+        self.bit_count = self.index if self.index > 0 else 32
+        # 'wait': the polarity (bit 7) and the source (bits 6-5)
+        self.polarity = 1 if (instruction & (1 << 7)) > 0 else 0
+        self.source = (instruction & 0x0060) >> 5
+        # 'push' and 'pull': IfFull / IfEmpty (bit 6) and Block (bit 5)
+        self.if_flag = 1 if (instruction & (1 << 6)) > 0 else 0
+        self.block = 1 if (instruction & (1 << 5)) > 0 else 0
+        # 'mov': the operation (bits 4-3) and the source (bits 2-0)
+        self.operation = (instruction & 0x0018) >> 3
+        self.mov_source = instruction & 0x0007
+        # 'irq': Clear (bit 6) and Wait (bit 5), and for 'irq' and 'wait irq': relative (bit 4)
+        self.clear = self.if_flag
+        self.wait = self.block
+        self.relative = 1 if (instruction & (1 << 4)) > 0 else 0
+        # if the instruction stalls: why (used in the profile)
+        if self.type == 1:
+            self.stall_reason = 'wait'
+        elif self.type == 6:
+            self.stall_reason = 'irq'
+        elif self.type == 3 or (self.type == 4 and self.is_pull):
+            self.stall_reason = 'TxFIFO empty'
+        elif self.type == 2 or self.type == 4:
+            self.stall_reason = 'RxFIFO full'
+        else:
+            self.stall_reason = None
+
+
+def decode_program(program):
+    """ decode all instructions of the pio program (the hex strings of the .pio.h file) """
+    return [decoded_instruction(int(p[0], 16)) for p in program]
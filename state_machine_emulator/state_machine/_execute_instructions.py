@@ -1,9 +1,9 @@
 def execute_instruction(self, instruction):
-    """ Execute the PIO instruction """
-    # get the three bits that encode the instruction type
-    instruction_type = (instruction & 0xE000) >> 13
-    # get the five delay/side-set bits
-    instruction_delay_sideset = (instruction & 0x1F00) >> 8
+    """ Execute the PIO instruction (decoded when the program was loaded, see _decode.py) """
+    # the three bits that encode the instruction type
+    instruction_type = instruction.type
+    # the five delay/side-set bits
+    instruction_delay_sideset = instruction.delay_sideset
 
     # determine the (optional) delay
     # the bits for delay is 5 minus the number of sideset pins
@@ -13,7 +13,7 @@ def execute_instruction(self, instruction):
     self.vars["delay"] = instruction_delay_sideset & ((1 << bits_for_delay) - 1)
     self.do_sideset(instruction_delay_sideset)
 
-    is_pull = 1 if (instruction & (1 << 7)) > 0 else 0
+    is_pull = instruction.is_pull
     # determine which function to execute based on the instruction_type
     if instruction_type == 0:                   # its a 'jmp'
         self.execute_jmp(instruction)
@@ -47,8 +47,8 @@ def execute_instruction(self, instruction):
 def execute_jmp(self, instruction):
     """ execute a jmp instruction """
     # get instruction parameters
-    jmp_condition = (instruction & 0x00E0) >> 5
-    addr = instruction & 0x001F
+    jmp_condition = instruction.op
+    addr = instruction.index
 
     do_jump = False
     if jmp_condition == 0:      # always
@@ -90,9 +90,9 @@ def execute_jmp(self, instruction):
 def execute_wait(self, instruction):
     """ execute a wait instruction """
     # get instruction parameters
-    polarity = 1 if (instruction & (1 << 7)) > 0 else 0
-    source = (instruction & 0x0060) >> 5
-    index = instruction & 0x1F
+    polarity = instruction.polarity
+    source = instruction.source
+    index = instruction.index
     
     is_not_met = False
     if source == 0:             # GPIO
@@ -104,13 +104,16 @@ def execute_wait(self, instruction):
         if self.GPIO_data["GPIO"][(self.settings["in_base"]+index) % 32] != polarity:
             is_not_met = True
     elif source == 2:           # IRQ
-        MSB = 1 if (instruction & (1 << 4)) > 0 else 0
-        if MSB:
-            irq = (instruction & 0x07 + self.sm_number) % 4
+        if instruction.relative:
+            # the sm number is added to the two LSB (modulo 4), bit 2 is kept
+            irq = (index & 0x04) | ((index + self.sm_number) & 0x03)
         else:
-            irq = instruction & 0x07
+            irq = index & 0x07
         if self.sm_irq[irq] != polarity:
             is_not_met = True
+        elif polarity == 1:
+            # waiting for a set irq clears it (this is how another sm is released)
+            self.sm_irq[irq] = 0
     else:
         self.sm_warning_messages.append("Warning: WAIT has unknown source, continuing\n")
 
@@ -129,12 +132,10 @@ def execute_in(self, instruction):
         self.sm_warning_messages.append("Warning: push is stalling in IN\n")
         return
 
-    # get instruction parameters
-    source = (instruction & 0x00E0) >> 5
-    bit_count = instruction & 0x001F
+    # get instruction parameters (a bit count of 0 is decoded as 32)
+    source = instruction.op
+    bit_count = instruction.bit_count
 
-    if bit_count == 0:
-        bit_count = 32
     value = 0
     mask = (1 << bit_count) - 1
 
@@ -188,6 +189,8 @@ def execute_in(self, instruction):
             self.skip_increase_pc = True
             self.delay_delay = True
             self.push_is_stalling = True
+    # for the profile
+    self.in_bits += bit_count
 
 def execute_out(self, instruction):
     """ execute an out instruction """
@@ -196,20 +199,20 @@ def execute_out(self, instruction):
     if self.settings["out_shift_autopull"]:
         if self.vars["OSR_shift_counter"] >= self.settings["pull_threshold"]:
             if self.vars["TxFIFO_count"] > 0:
+                # the OSR is refilled and the 'out' is done in the same clock cycle
                 self.pull_from_TxFIFO()
-            # stall
-            self.skip_increase_pc = True
-            self.delay_delay = True
-            self.pull_is_stalling = True
-            self.sm_warning_messages.append("Warning: pull is stalling in OUT\n")
-            return
+                self.pull_is_stalling = False
+            else:
+                # stall
+                self.skip_increase_pc = True
+                self.delay_delay = True
+                self.pull_is_stalling = True
+                self.sm_warning_messages.append("Warning: pull is stalling in OUT\n")
+                return
     
-    # get instruction parameters
-    destination = (instruction & 0x00E0) >> 5
-    bit_count = instruction & 0x001F
-
-    if bit_count == 0:
-        bit_count = 32
+    # get instruction parameters (a bit count of 0 is decoded as 32)
+    destination = instruction.op
+    bit_count = instruction.bit_count
 
     # shift to the right
     if self.settings["out_shift_right"]:
@@ -233,6 +236,8 @@ def execute_out(self, instruction):
     self.vars["OSR"] &= 0xFFFFFFFF
     # adjust the shift counter
     self.vars["OSR_shift_counter"] += bit_count
+    # for the profile
+    self.out_bits += bit_count
 
     # put the result in the destination
     if destination == 0:     # PINS
@@ -274,8 +279,8 @@ def execute_out(self, instruction):
 def execute_push(self, instruction):
     """ execute a push instruction """
     # get instruction parameters
-    ifF = 1 if (instruction & (1 << 6)) > 0 else 0
-    Blk = 1 if (instruction & (1 << 5)) > 0 else 0
+    ifF = instruction.if_flag
+    Blk = instruction.block
 
     # check if there is space in the FIFO
     if self.vars["RxFIFO_count"] < 4:
@@ -302,8 +307,8 @@ def execute_push(self, instruction):
 def execute_pull(self, instruction):
     """ execute a pull instruction """
     # get instruction parameters
-    ifE = 1 if (instruction & (1 << 6)) > 0 else 0
-    Blk = 1 if (instruction & (1 << 5)) > 0 else 0
+    ifE = instruction.if_flag
+    Blk = instruction.block
 
     if self.vars["TxFIFO_count"] != 0:
         if ifE:
@@ -332,9 +337,9 @@ def execute_pull(self, instruction):
 def execute_mov(self, instruction):
     """ execute a mov instruction """
     # get instruction parameters
-    destination = (instruction & 0x00E0) >> 5
-    operation = (instruction & 0x0018) >> 3
-    source = (instruction & 0x0007)
+    destination = instruction.op
+    operation = instruction.operation
+    source = instruction.mov_source
 
     # the value to be moved
     value = -1
@@ -419,15 +424,16 @@ def execute_mov(self, instruction):
 def execute_irq(self, instruction):
     """ execute an irq instruction """
     # get instruction parameters
-    Clr = 1 if (instruction & (1 << 6)) > 0 else 0
-    Wait = 1 if (instruction & (1 << 5)) > 0 else 0
-    MSB = 1 if (instruction & (1 << 4)) > 0 else 0
+    Clr = instruction.clear
+    Wait = instruction.wait
+    MSB = instruction.relative
+    index = instruction.index
 
-    # add sm number and do modulo 4 if MSB is set
+    # add sm number and do modulo 4 if MSB is set (on the two LSB, bit 2 is kept)
     if MSB:
-        irq = (instruction & 0x07 + self.sm_number) % 4
+        irq = (index & 0x04) | ((index + self.sm_number) & 0x03)
     else:
-        irq = instruction & 0x07
+        irq = index & 0x07
     
     # the irq statement is already waiting for clearing 
     if self.irq_is_waiting:
@@ -453,8 +459,8 @@ def execute_irq(self, instruction):
 def execute_set(self, instruction):
     """ execute a set instruction """
     # get instruction parameters
-    destination = (instruction & 0x00E0) >> 5
-    data = instruction & 0x001F
+    destination = instruction.op
+    data = instruction.index
 
     if destination == 0:        # PINS
         if self.settings["set_base"] == -1:
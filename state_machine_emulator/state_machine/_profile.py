@@ -0,0 +1,31 @@
+def stall_cycles(self, reason):
+    """ the clock cycles the sm stalled for a reason: 'TxFIFO empty', 'RxFIFO full', 'wait' or 'irq' """
+    return sum(stalled for instruction, stalled in zip(self.decoded_program, self.profile_stalled) if instruction.stall_reason == reason)
+
+
+def profile_report(self):
+    """ the profile of the sm as lines of text: where the clock cycles were spent and the achieved bits/cycle """
+    # every clock cycle the sm runs, an instruction is executed, it stalls, or it is a delay cycle
+    cycles = self.profile_cycles
+    lines = ["profile of sm" + str(self.sm_number) + ": " + str(cycles) + " clock cycles running (of " + str(self.clock) + ")"]
+    if cycles == 0:
+        return lines
+
+    def part(count):
+        return str(count) + " (" + "{:.1f}".format(100 * count / cycles) + "%)"
+
+    # per instruction address (only the instructions that were used)
+    lines.append("   pc  executed     delay   stalled  instruction")
+    for pc, (executed, delay, stalled) in enumerate(zip(self.profile_executed, self.profile_delay, self.profile_stalled)):
+        if executed or delay or stalled:
+            reason = " (" + self.decoded_program[pc].stall_reason + ")" if stalled else ""
+            lines.append("{:5d}{:10d}{:10d}{:10d}  {}{}".format(pc, executed, delay, stalled, self.program[pc][1], reason))
+    # the totals
+    lines.append("executing: " + part(sum(self.profile_executed)) + ", delay: " + part(sum(self.profile_delay)))
+    lines.append("stalled on an empty TxFIFO: " + part(self.stall_cycles('TxFIFO empty')) +
+                 ", on a full RxFIFO: " + part(self.stall_cycles('RxFIFO full')) +
+                 ", on wait: " + part(self.stall_cycles('wait')) + ", on irq: " + part(self.stall_cycles('irq')))
+    # the bits shifted out of the OSR and into the ISR
+    lines.append("out: " + str(self.out_bits) + " bits (" + "{:.3f}".format(self.out_bits / cycles) + " bits/cycle), " +
+                 "in: " + str(self.in_bits) + " bits (" + "{:.3f}".format(self.in_bits / cycles) + " bits/cycle)")
+    return lines
@@ -7,6 +7,7 @@ def push_to_RxFIFO(self):
     # clear the shift counter and the ISR itself
     self.vars["ISR_shift_counter"] = 0
     self.vars["ISR"] = 0
+    self.pushes += 1
 
 
 def pull_from_TxFIFO(self):
@@ -22,3 +23,41 @@ def pull_from_TxFIFO(self):
     self.vars["TxFIFO_count"] -= 1
     # the number of bits shifted out of the OSR is 0
     self.vars["OSR_shift_counter"] = 0
+    self.pulls += 1
+
+
+def put_to_TxFIFO(self, value):
+    """ put data in the TxFIFO from outside the sm (c-program or dma), returns False if the TxFIFO is full """
+    if self.vars["TxFIFO_count"] >= 4:
+        return False
+    # there is still room in the TxFIFO: add the value and increase the number of items in the TxFIFO
+    self.vars["TxFIFO"][self.vars["TxFIFO_count"]] = value
+    self.vars["TxFIFO_count"] += 1
+    # make sure the 'status' is correct
+    if self.settings['status_sel'] == 0:
+        if self.vars["TxFIFO_count"] < self.settings['FIFO_level_N']:
+            self.vars["status"] = 0xFFFFFFFF; # binary all ones 
+        else:
+            self.vars["status"] = 0;  # binary all zeroes
+    return True
+
+
+def get_from_RxFIFO(self):
+    """ get data from the RxFIFO from outside the sm (c-program or dma), returns None if the RxFIFO is empty """
+    if self.vars["RxFIFO_count"] == 0:
+        return None
+    value = self.vars["RxFIFO"][0]
+    # shift FIFO entries 1 to 4 back one place
+    for i in range(0, 3):
+        self.vars["RxFIFO"][i] = self.vars["RxFIFO"][i+1]
+    # set the last entry to 0 (this may not happen in reality!)
+    self.vars["RxFIFO"][3] = 0
+    # there is now one less item in the Rx FIFO
+    self.vars["RxFIFO_count"] -= 1
+    # make sure the 'status' is correct
+    if self.settings['status_sel'] == 1:
+        if self.vars["RxFIFO_count"] < self.settings['FIFO_level_N']:
+            self.vars["status"] = 0xFFFFFFFF; # binary all ones
+        else:
+            self.vars["status"] = 0; # binary all zeroes
+    return value
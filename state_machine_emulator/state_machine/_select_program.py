@@ -0,0 +1,25 @@
+def select_program(self, index):
+    """ let the sm run one of the programs in the instruction memory (like pio_sm_init with the offset of the program) """
+    if index < 0 or index >= len(self.programs):
+        return ["Warning: there is no program " + str(index) + " in the pio file, continuing\n"]
+    program = self.programs[index]
+    # the wrap of the program (at the offset it is loaded)
+    self.wrap_target = program['wrap_target']
+    self.wrap = program['wrap']
+    # the side set of the program (.side_set in the pio code), the sideset_base is set by the c_program
+    if program['sideset']:
+        self.settings["sideset_count"], self.settings["sideset_opt"], self.settings["sideset_pindirs"] = program['sideset']
+    else:
+        self.settings["sideset_count"] = 0
+        self.settings["sideset_opt"] = False
+        self.settings["sideset_pindirs"] = False
+    # start at the first instruction of the program: the pc first adds 1 (see time_step())
+    self.vars["pc"] = program['offset'] - 1
+    self.delay_delay = False
+    self.skip_increase_pc = False
+    self.jmp_to = -1
+    self.profile_is_stalling = False
+    self.vars["delay"] = 0
+    # and run
+    self.enabled = True
+    return []
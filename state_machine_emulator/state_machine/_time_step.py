@@ -2,6 +2,12 @@ def time_step(self):
     """ emulate one time step """
     # prepare for warning messages
     self.sm_warning_messages = []
+    # a disabled sm does nothing, but the clock goes on
+    if not self.enabled:
+        self.clock += 1
+        return self.sm_warning_messages
+    # for the profile: the clock cycles the sm runs
+    self.profile_cycles += 1
     # flag to indicate we're dealing with a delayed delay
     skip_due_to_delay_delay = False
     # check if delay is active: for some instructions (wait, irq) delay needs to wait till after the instruction has finished
@@ -10,6 +16,8 @@ def time_step(self):
         if self.vars["delay"] > 0:
             self.vars["delay"] -= 1
             skip_due_to_delay_delay = True
+            # for the profile: the delay is counted for the instruction that has it
+            self.profile_delay[self.vars["pc"]] += 1
     
     # if delayed delay: skip normal pc increase and instruction execution
     if skip_due_to_delay_delay == False:
@@ -28,10 +36,18 @@ def time_step(self):
             # check if the pc should wrap
             if self.vars["pc"] == self.wrap+1:
                 self.vars["pc"] = self.wrap_target
-        # get the new instruction and execute it
-        instruction = int(self.program[self.vars["pc"]][0], 16)
+        # get the new (decoded) instruction
+        pc = self.vars["pc"]
+        instruction = self.decoded_program[pc]
+        # for the profile: an instruction that stalled is executed again, these clock cycles are stall cycles
+        if self.profile_is_stalling:
+            self.profile_stalled[pc] += 1
+        else:
+            self.profile_executed[pc] += 1
         # execute the instruction
         self.execute_instruction(instruction)
+        # it stalls (e.g. 'wait', or 'pull' on an empty TxFIFO) if the pc isn't increased and there is no jump
+        self.profile_is_stalling = self.skip_increase_pc and self.jmp_to < 0
         # set the 'status' depending on RxFIFO or TxFIFO count
         if self.settings['status_sel'] == 0:
             # check TxFIFO level
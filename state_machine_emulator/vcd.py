@@ -0,0 +1,125 @@
+from datetime import datetime
+
+
+class vcd_writer:
+    """ This class writes the signals of the state machines (and dma channels) as a VCD (value change dump) waveform
+        only the changes are written, one time unit in the VCD file is one clock cycle (time step)
+        the file can be viewed with e.g. GTKWave
+    """
+
+    def __init__(self, filename, emulation):
+        """ open the file and write the header with the definitions of the signals """
+        # the GPIOs and irq are shared by the state machines
+        self.state_machine = emulation.state_machine
+        self.state_machines = emulation.state_machines
+        # the dma channels that are used in the c-program: their transfer count
+        self.dma = emulation.dma
+        self.channels = sorted(set(int(c[1].split(':')[0][3:]) for c in emulation.c_program if c[1].startswith('dma'))) if self.dma else []
+        # the 32 bit vectors with some of the variables of the sm: name, number of bits, and key in vars
+        # Note: the pc is -1 before the first instruction, that is written as undefined
+        self.var_signals = [("pc", 5, "pc"), ("delay", 5, "delay"), ("x", 32, "x"), ("y", 32, "y"),
+                            ("ISR", 32, "ISR"), ("ISR_shift_counter", 6, "ISR_shift_counter"),
+                            ("OSR", 32, "OSR"), ("OSR_shift_counter", 6, "OSR_shift_counter"),
+                            ("TxFIFO_count", 3, "TxFIFO_count"), ("RxFIFO_count", 3, "RxFIFO_count"),
+                            ("status", 32, "status")]
+        # each signal gets an identifier of printable characters
+        self.gpio_ids = [self.identifier(i) for i in range(32)]
+        self.pindirs_id = self.identifier(32)
+        self.irq_id = self.identifier(33)
+        # for each sm
+        number = 34
+        self.var_ids = []
+        for sm in self.state_machines:
+            self.var_ids.append([self.identifier(number + i) for i in range(len(self.var_signals))])
+            number += len(self.var_signals)
+        self.channel_ids = [self.identifier(number + i) for i in range(len(self.channels))]
+        # the values that were written last (None: nothing written yet)
+        self.last_gpio = None
+        self.last_pindirs = None
+        self.last_irq = None
+        self.last_vars = [[None for _ in self.var_signals] for _ in self.state_machines]
+        self.last_transfer_count = [None for _ in self.channels]
+        # the last time step that was written
+        self.last_time = -1
+
+        self.file = open(filename, 'w')
+        self.file.write("$date " + datetime.now().strftime("%Y-%m-%d %H:%M:%S") + " $end\n")
+        self.file.write("$version RPI Pico PIO state machine emulator $end\n")
+        self.file.write("$comment one time unit is one clock cycle of the sm $end\n")
+        self.file.write("$timescale 1 ns $end\n")
+        self.file.write("$scope module pio $end\n")
+        for gpio in range(32):
+            self.file.write("$var wire 1 " + self.gpio_ids[gpio] + " GPIO" + str(gpio) + " $end\n")
+        # pindir = 1 means input, 0 means output
+        self.file.write("$var wire 32 " + self.pindirs_id + " pindirs $end\n")
+        self.file.write("$var wire 8 " + self.irq_id + " irq $end\n")
+        for sm, ids in zip(self.state_machines, self.var_ids):
+            self.file.write("$scope module sm" + str(sm.sm_number) + " $end\n")
+            for (name, bits, _), id in zip(self.var_signals, ids):
+                self.file.write("$var reg " + str(bits) + " " + id + " " + name + " $end\n")
+            self.file.write("$upscope $end\n")
+        for channel, id in zip(self.channels, self.channel_ids):
+            self.file.write("$var reg 32 " + id + " dma" + str(channel) + "_transfer_count $end\n")
+        self.file.write("$upscope $end\n")
+        self.file.write("$enddefinitions $end\n")
+
+    def identifier(self, number):
+        """ the identifier of a signal: one or more printable characters ('!' to '~') """
+        id = chr(33 + number % 94)
+        while number >= 94:
+            number = number // 94 - 1
+            id += chr(33 + number % 94)
+        return id
+
+    def vector(self, value, bits):
+        """ a vector value in the VCD format, a negative value is undefined (except for all ones) """
+        if value < 0 and value != -1:
+            return "bx"
+        return "b" + bin(value & ((1 << bits) - 1))[2:]
+
+    def sample(self, time):
+        """ write the signals that have changed at this time step """
+        sm = self.state_machine
+        changes = []
+        # the GPIO: -1 means not driven (high impedance)
+        gpio = sm.GPIO_data["GPIO"]
+        if gpio != self.last_gpio:
+            for pin in range(32):
+                if self.last_gpio is None or gpio[pin] != self.last_gpio[pin]:
+                    changes.append(("z" if gpio[pin] == -1 else str(gpio[pin])) + self.gpio_ids[pin])
+            self.last_gpio = list(gpio)
+        pindirs = sm.GPIO_data["GPIO_pindirs"]
+        if pindirs != self.last_pindirs:
+            # pindir -1 (not set) is shown as input
+            changes.append(self.vector(sum(1 << pin for pin in range(32) if pindirs[pin] != 0), 32) + " " + self.pindirs_id)
+            self.last_pindirs = list(pindirs)
+        irq = sm.sm_irq
+        if irq != self.last_irq:
+            changes.append(self.vector(sum(irq[i] << i for i in range(8)), 8) + " " + self.irq_id)
+            self.last_irq = list(irq)
+        for s, sm in enumerate(self.state_machines):
+            last = self.last_vars[s]
+            for i, (name, bits, key) in enumerate(self.var_signals):
+                value = sm.vars[key]
+                if value != last[i]:
+                    changes.append(("bx" if name == "pc" and value < 0 else self.vector(value, bits)) + " " + self.var_ids[s][i])
+                    last[i] = value
+        for i, channel in enumerate(self.channels):
+            value = self.dma.channels[channel].transfer_count
+            if value != self.last_transfer_count[i]:
+                changes.append(self.vector(value, 32) + " " + self.channel_ids[i])
+                self.last_transfer_count[i] = value
+        # only the time steps with changes are written
+        if changes:
+            self.file.write("#" + str(time) + "\n")
+            if self.last_time < 0:
+                self.file.write("$dumpvars\n" + "\n".join(changes) + "\n$end\n")
+            else:
+                self.file.write("\n".join(changes) + "\n")
+            self.last_time = time
+
+    def close(self, time):
+        """ write the end time and close the file """
+        if time > self.last_time:
+            self.file.write("#" + str(time) + "\n")
+        self.file.close()
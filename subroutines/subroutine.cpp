@@ -8,7 +8,77 @@
 #include "pico/stdlib.h"
 #include "hardware/pio.h"
 
+#include "hardware/sync.h"
+#include "hardware/structs/systick.h"
+
 #include "subroutine.pio.h"
+#include "subroutine_overhead.pio.h"
+#include "pio_resources.h"
+#include "pio_subroutines.h"
+
+// the number of measurements of each delay
+#define REPEATS 100
+
+// the clock cycles from putting a count into the TxFIFO of the sm until the sm has pushed
+// (the average of REPEATS measurements)
+uint32_t measure_delay(PIO pio, uint sm, uint32_t count)
+{
+    uint32_t total = 0;
+    for (int i = 0; i < REPEATS; i++)
+    {
+        uint32_t status = save_and_disable_interrupts();
+        uint32_t start = systick_hw->cvr;
+        pio_sm_put(pio, sm, count);
+        while (pio_sm_is_rx_fifo_empty(pio, sm))
+            ;
+        uint32_t end = systick_hw->cvr;
+        restore_interrupts(status);
+        pio_sm_get(pio, sm);
+        // the SysTick counts down
+        total += (start - end) & 0xFFFFFF;
+    }
+    return total / REPEATS;
+}
+
+// measure the instructions and clock cycles of a delay loop in the program itself and of a
+// call of the shared delay routine (on the other pio: the example program fills pio0)
+void measure_overhead(void)
+{
+    systick_hw->rvr = 0xFFFFFF;
+    systick_hw->csr = M0PLUS_SYST_CSR_CLKSOURCE_BITS | M0PLUS_SYST_CSR_ENABLE_BITS;
+    PIO pio;
+    uint sm, offset_inline;
+    if (!pio_resources_claim_sm(&delay_inline_program, &pio, &sm, &offset_inline))
+    {
+        printf("no free state machine\n");
+        return;
+    }
+    static pio_subroutines_linked linked;
+    const pio_subroutines_call calls[] = {{delay_call_offset_call_delay, pio_subroutines_offset_delay}};
+    int offset_call = pio_subroutines_add_program(pio, &delay_call_program, calls, 1, &linked);
+    if (offset_call < 0)
+    {
+        printf("no room for the subroutines\n");
+        return;
+    }
+    printf("instructions: inline %d, call %d (+ %d of the shared routines)\n", delay_inline_program.length,
+           delay_call_program.length, pio_subroutines_program.length);
+    const uint32_t counts[] = {10, 100, 1000};
+    for (uint i = 0; i < 3; i++)
+    {
+        pio_sm_config c = delay_inline_program_get_default_config(offset_inline);
+        pio_sm_init(pio, sm, offset_inline, &c);
+        pio_sm_set_enabled(pio, sm, true);
+        uint32_t cycles_inline = measure_delay(pio, sm, counts[i]);
+        c = delay_call_program_get_default_config(offset_call);
+        pio_sm_init(pio, sm, offset_call, &c);
+        pio_sm_set_enabled(pio, sm, true);
+        uint32_t cycles_call = measure_delay(pio, sm, counts[i]);
+        printf("delay %4d: inline %d, call %d clock cycles: overhead %d\n", counts[i], cycles_inline, cycles_call,
+               cycles_call - cycles_inline);
+    }
+    pio_sm_set_enabled(pio, sm, false);
+}
 
 int main()
 {
@@ -26,6 +96,8 @@ int main()
     pio_gpio_init(pio, tx_pin);
     // load the pio program into the pio memory
     uint offset = pio_add_program(pio, &subroutine_program);
+    // the state machine is taken (for the shared pio resources, see measure_overhead)
+    pio_sm_claim(pio, sm);
     // make a sm config
     pio_sm_config c = subroutine_program_get_default_config(offset);
     // set the 'out' pin
@@ -42,6 +114,11 @@ int main()
     pio_sm_init(pio, sm, offset, &c);
     // enable the sm
     pio_sm_set_enabled(pio, sm, true);
+
+    // the cost of the shared pio subroutines
+    sleep_ms(1000);
+    measure_overhead();
+
     // do nothing
     while (1)
         ;
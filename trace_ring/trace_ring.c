@@ -0,0 +1,68 @@
+#include <stdio.h>
+
+#include "trace_ring.h"
+
+trace_ring trace_rings[2];
+
+// the names of the drivers and their events (NULL: print the number)
+static const char *driver_names[TRACE_MAX_DRIVERS];
+static const char *const *event_names[TRACE_MAX_DRIVERS];
+static uint num_event_names[TRACE_MAX_DRIVERS];
+// the dropped events that have been printed, for each core
+static uint32_t dropped_printed[2];
+// the letter of each level
+static const char level_letters[] = "-EWIV";
+
+void trace_set_names(uint driver, const char *driver_name, const char *const *names, uint num_events)
+{
+    if (driver >= TRACE_MAX_DRIVERS)
+        return;
+    driver_names[driver] = driver_name;
+    event_names[driver] = names;
+    num_event_names[driver] = num_events;
+}
+
+// print one event
+static void print_event(uint core, const trace_event *event)
+{
+    uint driver = event->id >> 8;
+    uint number = event->id & 0xFF;
+    char level = (event->level <= TRACE_LEVEL_VERBOSE) ? level_letters[event->level] : '?';
+    printf("TRACE,%d,%u,%c,", core, (uint)event->time_us, level);
+    if (driver < TRACE_MAX_DRIVERS && driver_names[driver] != NULL)
+        printf("%s,", driver_names[driver]);
+    else
+        printf("%d,", driver);
+    if (driver < TRACE_MAX_DRIVERS && number < num_event_names[driver])
+        printf("%s,", event_names[driver][number]);
+    else
+        printf("%d,", number);
+    printf("0x%x\n", (uint)event->value);
+}
+
+uint trace_drain(uint max_events)
+{
+    uint printed = 0;
+    for (uint core = 0; core < 2; core++)
+    {
+        trace_ring *ring = &trace_rings[core];
+        while (printed < max_events && ring->tail != ring->head)
+        {
+            // the head is read before the event it covers (the emitter may run on the other core)
+            __dmb();
+            // copy the event and free its place before the (slow) printing
+            trace_event event = ring->events[ring->tail % TRACE_RING_SIZE];
+            __dmb();
+            ring->tail = ring->tail + 1;
+            print_event(core, &event);
+            printed++;
+        }
+        uint32_t dropped = ring->dropped;
+        if (dropped != dropped_printed[core])
+        {
+            printf("TRACE,%d,%u,W,trace,dropped,%u\n", core, (uint)time_us_32(), (uint)(dropped - dropped_printed[core]));
+            dropped_printed[core] = dropped;
+        }
+    }
+    return printed;
+}
@@ -0,0 +1,146 @@
+#ifndef TRACE_RING_H
+#define TRACE_RING_H
+
+#include "pico/stdlib.h"
+#include "hardware/sync.h"
+
+/*
+ * A trace of timestamped binary events, for the hot paths of drivers
+ *
+ * - emit: a driver emits an event as a 16 bit id (its driver number and an event number)
+ *   and a 32 bit value, e.g. TRACE_WARNING(TRACE_ID(TRACE_DRIVER_SBUS, 1), errors). This
+ *   writes 12 bytes into the ring of the core it runs on, no formatting, no printing. Each
+ *   core has its own ring with one writer (that core, interrupts are disabled for the few
+ *   instructions of the write, so an interrupt handler can emit too) and one reader (the
+ *   drain), so no lock is needed between the cores. If the ring is full the event is
+ *   dropped (and counted), the emitter never waits.
+ * - drain: trace_drain() prints the events of both rings, e.g. from the main loop of core 0
+ *   when it has nothing else to do. Each event is one line:
+ *       TRACE,<core>,<time_us>,<level>,<driver>,<event>,<value>
+ *   with the names given by trace_set_names() (or the numbers), e.g.
+ *       TRACE,0,1234567,W,SBUS,byte_error,0x1
+ * - levels: TRACE_LEVEL (error, warning, info, verbose) is set per source file, before the
+ *   #include of this file. The events above the level are removed by the preprocessor,
+ *   including the calculation of their value: with TRACE_LEVEL_OFF a trace costs nothing.
+ */
+
+// the levels
+#define TRACE_LEVEL_OFF 0
+#define TRACE_LEVEL_ERROR 1
+#define TRACE_LEVEL_WARNING 2
+#define TRACE_LEVEL_INFO 3
+#define TRACE_LEVEL_VERBOSE 4
+
+// the level of a source file: define it before the #include of this file
+#ifndef TRACE_LEVEL
+#define TRACE_LEVEL TRACE_LEVEL_WARNING
+#endif
+
+// the number of events in the ring of each core (a power of 2)
+#define TRACE_RING_BITS 8
+#define TRACE_RING_SIZE (1 << TRACE_RING_BITS)
+
+// an event id: the driver in the upper 8 bits, its event in the lower 8 bits
+#define TRACE_ID(driver, event) ((uint16_t)((driver) << 8 | (event)))
+// the drivers (at most TRACE_MAX_DRIVERS)
+#define TRACE_DRIVER_Z80 1
+#define TRACE_DRIVER_SBUS 2
+#define TRACE_DRIVER_ONEWIRE 3
+#define TRACE_DRIVER_DEBOUNCE 4
+#define TRACE_MAX_DRIVERS 16
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+// one event
+typedef struct
+{
+    uint32_t time_us;
+    uint16_t id;
+    uint16_t level;
+    uint32_t value;
+} trace_event;
+
+// the ring of one core
+typedef struct
+{
+    trace_event events[TRACE_RING_SIZE];
+    // the number of events written (by the core) and read (by the drain)
+    volatile uint32_t head;
+    volatile uint32_t tail;
+    // the number of events that were dropped because the ring was full
+    volatile uint32_t dropped;
+} trace_ring;
+
+extern trace_ring trace_rings[2];
+
+// write an event into the ring of this core (use the TRACE_ macros below)
+static inline void trace_emit(uint level, uint16_t id, uint32_t value)
+{
+    trace_ring *ring = &trace_rings[get_core_num()];
+    uint32_t interrupts = save_and_disable_interrupts();
+    uint32_t head = ring->head;
+    if (head - ring->tail < TRACE_RING_SIZE)
+    {
+        trace_event *event = &ring->events[head % TRACE_RING_SIZE];
+        event->time_us = time_us_32();
+        event->id = id;
+        event->level = level;
+        event->value = value;
+        // the event is complete before the drain can see it (a memory barrier, not only a
+        // compiler barrier, as the drain may run on the other core)
+        __dmb();
+        ring->head = head + 1;
+    }
+    else
+        ring->dropped++;
+    restore_interrupts(interrupts);
+}
+
+#if TRACE_LEVEL >= TRACE_LEVEL_ERROR
+#define TRACE_ERROR(id, value) trace_emit(TRACE_LEVEL_ERROR, (id), (value))
+#else
+#define TRACE_ERROR(id, value) ((void)0)
+#endif
+#if TRACE_LEVEL >= TRACE_LEVEL_WARNING
+#define TRACE_WARNING(id, value) trace_emit(TRACE_LEVEL_WARNING, (id), (value))
+#else
+#define TRACE_WARNING(id, value) ((void)0)
+#endif
+#if TRACE_LEVEL >= TRACE_LEVEL_INFO
+#define TRACE_INFO(id, value) trace_emit(TRACE_LEVEL_INFO, (id), (value))
+#else
+#define TRACE_INFO(id, value) ((void)0)
+#endif
+#if TRACE_LEVEL >= TRACE_LEVEL_VERBOSE
+#define TRACE_VERBOSE(id, value) trace_emit(TRACE_LEVEL_VERBOSE, (id), (value))
+#else
+#define TRACE_VERBOSE(id, value) ((void)0)
+#endif
+
+/*
+ * Give the names of a driver and its events, used by trace_drain()
+ * @param event_names: the name of event 0, 1, ... (the array is not copied)
+ */
+void trace_set_names(uint driver, const char *driver_name, const char *const *event_names, uint num_events);
+// the same, removed with TRACE_LEVEL_OFF (so the names are not in the firmware)
+#if TRACE_LEVEL > TRACE_LEVEL_OFF
+#define TRACE_SET_NAMES(driver, driver_name, event_names) \
+    trace_set_names((driver), (driver_name), (event_names), sizeof(event_names) / sizeof((event_names)[0]))
+#else
+#define TRACE_SET_NAMES(driver, driver_name, event_names) ((void)0)
+#endif
+
+/*
+ * Print the events of both rings (oldest first per core), and the number of dropped events
+ * @param max_events: print at most this many events
+ * returns the number of events printed, e.g. while (trace_drain(16)) to empty the rings
+ */
+uint trace_drain(uint max_events);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
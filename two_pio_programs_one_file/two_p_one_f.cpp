@@ -4,14 +4,57 @@
 #include "hardware/pio.h"
 
 #include "two_p_one_f.pio.h"
+#include "pio_resources.h"
+#include "pio_overlay.h"
+#include "pio_timing.h"
 
 #define TEST_PIN 16
 
+// the original example: both programs loaded, switched with a jmp (pio_sm_exec)
+// comment out to switch via the overlay manager
+// #define BOTH_RESIDENT
+// the overlay manager: the room (instructions) it may use, 4 leaves room for one program at a
+// time (each switch unloads one and loads the other: a slow switch), 32 for all free room
+#define OVERLAY_INSTRUCTIONS 32
+
 /*
 This program shows how you can use two pio programs in one file (two_p_one_f)
 For this test it is assumed that the TEST_PIN is externally pulled high via e.g. a 10k resistor
 */
 
+// the pins and the clock are the same for both programs, the wrap and the side-set come
+// from the program (for the offset it is loaded at)
+static void configure(pio_sm_config *c)
+{
+    // set the pin used by set
+    sm_config_set_set_pins(c, TEST_PIN, 1);
+    // set the pin used by sideset (same pin as for SET, one line above)
+    sm_config_set_sideset_pins(c, TEST_PIN);
+    // one clock cycle is 10 us (100 kHz) at the current system clock (see ../pio_timing)
+    sm_config_set_clkdiv(c, pio_timing_clkdiv(100000));
+}
+
+static pio_sm_config get_config_1(uint offset)
+{
+    pio_sm_config c = two_p_one_f_1_program_get_default_config(offset);
+    configure(&c);
+    return c;
+}
+
+static pio_sm_config get_config_2(uint offset)
+{
+    pio_sm_config c = two_p_one_f_2_program_get_default_config(offset);
+    configure(&c);
+    return c;
+}
+
+// the catalog: the programs stay in flash and are loaded when the sm switches to them
+static const pio_overlay_entry catalog[] = {
+    {"two_p_one_f_1", &two_p_one_f_1_program, get_config_1},
+    {"two_p_one_f_2", &two_p_one_f_2_program, get_config_2},
+};
+
+#ifdef BOTH_RESIDENT
 int main()
 {
     // needed for printf
@@ -36,11 +79,11 @@ int main()
     sm_config_set_sideset(&c, 2, true, true);
     // set the pin used by sideset (same pin as for SET, two lines above)
     sm_config_set_sideset_pins(&c, TEST_PIN);
-    // one clock cycle is 10 us
-    sm_config_set_clkdiv(&c, 1250);
 
     // init the pio sm with the config, start with two_p_one_f_1
     pio_sm_init(pio, sm, offset_1, &c);
+    // one clock cycle is 10 us (100 kHz), at any system clock (see ../pio_timing)
+    pio_timing_register_sm(pio, sm, 100000);
     // enable the sm
     pio_sm_set_enabled(pio, sm, true);
 
@@ -54,3 +97,38 @@ int main()
         sleep_ms(1000);
     }
 }
+#else
+int main()
+{
+    // needed for printf
+    stdio_init_all();
+    // claim a state machine (no program: the overlay manager loads them)
+    PIO pio;
+    uint sm, offset;
+    if (!pio_resources_claim_sm(NULL, &pio, &sm, &offset))
+    {
+        printf("two_p_one_f: no free state machine\n");
+        while (true)
+            ;
+    }
+    // configure the used pin
+    pio_gpio_init(pio, TEST_PIN);
+    // the overlay manager for the pio of the sm
+    static pio_overlay overlays;
+    pio_overlay_init(&overlays, pio, catalog, sizeof(catalog) / sizeof(catalog[0]), OVERLAY_INSTRUCTIONS);
+    // keep 10 us per clock cycle if the system clock changes between the switches (a switch
+    // sets the clkdiv of the config, see configure)
+    pio_timing_register_sm(pio, sm, 100000);
+
+    uint entry = 0;
+    while (true)
+    {
+        // switch to the next program of the catalog
+        if (!pio_overlay_switch(&overlays, sm, entry))
+            printf("two_p_one_f: can't switch to %s\n", catalog[entry].name);
+        pio_overlay_print(&overlays);
+        sleep_ms(1000);
+        entry = (entry + 1) % (sizeof(catalog) / sizeof(catalog[0]));
+    }
+}
+#endif
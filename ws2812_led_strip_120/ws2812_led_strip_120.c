@@ -4,12 +4,15 @@
 #include "pico/stdlib.h"
 #include "hardware/pio.h"
 #include "hardware/clocks.h"
+#include "hardware/dma.h"
+#include "hardware/irq.h"
 #include "ws2812_led_strip_120.pio.h"
+#include "pio_resources.h"
 
-static inline void put_pixel(uint32_t pixel_grb)
-{
-    pio_sm_put_blocking(pio0, 0, pixel_grb << 8u);
-}
+/******************************************************************************
+ * frame buffer api: fill 'pixels' and call show()
+ *                   or fill 'pixels16' and call show_dithered()
+ *****************************************************************************/
 
 static inline uint32_t urgb_u32(uint8_t r, uint8_t g, uint8_t b)
 {
@@ -18,28 +21,272 @@ static inline uint32_t urgb_u32(uint8_t r, uint8_t g, uint8_t b)
            (uint32_t)(b);
 }
 
+// the number of pixels of the led strip
+#define NUM_PIXELS 120
+// the reset period of the ws2812 (us) in which the data line is low
+// Note: the ws2812 data sheet specifies 50 us, some newer versions need 280 us
+#define RESET_US 100
+// one bit takes 97 clock cycles of the sm (see the .pio file)
+#define CYCLES_PER_BIT 97
+// the number of pixels that can still be in the sm after the dma has finished:
+// the joined TxFIFO (8) and the OSR (1)
+#define PIXELS_IN_SM 9
+
+// the frame buffer: GRB values (see urgb_u32) for every pixel, to be filled by the user
+uint32_t pixels[NUM_PIXELS];
+
+// the pio, sm and dma channel that send the pixels to the strip
+PIO ws2812_pio;
+uint ws2812_sm;
+int ws2812_dma_chan;
+// the data for the dma: the frame buffer is copied into it by show(), so
+// the frame buffer can immediately be changed for the next frame
+// Note: the 24 bits of a pixel are sent MSB first, so they are shifted into the upper bits
+uint32_t dma_buffer[NUM_PIXELS];
+// true while a frame is being sent to the strip (including the reset period)
+volatile bool busy = false;
+// function called when a frame has been sent (including the reset period), may be NULL
+// Note: it is called in interrupt context
+void (*frame_done)(void) = NULL;
+
+/*
+Temporal dithering
+
+The pixels can also be set with 16 bit per color ('pixels16'): 8 bits for the level 
+that is sent to the ws2812 and 8 bits for a fraction of a level. With show_dithered()
+the pixels are repeatedly sent to the strip (as fast as the strip allows), where for
+some of the frames the level is one higher. On average the pixel then has the 
+intermediate level. 
+The DITHER_FRAMES frames are precomputed by show_dithered() into a ring of frames, 
+sending them to the strip takes no cpu time: at the end of the reset period of 
+a frame, the next frame of the ring is started via dma. There are two rings: the one
+that is being shown and the one that show_dithered() fills. The dither engine switches
+to the new ring at the start of the ring, such that the frames of a ring are always 
+shown completely.
+Note: with 120 pixels one frame takes about 2.5 ms, so a ring of 8 frames takes 20 ms. 
+More frames give more intermediate levels but flicker more.
+*/
+// the number of frames in a ring: one level is divided into this many intermediate levels
+#define DITHER_FRAMES 8
+
+// the pixels with 16 bits per color (8 bits level, 8 bits fraction), to be filled by the user
+uint16_t pixels16[NUM_PIXELS][3];
+// the two rings of precomputed frames (in the format for the dma)
+uint32_t dither_ring[2][DITHER_FRAMES][NUM_PIXELS];
+// the ring that is being shown, and the frame of that ring that is sent next
+volatile uint ring_showing = 0;
+volatile uint dither_frame = 0;
+// set when the other ring has been filled and has to be shown from the start of the next ring
+volatile bool ring_pending = false;
+// true while the dither engine is running
+volatile bool dithering = false;
+
+// send the next frame of the ring to the strip (called at the end of the reset period)
+void start_dither_frame()
+{
+    // switch to the new ring at the start of a ring
+    if (dither_frame == 0 && ring_pending)
+    {
+        ring_showing = 1 - ring_showing;
+        ring_pending = false;
+    }
+    dma_channel_transfer_from_buffer_now(ws2812_dma_chan, dither_ring[ring_showing][dither_frame], NUM_PIXELS);
+    dither_frame = (dither_frame + 1) % DITHER_FRAMES;
+}
+
+// the alarm at the end of the reset period: the strip is ready for a new frame
+int64_t reset_done(alarm_id_t id, void *user_data)
+{
+    if (frame_done)
+        frame_done();
+    // the dither engine immediately sends the next frame
+    if (dithering)
+        start_dither_frame();
+    else
+        busy = false;
+    // do not repeat the alarm
+    return 0;
+}
+
+// the dma has finished: the last pixels are still being sent by the sm, after that
+// the reset period starts. Set an alarm for the time this takes.
+void dma_handler()
+{
+    // clear the interrupt request
+    dma_hw->ints0 = 1u << ws2812_dma_chan;
+    // the time (us) to send the pixels that are still in the sm
+    uint64_t drain_us = (uint64_t)PIXELS_IN_SM * 24 * CYCLES_PER_BIT * 1000000 / clock_get_hz(clk_sys) + 1;
+    if (add_alarm_in_us(drain_us + RESET_US, reset_done, NULL, true) < 0)
+    {
+        // no free alarm: wait here (about 110 us), otherwise busy would never be cleared
+        busy_wait_us(drain_us + RESET_US);
+        reset_done(0, NULL);
+    }
+}
+
+// set the function to be called when a frame has been sent
+void set_frame_done_callback(void (*callback)(void))
+{
+    frame_done = callback;
+}
+
+// true if a frame is being sent to the strip
+bool show_busy()
+{
+    return busy;
+}
+
+// stop the dither engine, it waits until the last frame has been sent
+void stop_dithering()
+{
+    dithering = false;
+    while (busy)
+        tight_loop_contents();
+    // a ring that had not been started yet will not be shown
+    ring_pending = false;
+}
+
+// precompute the frames of ring r from pixels16
+// For each color the fraction is added to an accumulator for each frame: when it 
+// overflows the level is one higher for that frame. So for a fraction of 3/8 three 
+// of the 8 frames are one level higher, spread over the ring.
+void fill_dither_ring(uint r)
+{
+    for (uint i = 0; i < NUM_PIXELS; i++)
+    {
+        // the accumulators for r, g and b, starting halfway to round the fraction
+        uint acc[3] = {128, 128, 128};
+        for (uint f = 0; f < DITHER_FRAMES; f++)
+        {
+            uint level[3];
+            for (uint c = 0; c < 3; c++)
+            {
+                acc[c] += pixels16[i][c] & 0xFF;
+                level[c] = (pixels16[i][c] >> 8) + (acc[c] >> 8);
+                acc[c] &= 0xFF;
+                if (level[c] > 255)
+                    level[c] = 255;
+            }
+            dither_ring[r][f][i] = urgb_u32(level[0], level[1], level[2]) << 8u;
+        }
+    }
+}
+
+// send pixels16 to the strip with temporal dithering (see above).
+// The frames are precomputed here, after that the dither engine keeps sending them
+// without cpu time until show_dithered() is called again (or show() or stop_dithering()).
+// It only waits if the previously precomputed frames have not been started yet.
+void show_dithered()
+{
+    // wait until the dither engine has started the previous ring
+    while (ring_pending)
+        tight_loop_contents();
+    // fill the ring that is not shown
+    uint fill = 1 - ring_showing;
+    fill_dither_ring(fill);
+    if (dithering)
+    {
+        // the dither engine switches to it at the start of the next ring
+        ring_pending = true;
+        return;
+    }
+    // start the dither engine: wait for the frame that is still sent by show()
+    while (busy)
+        tight_loop_contents();
+    ring_showing = fill;
+    dither_frame = 0;
+    dithering = true;
+    busy = true;
+    start_dither_frame();
+}
+
+// send the frame buffer to the strip.
+// It only waits if the previous frame is still being sent, the frame itself
+// is sent by the dma while the cpu can do other things
+void show()
+{
+    // a single frame: stop the dither engine
+    if (dithering)
+        stop_dithering();
+    // wait for the previous frame (and its reset period)
+    while (busy)
+        tight_loop_contents();
+    // copy the frame buffer into the dma buffer
+    for (uint i = 0; i < NUM_PIXELS; i++)
+        dma_buffer[i] = pixels[i] << 8u;
+    busy = true;
+    // start the dma
+    dma_channel_transfer_from_buffer_now(ws2812_dma_chan, dma_buffer, NUM_PIXELS);
+}
+
+// set up the dma channel that sends the dma buffer to the TxFIFO of the sm
+void configure_dma()
+{
+    // get a free channel, panic() if there are none
+    ws2812_dma_chan = dma_claim_unused_channel(true);
+    // make a dma config
+    dma_channel_config c = dma_channel_get_default_config(ws2812_dma_chan);
+    // transfer uint32_t
+    channel_config_set_transfer_data_size(&c, DMA_SIZE_32);
+    // the buffer increment of read pointer
+    channel_config_set_read_increment(&c, true);
+    // the TxFIFO is fixed in memory -> no increment write pointer
+    channel_config_set_write_increment(&c, false);
+    // let the sm determine the speed
+    channel_config_set_dreq(&c, pio_get_dreq(ws2812_pio, ws2812_sm, true));
+    // configure the dma channel, but do not start it yet (show() does that)
+    dma_channel_configure(ws2812_dma_chan, &c, &ws2812_pio->txf[ws2812_sm], dma_buffer, NUM_PIXELS, false);
+    // interrupt when the dma has finished
+    dma_channel_set_irq0_enabled(ws2812_dma_chan, true);
+    irq_set_exclusive_handler(DMA_IRQ_0, dma_handler);
+    irq_set_enabled(DMA_IRQ_0, true);
+}
+
+// fill the frame buffer with one color
+void fill(uint32_t pixel_grb)
+{
+    for (uint i = 0; i < NUM_PIXELS; ++i)
+        pixels[i] = pixel_grb;
+}
+
 void all_red()
 {
-    for (uint i = 0; i < 120; ++i)
-        put_pixel(urgb_u32(0x80, 0, 0));
+    fill(urgb_u32(0x80, 0, 0));
+    show();
 }
 
 void all_green()
 {
-    for (uint i = 0; i < 120; ++i)
-        put_pixel(urgb_u32(0, 0x80, 0));
+    fill(urgb_u32(0, 0x80, 0));
+    show();
 }
 
 void all_blue()
 {
-    for (uint i = 0; i < 120; ++i)
-        put_pixel(urgb_u32(0, 0, 0x80));
+    fill(urgb_u32(0, 0, 0x80));
+    show();
 }
 
 void white(int level)
 {
-    for (uint i = 0; i < 120; ++i)
-        put_pixel(urgb_u32(level, level, level));
+    fill(urgb_u32(level, level, level));
+    show();
+}
+
+// white with 16 bits: 8 bits level and 8 bits fraction
+void white16(uint level16)
+{
+    for (uint i = 0; i < NUM_PIXELS; ++i)
+        for (uint c = 0; c < 3; c++)
+            pixels16[i][c] = level16;
+    show_dithered();
+}
+
+// count the frames that have been sent (see set_frame_done_callback)
+volatile uint frames_shown = 0;
+void count_frames()
+{
+    frames_shown++;
 }
 
 const int PIN_TX = 2;
@@ -52,14 +299,15 @@ int main()
     PIO pio;
     // the state machine
     uint sm;
-    // pio 0 is used
-    pio = pio0;
-    // state machine 0
-    sm = 0;
+    // claim a state machine (in any pio) and load the pio program into the pio memory
+    uint offset;
+    if (!pio_resources_claim_sm(&ws2812_led_strip_120_program, &pio, &sm, &offset))
+    {
+        printf("no free state machine\n");
+        return 1;
+    }
     // configure the used pins
     pio_gpio_init(pio, PIN_TX);
-    // load the pio program into the pio memory
-    uint offset = pio_add_program(pio, &ws2812_led_strip_120_program);
     // make a sm config
     pio_sm_config c = ws2812_led_strip_120_program_get_default_config(offset);
     // set the 'set' pin
@@ -68,8 +316,6 @@ int main()
     pio_sm_set_consecutive_pindirs(pio, sm, PIN_TX, 1, true);
     // set out shift direction
     sm_config_set_out_shift(&c, false, true, 24);
-    // set in shift direction
-    sm_config_set_in_shift(&c, false, false, 0);
     // join the FIFOs
     sm_config_set_fifo_join(&c, PIO_FIFO_JOIN_TX);
     // init the pio sm with the config
@@ -77,60 +323,37 @@ int main()
     // enable the sm
     pio_sm_set_enabled(pio, sm, true);
 
-    // int maxRows = 11;
-    // int maxCols = 10;
-    //     bool transition[11][10] = {
-    //         {0, 0, 0, 0, 0, 0, 0, 0, 0, 0}, // 10
-    //         {0, 0, 0, 0, 0, 0, 0, 0, 0, 1}, // 9
-    //         {0, 0, 0, 0, 1, 0, 0, 0, 0, 1}, // 8
-    //         {0, 0, 0, 1, 0, 0, 1, 0, 0, 1}, // 7
-    //         {0, 0, 1, 0, 1, 0, 0, 1, 0, 1}, // 6
-    //         {0, 1, 0, 1, 0, 1, 0, 1, 0, 1}, // 5
-    //         {0, 1, 0, 1, 1, 0, 1, 0, 1, 1}, // 4
-    //         {0, 1, 1, 0, 1, 1, 0, 1, 1, 1}, // 3
-    //         {0, 1, 1, 1, 1, 0, 1, 1, 1, 1}, // 2
-    //         {0, 1, 1, 1, 1, 1, 1, 1, 1, 1}, // 1
-    //         {1, 1, 1, 1, 1, 1, 1, 1, 1, 1}, // 0
-    //     };
-
-    int maxRows = 13;
-    int maxCols = 12;
-    bool transition[13][12] = {
-        {0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0}, // 12
-        {1, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0}, // 11
-        {1, 0, 0, 0, 0, 0, 1, 0, 0, 0, 0, 0}, // 10
-        {1, 0, 0, 0, 1, 0, 0, 0, 1, 0, 0, 0}, // 9
-        {1, 0, 0, 1, 0, 0, 1, 0, 0, 1, 0, 0}, // 8
-        {1, 0, 1, 0, 1, 0, 0, 1, 0, 1, 0, 0}, // 7
-        {1, 0, 1, 0, 1, 0, 1, 0, 1, 0, 1, 0}, // 6
-        {0, 1, 0, 1, 0, 1, 1, 0, 1, 0, 1, 1}, // 5
-        {0, 1, 1, 0, 1, 1, 0, 1, 1, 0, 1, 1}, // 4
-        {0, 1, 1, 1, 0, 1, 1, 1, 0, 1, 1, 1}, // 3
-        {0, 1, 1, 1, 1, 1, 0, 1, 1, 1, 1, 1}, // 2
-        {0, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1}, // 1
-        {1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1}, // 0
-    };
+    // the frame buffer is sent via dma
+    ws2812_pio = pio;
+    ws2812_sm = sm;
+    configure_dma();
+    set_frame_done_callback(count_frames);
 
     int maxLevel = 20;
     while (1)
     {
-        // without dithering
+        // without dithering: 20 levels
         for (int level = 0; level < maxLevel; level++)
-            // next loop is just to make it equal to the dithered version below
-            for (int row = 0; row < maxRows * maxCols; row++) 
-                white(level);
+        {
+            white(level);
+            sleep_ms(400);
+        }
         for (int level = maxLevel; level > 0; level--)
-            // next loop is just to make it equal to the dithered version below
-            for (int row = maxRows * maxCols - 1; row >= 0; row--) 
-                white(level);
-        // with dithering
-        for (int level = 0; level < maxLevel; level++)
-            for (int row = 0; row < maxRows; row++)
-                for (int col = 0; col < maxCols; col++)
-                    white(level + transition[row][col]);
-        for (int level = maxLevel; level > 0; level--)
-            for (int row = maxRows - 1; row >= 0; row--)
-                for (int col = 0; col < maxCols; col++)
-                    white(level + transition[row][col]);
+        {
+            white(level);
+            sleep_ms(400);
+        }
+        // with dithering: each level in DITHER_FRAMES steps, in the same time
+        for (uint level16 = 0; level16 < maxLevel << 8; level16 += 256 / DITHER_FRAMES)
+        {
+            white16(level16);
+            sleep_ms(400 / DITHER_FRAMES);
+        }
+        for (uint level16 = maxLevel << 8; level16 > 0; level16 -= 256 / DITHER_FRAMES)
+        {
+            white16(level16);
+            sleep_ms(400 / DITHER_FRAMES);
+        }
+        printf("frames shown: %u\n", frames_shown);
     }
-}
\ No newline at end of file
+}
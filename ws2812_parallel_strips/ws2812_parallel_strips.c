@@ -0,0 +1,232 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include "pico/stdlib.h"
+#include "hardware/pio.h"
+#include "hardware/clocks.h"
+#include "hardware/dma.h"
+#include "hardware/irq.h"
+#include "ws2812_parallel_strips.pio.h"
+#include "pio_resources.h"
+
+/******************************************************************************
+ * frame buffer api: fill 'strips' and call show()
+ *****************************************************************************/
+
+// the number of strips (1 to 8), each on its own pin starting at PIN_BASE
+#define NUM_STRIPS 8
+// the number of pixels of each led strip
+#define NUM_PIXELS 120
+// the first pin, strip s is on pin PIN_BASE + s
+#define PIN_BASE 2
+// the reset period of the ws2812 (us) in which the data line is low
+// Note: the ws2812 data sheet specifies 50 us, some newer versions need 280 us
+#define RESET_US 100
+// one bit takes 97 clock cycles of the sm (see the .pio file)
+#define CYCLES_PER_BIT 97
+// the number of bits that can still be in the sm after the dma has finished:
+// the joined TxFIFO (8 words) and the OSR (1 word), each 4 bytes = 4 bits per strip
+#define BITS_IN_SM (9 * 4)
+
+// the frame buffer: GRB values (see urgb_u32) for every pixel of every strip, to be filled by the user
+uint32_t strips[NUM_STRIPS][NUM_PIXELS];
+
+// the pio, sm and dma channel that send the pixels to the strips
+PIO ws2812_pio;
+uint ws2812_sm;
+int ws2812_dma_chan;
+// the transposed frame buffer for the dma: for each pixel 24 bytes (MSB first), 
+// each byte contains the bit for all 8 strips (strip s in bit s).
+// Note: a uint32_t array so the dma can send it as words
+uint32_t dma_buffer[NUM_PIXELS * 24 / 4];
+// true while a frame is being sent to the strips (including the reset period)
+volatile bool busy = false;
+// function called when a frame has been sent (including the reset period), may be NULL
+// Note: it is called in interrupt context
+void (*frame_done)(void) = NULL;
+
+/*
+Transposing the frame buffer
+
+For each pixel index the 8 strips each have 24 bits. The sm needs them per bit: byte k 
+contains bit k (MSB first) of each of the 8 strips. This is a transposition of an 8x8 bit 
+matrix for each of the three colors, which is done with a few shifts and masks on 32 
+bit words instead of 64 single bit operations (see "Hacker's Delight", transpose8).
+*/
+// transpose 8 bytes: in[j] is a row, out[k] gets bit (7-k) of every row, with in[0] in the MSB
+static inline void transpose8(const uint8_t *in, uint8_t *out)
+{
+    uint32_t x = (uint32_t)in[0] << 24 | (uint32_t)in[1] << 16 | (uint32_t)in[2] << 8 | in[3];
+    uint32_t y = (uint32_t)in[4] << 24 | (uint32_t)in[5] << 16 | (uint32_t)in[6] << 8 | in[7];
+    uint32_t t;
+    // swap single bits
+    t = (x ^ (x >> 7)) & 0x00AA00AA;
+    x = x ^ t ^ (t << 7);
+    t = (y ^ (y >> 7)) & 0x00AA00AA;
+    y = y ^ t ^ (t << 7);
+    // swap pairs of bits
+    t = (x ^ (x >> 14)) & 0x0000CCCC;
+    x = x ^ t ^ (t << 14);
+    t = (y ^ (y >> 14)) & 0x0000CCCC;
+    y = y ^ t ^ (t << 14);
+    // swap nibbles
+    t = (x & 0xF0F0F0F0) | ((y >> 4) & 0x0F0F0F0F);
+    y = ((x << 4) & 0xF0F0F0F0) | (y & 0x0F0F0F0F);
+    x = t;
+    out[0] = x >> 24;
+    out[1] = x >> 16;
+    out[2] = x >> 8;
+    out[3] = x;
+    out[4] = y >> 24;
+    out[5] = y >> 16;
+    out[6] = y >> 8;
+    out[7] = y;
+}
+
+// transpose the frame buffer into the dma buffer
+void transpose_strips()
+{
+    uint8_t *slices = (uint8_t *)dma_buffer;
+    uint8_t rows[8];
+    for (uint i = 0; i < NUM_PIXELS; i++)
+        // the three colors: g, r, b (MSB first)
+        for (uint c = 0; c < 3; c++)
+        {
+            // the strip in bit s of the output must be the row 7-s of the input
+            for (uint s = 0; s < 8; s++)
+                rows[7 - s] = (s < NUM_STRIPS) ? (uint8_t)(strips[s][i] >> (16 - 8 * c)) : 0;
+            transpose8(rows, slices + i * 24 + c * 8);
+        }
+}
+
+// the alarm at the end of the reset period: the strips are ready for a new frame
+int64_t reset_done(alarm_id_t id, void *user_data)
+{
+    busy = false;
+    if (frame_done)
+        frame_done();
+    // do not repeat the alarm
+    return 0;
+}
+
+// the dma has finished: the last bits are still being sent by the sm, after that
+// the reset period starts. Set an alarm for the time this takes.
+void dma_handler()
+{
+    // clear the interrupt request
+    dma_hw->ints0 = 1u << ws2812_dma_chan;
+    // the time (us) to send the bits that are still in the sm
+    uint64_t drain_us = (uint64_t)BITS_IN_SM * CYCLES_PER_BIT * 1000000 / clock_get_hz(clk_sys) + 1;
+    if (add_alarm_in_us(drain_us + RESET_US, reset_done, NULL, true) < 0)
+    {
+        // no free alarm: wait here (about the reset period), otherwise busy would never be cleared
+        busy_wait_us(drain_us + RESET_US);
+        reset_done(0, NULL);
+    }
+}
+
+// set the function to be called when a frame has been sent
+void set_frame_done_callback(void (*callback)(void))
+{
+    frame_done = callback;
+}
+
+// send the frame buffer to the strips.
+// It only waits if the previous frame is still being sent, the frame itself
+// is sent by the dma while the cpu can do other things
+void show()
+{
+    // wait for the previous frame (and its reset period)
+    while (busy)
+        tight_loop_contents();
+    // transpose the frame buffer into the dma buffer
+    transpose_strips();
+    busy = true;
+    // start the dma
+    dma_channel_transfer_from_buffer_now(ws2812_dma_chan, dma_buffer, NUM_PIXELS * 24 / 4);
+}
+
+// set up the dma channel that sends the dma buffer to the TxFIFO of the sm
+void configure_dma()
+{
+    // get a free channel, panic() if there are none
+    ws2812_dma_chan = dma_claim_unused_channel(true);
+    // make a dma config
+    dma_channel_config c = dma_channel_get_default_config(ws2812_dma_chan);
+    // transfer uint32_t
+    channel_config_set_transfer_data_size(&c, DMA_SIZE_32);
+    // the buffer increment of read pointer
+    channel_config_set_read_increment(&c, true);
+    // the TxFIFO is fixed in memory -> no increment write pointer
+    channel_config_set_write_increment(&c, false);
+    // let the sm determine the speed
+    channel_config_set_dreq(&c, pio_get_dreq(ws2812_pio, ws2812_sm, true));
+    // configure the dma channel, but do not start it yet (show() does that)
+    dma_channel_configure(ws2812_dma_chan, &c, &ws2812_pio->txf[ws2812_sm], dma_buffer, NUM_PIXELS * 24 / 4, false);
+    // interrupt when the dma has finished
+    dma_channel_set_irq0_enabled(ws2812_dma_chan, true);
+    irq_set_exclusive_handler(DMA_IRQ_0, dma_handler);
+    irq_set_enabled(DMA_IRQ_0, true);
+}
+
+static inline uint32_t urgb_u32(uint8_t r, uint8_t g, uint8_t b)
+{
+    return ((uint32_t)(r) << 8) |
+           ((uint32_t)(g) << 16) |
+           (uint32_t)(b);
+}
+
+int main()
+{
+    // needed for printf
+    stdio_init_all();
+    // the pio instance
+    PIO pio;
+    // the state machine
+    uint sm;
+    // claim a state machine (in any pio) and load the pio program into the pio memory
+    uint offset;
+    if (!pio_resources_claim_sm(&ws2812_parallel_strips_program, &pio, &sm, &offset))
+    {
+        printf("no free state machine\n");
+        return 1;
+    }
+    // configure the used pins
+    for (uint s = 0; s < NUM_STRIPS; s++)
+        pio_gpio_init(pio, PIN_BASE + s);
+    // make a sm config
+    pio_sm_config c = ws2812_parallel_strips_program_get_default_config(offset);
+    // set the 'out' pins: one for each strip
+    sm_config_set_out_pins(&c, PIN_BASE, NUM_STRIPS);
+    // set the pindirs to output
+    pio_sm_set_consecutive_pindirs(pio, sm, PIN_BASE, NUM_STRIPS, true);
+    // set out shift direction: right, so the bytes are sent in the order they are in memory
+    sm_config_set_out_shift(&c, true, true, 32);
+    // join the FIFOs
+    sm_config_set_fifo_join(&c, PIO_FIFO_JOIN_TX);
+    // init the pio sm with the config
+    pio_sm_init(pio, sm, offset, &c);
+    // enable the sm
+    pio_sm_set_enabled(pio, sm, true);
+
+    // the frame buffer is sent via dma
+    ws2812_pio = pio;
+    ws2812_sm = sm;
+    configure_dma();
+
+    // a different color for each strip
+    uint32_t colors[8] = {
+        urgb_u32(0x20, 0, 0), urgb_u32(0, 0x20, 0), urgb_u32(0, 0, 0x20), urgb_u32(0x20, 0x20, 0),
+        urgb_u32(0, 0x20, 0x20), urgb_u32(0x20, 0, 0x20), urgb_u32(0x20, 0x20, 0x20), urgb_u32(0x08, 0x10, 0x20)};
+
+    // a dot that runs along each strip, each strip one pixel further than the previous one
+    uint t = 0;
+    while (1)
+    {
+        for (uint s = 0; s < NUM_STRIPS; s++)
+            for (uint i = 0; i < NUM_PIXELS; i++)
+                strips[s][i] = (i == (t + s) % NUM_PIXELS) ? colors[s] : 0;
+        show();
+        t++;
+        sleep_ms(10);
+    }
+}